@@ -36,6 +36,8 @@ void FileGenerator::GenerateHeaderIncludes(Printer* printer)
     printer->Print(
         "#include \"rpc/Future.h\"\n"
         "#include \"rpc/Base.h\"\n"
+        "#include \"rpc/Coroutine.h\"\n"
+        "#include \"rpc/MessageStream.h\"\n"
     );
 }
 
@@ -61,6 +63,7 @@ void FileGenerator::GenerateSourceIncludes(Printer* printer)
 {
     printer->Print(
         "#include \"rpc/Exceptions.h\"\n"
+        "#include \"rpc/Dispatch.h\"\n"
         "#include \"rpc_base.pb.h\"\n"
         "#include <assert.h>\n"
         "#include <boost/shared_ptr.hpp>\n"
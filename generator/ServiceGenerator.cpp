@@ -59,8 +59,28 @@ void ServiceGenerator::GenerateInterface(io::Printer* printer)
         sub_vars["request_type"]  = GetRequestWrapper(*method);
         sub_vars["response_type"] = GetResponseWrapper(*method);
 
+        // typed readers and writers of message streams, requests are written by the caller, responses by the handler
+        if (IsInputMessagesPresent(*method))
+        {
+            printer->Print(sub_vars, "typedef rpc::MessageWriter<$input_type$> $name$RequestWriter;\n"
+                "typedef rpc::MessageReader<$input_type$> $name$RequestReader;\n");
+        }
+        if (IsOutMessagesPresent(*method))
+        {
+            printer->Print(sub_vars, "typedef rpc::MessageWriter<$output_type$> $name$ResponseWriter;\n"
+                "typedef rpc::MessageReader<$output_type$> $name$ResponseReader;\n");
+        }
+
         printer->Print(sub_vars, "virtual void $name$(const rpc::$request_type$<$input_type$>::Ptr& request,\n"
             "                    const rpc::$response_type$<$output_type$>::Ptr& response);\n");
+
+        // response without stream may be returned by coroutine
+        if (!IsOutStreamPresent(*method))
+        {
+            printer->Print(sub_vars, "#ifdef RPC_ENABLE_COROUTINES\n"
+                "virtual rpc::Task<$output_type$> $name$(const rpc::$request_type$<$input_type$>::Ptr& request);\n"
+                "#endif\n");
+        }
     }
 
     printer->Print("\n"
@@ -75,6 +95,11 @@ void ServiceGenerator::GenerateInterface(io::Printer* printer)
                        "  const ::google::protobuf::MethodDescriptor& method) const override;\n"
                        "virtual google::protobuf::Message* CreateResponse(\n"
                        "  const ::google::protobuf::MethodDescriptor& method) const override;\n"
+                       "virtual rpc::MessagePtr AcquireRequest(\n"
+                       "  const ::google::protobuf::MethodDescriptor& method) const override;\n"
+                       "virtual rpc::MessagePtr AcquireResponse(\n"
+                       "  const ::google::protobuf::MethodDescriptor& method) const override;\n"
+                       "virtual const rpc::details::MethodEntry* GetMethodTable() const override;\n"
                        "virtual const rpc::InstanceId& GetName() const override;\n"
                        "virtual Id GetId() const override;\n");
 
@@ -169,9 +194,12 @@ void ServiceGenerator::GenerateImplementation(io::Printer* printer)
 
     // Generate methods of the interface.
     GenerateNotImplementedMethods(printer);
+    GenerateMethodTable(printer);
     GenerateCallMethod(printer);
     GenerateGetPrototype(REQUEST, printer);
     GenerateGetPrototype(RESPONSE, printer);
+    GenerateAcquire(REQUEST, printer);
+    GenerateAcquire(RESPONSE, printer);
 
     // Generate stub implementation.
     printer->Print(vars_, "$classname$_Stub::$classname$_Stub(const $classname$_Stub& other)\n"
@@ -200,49 +228,92 @@ void ServiceGenerator::GenerateNotImplementedMethods(io::Printer* printer)
         sub_vars["request_type"]  = GetRequestWrapper(*method);
         sub_vars["response_type"] = GetResponseWrapper(*method);
 
+        if (!IsOutStreamPresent(*method))
+        {
+            // by default method waits for the coroutine, which is not implemented either
+            printer->Print(sub_vars, "#ifdef RPC_ENABLE_COROUTINES\n"
+                "void $classname$::$name$(const rpc::$request_type$<$input_type$>::Ptr& request,\n"
+                "                         const rpc::$response_type$<$output_type$>::Ptr& response) {\n"
+                "  rpc::details::CompleteResponse($name$(request), response);\n"
+                "}\n"
+                "\n"
+                "rpc::Task<$output_type$> $classname$::$name$(const rpc::$request_type$<$input_type$>::Ptr&) {\n"
+                "  BOOST_THROW_EXCEPTION(rpc::Exception(\"Method not implemented\"));\n"
+                "}\n"
+                "#else\n");
+        }
+
         printer->Print(sub_vars, "void $classname$::$name$(const rpc::$request_type$<$input_type$>::Ptr&,\n"
             "                         const rpc::$response_type$<$output_type$>::Ptr&) {\n"
             "  BOOST_THROW_EXCEPTION(rpc::Exception(\"Method not implemented\"));\n"
-            "}\n"
-            "\n");
+            "}\n");
+
+        if (!IsOutStreamPresent(*method))
+            printer->Print("#endif\n");
+
+        printer->Print("\n");
     }
 }
 
-void ServiceGenerator::GenerateCallMethod(io::Printer* printer)
+void ServiceGenerator::GenerateMethodTable(io::Printer* printer)
 {
-    printer->Print(vars_, "void $classname$::CallMethod(const google::protobuf::MethodDescriptor& method,\n"
-        "                             const rpc::MessagePtr& request,\n"
-        "                             const rpc::MessagePtr& response) {\n"
-        "  GOOGLE_DCHECK_EQ(method.service(), $classname$_descriptor_);\n"
-        "  switch(method.index()) {\n");
+    if (!descriptor_->method_count())
+    {
+        printer->Print(vars_, "const rpc::details::MethodEntry* $classname$::GetMethodTable() const {\n"
+            "  return nullptr;\n"
+            "}\n"
+            "\n");
+        return;
+    }
+
+    printer->Print(vars_, "static constexpr rpc::details::MethodEntry $classname$_methods_[] = {\n");
 
     for (int i = 0; i < descriptor_->method_count(); i++)
     {
         const MethodDescriptor* method = descriptor_->method(i);
         std::map<string, string> sub_vars;
+        sub_vars["classname"]     = descriptor_->name();
         sub_vars["name"]          = method->name();
-        sub_vars["index"]         = SimpleItoa(i);
         sub_vars["input_type"]    = ClassName(method->input_type(), true);
         sub_vars["output_type"]   = ClassName(method->output_type(), true);
         sub_vars["request_type"]  = GetRequestWrapper(*method);
         sub_vars["response_type"] = GetResponseWrapper(*method);
 
-        // Note:  down_cast does not work here because it only works on pointers,
-        //   not references.
-        printer->Print(sub_vars, "    case $index$:\n"
-            "      $name$(boost::dynamic_pointer_cast<rpc::$request_type$<$input_type$> >(request),\n"
-            "             boost::dynamic_pointer_cast<rpc::$response_type$<$output_type$> >(response));\n"
-            "      break;\n");
+        printer->Print(sub_vars, "  rpc::details::MethodThunks<$classname$,\n"
+            "                             rpc::$request_type$<$input_type$>,\n"
+            "                             rpc::$response_type$<$output_type$>,\n"
+            "                             &$classname$::$name$>::Entry(),\n");
     }
 
-    printer->Print(vars_, "    default:\n"
-        "      GOOGLE_LOG(FATAL) << \"Bad method index; this should never happen.\";\n"
-        "      break;\n"
-        "  }\n"
+    printer->Print(vars_, "};\n"
+        "\n"
+        "const rpc::details::MethodEntry* $classname$::GetMethodTable() const {\n"
+        "  return $classname$_methods_;\n"
         "}\n"
         "\n");
 }
 
+void ServiceGenerator::GenerateCallMethod(io::Printer* printer)
+{
+    std::map<string, string> sub_vars(vars_);
+    sub_vars["count"] = SimpleItoa(descriptor_->method_count());
+
+    printer->Print(sub_vars, "void $classname$::CallMethod(const google::protobuf::MethodDescriptor& method,\n"
+        "                             const rpc::MessagePtr& request,\n"
+        "                             const rpc::MessagePtr& response) {\n"
+        "  GOOGLE_DCHECK_EQ(method.service(), $classname$_descriptor_);\n"
+        "  if (method.index() >= $count$) {\n"
+        "    GOOGLE_LOG(FATAL) << \"Bad method index; this should never happen.\";\n"
+        "    return;\n"
+        "  }\n");
+
+    if (descriptor_->method_count())
+        printer->Print(vars_, "  $classname$_methods_[method.index()].m_Invoke(*this, request, response);\n");
+
+    printer->Print("}\n"
+        "\n");
+}
+
 void ServiceGenerator::GenerateGetPrototype(RequestOrResponse which, io::Printer* printer)
 {
     if (which == REQUEST)
@@ -290,6 +361,29 @@ void ServiceGenerator::GenerateGetPrototype(RequestOrResponse which, io::Printer
         "\n");
 }
 
+void ServiceGenerator::GenerateAcquire(RequestOrResponse which, io::Printer* printer)
+{
+    std::map<string, string> sub_vars(vars_);
+    sub_vars["count"] = SimpleItoa(descriptor_->method_count());
+    sub_vars["which"] = (which == REQUEST) ? "Request" : "Response";
+
+    printer->Print(sub_vars, "rpc::MessagePtr $classname$::Acquire$which$(\n"
+        "    const ::google::protobuf::MethodDescriptor& method) const {\n"
+        "  GOOGLE_DCHECK_EQ(method.service(), &descriptor());\n"
+        "  if (method.index() >= $count$) {\n"
+        "    GOOGLE_LOG(FATAL) << \"Bad method index; this should never happen.\";\n"
+        "    return rpc::MessagePtr();\n"
+        "  }\n");
+
+    if (descriptor_->method_count())
+        printer->Print(sub_vars, "  return $classname$_methods_[method.index()].m_Acquire$which$();\n");
+    else
+        printer->Print("  return rpc::MessagePtr();\n");
+
+    printer->Print("}\n"
+        "\n");
+}
+
 void ServiceGenerator::GenerateStubMethods(io::Printer* printer)
 {
     for (int i = 0; i < descriptor_->method_count(); i++)
@@ -302,6 +396,30 @@ void ServiceGenerator::GenerateStubMethods(io::Printer* printer)
         sub_vars["input_type"]  = ClassName(method->input_type(), true);
         sub_vars["output_type"] = ClassName(method->output_type(), true);
 
+        if (IsInputMessagesPresent(*method))
+        {
+            // messages written after the call are sent as chunks of the request stream
+            if (method->input_type()->field_count())
+            {
+                printer->Print(sub_vars,
+                               "rpc::Future<$output_type$> $classname$_Stub::$name$(const $input_type$& request, \n"
+                               "                                                    const rpc::MessageWriter<$input_type$>& writer) {\n"
+                               "    return rpc::Future<$output_type$>(channel_->CallMethod(*descriptor().method($index$), \n"
+                               "                                                           boost::make_shared<rpc::StreamRequest<$input_type$>>(writer.Stream(), request), \n"
+                               "                                                           writer.Stream()));\n"
+                               "}\n");
+            }
+            else
+            {
+                printer->Print(sub_vars,
+                               "rpc::Future<$output_type$> $classname$_Stub::$name$(const rpc::MessageWriter<$input_type$>& writer) {\n"
+                               "   return rpc::Future<$output_type$>(channel_->CallMethod(*descriptor().method($index$), \n"
+                               "                                                          boost::make_shared<rpc::StreamRequest<$input_type$>>(writer.Stream()), \n"
+                               "                                                          writer.Stream()));\n"
+                               "}\n");
+            }
+        }
+        else
         if (IsInputStreamPresent(*method))
         {
             if (method->input_type()->field_count())
@@ -354,29 +472,42 @@ enum MethodStreamType
 };
 
 static const int STREAM_FIELD = 60002;
+static const int MESSAGES_FIELD = 60003;
 
-bool ServiceGenerator::IsInputStreamPresent(const MethodDescriptor& method)
+static MethodStreamType GetStreamType(const MethodDescriptor& method, int number)
 {
     for (int i = 0; i < method.options().unknown_fields().field_count(); ++i)
     {
         const auto& field = method.options().unknown_fields().field(i);
-        if (field.number() == STREAM_FIELD && field.type() == 0)
-            return static_cast<MethodStreamType>(field.varint()) == In ||
-                   static_cast<MethodStreamType>(field.varint()) == InOut;
+        if (field.number() == number && field.type() == 0)
+            return static_cast<MethodStreamType>(field.varint());
     }
-    return false;
+    return No;
+}
+
+bool ServiceGenerator::IsInputStreamPresent(const MethodDescriptor& method)
+{
+    // messages are carried by the stream of the request
+    const auto type = GetStreamType(method, STREAM_FIELD);
+    return type == In || type == InOut || IsInputMessagesPresent(method);
 }
 
 bool ServiceGenerator::IsOutStreamPresent(const MethodDescriptor& method)
 {
-    for (int i = 0; i < method.options().unknown_fields().field_count(); ++i)
-    {
-        const auto& field = method.options().unknown_fields().field(i);
-        if (field.number() == STREAM_FIELD && field.type() == 0)
-            return static_cast<MethodStreamType>(field.varint()) == Out ||
-                   static_cast<MethodStreamType>(field.varint()) == InOut;
-    }
-    return false;
+    const auto type = GetStreamType(method, STREAM_FIELD);
+    return type == Out || type == InOut || IsOutMessagesPresent(method);
+}
+
+bool ServiceGenerator::IsInputMessagesPresent(const MethodDescriptor& method)
+{
+    const auto type = GetStreamType(method, MESSAGES_FIELD);
+    return type == In || type == InOut;
+}
+
+bool ServiceGenerator::IsOutMessagesPresent(const MethodDescriptor& method)
+{
+    const auto type = GetStreamType(method, MESSAGES_FIELD);
+    return type == Out || type == InOut;
 }
 
 std::string ServiceGenerator::GetRequestWrapper(const MethodDescriptor& method)
@@ -391,6 +522,14 @@ std::string ServiceGenerator::GetResponseWrapper(const MethodDescriptor& method)
 
 std::string ServiceGenerator::GetMethodSignature(const MethodDescriptor& method, const std::string& inType)
 {
+    if (IsInputMessagesPresent(method))
+    {
+        if (method.input_type()->field_count())
+            return std::string("const ") + inType + "& request, const rpc::MessageWriter<" + inType + ">& writer";
+        else
+            return std::string("const rpc::MessageWriter<") + inType + ">& writer";
+    }
+    else
     if (IsInputStreamPresent(method))
     {
         if (method.input_type()->field_count())
@@ -61,12 +61,19 @@ class ServiceGenerator {
   // produce a "not implemented" error.
   void GenerateNotImplementedMethods(io::Printer* printer);
 
+  // Generate the table of typed method thunks and GetMethodTable() method.
+  void GenerateMethodTable(io::Printer* printer);
+
   // Generate the CallMethod() method of the service.
   void GenerateCallMethod(io::Printer* printer);
 
   // Generate the Get{Request,Response}Prototype() methods.
   void GenerateGetPrototype(RequestOrResponse which, io::Printer* printer);
 
+  // Generate the Acquire{Request,Response}() methods, which take wrappers from object pool
+  // through the method table.
+  void GenerateAcquire(RequestOrResponse which, io::Printer* printer);
+
   // Generate the stub's implementations of the service methods.
   void GenerateStubMethods(io::Printer* printer);
 
@@ -76,6 +83,12 @@ class ServiceGenerator {
   // Test if method has output stream
   bool IsOutStreamPresent(const MethodDescriptor& method);
 
+  // Test if request is followed by stream of messages
+  bool IsInputMessagesPresent(const MethodDescriptor& method);
+
+  // Test if response is followed by stream of messages
+  bool IsOutMessagesPresent(const MethodDescriptor& method);
+
   // Get request wrapper type
   std::string GetRequestWrapper(const MethodDescriptor& method);
 
@@ -2,11 +2,13 @@
 #define RpcBase_h__
 
 #include "Future.h"
+#include "Deadline.h"
 
 #include <iosfwd>
 #include <string>
 #include <initializer_list>
 #include <set>
+#include <atomic>
 
 #include <boost/noncopyable.hpp>
 #include <boost/cstdint.hpp>
@@ -39,6 +41,7 @@ namespace details
 {
 
 class IChannel;
+struct MethodEntry;
 
 class PacketHolder
 {
@@ -49,6 +52,12 @@ public:
     const boost::exception_ptr& GetException() const { return m_Exception; }
     void SetException(const boost::exception_ptr& e) { m_Exception = e; }
     IChannel& GetChannel() { return *m_Channel; }
+protected:
+    void Reset()
+    {
+        m_Exception = boost::exception_ptr();
+        m_Channel.reset();
+    }
 protected:
     boost::exception_ptr m_Exception;
     boost::shared_ptr<IChannel> m_Channel;
@@ -57,15 +66,37 @@ protected:
 class RequestAndInfoHolder : public PacketHolder
 {
 public:
-    RequestAndInfoHolder() : m_IsResponseRequired(), m_MethodDescriptor() {}
+    RequestAndInfoHolder() : m_IsResponseRequired(), m_MethodDescriptor(), m_Deadline(CallDeadline::Clock::time_point::max()), m_IsCancelled() {}
 
     const rpc::InstanceId& GetCaller() const { return m_InstanceId; }
     bool IsResponseRequired() const { return m_IsResponseRequired; }
     const gp::MethodDescriptor& GetMethodDescriptor() const { return *m_MethodDescriptor; }
+
+    //! Time left until the caller gives up, pos_infin if call has no deadline.
+    //! Calls made by the handler later, outside of the dispatch, should be scoped with CallDeadline(GetRemaining()).
+    boost::posix_time::time_duration GetRemaining() const { return CallDeadline::Remaining(m_Deadline); }
+
+    //! Caller cancelled the call, handler may stop working on it, response is still sent
+    bool IsCancelled() const { return m_IsCancelled; }
+
+    //! Called by channel once cancel packet is received
+    void MarkCancelled() { m_IsCancelled = true; }
+protected:
+    void Reset()
+    {
+        PacketHolder::Reset();
+        m_InstanceId.clear();
+        m_IsResponseRequired = false;
+        m_MethodDescriptor = nullptr;
+        m_Deadline = CallDeadline::Clock::time_point::max();
+        m_IsCancelled = false;
+    }
 protected:
     rpc::InstanceId m_InstanceId;
     bool m_IsResponseRequired;
     const gp::MethodDescriptor* m_MethodDescriptor;
+    CallDeadline::Clock::time_point m_Deadline;
+    std::atomic<bool> m_IsCancelled;
 };
 
 class StreamHolder
@@ -76,6 +107,8 @@ public:
     const IStream& Stream() const { return m_Stream; }
     IStream& Stream() { return m_Stream; }
     void Stream(const IStream& stream) { m_Stream = stream; }
+protected:
+    void Reset() { m_Stream.reset(); }
 private:
     IStream m_Stream;
 };
@@ -85,7 +118,11 @@ class ResponseHolder : public PacketHolder
 public:
     ResponseHolder();
 protected:
-    void Send(const gp::Message& message, const IStream& stream);
+    //! Last send happens right before wrapper is cleared or destroyed, so sink may take content of the message
+    void Send(gp::Message& message, const IStream& stream, bool isLast = false);
+
+    //! Prepare for reuse, base packet is kept to avoid allocation, cleared base means no response
+    void Reset();
 protected:
     bool m_IsSent;
     std::unique_ptr<gp::Message> m_Base;
@@ -103,6 +140,13 @@ public:
     Request(Arg... var) : T(var...) {}
 
     typedef boost::shared_ptr<Request<T> > Ptr;
+
+    //! Prepare for reuse by object pool
+    void Recycle()
+    {
+        T::Clear();
+        RequestAndInfoHolder::Reset();
+    }
 };
 
 template<typename T>
@@ -112,12 +156,20 @@ public:
     typedef boost::shared_ptr<Response<T> > Ptr;
     ~Response()
     {
-        Send();
+        ResponseHolder::Send(*this, IStream(), true);
     }
     void Send()
     {
         ResponseHolder::Send(*this, IStream());
     }
+
+    //! Send response and prepare for reuse by object pool
+    void Recycle()
+    {
+        ResponseHolder::Send(*this, IStream(), true);
+        T::Clear();
+        ResponseHolder::Reset();
+    }
 };
 
 template<typename T>
@@ -128,6 +180,14 @@ public:
     StreamRequest(const IStream& s, Arg... var) : T(var...), details::StreamHolder(s) {}
     StreamRequest() {}
     typedef boost::shared_ptr<StreamRequest<T> > Ptr;
+
+    //! Prepare for reuse by object pool
+    void Recycle()
+    {
+        T::Clear();
+        RequestAndInfoHolder::Reset();
+        StreamHolder::Reset();
+    }
 };
 
 template<typename T>
@@ -138,12 +198,21 @@ public:
 
     ~StreamResponse()
     {
-        Send();
+        ResponseHolder::Send(*this, Stream(), true);
     }
     void Send()
     {
         ResponseHolder::Send(*this, Stream());
     }
+
+    //! Send response and prepare for reuse by object pool
+    void Recycle()
+    {
+        ResponseHolder::Send(*this, Stream(), true);
+        T::Clear();
+        ResponseHolder::Reset();
+        StreamHolder::Reset();
+    }
 };
 
 namespace details
@@ -180,6 +249,22 @@ public:
 
     virtual gp::Message* CreateRequest(const gp::MethodDescriptor& method) const = 0;
     virtual gp::Message* CreateResponse(const gp::MethodDescriptor& method) const = 0;
+
+    //! Request and response for incoming call, generated services take them from object pool
+    virtual MessagePtr AcquireRequest(const gp::MethodDescriptor& method) const
+    {
+        return MessagePtr(CreateRequest(method));
+    }
+    virtual MessagePtr AcquireResponse(const gp::MethodDescriptor& method) const
+    {
+        return MessagePtr(CreateResponse(method));
+    }
+
+    //! Typed method thunks indexed by method index, nullptr if service is not generated
+    virtual const details::MethodEntry* GetMethodTable() const
+    {
+        return nullptr;
+    }
 };
 
 } // namespace rpc
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "net/connection.hpp"
+
+#include <vector>
+
+namespace rpc
+{
+
+//! Extension point for connections which prepare several blocks at once, e.g. one reservation in the shared memory ring.
+//! Write coalescer hands every batch over to it in a single call instead of preparing blocks one by one.
+class IBatchConnection
+{
+public:
+    virtual ~IBatchConnection() {}
+
+    //! Prepare one block per size, data is written to the blocks in order and they are sent once data is destroyed.
+    //! Receiver gets each block as it would get a block prepared on its own.
+    virtual net::details::IData::Ptr PrepareBatch(const std::vector<std::size_t>& sizes) = 0;
+};
+
+} // namespace rpc
@@ -1,6 +1,10 @@
 #pragma once
 
 #include "Base.h"
+#include "Compression.h"
+#include "FlowControl.h"
+#include "SpillStream.h"
+#include "WriteCoalescer.h"
 #include "net/connection.hpp"
 
 #include <iosfwd>
@@ -35,6 +39,21 @@ public:
     virtual boost::shared_ptr<details::IChannelSink> GetSink() const = 0;
     virtual void SetConnection(const net::IConnection::Ptr& connection) = 0;
 
+    //! Compress payload of outgoing packets and limit decompressed size of received ones, see Compression::Negotiate
+    virtual void SetCompression(const details::Compression::Settings& settings) = 0;
+
+    //! Limit calls the peer may have in flight to this side and choose what happens with calls of this side without credit
+    virtual void SetFlowControl(const details::FlowControl::Settings& settings) = 0;
+
+    //! Collect received chunked streams, data past threshold is moved into temporary file
+    virtual void SetSpill(const SpillStream::Settings& settings) = 0;
+
+    //! Timeout of calls made without CallDeadline, zero or pos_infin disables it
+    virtual void SetCallTimeout(const boost::posix_time::time_duration& timeout) = 0;
+
+    //! Batch packets written while another write is in flight, zero max batch size disables it
+    virtual void SetCoalescing(const details::WriteCoalescer::Settings& settings) = 0;
+
     static Ptr Instance(boost::asio::io_service& svc);
 };
 
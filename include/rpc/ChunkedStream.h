@@ -0,0 +1,123 @@
+#pragma once
+
+#include "rpc/Base.h"
+
+#include <deque>
+#include <istream>
+#include <string>
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/exception_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace rpc
+{
+
+//! Unbounded stream which is sent and delivered in chunks as they are produced, so the transfer is never kept in memory.
+//! It's passed wherever IStream is expected: as stream of a request or of a response. Producer writes chunks and closes
+//! the stream, the other side gets ChunkedStream instead of materialized data and reads chunks as they arrive.
+//! Chunks are kept only until consumer starts reading. Producer must not write from several threads at once.
+//! Streams sent over a channel have a window of DEFAULT_WINDOW chunks unless producer sets one, the receiving side
+//! returns credit once the consumer callback handled chunks. So a slow consumer makes chunks wait in the producer's
+//! stream, Write returns false once they reach the queue limit and WhenWritable tells when to resume.
+//! The istream interface reads only data received with the packet which opened the stream.
+class ChunkedStream : public std::istream
+{
+public:
+    typedef boost::shared_ptr<ChunkedStream> Ptr;
+
+    enum { DEFAULT_WINDOW = 16, DEFAULT_MAX_QUEUED = 64 };
+
+    //! Chunk of data, empty chunk ends the stream and exception is set if producer failed
+    typedef boost::function<void(const IStream& chunk, const boost::exception_ptr& e)> Callback;
+
+    //! Passes credit of the consumer to the producer on the other side of the channel
+    typedef boost::function<void(std::size_t chunks)> GrantFn;
+
+    //! Queue of the stream has room for more chunks
+    typedef boost::function<void()> WritableFn;
+
+    //! Tells the producer on the other side of the channel that consumer closed the stream before its end
+    typedef boost::function<void(const boost::exception_ptr& e)> CancelFn;
+
+    explicit ChunkedStream(const IStream& head = IStream());
+    ~ChunkedStream();
+
+    static Ptr Instance(const IStream& head = IStream());
+
+    //! Chunked stream or empty pointer if stream is materialized
+    static Ptr Cast(const IStream& stream);
+
+    //! Deliver chunk, throws if stream is closed.
+    //!\return false if queued chunks reached the limit, chunk is queued anyway but producer should wait for WhenWritable
+    bool Write(const IStream& chunk);
+    //! Chunk reads the data in place, pass rvalue to avoid a copy
+    bool Write(std::string data);
+
+    //! Invoke callback once, as soon as the queue is below the limit: right away or by the thread which delivers chunks
+    void WhenWritable(const WritableFn& callback);
+
+    //! Chunks queued before Write returns false, zero means no limit
+    void SetMaxQueued(std::size_t chunks);
+
+    //! End the stream once queued chunks are delivered, closing closed stream does nothing.
+    //! Consumer which closes received stream cancels it, producer's stream is closed with the error.
+    void Close(const boost::exception_ptr& e = boost::exception_ptr());
+
+    //! Start reading, queued chunks are delivered first. Callback is invoked by the thread which writes or closes the stream.
+    void Read(const Callback& callback);
+
+    bool IsClosed() const;
+
+    //! Deliver at most window chunks which consumer hasn't handled yet, zero window means no limit.
+    //! Set by producer before it writes, chunks without credit wait in the stream.
+    void SetWindow(std::size_t chunks);
+    std::size_t GetWindow() const;
+
+    //! Consumer allows producer to deliver more chunks in addition to credit of handled ones
+    void Grant(std::size_t chunks);
+
+    //! Chunks waiting for consumer or for credit, producer should slow down when it grows
+    std::size_t GetQueued() const;
+
+    //! Return credit of chunks handled by consumer callback in batches, zero means consumer grants credit itself.
+    //! Batch must not exceed window of the producer. Received streams return credit of each half of the window.
+    void SetAutoGrant(std::size_t batch);
+
+    //! Used by channel sink for received streams, credit is sent to the producer instead of being kept here
+    void SetGrant(const GrantFn& grant);
+
+    //! Used by channel sink for received streams, invoked once if the stream is closed before producer ends it
+    void SetCancel(const CancelFn& cancel);
+
+private:
+    //! Only one thread delivers chunks at a time, so they are never reordered
+    void Deliver(boost::unique_lock<boost::mutex>& lock);
+
+    //! Return credit of the chunk handled by consumer if credit is granted automatically
+    void Return();
+
+    bool IsFull() const;
+
+private:
+    const IStream m_Head;
+
+    mutable boost::mutex m_Mutex;
+    std::deque<IStream> m_Chunks;
+    Callback m_Callback;
+    GrantFn m_Grant;
+    WritableFn m_Writable;
+    CancelFn m_Cancel;
+    std::size_t m_Window;
+    std::size_t m_Credit;
+    std::size_t m_GrantBatch;
+    std::size_t m_Handled;          //!< handled chunks which credit is not sent yet
+    std::size_t m_MaxQueued;
+    boost::exception_ptr m_Exception;
+    bool m_IsClosed;
+    bool m_IsEnded;
+    bool m_IsDelivering;
+};
+
+} // namespace rpc
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "rpc/Base.h"
+
+#include "rpc_base.pb.h"
+
+#include <string>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace rpc
+{
+namespace details
+{
+
+//! Compresses payload of outgoing packets: request or response and stream which follow the base packet.
+//! Base packet is never compressed, its Compression field tells the receiver how to restore the payload.
+//! Payloads below threshold or above limit, chunked streams and files are sent as is, as well as payloads which don't shrink.
+//! Compressed payload is kept in memory, so the limit bounds memory of compressed packets on both sides.
+class Compression : boost::noncopyable
+{
+public:
+    typedef boost::shared_ptr<Compression> Ptr;
+    typedef proto::CompressionType Codec;
+
+    enum
+    {
+        DEFAULT_MIN_BYTES = 1024,
+        DEFAULT_MAX_BYTES = 16 * 1024 * 1024,
+        DEFAULT_MAX_DECOMPRESSED_BYTES = 64 * 1024 * 1024
+    };
+
+    //! Name of the RpcInfo.Instance property which lists codecs the instance decodes
+    static const char* const PROPERTY;
+
+    struct Settings
+    {
+        Settings()
+            : m_Codec(proto::NoCompression)
+            , m_MinBytes(DEFAULT_MIN_BYTES)
+            , m_MaxBytes(DEFAULT_MAX_BYTES)
+            , m_MaxDecompressedBytes(DEFAULT_MAX_DECOMPRESSED_BYTES)
+        {}
+
+        Codec m_Codec;                                          //!< codec of packets without codec of their method
+        boost::uint32_t m_MinBytes;                             //!< smaller payloads are sent as is
+        boost::uint64_t m_MaxBytes;                             //!< larger payloads are sent as is, zero means no limit
+        boost::uint64_t m_MaxDecompressedBytes;                 //!< received packets which decompress to more are failed, zero means no limit
+        boost::unordered_map<boost::uint64_t, Codec> m_Methods; //!< codec per method, see MethodKey
+    };
+
+    struct Stats
+    {
+        Stats() : m_Packets(), m_RawBytes(), m_CompressedBytes(), m_Skipped() {}
+
+        boost::uint64_t m_Packets;          //!< packets sent compressed
+        boost::uint64_t m_RawBytes;         //!< payload bytes of compressed packets before compression
+        boost::uint64_t m_CompressedBytes;  //!< payload bytes of compressed packets on the wire
+        boost::uint64_t m_Skipped;          //!< payloads which were not smaller once compressed
+    };
+
+    explicit Compression(const Settings& settings);
+
+    static boost::uint64_t MethodKey(boost::uint32_t serviceId, boost::uint32_t method);
+
+    //! Codec of the packet, no compression if payload is too small or can't be compressed
+    Codec Select(const proto::BasePacket& base, const gp::Message* request, const IStream& stream) const;
+
+    //! Serialized and compressed payload, empty stream if it's not smaller than the raw one
+    IStream Compress(Codec codec, const gp::Message* request, const IStream& stream);
+
+    //! Raw payload of the rest of the received stream, throws if it's larger than maxBytes, zero means no limit
+    static IStream Decompress(Codec codec, std::istream& stream, boost::uint64_t maxBytes = DEFAULT_MAX_DECOMPRESSED_BYTES);
+
+    static std::string Compress(Codec codec, const std::string& data);
+    static std::string Decompress(Codec codec, const std::string& data, boost::uint64_t maxBytes = DEFAULT_MAX_DECOMPRESSED_BYTES);
+
+    //! Let the peer know which codecs this side decodes, property should be sent with RegistrationService.Register.
+    //! Registration is implemented by the application, it passes Negotiate result of the peer to IChannelSink::SetCompression.
+    static void Advertise(proto::RpcInfo::Instance& instance);
+
+    //! Settings limited to codecs the peer decodes, peer which doesn't advertise codecs gets raw packets
+    static Settings Negotiate(const Settings& settings, const proto::RpcInfo::Instance& peer);
+
+    Stats GetStats() const;
+
+private:
+    const Settings m_Settings;
+
+    mutable boost::mutex m_Mutex;
+    Stats m_Stats;
+};
+
+} // namespace details
+} // namespace rpc
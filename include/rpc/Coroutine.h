@@ -0,0 +1,280 @@
+#pragma once
+
+#include "Future.h"
+
+//! C++20 coroutine support, enabled by RPC_ENABLE_COROUTINES.
+//! rpc::Future is awaitable, coroutine is resumed on the io_service of the future without blocking a thread.
+//! Generated services may implement a method as a coroutine returning rpc::Task with the response message.
+
+#ifdef RPC_ENABLE_COROUTINES
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/asio/dispatch.hpp>
+
+namespace rpc
+{
+
+template<typename T>
+class Task;
+
+namespace details
+{
+
+//! Suspends coroutine until future is ready, result of co_await is the future with parsed response
+template<typename T>
+class FutureAwaiter : public IFuture::Waiter
+{
+public:
+    explicit FutureAwaiter(const Future<T>& future) : m_Future(future) {}
+
+    bool await_ready() const
+    {
+        return m_Future.IsReady();
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        m_Handle = handle;
+        return m_Future.m_Future->AddWaiter(*this);
+    }
+
+    Future<T> await_resume() const
+    {
+        m_Future.Response(); // throws if call failed
+        return m_Future;
+    }
+
+private:
+    virtual void OnReady() override
+    {
+        // awaiter is destroyed once coroutine is resumed, members can't be used after dispatch
+        const auto handle = m_Handle;
+        boost::asio::dispatch(m_Future.m_Future->GetService(), [handle](){ handle.resume(); });
+    }
+
+private:
+    const Future<T> m_Future;
+    std::coroutine_handle<> m_Handle;
+};
+
+//! Resumes coroutine awaiting the task, if any
+struct FinalAwaiter
+{
+    bool await_ready() noexcept { return false; }
+    void await_resume() noexcept {}
+
+    template<typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept;
+};
+
+//! State shared by task and its coroutine, the last one of them destroys coroutine frame
+class TaskPromiseBase
+{
+    friend struct FinalAwaiter;
+public:
+    TaskPromiseBase() : m_Awaited(), m_Released() {}
+
+    std::suspend_never initial_suspend() noexcept
+    {
+        return {};
+    }
+
+    FinalAwaiter final_suspend() noexcept
+    {
+        return FinalAwaiter();
+    }
+
+    void unhandled_exception()
+    {
+        m_Exception = std::current_exception();
+    }
+
+    //!\return false if coroutine is already finished and continuation won't be resumed
+    bool SetContinuation(std::coroutine_handle<> continuation)
+    {
+        m_Continuation = continuation;
+        return !m_Awaited.exchange(true);
+    }
+
+    //!\return true if coroutine is finished and frame must be destroyed by the caller
+    bool Release()
+    {
+        return m_Released.exchange(true);
+    }
+
+protected:
+    void Rethrow() const
+    {
+        if (m_Exception)
+            std::rethrow_exception(m_Exception);
+    }
+
+private:
+    std::coroutine_handle<> m_Continuation;
+    std::exception_ptr m_Exception;
+    std::atomic<bool> m_Awaited;
+    std::atomic<bool> m_Released;
+};
+
+template<typename Promise>
+std::coroutine_handle<> FinalAwaiter::await_suspend(std::coroutine_handle<Promise> handle) noexcept
+{
+    TaskPromiseBase& promise = handle.promise();
+    const bool awaited = promise.m_Awaited.exchange(true);
+    const auto continuation = promise.m_Continuation;
+    if (promise.m_Released.exchange(true))
+    {
+        // task is gone, nobody will ask for the result
+        handle.destroy();
+        return std::noop_coroutine();
+    }
+    return awaited ? continuation : std::noop_coroutine();
+}
+
+template<typename T>
+class TaskPromise : public TaskPromiseBase
+{
+public:
+    Task<T> get_return_object();
+
+    void return_value(T value)
+    {
+        m_Value.emplace(std::move(value));
+    }
+
+    T GetResult()
+    {
+        Rethrow();
+        return std::move(*m_Value);
+    }
+
+private:
+    std::optional<T> m_Value;
+};
+
+template<>
+class TaskPromise<void> : public TaskPromiseBase
+{
+public:
+    Task<void> get_return_object();
+
+    void return_void() {}
+
+    void GetResult()
+    {
+        Rethrow();
+    }
+};
+
+//! Suspends coroutine until task is finished, result of co_await is the value returned by task
+template<typename T>
+class TaskAwaiter
+{
+public:
+    typedef std::coroutine_handle<TaskPromise<T>> Handle;
+
+    explicit TaskAwaiter(Handle handle) : m_Handle(handle) {}
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> continuation)
+    {
+        return m_Handle.promise().SetContinuation(continuation);
+    }
+
+    T await_resume()
+    {
+        return m_Handle.promise().GetResult();
+    }
+
+private:
+    Handle m_Handle;
+};
+
+//! Coroutine which nobody waits for, it owns itself
+struct DetachedTask
+{
+    struct promise_type
+    {
+        DetachedTask get_return_object() { return DetachedTask(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+//! Used by generated services, response is sent once coroutine returns it and response pointer is released
+template<typename T, typename Response>
+DetachedTask CompleteResponse(Task<T> task, boost::shared_ptr<Response> response)
+{
+    try
+    {
+        auto result = co_await task;
+        static_cast<T&>(*response).Swap(&result);
+    }
+    catch (const std::exception&)
+    {
+        response->SetException(boost::current_exception());
+    }
+}
+
+} // namespace details
+
+//! Coroutine task, starts eagerly. Task may be dropped before coroutine is finished, coroutine keeps running.
+template<typename T>
+class Task
+{
+public:
+    typedef details::TaskPromise<T> promise_type;
+    typedef std::coroutine_handle<promise_type> Handle;
+
+    explicit Task(Handle handle) : m_Handle(handle) {}
+    Task(Task&& other) noexcept : m_Handle(std::exchange(other.m_Handle, nullptr)) {}
+    Task(const Task&) = delete;
+    Task& operator = (const Task&) = delete;
+
+    ~Task()
+    {
+        if (m_Handle && m_Handle.promise().Release())
+            m_Handle.destroy();
+    }
+
+    details::TaskAwaiter<T> operator co_await() const noexcept
+    {
+        return details::TaskAwaiter<T>(m_Handle);
+    }
+
+private:
+    Handle m_Handle;
+};
+
+template<typename T>
+Task<T> details::TaskPromise<T>::get_return_object()
+{
+    return Task<T>(Task<T>::Handle::from_promise(*this));
+}
+
+inline Task<void> details::TaskPromise<void>::get_return_object()
+{
+    return Task<void>(Task<void>::Handle::from_promise(*this));
+}
+
+template<typename T>
+details::FutureAwaiter<T> operator co_await(const Future<T>& future)
+{
+    return details::FutureAwaiter<T>(future);
+}
+
+} // namespace rpc
+
+#endif // RPC_ENABLE_COROUTINES
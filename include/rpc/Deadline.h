@@ -0,0 +1,35 @@
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <boost/chrono.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace rpc
+{
+
+//! Deadline of calls made by the current thread while the object exists.
+//! Nested deadline can't extend the outer one. Calls made without deadline use timeout of the channel sink.
+//! Deadline is sent with request, so the server knows how much time the caller is going to wait.
+class CallDeadline : boost::noncopyable
+{
+public:
+    typedef boost::chrono::steady_clock Clock;
+
+    explicit CallDeadline(const boost::posix_time::time_duration& timeout);
+    ~CallDeadline();
+
+    //! Deadline of the current thread, max time point if there is no deadline
+    static Clock::time_point Current();
+
+    //! Time left until deadline of the current thread, pos_infin if there is no deadline, negative if expired
+    static boost::posix_time::time_duration Remaining();
+
+    //! Time left until deadline, pos_infin for max time point
+    static boost::posix_time::time_duration Remaining(const Clock::time_point& deadline);
+
+private:
+    const CallDeadline* m_Previous;
+    Clock::time_point m_Deadline;   //!< max time point means no deadline
+};
+
+} // namespace rpc
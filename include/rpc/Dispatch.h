@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Base.h"
+#include "Pool.h"
+
+#include <type_traits>
+#include <typeinfo>
+
+#include <boost/shared_ptr.hpp>
+
+namespace rpc
+{
+namespace details
+{
+
+//! Generated per method entry, gives typed access to request and response wrappers without RTTI
+struct MethodEntry
+{
+    typedef MessagePtr (*AcquireFn)();
+    typedef bool (*IsRequestFn)(const gp::Message& message);
+    typedef void (*InvokeFn)(IService& service, const MessagePtr& request, const MessagePtr& response);
+    typedef RequestAndInfoHolder& (*RequestHolderFn)(gp::Message& request);
+    typedef ResponseHolder& (*ResponseHolderFn)(gp::Message& response);
+    typedef StreamHolder* (*StreamHolderFn)(gp::Message& request);
+
+    AcquireFn m_AcquireRequest;
+    AcquireFn m_AcquireResponse;
+    IsRequestFn m_IsRequest;         //!< message is the request wrapper itself, so it may be dispatched as is
+    InvokeFn m_Invoke;
+    RequestHolderFn m_RequestHolder;
+    ResponseHolderFn m_ResponseHolder;
+    StreamHolderFn m_StreamHolder;   //!< returns nullptr if request has no stream
+};
+
+//! Thunks for method of generated service, wrapper types are known at compile time so all casts are static
+template<typename Service, typename Request, typename Response, void (Service::*Method)(const typename Request::Ptr&, const typename Response::Ptr&)>
+struct MethodThunks
+{
+    static MessagePtr AcquireRequest()
+    {
+        return ObjectPool<Request>::Instance().Acquire();
+    }
+
+    static MessagePtr AcquireResponse()
+    {
+        return ObjectPool<Response>::Instance().Acquire();
+    }
+
+    static bool IsRequest(const gp::Message& message)
+    {
+        return typeid(message) == typeid(Request);
+    }
+
+    static void Invoke(IService& service, const MessagePtr& request, const MessagePtr& response)
+    {
+        (static_cast<Service&>(service).*Method)(boost::static_pointer_cast<Request>(request),
+                                                 boost::static_pointer_cast<Response>(response));
+    }
+
+    static RequestAndInfoHolder& GetRequestHolder(gp::Message& request)
+    {
+        return static_cast<Request&>(request);
+    }
+
+    static ResponseHolder& GetResponseHolder(gp::Message& response)
+    {
+        return static_cast<Response&>(response);
+    }
+
+    static StreamHolder* GetStreamHolder(gp::Message& request)
+    {
+        return GetStreamHolder(request, std::is_base_of<StreamHolder, Request>());
+    }
+
+    static constexpr MethodEntry Entry()
+    {
+        return MethodEntry{ &AcquireRequest, &AcquireResponse, &IsRequest, &Invoke, &GetRequestHolder, &GetResponseHolder, &GetStreamHolder };
+    }
+
+private:
+    static StreamHolder* GetStreamHolder(gp::Message& request, std::true_type)
+    {
+        return &static_cast<Request&>(request);
+    }
+
+    static StreamHolder* GetStreamHolder(gp::Message&, std::false_type)
+    {
+        return nullptr;
+    }
+};
+
+} // namespace details
+} // namespace rpc
@@ -29,6 +29,33 @@ struct Exception : public virtual boost::exception, std::runtime_error
     {}
 };
 
+//! Call deadline expired before response was received
+struct TimeoutException : public Exception
+{
+    template <typename ... T>
+    TimeoutException(const std::string& text, const T&... args)
+        : Exception(text, args...)
+    {}
+};
+
+//! Call cancelled by the caller before response was received
+struct CancelledException : public Exception
+{
+    template <typename ... T>
+    CancelledException(const std::string& text, const T&... args)
+        : Exception(text, args...)
+    {}
+};
+
+//! Call failed because peer granted no credit for it
+struct OverloadException : public Exception
+{
+    template <typename ... T>
+    OverloadException(const std::string& text, const T&... args)
+        : Exception(text, args...)
+    {}
+};
+
 typedef boost::shared_ptr<google::protobuf::Message> MessagePtr;
 typedef boost::error_info<struct tag_proto_message, MessagePtr> ProtoErrorInfo;
 
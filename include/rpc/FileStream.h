@@ -0,0 +1,82 @@
+#pragma once
+
+#include "rpc/Base.h"
+
+#include <istream>
+#include <limits>
+#include <memory>
+#include <string>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+
+namespace rpc
+{
+
+//! Stream of a file region. The write path recognizes it and reads the file with pread straight into buffers of
+//! the connection, data never passes through an intermediate buffer. Connections of this library, shared memory one
+//! included, take this path. Connection which implements IFileSender gets the region instead.
+//! Readers of the istream interface read regions of at least MIN_MAPPED_SIZE from a mapping, smaller ones
+//! aren't worth the cost of mapping and are read with pread into a small buffer.
+//! File must not be truncated while the stream exists: reading the mapping past the new end of the file raises
+//! SIGBUS and kills the process. The write path and Read don't touch the mapping, they throw on truncated file.
+class FileStream : public std::istream
+{
+public:
+    typedef boost::shared_ptr<FileStream> Ptr;
+
+    enum { MIN_MAPPED_SIZE = 1024 * 1024 };
+
+    //! Region of the file from offset, up to the end of the file by default. Temporary file is removed with the stream.
+    FileStream(const std::string& path, boost::uint64_t offset, boost::uint64_t size, bool isTemporary = false);
+    ~FileStream();
+
+    static Ptr Instance(const std::string& path, boost::uint64_t offset = 0, boost::uint64_t size = std::numeric_limits<boost::uint64_t>::max());
+
+    //! Whole temporary file, it's removed once the stream is destroyed
+    static Ptr Temporary(const std::string& path);
+
+    //! File stream or empty pointer if stream is not backed by a file
+    static Ptr Cast(const IStream& stream);
+
+    //! Offset of the region in the file
+    boost::uint64_t GetOffset() const;
+
+    //! Size of the region
+    boost::uint64_t GetSize() const;
+
+    //! Bytes of the region already read
+    boost::uint64_t GetPosition() const;
+
+    //! Mapped region, null if region is empty or smaller than MIN_MAPPED_SIZE
+    const char* GetData() const;
+
+    //! Copy bytes of the region starting from position, stream position is not changed.
+    //! Throws if the range is out of the region or the file ends before it.
+    void Read(boost::uint64_t position, char* data, std::size_t size) const;
+
+#if defined(__linux__)
+    //! Send bytes of the region with sendfile, data doesn't pass through user space.
+    //! Returns bytes sent, it's less than size if socket is non-blocking and its buffer is full.
+    std::size_t SendTo(int socket, boost::uint64_t position, std::size_t size) const;
+#endif
+
+private:
+    class Buffer;
+    const boost::uint64_t m_Offset;
+    std::unique_ptr<Buffer> m_Buffer;
+};
+
+//! Extension point for connections which transmit file regions by themselves, e.g. socket connection of the net layer
+//! with sendfile, see FileStream::SendTo. No connection of this library implements it.
+//! Write path hands FileStream payload over to it instead of copying it into connection buffers.
+class IFileSender
+{
+public:
+    virtual ~IFileSender() {}
+
+    //! Send size bytes of the region starting from position, after data prepared before the call
+    virtual void SendFile(const FileStream::Ptr& file, boost::uint64_t position, boost::uint64_t size) = 0;
+};
+
+} // namespace rpc
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "rpc/Base.h"
+
+#include "rpc_base.pb.h"
+
+#include <deque>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace rpc
+{
+namespace details
+{
+
+//! Limits calls in flight and bytes of their requests by credits granted by the receiver.
+//! Call takes a credit when it's written and returns it once it's not pending anymore:
+//! response received, call timed out, cancelled or channel closed.
+//! Calls without response are not limited, there is nothing that returns their credit.
+//! Receiver counts incoming calls the same way and refuses calls of the peer which exceed granted limits.
+class FlowControl : boost::noncopyable
+{
+public:
+    typedef boost::shared_ptr<FlowControl> Ptr;
+
+    //! Writes packet to the connection
+    typedef boost::function<void(const proto::BasePacket& base, const MessagePtr& request, const IStream& stream)> WriteFn;
+
+    enum Mode
+    {
+        MODE_WAIT,  //!< call without credit is queued until credit is returned, fails if the queue is full
+        MODE_FAIL,  //!< call without credit fails with OverloadException
+    };
+
+    enum { DEFAULT_MAX_QUEUED = 1024, DEFAULT_MAX_QUEUED_BYTES = 64 * 1024 * 1024 };
+
+    struct Settings
+    {
+        Settings() : m_MaxCalls(), m_MaxBytes(), m_Mode(MODE_WAIT), m_MaxQueued(DEFAULT_MAX_QUEUED), m_MaxQueuedBytes(DEFAULT_MAX_QUEUED_BYTES) {}
+
+        boost::uint32_t m_MaxCalls;         //!< calls the peer may have in flight to this side, zero means no limit
+        boost::uint64_t m_MaxBytes;         //!< bytes of requests the peer may have in flight to this side, zero means no limit
+        Mode m_Mode;                        //!< what happens with outgoing call when there is no credit
+        std::size_t m_MaxQueued;            //!< outgoing calls waiting for credit, zero means no limit
+        boost::uint64_t m_MaxQueuedBytes;   //!< bytes of outgoing calls waiting for credit, zero means no limit
+    };
+
+    struct Stats
+    {
+        Stats() : m_Calls(), m_Bytes(), m_CallsLimit(), m_BytesLimit(), m_Queued(), m_QueuedBytes(), m_Rejected(), m_IncomingCalls(), m_IncomingBytes(), m_Refused() {}
+
+        boost::uint32_t m_Calls;            //!< calls in flight
+        boost::uint64_t m_Bytes;            //!< bytes of requests in flight
+        boost::uint32_t m_CallsLimit;       //!< calls granted by the peer, zero means no limit
+        boost::uint64_t m_BytesLimit;       //!< bytes granted by the peer, zero means no limit
+        std::size_t m_Queued;               //!< calls waiting for credit
+        boost::uint64_t m_QueuedBytes;      //!< bytes of calls waiting for credit
+        boost::uint64_t m_Rejected;         //!< calls failed because there was no credit or the queue was full
+        boost::uint32_t m_IncomingCalls;    //!< calls of the peer in flight to this side
+        boost::uint64_t m_IncomingBytes;    //!< bytes of requests of the peer in flight to this side
+        boost::uint64_t m_Refused;          //!< calls of the peer refused because they exceeded granted limits
+    };
+
+    explicit FlowControl(const WriteFn& write);
+
+    //! Mode and queue limits of outgoing calls, limits of incoming ones
+    void Configure(const Settings& settings);
+
+    //! Peer granted credit, calls waiting for it are written
+    void Grant(boost::uint32_t calls, boost::uint64_t bytes);
+
+    //! Write the call if there is credit for it, otherwise queue it or fail depending on mode.
+    //! Queued request is copied, so caller may reuse it. Call which completes while it's queued is never written.
+    //!\return false if call must fail
+    bool Send(const IFuture::Ptr& future, const proto::BasePacket& base, const MessagePtr& request, const IStream& stream);
+
+    //! Return credit of the call, unknown ids are ignored
+    void Release(boost::uint32_t id);
+
+    //! Count call of the peer until it's released, size is the size of its request without stream chunks
+    //!\return false if the call exceeds limits granted to the peer
+    bool Admit(boost::uint32_t id, boost::uint64_t size);
+
+    //! Call of the peer is answered or cancelled, unknown ids are ignored
+    void ReleaseIncoming(boost::uint32_t id);
+
+    //! Return all credits, forget incoming calls and drop queued calls, used on close
+    void Reset();
+
+    Stats GetStats() const;
+
+private:
+    struct Queued
+    {
+        boost::weak_ptr<IFuture> m_Future;
+        proto::BasePacket m_Base;
+        MessagePtr m_Request;
+        IStream m_Stream;
+        boost::uint64_t m_Size;
+    };
+
+    typedef std::vector<Queued> Ready;
+    typedef boost::unordered_map<boost::uint32_t, boost::uint64_t> Calls;
+
+    bool HasCredit(boost::uint64_t size) const;
+    bool IsQueueFull(boost::uint64_t size) const;
+    void Take(boost::uint32_t id, boost::uint64_t size);
+
+    //! Take queued calls which fit into credit, caller writes them once the lock is released
+    void Drain(Ready& ready);
+    void Write(const Ready& ready) const;
+
+private:
+    const WriteFn m_Write;
+
+    mutable boost::mutex m_Mutex;
+    Settings m_Settings;
+    Calls m_InFlight;   //!< size of each call in flight
+    Calls m_Incoming;   //!< size of each call of the peer in flight
+    std::deque<Queued> m_Queue;
+    Stats m_Stats;
+};
+
+} // namespace details
+} // namespace rpc
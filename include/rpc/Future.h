@@ -2,13 +2,20 @@
 #define Future_h__
 
 #include <iosfwd>
+#include <cassert>
+#include <atomic>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/function.hpp>
 #include <boost/exception_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/bind.hpp>
 #include <boost/asio/io_service.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 
 namespace google
 {
@@ -26,16 +33,61 @@ class IFuture
 public:
     typedef boost::shared_ptr<IFuture> Ptr;
     typedef boost::shared_ptr<std::istream> StreamPtr;
+    typedef boost::shared_ptr<const google::protobuf::Message> MessagePtr;
     typedef boost::function<void(const Ptr& future)> Callback;
 
+    //! Removes pending call and notifies the callee, returns false if call is not pending anymore
+    typedef boost::function<bool(const Ptr& future)> CancelFn;
+
+    //! Intrusive waiter, owned by the caller, so adding it doesn't allocate
+    struct Waiter
+    {
+        Waiter() : m_Next() {}
+
+        //! Called once data is ready, on the thread which completed the future
+        virtual void OnReady() = 0;
+
+        Waiter* m_Next;
+    };
+
     virtual ~IFuture() {}
 
     virtual StreamPtr GetData() = 0;
+
+    //! Blocks until data is ready or timeout expired
+    //!\return true if data is ready
+    virtual bool Wait(const boost::posix_time::time_duration& timeout) = 0;
+
+    //! Callback is called once data is ready, on the thread which completed the future.
+    //! Any number of callbacks may be added, they are called in order.
     virtual void GetData(const Callback& c) = 0;
+
+    //! Waiter is notified once data is ready, after callbacks, order of waiters is not defined
+    //!\return false if data is already ready, waiter is not added
+    virtual bool AddWaiter(Waiter& waiter) = 0;
     virtual void SetData(const StreamPtr& stream) = 0;
     virtual void SetException(const boost::exception_ptr& e) = 0;
+
+    //! Set response message which wasn't serialized, stream is passed as is
+    virtual void SetMessage(const MessagePtr& message, const StreamPtr& stream) = 0;
+
+    //! Blocks until data is ready, response is parsed from data once and shared by all callers.
+    //! Prototype defines type of the response, message set by SetMessage is returned as is.
+    virtual const google::protobuf::Message& GetResponse(const google::protobuf::Message& prototype) = 0;
+
     virtual boost::exception_ptr GetException() const = 0;
     virtual bool IsReady() const = 0;
+
+    //! Set by the channel which made the call
+    virtual void SetCancel(const CancelFn& cancel) = 0;
+
+    //! Fails pending call with CancelledException and asks the callee to stop working on it
+    //!\return false if data is already ready or the future isn't a call made by a channel
+    virtual bool Cancel() = 0;
+
+    //! Service the future was created with, continuations create futures on it
+    virtual boost::asio::io_service& GetService() const = 0;
+
     virtual const google::protobuf::Message* GetBase() const = 0;
     virtual void SetBase(const google::protobuf::Message& base) = 0;
 
@@ -49,30 +101,101 @@ void ParseMessage(google::protobuf::Message& message, std::istream& s);
 
 } // namespace details
 
+template<typename T>
+class Future;
+
+namespace details
+{
+
+template<typename T>
+class FutureAwaiter;
+
+//! Completes target future with the message returned by continuation
+template<typename R>
+struct Continuation
+{
+    typedef Future<R> Result;
+
+    template<typename Fn>
+    static void Complete(const IFuture::Ptr& target, const Fn& fn)
+    {
+        try
+        {
+            target->SetMessage(boost::make_shared<R>(fn()), IFuture::StreamPtr());
+        }
+        catch (const std::exception&)
+        {
+            target->SetException(boost::current_exception());
+        }
+    }
+};
+
+//! Continuation returned another future, target is completed with its response and stream
+template<typename R>
+struct Continuation<Future<R>>
+{
+    typedef Future<R> Result;
+
+    template<typename Fn>
+    static void Complete(const IFuture::Ptr& target, const Fn& fn)
+    {
+        try
+        {
+            fn().Async([target](const Future<R>& inner){
+                try
+                {
+                    // response stays owned by the inner future, nothing is copied
+                    const auto owner = boost::make_shared<Future<R>>(inner);
+                    const IFuture::MessagePtr response(owner, &owner->Response());
+                    target->SetMessage(response, owner->Stream());
+                }
+                catch (const std::exception&)
+                {
+                    target->SetException(boost::current_exception());
+                }
+            });
+        }
+        catch (const std::exception&)
+        {
+            target->SetException(boost::current_exception());
+        }
+    }
+};
+
+template<typename Fn, typename... Args>
+using ContinuationOf = Continuation<std::decay_t<std::result_of_t<Fn(Args...)>>>;
+
+template<typename T>
+struct WhenState
+{
+    WhenState(const std::vector<Future<T>>& futures) : m_Futures(futures), m_Pending(futures.size()), m_Done() {}
+
+    const std::vector<Future<T>> m_Futures;
+    std::atomic<std::size_t> m_Pending;
+    std::atomic<bool> m_Done;
+};
+
+} // namespace details
+
 
 template<typename T>
 class Future : public boost::enable_shared_from_this<Future<T>>
 {
     typedef boost::function<void(const Future<T>&)> UserCallbackFn;
 public:
-    Future(const IFuture::Ptr& f) : m_Future(f), m_Parsed() {}
+    Future(const IFuture::Ptr& f) : m_Future(f) {}
 
     operator const T& () const
     {
         return Response();
     }
 
+    //! Response is parsed on first access, all copies of the future share it
     const T& Response() const
     {
-        // parse message here
-        if (!m_Parsed)
-        {
-            const auto stream = m_Future->GetData();
-            if (stream)
-                details::ParseMessage(m_Message, *stream);
-            m_Parsed = true;
-        }
-        return m_Message;
+        const auto& message = m_Future->GetResponse(T::default_instance());
+        assert(dynamic_cast<const T*>(&message));
+        return static_cast<const T&>(message);
     }
 
     IFuture::StreamPtr Stream() const
@@ -104,11 +227,52 @@ public:
         });
     }
 
+    //! Continuation is called with this future once it's ready, on the thread which completed it.
+    //! Continuation returns a message or another future, returned future is completed with it.
+    //! Exception thrown by continuation, including one from Response() of failed future, is set to returned future.
+    template<typename C>
+    auto Then(const C& continuation) const
+    {
+        typedef details::ContinuationOf<C, const Future<T>&> Continuation;
+
+        const auto target = IFuture::Instance(m_Future->GetService());
+        Async([target, continuation](const Future<T>& future){
+            Continuation::Complete(target, [&](){ return continuation(future); });
+        });
+        return typename Continuation::Result(target);
+    }
+
+    //! Same as Then(continuation), but continuation is posted to executor
+    template<typename C>
+    auto Then(boost::asio::io_service& executor, const C& continuation) const
+    {
+        typedef details::ContinuationOf<C, const Future<T>&> Continuation;
+
+        const auto target = IFuture::Instance(executor);
+        Async([&executor, target, continuation](const Future<T>& future){
+            executor.post([target, continuation, future](){
+                Continuation::Complete(target, [&](){ return continuation(future); });
+            });
+        });
+        return typename Continuation::Result(target);
+    }
+
     bool IsReady() const
     {
         return m_Future->IsReady();
     }
 
+    bool Wait(const boost::posix_time::time_duration& timeout) const
+    {
+        return m_Future->Wait(timeout);
+    }
+
+    //! Cancel the call, see IFuture::Cancel
+    bool Cancel() const
+    {
+        return m_Future->Cancel();
+    }
+
 private:
     static void Callback(const IFuture::Ptr& future, const UserCallbackFn& cb)
     {
@@ -117,12 +281,68 @@ private:
     }
 
 private:
+    friend class details::FutureAwaiter<T>;
 
     IFuture::Ptr m_Future;
-    mutable T m_Message;
-    mutable bool m_Parsed;
 };
 
+//! Continuation is posted to executor with all futures once every one of them is ready.
+//! Failed futures are passed as is, their Response() throws. See Future::Then for the result.
+template<typename T, typename C>
+auto WhenAll(boost::asio::io_service& executor, const std::vector<Future<T>>& futures, const C& continuation)
+{
+    typedef details::ContinuationOf<C, const std::vector<Future<T>>&> Continuation;
+
+    const auto target = IFuture::Instance(executor);
+    const auto state = boost::make_shared<details::WhenState<T>>(futures);
+    const auto complete = [&executor, target, state, continuation](){
+        executor.post([target, state, continuation](){
+            Continuation::Complete(target, [&](){ return continuation(state->m_Futures); });
+        });
+    };
+
+    if (futures.empty())
+        complete();
+
+    for (const auto& future : futures)
+    {
+        future.Async([state, complete](const Future<T>&){
+            if (!--state->m_Pending)
+                complete();
+        });
+    }
+    return typename Continuation::Result(target);
+}
+
+//! Continuation is posted to executor with index of the first ready future and all futures.
+//! Futures completed later are ignored. See Future::Then for the result.
+template<typename T, typename C>
+auto WhenAny(boost::asio::io_service& executor, const std::vector<Future<T>>& futures, const C& continuation)
+{
+    typedef details::ContinuationOf<C, std::size_t, const std::vector<Future<T>>&> Continuation;
+
+    const auto target = IFuture::Instance(executor);
+    if (futures.empty())
+    {
+        target->SetException(boost::copy_exception(std::invalid_argument("No futures to wait for")));
+        return typename Continuation::Result(target);
+    }
+
+    const auto state = boost::make_shared<details::WhenState<T>>(futures);
+    for (std::size_t i = 0; i < futures.size(); ++i)
+    {
+        futures[i].Async([&executor, target, state, continuation, i](const Future<T>&){
+            if (state->m_Done.exchange(true))
+                return;
+
+            executor.post([target, state, continuation, i](){
+                Continuation::Complete(target, [&](){ return continuation(i, state->m_Futures); });
+            });
+        });
+    }
+    return typename Continuation::Result(target);
+}
+
 
 } // namespace rpc
 
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "Channel.h"
+
+#include <boost/shared_ptr.hpp>
+#include <boost/asio/io_service.hpp>
+
+namespace rpc
+{
+
+//! Channel to services provided in the same process, nothing is serialized.
+//! Request message is handed to the local handler added by AddHandler, response message is handed to the future,
+//! streams are passed as is. Requests are dispatched on the io_service, remote id is reported to services as caller id.
+//! Channel has no connection, it is also the sink used by responses.
+class IInProcessChannel : public ISequencedChannel
+{
+public:
+    typedef boost::shared_ptr<IInProcessChannel> Ptr;
+
+    virtual ~IInProcessChannel() {}
+
+    static Ptr Instance(boost::asio::io_service& svc);
+};
+
+} // namespace rpc
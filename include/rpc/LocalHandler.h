@@ -20,6 +20,9 @@ public:
     virtual void ProvideService(const boost::weak_ptr<IService>& svc) = 0;
     virtual void RemoveService(const boost::weak_ptr<IService>& svc) = 0;
     virtual bool HasService(const rpc::IService::Id& id) const = 0;
+
+    //! Dispatch request message which wasn't serialized, used by in-process channel
+    virtual void HandleMessage(const gp::Message& base, const MessagePtr& request, const IStream& stream, const rpc::ISequencedChannel::Ptr& channel) = 0;
     
     //! Instance
     static Ptr Instance(boost::asio::io_service& svc);
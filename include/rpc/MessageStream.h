@@ -0,0 +1,130 @@
+#pragma once
+
+#include "rpc/ChunkedStream.h"
+#include "rpc/Exceptions.h"
+
+#include <string>
+#include <utility>
+
+#include <boost/function.hpp>
+#include <boost/make_shared.hpp>
+
+namespace rpc
+{
+
+//! Writes typed messages of a call marked with option(Messages), each message is sent as a separate chunk.
+//! At most window messages are sent until the reader handles them, the rest wait in the writer.
+template<typename T>
+class MessageWriter
+{
+public:
+    enum { DEFAULT_WINDOW = 64 };
+
+    explicit MessageWriter(std::size_t window = DEFAULT_WINDOW)
+        : m_Stream(ChunkedStream::Instance())
+    {
+        m_Stream->SetWindow(window);
+    }
+
+    //!\return false if messages waiting for credit reached the limit, writer should wait for WhenWritable
+    bool Write(const T& message) const
+    {
+        // message is serialized right into the buffer of the chunk
+        std::string data;
+        if (!message.SerializeToString(&data))
+            BOOST_THROW_EXCEPTION(Exception("Failed to serialize message of the stream: %s", message.GetTypeName()));
+
+        return m_Stream->Write(std::move(data));
+    }
+
+    //! Invoke callback once there is room for more messages, see ChunkedStream::WhenWritable
+    void WhenWritable(const ChunkedStream::WritableFn& callback) const
+    {
+        m_Stream->WhenWritable(callback);
+    }
+
+    //! End the stream, reader gets the exception if it's set
+    void Close(const boost::exception_ptr& e = boost::exception_ptr()) const
+    {
+        m_Stream->Close(e);
+    }
+
+    //! Messages waiting for credit of the reader, producer should slow down when it grows
+    std::size_t GetQueued() const
+    {
+        return m_Stream->GetQueued();
+    }
+
+    //! Stream passed to the stub or to the response
+    const ChunkedStream::Ptr& Stream() const
+    {
+        return m_Stream;
+    }
+
+private:
+    ChunkedStream::Ptr m_Stream;
+};
+
+//! Reads typed messages of a call marked with option(Messages) as they arrive.
+//! Credit is returned to the writer in batches once messages are handled, batch must be smaller than window of the writer.
+template<typename T>
+class MessageReader
+{
+public:
+    enum { DEFAULT_BATCH = 16 };
+
+    typedef boost::function<void(const T& message)> MessageFn;
+    typedef boost::function<void(const boost::exception_ptr& e)> EndFn;
+
+    explicit MessageReader(const IStream& stream, std::size_t batch = DEFAULT_BATCH)
+        : m_Stream(ChunkedStream::Cast(stream))
+        , m_Batch(batch)
+    {
+        if (!m_Stream)
+            BOOST_THROW_EXCEPTION(Exception("Stream doesn't carry messages"));
+    }
+
+    //! Invoke callback for each message and end callback once writer closes the stream.
+    //! Message which can't be parsed closes the stream and ends it with the parse error, the rest of chunks is dropped.
+    void Read(const MessageFn& onMessage, const EndFn& onEnd) const
+    {
+        // callback is kept by the stream, so the stream outlives each invocation
+        ChunkedStream* const stream = m_Stream.get();
+        const auto isFailed = boost::make_shared<bool>(false);
+
+        m_Stream->SetAutoGrant(m_Batch);
+        m_Stream->Read([stream, isFailed, onMessage, onEnd](const IStream& chunk, const boost::exception_ptr& e){
+            if (*isFailed)
+                return;
+
+            if (!chunk)
+            {
+                onEnd(e);
+                return;
+            }
+
+            T message;
+            try
+            {
+                if (!message.ParseFromIstream(chunk.get()))
+                    BOOST_THROW_EXCEPTION(Exception("Failed to parse message of the stream: %s", message.GetTypeName()));
+            }
+            catch (const std::exception&)
+            {
+                *isFailed = true;
+                const auto error = boost::current_exception();
+                stream->Close(error);
+                onEnd(error);
+                return;
+            }
+
+            onMessage(message);
+        });
+    }
+
+private:
+    ChunkedStream::Ptr m_Stream;
+    std::size_t m_Batch;
+};
+
+} // namespace rpc
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <exception>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/lockfree/stack.hpp>
+#include <boost/pool/pool_alloc.hpp>
+
+namespace rpc
+{
+namespace details
+{
+
+//! Pool of request and response wrappers used by generated services.
+//! Object is recycled when the last reference drops, shared pointer control blocks
+//! are allocated from the pool too, so steady state dispatch doesn't touch the heap.
+template<typename T>
+class ObjectPool : boost::noncopyable
+{
+public:
+    enum { CAPACITY = 1024 };
+
+    typedef boost::shared_ptr<T> Ptr;
+
+    static ObjectPool& Instance()
+    {
+        // never destroyed, objects may be returned during static destruction
+        static ObjectPool* instance = new ObjectPool();
+        return *instance;
+    }
+
+    Ptr Acquire()
+    {
+        T* object = nullptr;
+        if (!m_Free.pop(object))
+            object = new T();
+        return Ptr(object, Recycler(*this), Allocator());
+    }
+
+private:
+    typedef boost::fast_pool_allocator<T> Allocator;
+
+    struct Recycler
+    {
+        Recycler(ObjectPool& pool) : m_Pool(&pool) {}
+        void operator () (T* object) const
+        {
+            m_Pool->Release(object);
+        }
+        ObjectPool* m_Pool;
+    };
+
+    ObjectPool() {}
+
+    void Release(T* object)
+    {
+        try
+        {
+            object->Recycle();
+        }
+        catch (const std::exception&)
+        {
+            delete object;
+            return;
+        }
+
+        if (!m_Free.bounded_push(object))
+            delete object;
+    }
+
+private:
+    boost::lockfree::stack<T*, boost::lockfree::capacity<CAPACITY>> m_Free;
+};
+
+} // namespace details
+} // namespace rpc
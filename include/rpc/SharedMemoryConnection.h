@@ -0,0 +1,34 @@
+#pragma once
+
+#include "net/connection.hpp"
+
+#include <string>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/asio/io_service.hpp>
+
+namespace rpc
+{
+
+//! Same host transport over a named shared memory segment with one ring buffer per direction.
+//! Every prepared block is a record in the ring, packets are serialized directly into the ring memory
+//! and received streams point to the ring until they are destroyed. Records of a batch are reserved at once.
+//! Reader is started by Receive, callback is invoked on the io_service with empty stream once peer closes,
+//! process of the peer exits without closing or a record which doesn't fit the published data is read.
+class ISharedMemoryConnection : public net::IConnection
+{
+public:
+    typedef boost::shared_ptr<ISharedMemoryConnection> Ptr;
+
+    enum { DEFAULT_RING_SIZE = 4 * 1024 * 1024 };
+
+    virtual ~ISharedMemoryConnection() {}
+
+    //! Create segment, stale segment with the same name is removed. Segment is removed when connection is destroyed.
+    static Ptr Create(boost::asio::io_service& svc, const std::string& name, std::size_t ringSize = DEFAULT_RING_SIZE);
+
+    //! Open segment created by another process
+    static Ptr Open(boost::asio::io_service& svc, const std::string& name);
+};
+
+} // namespace rpc
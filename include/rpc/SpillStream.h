@@ -0,0 +1,66 @@
+#pragma once
+
+#include "rpc/Base.h"
+#include "rpc/ChunkedStream.h"
+
+#include <fstream>
+#include <string>
+
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/exception_ptr.hpp>
+
+namespace rpc
+{
+
+//! Collects received stream data, once it grows past threshold data is spilled into temporary file which is read as FileStream.
+//! Resident memory stays bounded while reader still gets random access to the whole stream.
+class SpillStream : boost::noncopyable
+{
+public:
+    struct Settings
+    {
+        Settings() : m_Threshold() {}
+
+        boost::uint64_t m_Threshold;    //!< bytes kept in memory, zero disables spilling
+        std::string m_Directory;        //!< directory of temporary files, system one if empty
+    };
+
+    //! Whole data once the stream ends, empty stream and exception if producer failed
+    typedef boost::function<void(const IStream& stream, const boost::exception_ptr& e)> Callback;
+
+    explicit SpillStream(const Settings& settings);
+    ~SpillStream();
+
+    void Write(const char* data, std::size_t size);
+
+    //! Append the rest of the stream
+    void Write(std::istream& stream);
+
+    boost::uint64_t GetSize() const;
+    bool IsSpilled() const;
+
+    //! Collected data: string stream or FileStream of temporary file which is removed with the stream, nothing may be written after it
+    IStream Finish();
+
+    //! Rest of the stream, it's moved into temporary file if it's larger than threshold.
+    //! Chunked and file streams are returned as is. Channels don't spill received packets, they are in memory already.
+    static IStream Spill(const IStream& stream, const Settings& settings);
+
+    //! Collect the rest of the stream head and all chunks of the stream, credit is returned to the producer as chunks are written.
+    //! Chunks are written by the thread which delivers them, so each write is bounded by size of the chunk.
+    static void Collect(const ChunkedStream::Ptr& stream, const Settings& settings, const Callback& callback);
+
+private:
+    void Open();
+
+private:
+    const Settings m_Settings;
+    std::string m_Memory;
+    std::string m_Path;
+    std::ofstream m_File;
+    boost::uint64_t m_Size;
+};
+
+} // namespace rpc
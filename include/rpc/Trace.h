@@ -0,0 +1,91 @@
+#pragma once
+
+#include "log/log.h"
+
+#include <atomic>
+#include <ostream>
+
+#include <google/protobuf/message.h>
+
+#include <boost/cstdint.hpp>
+
+//! Per packet logging of rpc library.
+//! Packets are logged at the given level of the logger, as with plain LOG_ macros. Level set by SetLevel
+//! mirrors the logger configuration: trace points below it are dropped before the logger is called,
+//! as are packets filtered by sampling and off modes, so skipped packets cost two relaxed loads.
+//! Packet dumps are passed as trace::Dump and formatted only when the logger writes the record.
+//! Define RPC_DISABLE_PACKET_TRACE to remove packet logging at compile time.
+
+namespace rpc
+{
+namespace trace
+{
+
+enum Mode
+{
+    TRACE_OFF,      //!< packets are not logged
+    TRACE_SAMPLED,  //!< packets with id divisible by sample rate are logged, both sides log the same calls
+    TRACE_ALL       //!< every packet is passed to the logger, default
+};
+
+//! Most verbose level written by the logger
+enum Level
+{
+    LEVEL_TRACE,    //!< every trace point reaches the logger, default
+    LEVEL_DEBUG,    //!< packets traced at debug level reach the logger
+    LEVEL_INFO      //!< packet trace points never reach the logger
+};
+
+//! Set packet trace mode, sample rate is used by sampled mode only
+void SetMode(Mode mode, boost::uint32_t sampleRate = 1000);
+Mode GetMode();
+
+//! Logger level isn't queried by trace points, application sets it here whenever it configures the logger
+void SetLevel(Level level);
+Level GetLevel();
+
+//! Packet dump which is formatted when it's written to the log, not when the trace point is reached.
+//! Dump refers to the message, so the logger must format the record before the trace point returns:
+//! logger which formats records on another thread gets a dangling reference, it must not be used with packet trace.
+class Dump
+{
+public:
+    explicit Dump(const google::protobuf::Message& message) : m_Message(message) {}
+
+    friend std::ostream& operator << (std::ostream& stream, const Dump& dump)
+    {
+        return stream << dump.m_Message.ShortDebugString();
+    }
+
+private:
+    const google::protobuf::Message& m_Message;
+};
+
+namespace details
+{
+
+//! Zero disables trace, one traces every packet
+extern std::atomic<boost::uint32_t> g_SampleRate;
+
+extern std::atomic<int> g_Level;
+
+inline bool IsEnabled(Level level)
+{
+    return level >= g_Level.load(std::memory_order_relaxed);
+}
+
+inline bool IsTraced(boost::uint32_t packetId)
+{
+    const auto rate = g_SampleRate.load(std::memory_order_relaxed);
+    return rate && (rate == 1 || packetId % rate == 0);
+}
+
+} // namespace details
+} // namespace trace
+} // namespace rpc
+
+#ifdef RPC_DISABLE_PACKET_TRACE
+#define RPC_TRACE_PACKET(level, packetId, ...) do {} while (false)
+#else
+#define RPC_TRACE_PACKET(level, packetId, ...) do { if (::rpc::trace::details::IsEnabled(::rpc::trace::LEVEL_##level) && ::rpc::trace::details::IsTraced(packetId)) LOG_##level(__VA_ARGS__); } while (false)
+#endif
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "rpc/Base.h"
+#include "net/connection.hpp"
+
+#include <vector>
+#include <deque>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace rpc
+{
+namespace details
+{
+
+//! Collects packets written while another write is in flight and writes them back to back.
+//! Packet written while nothing is in flight goes to the connection directly, without copying.
+//! Batched packet is serialized once into a single buffer and keeps its own framing:
+//! connection gets one prepared block per block of the original write. Connection which implements
+//! IBatchConnection prepares all blocks of the batch in a single call, others get them one by one.
+class WriteCoalescer : public boost::enable_shared_from_this<WriteCoalescer>, boost::noncopyable
+{
+public:
+    typedef boost::shared_ptr<WriteCoalescer> Ptr;
+
+    struct Settings
+    {
+        Settings() : m_MaxBatchBytes(), m_MaxDelay(boost::posix_time::milliseconds(0)) {}
+
+        std::size_t m_MaxBatchBytes;                    //!< batch is flushed once it reaches this size, zero disables coalescing
+        boost::posix_time::time_duration m_MaxDelay;    //!< max time packet may wait for a batch, zero means flush as soon as writer is idle
+    };
+
+    enum FlushReason
+    {
+        FLUSH_IDLE,         //!< nothing was in flight, packet written immediately without batching
+        FLUSH_IN_FLIGHT,    //!< packets collected while previous write was in flight
+        FLUSH_SIZE,         //!< batch size limit reached
+        FLUSH_DELAY,        //!< max delay expired
+        FLUSH_BYPASS,       //!< packet too large to be batched, pending batch written before it
+        FLUSH_CLOSE,        //!< channel closed or coalescing disabled
+        FLUSH_REASONS_COUNT
+    };
+
+    struct Stats
+    {
+        Stats() : m_Batches(), m_Writes(), m_Packets(), m_Bytes(), m_MaxBatchPackets(), m_Flushes() {}
+
+        boost::uint64_t m_Batches;
+        boost::uint64_t m_Writes;       //!< calls which prepared data on the connection
+        boost::uint64_t m_Packets;
+        boost::uint64_t m_Bytes;
+        boost::uint64_t m_MaxBatchPackets;
+        boost::uint64_t m_Flushes[FLUSH_REASONS_COUNT];
+    };
+
+    WriteCoalescer(boost::asio::io_service& svc, const Settings& settings);
+
+    //! Write packet to the connection, packet may be delayed until batch is flushed
+    void Write(const net::IConnection::Ptr& connection, const gp::Message& base, const gp::Message* request, const IStream& stream);
+
+    //! Write all pending packets
+    void Flush(FlushReason reason);
+
+    Stats GetStats() const;
+
+private:
+
+    //! Serialized packet, frames are sizes of prepared data blocks of the original write
+    struct Packet
+    {
+        net::IConnection::Ptr m_Connection;
+        std::vector<char> m_Data;
+        std::vector<std::size_t> m_Frames;
+    };
+
+    typedef std::deque<Packet> Batch;
+
+    //! Write pending batches, caller must be the active writer.
+    //! Unless forced, packets collected during the write wait for the timer if delay is set.
+    void Drain(boost::unique_lock<boost::mutex>& lock, FlushReason reason, bool force);
+    void ScheduleFlush();
+    void OnTimer(const boost::system::error_code& e);
+    void CountBatch(FlushReason reason, std::size_t packets, std::size_t bytes, std::size_t writes);
+
+    static std::size_t PacketSize(const gp::Message& base, const gp::Message* request, boost::uint64_t streamSize);
+
+    //! Write packets of the batch, returns number of calls which prepared data on connections
+    static std::size_t WriteBatch(Batch& batch);
+    static void WritePacket(const Packet& packet);
+
+private:
+    const Settings m_Settings;
+    boost::asio::deadline_timer m_Timer;
+
+    mutable boost::mutex m_Mutex;
+    boost::condition_variable m_WriterReleased;
+    Batch m_Batch;
+    std::size_t m_BatchBytes;
+    bool m_IsWriting;
+    bool m_IsTimerActive;
+    Stats m_Stats;
+};
+
+} // namespace details
+} // namespace rpc
@@ -1,10 +1,14 @@
 #include "rpc/Channel.h"
 #include "rpc/Exceptions.h"
+#include "rpc/Deadline.h"
 #include "conversion/cast.hpp"
 #include "Stream.h"
 #include "net/sequence.hpp"
+#include "rpc/Trace.h"
 #include "log/log.h"
 #include "ChannelSink.h"
+#include "TimeoutWheel.h"
+#include "PacketIdGenerator.h"
 
 #include "rpc_base.pb.h"
 
@@ -42,7 +46,6 @@ public:
 
     SequencedChannel(boost::asio::io_service& svc)
         : m_Service(svc)
-        , m_PacketCounter()
     {
     }
 
@@ -67,7 +70,7 @@ protected:
 
     IFuture::Ptr CallMethodImpl(const proto::BasePacket& base, const gp::Message* request, const IStream& stream)
     {
-        LOG_DEBUG("->[%s]: Pushing packet: %s", m_RemoteId, base.ShortDebugString());
+        RPC_TRACE_PACKET(DEBUG, base.packetid(), "->[%s]: Pushing packet: %s", m_RemoteId, trace::Dump(base));
         if (request && !request->IsInitialized())
             BOOST_THROW_EXCEPTION(Exception("Can't call method because request is not initialized: base: %s, request: %s, errors: %s", base.ShortDebugString(), request->ShortDebugString(), request->InitializationErrorString()));
 
@@ -82,6 +85,18 @@ protected:
         // make base request packet
         proto::BasePacket base;
 
+        try
+        {
+            base.set_timeout(m_Sink->GetCallTimeout());
+        }
+        catch (const TimeoutException&)
+        {
+            // deadline of the caller is over, call is failed without being sent
+            const auto future = IFuture::Instance(m_Service);
+            future->SetException(boost::current_exception());
+            return future;
+        }
+
         {
             base.set_method(method);
             base.set_serviceid(service);
@@ -102,29 +117,56 @@ protected:
 
     boost::uint32_t GetNextPacketId() const
     {
-        boost::unique_lock<boost::mutex> lock(m_PacketIdMutex);
-        while (m_PacketCounter++ == 0); // ensure the packet id is not equal to zero
-        return m_PacketCounter;
+        // skip ids of requests which are still waiting for response after counter wraparound
+        const auto& sink = *m_Sink;
+        return m_PacketIds.Next([&sink](boost::uint32_t id){ return sink.IsPending(id); });
     }
 
 private:
 
-    void HandleRequest(proto::BasePacket& basePacket, const IStream& stream)
+    void HandleRequest(proto::BasePacket& basePacket, const IStream& stream, const CallDeadline::Clock::time_point& received)
     {
         try
         {
-            LOG_DEBUG("<-[%s]: Handling request: [%s]", m_RemoteId, basePacket.ShortDebugString());
+            RPC_TRACE_PACKET(DEBUG, basePacket.packetid(), "<-[%s]: Handling request: [%s]", m_RemoteId, trace::Dump(basePacket));
+
+            // time spent since the packet was received counts against the budget of the call
+            const auto budget = details::TimeoutWheel::GetBudget(basePacket.timeout(), received);
+            const CallDeadline deadline(budget);
+
+            // expired and rejected calls are dropped before the payload is decompressed
+            if (!budget.is_pos_infinity() && budget <= boost::posix_time::time_duration())
+                BOOST_THROW_EXCEPTION(TimeoutException("Request dropped, deadline of the caller expired: %s", basePacket.ShortDebugString()));
+
+            // peer may not have more calls in flight than this side granted, request is counted on its raw size without the size prefix
+            const bool isCompressed = basePacket.compression() != proto::NoCompression;
+            const boost::uint64_t wireSize = net::StreamSize(*stream);
+            const boost::uint64_t size = isCompressed ? basePacket.rawsize() : wireSize > sizeof(boost::uint32_t) ? wireSize - sizeof(boost::uint32_t) : 0;
+            if (basePacket.packetid() && !m_Sink->AdmitIncoming(basePacket.packetid(), size))
+                BOOST_THROW_EXCEPTION(OverloadException("Call exceeds credit granted to the caller: %s", basePacket.ShortDebugString()));
+
+            IStream payload = stream;
+            if (isCompressed)
+            {
+                payload = m_Sink->Decompress(basePacket, *stream);
+
+                // base packet is reused for the response, which is compressed by its own settings
+                basePacket.clear_compression();
+                basePacket.clear_rawsize();
+            }
 
             if (basePacket.callerid().empty() && !m_RemoteId.empty())
                 basePacket.set_callerid(m_RemoteId);
 
-            HandleRawRequestData(basePacket, stream);
+            HandleRawRequestData(basePacket, payload);
         }
         catch (const std::exception& e)
         {
             LOG_ERROR("Failed to process request: %s", boost::diagnostic_information(e));
 
         	// send error response
+            basePacket.clear_compression();
+            basePacket.clear_rawsize();
             basePacket.set_direction(proto::BasePacket::Response);
             basePacket.set_error(conv::cast<std::string>(boost::diagnostic_information(e)));
 
@@ -137,13 +179,34 @@ private:
         if (!basePacket.packetid())
             return;
 
-        LOG_DEBUG("<-[%s]: Handling response: [%s]", m_RemoteId, basePacket.ShortDebugString());
+        RPC_TRACE_PACKET(DEBUG, basePacket.packetid(), "<-[%s]: Handling response: [%s]", m_RemoteId, trace::Dump(basePacket));
 
         m_Sink->Pop(basePacket, stream);
     }
 
+    void HandleCancel(const proto::BasePacket& basePacket)
+    {
+        RPC_TRACE_PACKET(DEBUG, basePacket.packetid(), "<-[%s]: Handling cancel: [%s]", m_RemoteId, trace::Dump(basePacket));
+
+        m_Sink->CancelIncoming(basePacket.packetid());
+    }
+
+    void HandleChunk(const proto::BasePacket& basePacket, const IStream& stream)
+    {
+        try
+        {
+            m_Sink->PopChunk(basePacket, stream);
+        }
+        catch (const std::exception& e)
+        {
+            LOG_ERROR("Failed to process chunk: %s, error: %s", basePacket.ShortDebugString(), boost::diagnostic_information(e));
+        }
+    }
+
     void HandleBasePacket(const IStream& stream)
     {
+        const auto received = CallDeadline::Clock::now();
+
         proto::BasePacket basePacket;
         try
         {
@@ -155,11 +218,51 @@ private:
             return;
         }
 
+        // request is admitted before its payload is decompressed
         if (basePacket.direction() == proto::BasePacket::Request)
-            HandleRequest(basePacket, stream);
-        else
+        {
+            HandleRequest(basePacket, stream, received);
+            return;
+        }
+
+        IStream payload = stream;
+        if (basePacket.compression() != proto::NoCompression)
+        {
+            try
+            {
+                payload = m_Sink->Decompress(basePacket, *stream);
+            }
+            catch (const std::exception& e)
+            {
+                LOG_ERROR("Failed to decompress packet: %s, error: %s", basePacket.ShortDebugString(), boost::diagnostic_information(e));
+                FailCompressed(basePacket, e);
+                return;
+            }
+            basePacket.clear_compression();
+        }
+
         if (basePacket.direction() == proto::BasePacket::Response)
-            HandleResponse(basePacket, stream);
+            HandleResponse(basePacket, payload);
+        else
+        if (basePacket.direction() == proto::BasePacket::Cancel)
+            HandleCancel(basePacket);
+        else
+        if (basePacket.direction() == proto::BasePacket::Credit)
+            m_Sink->GrantCredit(basePacket.creditcalls(), basePacket.creditbytes());
+        else
+        if (basePacket.direction() >= proto::BasePacket::RequestChunk && basePacket.direction() <= proto::BasePacket::ResponseCredit)
+            HandleChunk(basePacket, payload);
+    }
+
+    //! Call waiting for the response fails, requests which fail to decompress get error response in HandleRequest
+    void FailCompressed(proto::BasePacket& basePacket, const std::exception& e)
+    {
+        if (!basePacket.packetid() || basePacket.direction() != proto::BasePacket::Response)
+            return;
+
+        basePacket.clear_compression();
+        basePacket.set_error(conv::cast<std::string>(boost::diagnostic_information(e)));
+        HandleResponse(basePacket, IStream());
     }
 
     void HandleRawRequestData(proto::BasePacket& basePacket, const IStream& stream)
@@ -209,6 +312,31 @@ private:
         m_Sink->SetConnection(connection);
     }
 
+    virtual void SetCompression(const details::Compression::Settings& settings) override
+    {
+        m_Sink->SetCompression(settings);
+    }
+
+    virtual void SetFlowControl(const details::FlowControl::Settings& settings) override
+    {
+        m_Sink->SetFlowControl(settings);
+    }
+
+    virtual void SetSpill(const SpillStream::Settings& settings) override
+    {
+        m_Sink->SetSpill(settings);
+    }
+
+    virtual void SetCallTimeout(const boost::posix_time::time_duration& timeout) override
+    {
+        m_Sink->SetCallTimeout(timeout);
+    }
+
+    virtual void SetCoalescing(const details::WriteCoalescer::Settings& settings) override
+    {
+        m_Sink->SetCoalescing(settings);
+    }
+
 protected:
     boost::asio::io_service& m_Service;
     details::IChannelSink::Ptr m_Sink;
@@ -216,8 +344,7 @@ private:
     Handlers m_RequestHandlers;
     mutable boost::recursive_mutex m_Mutex;
     InstanceId m_RemoteId;
-    mutable std::atomic<boost::uint32_t> m_PacketCounter;
-    mutable boost::mutex m_PacketIdMutex;
+    mutable details::PacketIdGenerator m_PacketIds;
 };
 
 #pragma warning(push)
@@ -1,9 +1,13 @@
 #include "ChannelSink.h"
 #include "rpc/Exceptions.h"
+#include "rpc/Trace.h"
 #include "log/log.h"
 
 #include "Stream.h"
+#include "PendingRequests.h"
+#include "TimeoutWheel.h"
 
+#include <algorithm>
 #include <atomic>
 
 #include <boost/make_shared.hpp>
@@ -25,19 +29,16 @@ SET_LOGGING_MODULE("Rpc");
 
 class ChannelSink : public IChannelSink, public boost::enable_shared_from_this<ChannelSink>
 {
-    struct FutureResponse
-    {
-        FutureResponse()  {}
-        IFuture::Ptr m_Future;
-    };
-
-    typedef std::map<boost::uint32_t, FutureResponse> PacketMap;
     typedef std::deque<details::IRequestHandler::Ptr> Handlers;
+    typedef boost::shared_ptr<boost::weak_ptr<ChunkedStream>> WeakStream;
 
 public:
     ChannelSink(boost::asio::io_service& svc, const boost::weak_ptr<rpc::details::IChannel>& channel)
-        : m_Service(svc)
-        , m_Channel(channel)
+        : m_Channel(channel)
+        , m_Service(svc)
+        , m_CallTimeoutMs(0)
+        , m_Flow(boost::bind(&ChannelSink::WriteMessage, this, _1, _2, _3))
+        , m_MaxDecompressedBytes(Compression::DEFAULT_MAX_DECOMPRESSED_BYTES)
     {
     }
 
@@ -47,51 +48,103 @@ public:
 
     virtual IFuture::Ptr Push(const proto::BasePacket& base, const gp::Message* request, const IStream& stream) override
     {
-        FutureResponse packet;
+        IFuture::Ptr future;
         if (base.packetid() && base.direction() == proto::BasePacket::Request)
         {
-            boost::unique_lock<boost::recursive_mutex> lock(m_Mutex);
-            packet.m_Future = IFuture::Instance(m_Service);
-            if (!m_OutgoingRequests.insert(std::make_pair(base.packetid(), packet)).second)
+            future = IFuture::Instance(m_Service);
+            if (!m_OutgoingRequests.Insert(base.packetid(), future))
                 BOOST_THROW_EXCEPTION(Exception("Duplicated packet id: %s", base.ShortDebugString()));
+
+            if (base.timeout())
+                GetTimeouts()->Add(base.packetid(), future, boost::posix_time::milliseconds(base.timeout()));
+
+            const boost::weak_ptr<ChannelSink> weak = shared_from_this();
+            const auto id = base.packetid();
+            future->SetCancel([weak, id](const IFuture::Ptr& future){
+                const auto sink = weak.lock();
+                return sink && sink->Cancel(id, future);
+            });
+
+            // request isn't owned, flow control copies it if call has to wait for credit
+            if (!m_Flow.Send(future, base, MessagePtr(MessagePtr(), const_cast<gp::Message*>(request)), stream))
+                Reject(id, future);
+
+            return future;
+        }
+
+        if (base.packetid() && base.direction() == proto::BasePacket::Response)
+        {
+            m_IncomingRequests.Remove(base.packetid());
+            m_Flow.ReleaseIncoming(base.packetid());
         }
 
         Write(base, request, stream);
-        return packet.m_Future;
+        return future;
     }
 
-    virtual void Pop(const proto::BasePacket& base, const IStream& stream) override
+    virtual IFuture::Ptr PushMovable(const proto::BasePacket& base, gp::Message* message, const IStream& stream) override
     {
-        boost::for_each(m_Handlers, boost::bind(&details::IRequestHandler::HandleResponse, _1, boost::ref(base), GetRemoteId()));
-
-        FutureResponse future;
+        return Push(base, message, stream);
+    }
 
+    virtual void Pop(const proto::BasePacket& base, const IStream& stream) override
+    {
+        if (!m_Handlers.empty())
         {
-            boost::unique_lock<boost::recursive_mutex> lock(m_Mutex);
-            const auto it = m_OutgoingRequests.find(base.packetid());
-            if (it == m_OutgoingRequests.end())
-            {
-                LOG_ERROR("<-[%s] Unknown packet id: %s", GetRemoteId(), base.DebugString());
-                return;
-            }
+            const auto remoteId = GetRemoteId();
+            for (const auto& handler : m_Handlers)
+                handler->HandleResponse(base, remoteId);
+        }
 
-            future = it->second;
-            m_OutgoingRequests.erase(it);
+        const auto future = m_OutgoingRequests.Remove(base.packetid());
+        if (!future)
+        {
+            // late response of expired call is expected
+            LOG_WARNING("<-[%s] Unknown or timed out packet id: %s", GetRemoteId(), base.ShortDebugString());
+            return;
         }
 
-        future.m_Future->SetBase(base);
+        m_Flow.Release(base.packetid());
+        ForgetTimeout(base.packetid());
+
+        future->SetBase(base);
 
         if (!base.error().empty() || base.errorid())
-            future.m_Future->SetException(MakeException(base));
+            future->SetException(MakeException(base));
+        else
+        if (base.chunked())
+            SetChunks(future, OpenChunks(base, stream));
         else
-            future.m_Future->SetData(stream);
+            future->SetData(stream);
+    }
+
+    //! Caller gets the whole stream once it ends if spilling is enabled, chunks as they arrive otherwise
+    void SetChunks(const IFuture::Ptr& future, const ChunkedStream::Ptr& chunks)
+    {
+        const auto settings = boost::atomic_load(&m_Spill);
+        if (!settings || !settings->m_Threshold)
+        {
+            future->SetData(chunks);
+            return;
+        }
+
+        SpillStream::Collect(chunks, *settings, [future](const IStream& stream, const boost::exception_ptr& e){
+            if (e)
+                future->SetException(e);
+            else
+                future->SetData(stream);
+        });
+    }
+
+    virtual bool IsPending(boost::uint32_t packetId) const override
+    {
+        return m_OutgoingRequests.Contains(packetId);
     }
 
     virtual void SetConnection(const net::IConnection::Ptr& connection) override
     {
         boost::unique_lock<boost::recursive_mutex> lock(m_Mutex);
-        const auto previous = m_Connection;
-        m_Connection = connection;
+        const auto previous = boost::atomic_exchange(&m_Connection, connection);
         if (connection)
         {
             m_Exception = boost::exception_ptr();
@@ -102,48 +155,107 @@ public:
                 previous->Receive([](const net::IConnection::StreamPtr& s){}); // ignore everything from the old connection
                 previous->Close();
             }
+
+            // peer of the new connection doesn't know our limits yet
+            if (m_FlowSettings.m_MaxCalls || m_FlowSettings.m_MaxBytes)
+                WriteCredit();
         }
     }
 
+    void WriteMessage(const proto::BasePacket& base, const MessagePtr& request, const IStream& stream)
+    {
+        Write(base, request.get(), stream);
+    }
+
     void Write(const proto::BasePacket& base, const gp::Message* request, const IStream& stream)
     {
-        boost::unique_lock<boost::recursive_mutex> lock(m_Mutex);
-        const auto connection = m_Connection;
-        if (m_Exception || !connection)
+        if (const auto chunked = ChunkedStream::Cast(stream))
+        {
+            WriteChunked(base, request, chunked);
+            return;
+        }
+
+        // connection is reset on close, so there is no need to lock the sink here
+        const auto connection = boost::atomic_load(&m_Connection);
+        if (!connection)
         {
-            LOG_WARNING("->[%s] Channel has been closed, exception: %s, connection: %s", GetRemoteId(), (m_Exception ? "yes" : "no"), (connection ? "yes" : "no"));
+            LOG_WARNING("->[%s] Channel has been closed, exception: %s", GetRemoteId(), (GetException() ? "yes" : "no"));
             return;
         }
 
         const auto wrapped = m_WrapConnection ? m_WrapConnection(connection) : connection;
-        lock.unlock();
 
-        LOG_TRACE("->[%s] Writing packet: %s", GetRemoteId(), base.ShortDebugString());
+        RPC_TRACE_PACKET(TRACE, base.packetid(), "->[%s] Writing packet: %s", GetRemoteId(), trace::Dump(base));
 
-        details::WriteStream writer(wrapped);
+        if (const auto compression = boost::atomic_load(&m_Compression))
+        {
+            const auto codec = compression->Select(base, request, stream);
+            if (codec != proto::NoCompression)
+            {
+                // same size as the one the call is counted on by flow control, stream is consumed by compression
+                const boost::uint64_t rawSize = (request ? request->ByteSize() : 0) + (stream ? net::StreamSize(*stream) : 0);
+                if (const auto payload = compression->Compress(codec, request, stream))
+                {
+                    proto::BasePacket compressed(base);
+                    compressed.set_compression(codec);
+                    compressed.set_rawsize(rawSize);
+                    Write(wrapped, compressed, nullptr, payload);
+                    return;
+                }
+            }
+        }
+
+        Write(wrapped, base, request, stream);
+    }
+
+    void Write(const net::IConnection::Ptr& connection, const proto::BasePacket& base, const gp::Message* request, const IStream& stream)
+    {
+        if (const auto coalescer = boost::atomic_load(&m_Coalescer))
+        {
+            coalescer->Write(connection, base, request, stream);
+            return;
+        }
+
+        details::WriteStream writer(connection);
         writer.Write(base, request, stream);
     }
 
     virtual void Close(const boost::exception_ptr& e) override
     {
         boost::unique_lock<boost::recursive_mutex> lock(m_Mutex);
-        if (m_Connection)
-            m_Connection->Close();
-        m_Connection.reset();
+        if (const auto coalescer = boost::atomic_load(&m_Coalescer))
+            coalescer->Flush(WriteCoalescer::FLUSH_CLOSE);
+        if (const auto connection = boost::atomic_exchange(&m_Connection, net::IConnection::Ptr()))
+            connection->Close();
         if (!m_Exception)
             m_Exception = e;
 
-        if (!m_OutgoingRequests.empty())
-        {
-            PacketMap responses;
-            responses.swap(m_OutgoingRequests);
-            lock.unlock();
+        const auto responses = m_OutgoingRequests.RemoveAll();
+        const auto requestStreams = m_RequestStreams.RemoveAll();
+        const auto responseStreams = m_ResponseStreams.RemoveAll();
+        m_RequestWriters.RemoveAll();
+        m_ResponseWriters.RemoveAll();
+        if (const auto timeouts = boost::atomic_load(&m_Timeouts))
+            timeouts->Clear();
+        m_Flow.Reset();
+        lock.unlock();
+
+        // nobody is going to receive responses of requests in progress
+        for (const auto& request : m_IncomingRequests.RemoveAll())
+            request->MarkCancelled();
 
-            const auto exception = e ? e : rpc::MakeException("Channel closed by local side");
-            boost::for_each(responses, [&exception](const PacketMap::value_type& pair){
+        const auto exception = e ? e : rpc::MakeException("Channel closed by local side");
+        for (const auto& stream : requestStreams)
+            stream->Close(exception);
+        for (const auto& stream : responseStreams)
+            stream->Close(exception);
+
+        if (!responses.empty())
+        {
+            boost::for_each(responses, [&exception](const IFuture::Ptr& future){
                 try
                 {
-                    pair.second.m_Future->SetException(exception);
+                    future->SetException(exception);
                 }
                 catch (const std::exception&)
                 {
@@ -152,6 +264,120 @@ public:
         }
     }
 
+    virtual void AddIncoming(boost::uint32_t packetId, const boost::shared_ptr<RequestAndInfoHolder>& request) override
+    {
+        if (m_IncomingRequests.Insert(packetId, request))
+            return;
+
+        LOG_WARNING("<-[%s] Duplicated incoming packet id: %s", GetRemoteId(), packetId);
+        m_IncomingRequests.Remove(packetId);
+        m_IncomingRequests.Insert(packetId, request);
+    }
+
+    virtual void CancelIncoming(boost::uint32_t packetId) override
+    {
+        // caller has returned credit of the call already
+        m_Flow.ReleaseIncoming(packetId);
+
+        if (const auto request = m_IncomingRequests.Remove(packetId))
+            request->MarkCancelled();
+        if (const auto stream = m_RequestStreams.Remove(packetId))
+        {
+            stream->SetCancel(ChunkedStream::CancelFn());
+            stream->Close(MakeException("Call cancelled by the caller"));
+        }
+    }
+
+    virtual bool AdmitIncoming(boost::uint32_t packetId, boost::uint64_t size) override
+    {
+        if (m_Flow.Admit(packetId, size))
+            return true;
+
+        LOG_WARNING("<-[%s] Call %s exceeds credit granted to the peer, size: %s", GetRemoteId(), packetId, size);
+        return false;
+    }
+
+    virtual ChunkedStream::Ptr OpenChunks(const proto::BasePacket& base, const IStream& head) override
+    {
+        const auto stream = ChunkedStream::Instance(head);
+        const bool isRequest = base.direction() == proto::BasePacket::Request;
+        auto& streams = isRequest ? m_RequestStreams : m_ResponseStreams;
+        if (!streams.Insert(base.packetid(), stream))
+            BOOST_THROW_EXCEPTION(Exception("Duplicated chunked stream: %s", base.ShortDebugString()));
+
+        // window of the producer bounds chunks kept here, credit is returned as the consumer handles them
+        stream->SetMaxQueued(0);
+        if (const auto window = base.creditchunks())
+            stream->SetAutoGrant(std::max<std::size_t>(window / 2, 1));
+
+        // credit granted by the consumer goes to the producer on the other side
+        proto::BasePacket credit;
+        credit.set_packetid(base.packetid());
+        credit.set_direction(isRequest ? proto::BasePacket::RequestCredit : proto::BasePacket::ResponseCredit);
+
+        const boost::weak_ptr<ChannelSink> weak = shared_from_this();
+        stream->SetGrant([weak, credit](std::size_t chunks) mutable {
+            if (const auto sink = weak.lock())
+            {
+                credit.set_creditchunks(static_cast<boost::uint32_t>(chunks));
+                sink->Write(credit, nullptr, IStream());
+            }
+        });
+
+        // consumer which stops reading closes the stream of the producer, so it doesn't write chunks which are dropped
+        stream->SetCancel([weak, credit](const boost::exception_ptr& e) mutable {
+            if (const auto sink = weak.lock())
+                sink->CancelChunks(credit, e);
+        });
+        return stream;
+    }
+
+    virtual void PopChunk(const proto::BasePacket& base, const IStream& stream) override
+    {
+        if (base.direction() == proto::BasePacket::RequestCredit || base.direction() == proto::BasePacket::ResponseCredit)
+        {
+            auto& writers = base.direction() == proto::BasePacket::RequestCredit ? m_RequestWriters : m_ResponseWriters;
+            if (const auto writer = base.last() ? writers.Remove(base.packetid()) : writers.Get(base.packetid()))
+            {
+                if (const auto chunked = writer->lock())
+                {
+                    if (base.last())
+                        chunked->Close(MakeException(base));
+                    else
+                        chunked->Grant(base.creditchunks());
+                }
+            }
+            return;
+        }
+
+        auto& streams = base.direction() == proto::BasePacket::RequestChunk ? m_RequestStreams : m_ResponseStreams;
+        const auto chunked = base.last() ? streams.Remove(base.packetid()) : streams.Get(base.packetid());
+        if (!chunked)
+        {
+            // stream of dropped request or of expired call
+            RPC_TRACE_PACKET(DEBUG, base.packetid(), "<-[%s] Dropping chunk of unknown stream: %s", GetRemoteId(), trace::Dump(base));
+            return;
+        }
+
+        if (base.last())
+        {
+            // producer ended the stream, there is nobody to cancel
+            chunked->SetCancel(ChunkedStream::CancelFn());
+            chunked->Close(base.error().empty() ? boost::exception_ptr() : MakeException(base));
+        }
+        else
+        if (chunked->IsClosed())
+        {
+            // consumer stopped reading, e.g. message of the stream was malformed
+            streams.Remove(base.packetid());
+            RPC_TRACE_PACKET(DEBUG, base.packetid(), "<-[%s] Dropping chunk of closed stream: %s", GetRemoteId(), trace::Dump(base));
+        }
+        else
+        {
+            chunked->Write(stream);
+        }
+    }
+
     virtual void SetConnectionWrapper(const WrapConnectionFn& wrapper) override
     {
         m_WrapConnection = wrapper;
@@ -162,6 +388,96 @@ public:
         m_Handlers.emplace_back(handler);
     }
 
+    virtual void SetCoalescing(const WriteCoalescer::Settings& settings) override
+    {
+        const auto coalescer = settings.m_MaxBatchBytes ? boost::make_shared<WriteCoalescer>(m_Service, settings) : WriteCoalescer::Ptr();
+        boost::unique_lock<boost::recursive_mutex> lock(m_Mutex);
+        if (const auto previous = boost::atomic_exchange(&m_Coalescer, coalescer))
+        {
+            previous->Flush(WriteCoalescer::FLUSH_CLOSE);
+            m_CoalescingStats = previous->GetStats();
+        }
+    }
+
+    virtual WriteCoalescer::Stats GetCoalescingStats() const override
+    {
+        if (const auto coalescer = boost::atomic_load(&m_Coalescer))
+            return coalescer->GetStats();
+
+        boost::unique_lock<boost::recursive_mutex> lock(m_Mutex);
+        return m_CoalescingStats;
+    }
+
+    virtual void SetFlowControl(const FlowControl::Settings& settings) override
+    {
+        boost::unique_lock<boost::recursive_mutex> lock(m_Mutex);
+        m_FlowSettings = settings;
+        m_Flow.Configure(settings);
+        WriteCredit();
+    }
+
+    virtual FlowControl::Stats GetFlowControlStats() const override
+    {
+        return m_Flow.GetStats();
+    }
+
+    virtual void GrantCredit(boost::uint32_t calls, boost::uint64_t bytes) override
+    {
+        LOG_DEBUG("<-[%s] Credit granted, calls: %s, bytes: %s", GetRemoteId(), calls, bytes);
+        m_Flow.Grant(calls, bytes);
+    }
+
+    virtual void SetCompression(const Compression::Settings& settings) override
+    {
+        const bool isEnabled = settings.m_Codec != proto::NoCompression || !settings.m_Methods.empty();
+        boost::atomic_store(&m_Compression, isEnabled ? boost::make_shared<Compression>(settings) : Compression::Ptr());
+        m_MaxDecompressedBytes = settings.m_MaxDecompressedBytes;
+    }
+
+    virtual IStream Decompress(const proto::BasePacket& base, std::istream& stream) const override
+    {
+        return Compression::Decompress(base.compression(), stream, m_MaxDecompressedBytes);
+    }
+
+    virtual Compression::Stats GetCompressionStats() const override
+    {
+        const auto compression = boost::atomic_load(&m_Compression);
+        return compression ? compression->GetStats() : Compression::Stats();
+    }
+
+    virtual void SetSpill(const SpillStream::Settings& settings) override
+    {
+        boost::atomic_store(&m_Spill, boost::make_shared<const SpillStream::Settings>(settings));
+    }
+
+    virtual SpillStream::Settings GetSpill() const override
+    {
+        const auto settings = boost::atomic_load(&m_Spill);
+        return settings ? *settings : SpillStream::Settings();
+    }
+
+    virtual void Collect(const ChunkedStream::Ptr& stream, const SpillStream::Callback& callback) const override
+    {
+        const auto settings = boost::atomic_load(&m_Spill);
+        SpillStream::Collect(stream, settings ? *settings : SpillStream::Settings(), callback);
+    }
+
+    virtual void SetCallTimeout(const boost::posix_time::time_duration& timeout) override
+    {
+        m_CallTimeoutMs = timeout.is_pos_infinity() ? 0 : static_cast<boost::uint32_t>(std::max<boost::int64_t>(timeout.total_milliseconds(), 0));
+    }
+
+    virtual boost::uint32_t GetCallTimeout() const override
+    {
+        return TimeoutWheel::GetCallTimeout(m_CallTimeoutMs);
+    }
+
+    boost::exception_ptr GetException() const
+    {
+        boost::unique_lock<boost::recursive_mutex> lock(m_Mutex);
+        return m_Exception;
+    }
+
     std::string GetRemoteId() const
     {
         if (const auto lock = m_Channel.lock())
@@ -169,6 +485,161 @@ public:
         return std::string("destroyed channel");
     }
 
+private:
+    //! Forget pending call and let the callee know that nobody waits for the response
+    bool Cancel(boost::uint32_t id, const IFuture::Ptr& future)
+    {
+        if (!m_OutgoingRequests.Remove(id, future))
+            return false;
+
+        m_Flow.Release(id);
+        ForgetTimeout(id);
+
+        proto::BasePacket base;
+        base.set_packetid(id);
+        base.set_direction(proto::BasePacket::Cancel);
+
+        RPC_TRACE_PACKET(DEBUG, id, "->[%s] Cancelling call", GetRemoteId());
+        Write(base, nullptr, IStream());
+        return true;
+    }
+
+    //! Packet goes first, chunks of its stream follow as the producer writes them
+    void WriteChunked(const proto::BasePacket& base, const gp::Message* request, const ChunkedStream::Ptr& stream)
+    {
+        if (!base.packetid())
+            BOOST_THROW_EXCEPTION(Exception("Chunked stream requires packet id: %s", base.ShortDebugString()));
+
+        // slow consumer must not make the sink queue chunks without limit
+        if (!stream->GetWindow())
+            stream->SetWindow(ChunkedStream::DEFAULT_WINDOW);
+
+        proto::BasePacket header(base);
+        header.set_chunked(true);
+        header.set_creditchunks(static_cast<boost::uint32_t>(stream->GetWindow()));
+        Write(header, request, IStream());
+
+        const bool isRequest = base.direction() == proto::BasePacket::Request;
+        proto::BasePacket chunk;
+        chunk.set_packetid(base.packetid());
+        chunk.set_direction(isRequest ? proto::BasePacket::RequestChunk : proto::BasePacket::ResponseChunk);
+
+        // stream doesn't own the sink and isn't owned by its own callback or by the sink
+        const boost::weak_ptr<ChannelSink> weak = shared_from_this();
+        const boost::weak_ptr<ChunkedStream> weakStream = stream;
+
+        // credit of the consumer is routed to the stream by packet id
+        auto& writers = isRequest ? m_RequestWriters : m_ResponseWriters;
+        writers.Remove(base.packetid());
+        writers.Insert(base.packetid(), boost::make_shared<boost::weak_ptr<ChunkedStream>>(stream));
+
+        stream->Read([weak, weakStream, chunk](const IStream& data, const boost::exception_ptr& e) mutable {
+            const auto sink = weak.lock();
+            if (!sink)
+            {
+                if (const auto stream = weakStream.lock())
+                    stream->Close(MakeException("Channel destroyed"));
+                return;
+            }
+            sink->WriteChunk(chunk, data, e, weakStream);
+        });
+    }
+
+    void WriteChunk(proto::BasePacket& base, const IStream& data, const boost::exception_ptr& e, const boost::weak_ptr<ChunkedStream>& stream)
+    {
+        if (data && !boost::atomic_load(&m_Connection))
+        {
+            // nobody receives the rest, let the producer know
+            if (const auto chunked = stream.lock())
+                chunked->Close(GetException() ? GetException() : MakeException("Channel has been closed"));
+            return;
+        }
+
+        if (!data)
+        {
+            auto& writers = base.direction() == proto::BasePacket::RequestChunk ? m_RequestWriters : m_ResponseWriters;
+            writers.Remove(base.packetid());
+
+            base.set_last(true);
+            if (e)
+                base.set_error(GetExceptionText(e));
+        }
+
+        Write(base, nullptr, data);
+    }
+
+    //! Let the producer know that the consumer closed received stream, credit packet ends its stream with the error
+    void CancelChunks(proto::BasePacket& credit, const boost::exception_ptr& e)
+    {
+        if (!boost::atomic_load(&m_Connection))
+            return; // producer's side is closed with the channel
+
+        RPC_TRACE_PACKET(DEBUG, credit.packetid(), "->[%s] Cancelling received stream: %s", GetRemoteId(), trace::Dump(credit));
+
+        credit.set_creditchunks(0);
+        credit.set_last(true);
+        credit.set_error(GetExceptionText(e));
+        Write(credit, nullptr, IStream());
+    }
+
+    //! Fail the call which has no credit
+    void Reject(boost::uint32_t id, const IFuture::Ptr& future)
+    {
+        if (!m_OutgoingRequests.Remove(id, future))
+            return;
+
+        ForgetTimeout(id);
+        try
+        {
+            const auto stats = m_Flow.GetStats();
+            BOOST_THROW_EXCEPTION(OverloadException("No credit for call %s, calls in flight: %s, queued: %s", id, stats.m_Calls, stats.m_Queued));
+        }
+        catch (const std::exception&)
+        {
+            future->SetException(boost::current_exception());
+        }
+    }
+
+    //! Let the peer know how many calls it may have in flight
+    void WriteCredit()
+    {
+        if (!boost::atomic_load(&m_Connection))
+            return; // sent once connection is set
+
+        proto::BasePacket base;
+        base.set_direction(proto::BasePacket::Credit);
+        base.set_creditcalls(m_FlowSettings.m_MaxCalls);
+        base.set_creditbytes(m_FlowSettings.m_MaxBytes);
+        Write(base, nullptr, IStream());
+    }
+
+    //! Wheel is created by the first call with deadline
+    TimeoutWheel::Ptr GetTimeouts()
+    {
+        if (const auto timeouts = boost::atomic_load(&m_Timeouts))
+            return timeouts;
+
+        boost::unique_lock<boost::recursive_mutex> lock(m_Mutex);
+        if (!m_Timeouts)
+        {
+            const boost::weak_ptr<ChannelSink> weak = shared_from_this();
+            // expired call is cancelled, so the peer stops counting it against credit returned here
+            const auto timeouts = boost::make_shared<TimeoutWheel>(m_Service, [weak](boost::uint32_t id, const IFuture::Ptr& future){
+                const auto sink = weak.lock();
+                return sink && sink->Cancel(id, future);
+            });
+            boost::atomic_store(&m_Timeouts, timeouts);
+        }
+        return m_Timeouts;
+    }
+
+    //! Completed call doesn't wait in the wheel until its deadline
+    void ForgetTimeout(boost::uint32_t id)
+    {
+        if (const auto timeouts = boost::atomic_load(&m_Timeouts))
+            timeouts->Remove(id);
+    }
+
 private:
     const boost::weak_ptr<rpc::details::IChannel> m_Channel;
     boost::asio::io_service& m_Service;
@@ -176,10 +647,28 @@ private:
     Handlers m_Handlers;
 
     mutable boost::recursive_mutex m_Mutex;
-    PacketMap m_OutgoingRequests;
+    PendingRequests m_OutgoingRequests;
+    PacketTable<boost::shared_ptr<RequestAndInfoHolder>> m_IncomingRequests;
+    PacketTable<ChunkedStream::Ptr> m_RequestStreams;   //!< request streams of incoming calls
+    PacketTable<ChunkedStream::Ptr> m_ResponseStreams;  //!< response streams of outgoing calls
+    PacketTable<WeakStream> m_RequestWriters;           //!< request streams written by outgoing calls
+    PacketTable<WeakStream> m_ResponseWriters;          //!< response streams written by incoming calls
 
     net::IConnection::Ptr m_Connection;
     boost::exception_ptr m_Exception;
+
+    WriteCoalescer::Ptr m_Coalescer;
+    WriteCoalescer::Stats m_CoalescingStats;
+
+    TimeoutWheel::Ptr m_Timeouts;
+    std::atomic<boost::uint32_t> m_CallTimeoutMs;
+
+    FlowControl m_Flow;
+    FlowControl::Settings m_FlowSettings;
+
+    boost::shared_ptr<const SpillStream::Settings> m_Spill;
+    Compression::Ptr m_Compression;
+    std::atomic<boost::uint64_t> m_MaxDecompressedBytes;
 };
 
 } // anonymous namespace
@@ -1,6 +1,11 @@
 #pragma once
 
 #include "rpc/Channel.h"
+#include "rpc/ChunkedStream.h"
+#include "rpc/SpillStream.h"
+#include "rpc/Compression.h"
+#include "rpc/WriteCoalescer.h"
+#include "rpc/FlowControl.h"
 #include "net/connection.hpp"
 
 #include "rpc_base.pb.h"
@@ -10,6 +15,7 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/function.hpp>
 #include <boost/asio/io_service.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 
 namespace rpc
 {
@@ -27,12 +33,68 @@ public:
     virtual ~IChannelSink() {}
 
     virtual IFuture::Ptr Push(const proto::BasePacket& base, const gp::Message* request, const IStream& stream) = 0;
+
+    //! Same as Push, but caller is done with the message, sink which keeps messages instead of serializing them takes its content
+    virtual IFuture::Ptr PushMovable(const proto::BasePacket& base, gp::Message* message, const IStream& stream) = 0;
     virtual void Pop(const proto::BasePacket& base, const IStream& stream) = 0;
+    virtual bool IsPending(boost::uint32_t packetId) const = 0;
     virtual void SetConnection(const net::IConnection::Ptr& connection) = 0;
     virtual void SetConnectionWrapper(const WrapConnectionFn& wrapper) = 0;
     virtual void Close(const boost::exception_ptr& e) = 0;
     virtual void AddHandler(const details::IRequestHandler::Ptr& handler) = 0;
 
+    //! Incoming request which may be cancelled by the caller, it's forgotten once response is pushed
+    virtual void AddIncoming(boost::uint32_t packetId, const boost::shared_ptr<RequestAndInfoHolder>& request) = 0;
+
+    //! Mark incoming request as cancelled, unknown ids are ignored
+    virtual void CancelIncoming(boost::uint32_t packetId) = 0;
+
+    //! Count incoming call against limits granted to the peer until its response is pushed or it's cancelled
+    //!\return false if the peer exceeded its credit, call must be refused
+    virtual bool AdmitIncoming(boost::uint32_t packetId, boost::uint64_t size) = 0;
+
+    //! Stream of chunks which follow request or response, head is the rest of the packet which opened it
+    virtual ChunkedStream::Ptr OpenChunks(const proto::BasePacket& base, const IStream& head) = 0;
+
+    //! Chunk or credit of the stream opened by request or response with the same packet id, unknown ids are ignored
+    virtual void PopChunk(const proto::BasePacket& base, const IStream& stream) = 0;
+
+    //! Enable write coalescing, zero max batch size disables it and flushes pending packets
+    virtual void SetCoalescing(const WriteCoalescer::Settings& settings) = 0;
+    virtual WriteCoalescer::Stats GetCoalescingStats() const = 0;
+
+    //! Limit calls the peer may have in flight to this side, limits are sent to the peer as credit
+    virtual void SetFlowControl(const FlowControl::Settings& settings) = 0;
+    virtual FlowControl::Stats GetFlowControlStats() const = 0;
+
+    //! Peer granted credit for calls of this side
+    virtual void GrantCredit(boost::uint32_t calls, boost::uint64_t bytes) = 0;
+
+    //! Compress payload of outgoing packets, settings should be limited to codecs the peer decodes, see Compression::Negotiate.
+    //! Limit of decompressed size applies to received packets even if this side doesn't compress.
+    virtual void SetCompression(const Compression::Settings& settings) = 0;
+    virtual Compression::Stats GetCompressionStats() const = 0;
+
+    //! Raw payload of the received compressed packet, throws if it exceeds limit of decompressed size
+    virtual IStream Decompress(const proto::BasePacket& base, std::istream& stream) const = 0;
+
+    //! Received chunked streams are collected before the handler or the caller gets them, data past threshold is moved
+    //! into temporary file, zero threshold disables it and chunks are delivered as they arrive.
+    //! Other received streams are passed as is: their packet is already in memory once it's received and
+    //! copying it into a file on the receiving thread would only stall the connection.
+    virtual void SetSpill(const SpillStream::Settings& settings) = 0;
+    virtual SpillStream::Settings GetSpill() const = 0;
+
+    //! Collect all chunks of the received stream with spill settings of the channel, see SpillStream::Collect
+    virtual void Collect(const ChunkedStream::Ptr& stream, const SpillStream::Callback& callback) const = 0;
+
+    //! Timeout of calls made without CallDeadline, zero or pos_infin disables it
+    virtual void SetCallTimeout(const boost::posix_time::time_duration& timeout) = 0;
+
+    //! Milliseconds left for a call made now by the current thread, zero if call has no deadline,
+    //! throws TimeoutException if deadline of the thread is over
+    virtual boost::uint32_t GetCallTimeout() const = 0;
+
     //! Instance
     static Ptr Instance(boost::asio::io_service& svc, const boost::weak_ptr<rpc::details::IChannel>& channel);
 };
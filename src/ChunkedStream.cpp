@@ -0,0 +1,279 @@
+#include "rpc/ChunkedStream.h"
+#include "rpc/Exceptions.h"
+
+#include <string>
+#include <utility>
+#include <cassert>
+
+#include <google/protobuf/message.h>
+
+#include <boost/make_shared.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <boost/iostreams/device/array.hpp>
+
+namespace rpc
+{
+namespace
+{
+
+//! Stream over the string it owns
+class StringChunk : private std::string, public boost::iostreams::stream<boost::iostreams::array_source>
+{
+public:
+    explicit StringChunk(std::string&& data)
+        : std::string(std::move(data))
+        , boost::iostreams::stream<boost::iostreams::array_source>(std::string::data(), std::string::size())
+    {
+    }
+};
+
+} // anonymous namespace
+
+ChunkedStream::ChunkedStream(const IStream& head)
+    : std::istream(head ? head->rdbuf() : nullptr)
+    , m_Head(head)
+    , m_Window()
+    , m_Credit()
+    , m_GrantBatch()
+    , m_Handled()
+    , m_MaxQueued(DEFAULT_MAX_QUEUED)
+    , m_IsClosed()
+    , m_IsEnded()
+    , m_IsDelivering()
+{
+}
+
+ChunkedStream::~ChunkedStream()
+{
+    // consumer must not wait for the end forever
+    if (m_IsClosed || !m_Callback)
+        return;
+
+    try
+    {
+        m_Callback(IStream(), MakeException("Chunked stream destroyed before it was closed"));
+    }
+    catch (const std::exception&)
+    {
+    }
+}
+
+ChunkedStream::Ptr ChunkedStream::Instance(const IStream& head)
+{
+    return boost::make_shared<ChunkedStream>(head);
+}
+
+ChunkedStream::Ptr ChunkedStream::Cast(const IStream& stream)
+{
+    return boost::dynamic_pointer_cast<ChunkedStream>(stream);
+}
+
+bool ChunkedStream::Write(const IStream& chunk)
+{
+    assert(chunk && "empty chunk ends the stream, use Close");
+
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    if (m_IsClosed)
+        BOOST_THROW_EXCEPTION(Exception("Chunked stream is closed"));
+
+    m_Chunks.emplace_back(chunk);
+    Deliver(lock);
+    return !IsFull();
+}
+
+bool ChunkedStream::Write(std::string data)
+{
+    return Write(boost::make_shared<StringChunk>(std::move(data)));
+}
+
+void ChunkedStream::WhenWritable(const WritableFn& callback)
+{
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    if (IsFull() && !m_IsClosed)
+    {
+        m_Writable = callback;
+        return;
+    }
+
+    lock.unlock();
+    callback();
+}
+
+void ChunkedStream::SetMaxQueued(std::size_t chunks)
+{
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    m_MaxQueued = chunks;
+}
+
+void ChunkedStream::Close(const boost::exception_ptr& e)
+{
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    if (m_IsClosed)
+        return;
+
+    m_IsClosed = true;
+    m_Exception = e;
+
+    // producer waiting for room learns about close from the next write
+    WritableFn writable;
+    writable.swap(m_Writable);
+    CancelFn cancel;
+    cancel.swap(m_Cancel);
+    Deliver(lock);
+
+    lock.unlock();
+    if (writable)
+        writable();
+    if (cancel)
+        cancel(e ? e : MakeException("Chunked stream closed by consumer"));
+}
+
+void ChunkedStream::Read(const Callback& callback)
+{
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    if (m_Callback)
+        BOOST_THROW_EXCEPTION(Exception("Chunked stream is already read"));
+
+    m_Callback = callback;
+    Deliver(lock);
+}
+
+bool ChunkedStream::IsClosed() const
+{
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    return m_IsClosed;
+}
+
+void ChunkedStream::SetWindow(std::size_t chunks)
+{
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    m_Window = chunks;
+    m_Credit = chunks;
+    Deliver(lock);
+}
+
+std::size_t ChunkedStream::GetWindow() const
+{
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    return m_Window;
+}
+
+void ChunkedStream::Grant(std::size_t chunks)
+{
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    if (m_Grant)
+    {
+        const auto grant = m_Grant;
+        lock.unlock();
+        grant(chunks);
+        return;
+    }
+
+    m_Credit += chunks;
+    Deliver(lock);
+}
+
+std::size_t ChunkedStream::GetQueued() const
+{
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    return m_Chunks.size();
+}
+
+void ChunkedStream::SetAutoGrant(std::size_t batch)
+{
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    m_GrantBatch = batch;
+}
+
+void ChunkedStream::SetGrant(const GrantFn& grant)
+{
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    m_Grant = grant;
+}
+
+void ChunkedStream::SetCancel(const CancelFn& cancel)
+{
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    m_Cancel = cancel;
+}
+
+void ChunkedStream::Deliver(boost::unique_lock<boost::mutex>& lock)
+{
+    if (m_IsDelivering || !m_Callback)
+        return;
+
+    m_IsDelivering = true;
+    for (;;)
+    {
+        IStream chunk;
+        if (!m_Chunks.empty())
+        {
+            if (m_Window && !m_Credit)
+                break;
+
+            chunk.swap(m_Chunks.front());
+            m_Chunks.pop_front();
+            if (m_Window)
+                --m_Credit;
+        }
+        else
+        if (m_IsClosed && !m_IsEnded)
+        {
+            m_IsEnded = true;
+        }
+        else
+        {
+            break;
+        }
+
+        // producer is told about room in the queue once the chunk is out of it
+        WritableFn writable;
+        if (m_Writable && (!IsFull() || m_IsClosed))
+            writable.swap(m_Writable);
+
+        const auto e = chunk ? boost::exception_ptr() : m_Exception;
+        lock.unlock();
+        try
+        {
+            m_Callback(chunk, e);
+            if (writable)
+                writable();
+            if (chunk)
+                Return();
+        }
+        catch (...)
+        {
+            lock.lock();
+            m_IsDelivering = false;
+            throw;
+        }
+        lock.lock();
+    }
+    m_IsDelivering = false;
+}
+
+void ChunkedStream::Return()
+{
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    if (!m_GrantBatch || ++m_Handled < m_GrantBatch)
+        return;
+
+    const auto handled = m_Handled;
+    m_Handled = 0;
+    if (!m_Grant)
+    {
+        m_Credit += handled;
+        return;
+    }
+
+    const auto grant = m_Grant;
+    lock.unlock();
+    grant(handled);
+}
+
+bool ChunkedStream::IsFull() const
+{
+    return m_MaxQueued && m_Chunks.size() >= m_MaxQueued;
+}
+
+} // namespace rpc
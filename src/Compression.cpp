@@ -0,0 +1,252 @@
+#include "rpc/Compression.h"
+#include "rpc/ChunkedStream.h"
+#include "rpc/FileStream.h"
+#include "rpc/Exceptions.h"
+#include "net/connection.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <vector>
+
+#include <boost/make_shared.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/join.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/iostreams/copy.hpp>
+#include <boost/iostreams/write.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
+#include <boost/iostreams/filter/zstd.hpp>
+
+namespace rpc
+{
+namespace details
+{
+
+namespace io = boost::iostreams;
+
+namespace
+{
+
+//! Codecs this side decodes, in order of preference
+const Compression::Codec CODECS[] = { proto::Zstd, proto::Zlib };
+
+template<typename Stream>
+void PushCompressor(Stream& out, Compression::Codec codec)
+{
+    switch (codec)
+    {
+    case proto::Zlib: out.push(io::zlib_compressor(io::zlib_params(io::zlib::best_speed))); break;
+    case proto::Zstd: out.push(io::zstd_compressor(io::zstd_params(io::zstd::default_compression))); break;
+    default: BOOST_THROW_EXCEPTION(Exception("Unknown compression codec: %s", static_cast<int>(codec)));
+    }
+}
+
+template<typename Stream>
+void PushDecompressor(Stream& in, Compression::Codec codec)
+{
+    switch (codec)
+    {
+    case proto::Zlib: in.push(io::zlib_decompressor()); break;
+    case proto::Zstd: in.push(io::zstd_decompressor()); break;
+    default: BOOST_THROW_EXCEPTION(Exception("Unknown compression codec: %s", static_cast<int>(codec)));
+    }
+}
+
+//! Copy decompressed data to the sink, throws once it grows past the limit
+template<typename Sink>
+void CopyLimited(std::istream& in, Sink& out, boost::uint64_t maxBytes)
+{
+    char buffer[io::default_device_buffer_size];
+    for (boost::uint64_t size = 0;;)
+    {
+        const auto read = in.read(buffer, sizeof(buffer)).gcount();
+        if (!read)
+            break;
+
+        size += read;
+        if (maxBytes && size > maxBytes)
+            BOOST_THROW_EXCEPTION(Exception("Decompressed payload exceeds limit: %s", maxBytes));
+
+        io::write(out, buffer, read);
+    }
+}
+
+} // anonymous namespace
+
+const char* const Compression::PROPERTY = "Compression";
+
+Compression::Compression(const Settings& settings)
+    : m_Settings(settings)
+{
+}
+
+boost::uint64_t Compression::MethodKey(boost::uint32_t serviceId, boost::uint32_t method)
+{
+    return (static_cast<boost::uint64_t>(serviceId) << 32) | method;
+}
+
+Compression::Codec Compression::Select(const proto::BasePacket& base, const gp::Message* request, const IStream& stream) const
+{
+    const auto it = m_Settings.m_Methods.find(MethodKey(base.serviceid(), base.method()));
+    const auto codec = it == m_Settings.m_Methods.end() ? m_Settings.m_Codec : it->second;
+    if (codec == proto::NoCompression)
+        return codec;
+
+    // chunks of chunked streams are compressed one by one, files are sent without copying
+    if (stream && (ChunkedStream::Cast(stream) || FileStream::Cast(stream)))
+        return proto::NoCompression;
+
+    // compressed payload is kept in memory, large ones are sent as is
+    const boost::uint64_t size = (request ? request->ByteSize() : 0) + (stream ? net::StreamSize(*stream) : 0);
+    if (size < m_Settings.m_MinBytes || (m_Settings.m_MaxBytes && size > m_Settings.m_MaxBytes))
+        return proto::NoCompression;
+    return codec;
+}
+
+IStream Compression::Compress(Codec codec, const gp::Message* request, const IStream& stream)
+{
+    const auto position = stream ? stream->tellg() : std::streampos();
+
+    std::string compressed;
+    boost::uint64_t rawSize = 0;
+    {
+        io::filtering_ostream out;
+        PushCompressor(out, codec);
+        out.push(io::back_inserter(compressed));
+
+        // same layout as the raw payload, receiver parses decompressed data as usual
+        if (request)
+        {
+            const boost::uint32_t requestSize = request->ByteSize();
+            out.write(reinterpret_cast<const char*>(&requestSize), sizeof(requestSize));
+            if (!request->SerializeToOstream(&out))
+                BOOST_THROW_EXCEPTION(Exception("Failed to serialize packet payload"));
+            rawSize += sizeof(requestSize) + requestSize;
+        }
+
+        if (stream)
+            rawSize += io::copy(*stream, out, io::default_device_buffer_size);
+        else
+            io::close(out);
+    }
+
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    if (compressed.size() >= rawSize)
+    {
+        ++m_Stats.m_Skipped;
+        lock.unlock();
+
+        if (stream)
+        {
+            stream->clear();
+            stream->seekg(position);
+        }
+        return IStream();
+    }
+
+    ++m_Stats.m_Packets;
+    m_Stats.m_RawBytes += rawSize;
+    m_Stats.m_CompressedBytes += compressed.size();
+    lock.unlock();
+
+    return boost::make_shared<std::istringstream>(compressed);
+}
+
+IStream Compression::Decompress(Codec codec, std::istream& stream, boost::uint64_t maxBytes)
+{
+    io::filtering_istream in;
+    PushDecompressor(in, codec);
+    in.push(stream);
+
+    const auto result = boost::make_shared<std::stringstream>();
+    CopyLimited(in, *result, maxBytes);
+    return result;
+}
+
+std::string Compression::Compress(Codec codec, const std::string& data)
+{
+    std::string result;
+    io::filtering_ostream out;
+    PushCompressor(out, codec);
+    out.push(io::back_inserter(result));
+    out.write(data.data(), data.size());
+    io::close(out);
+    return result;
+}
+
+std::string Compression::Decompress(Codec codec, const std::string& data, boost::uint64_t maxBytes)
+{
+    std::string result;
+    io::filtering_istream in;
+    PushDecompressor(in, codec);
+    in.push(io::array_source(data.data(), data.size()));
+
+    auto out = io::back_inserter(result);
+    CopyLimited(in, out, maxBytes);
+    return result;
+}
+
+void Compression::Advertise(proto::RpcInfo::Instance& instance)
+{
+    std::vector<std::string> names;
+    for (const auto codec : CODECS)
+        names.push_back(proto::CompressionType_Name(codec));
+
+    for (auto& property : *instance.mutable_properties())
+    {
+        if (property.name() == PROPERTY)
+        {
+            property.set_value(boost::algorithm::join(names, ","));
+            return;
+        }
+    }
+
+    auto& property = *instance.add_properties();
+    property.set_name(PROPERTY);
+    property.set_value(boost::algorithm::join(names, ","));
+}
+
+Compression::Settings Compression::Negotiate(const Settings& settings, const proto::RpcInfo::Instance& peer)
+{
+    std::vector<Codec> supported;
+    for (const auto& property : peer.properties())
+    {
+        if (property.name() != PROPERTY)
+            continue;
+
+        std::vector<std::string> names;
+        boost::algorithm::split(names, property.value(), boost::algorithm::is_any_of(","));
+        for (const auto& name : names)
+        {
+            Codec codec;
+            if (proto::CompressionType_Parse(name, &codec))
+                supported.push_back(codec);
+        }
+    }
+
+    const auto isSupported = [&supported](Codec codec){
+        return codec == proto::NoCompression || std::find(supported.begin(), supported.end(), codec) != supported.end();
+    };
+
+    Settings result(settings);
+    if (!isSupported(result.m_Codec))
+        result.m_Codec = proto::NoCompression;
+    for (auto& method : result.m_Methods)
+    {
+        if (!isSupported(method.second))
+            method.second = proto::NoCompression;
+    }
+    return result;
+}
+
+Compression::Stats Compression::GetStats() const
+{
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    return m_Stats;
+}
+
+} // namespace details
+} // namespace rpc
@@ -0,0 +1,48 @@
+#include "rpc/Deadline.h"
+
+#include <algorithm>
+
+namespace rpc
+{
+
+namespace
+{
+
+thread_local const CallDeadline* g_Current = nullptr;
+
+} // anonymous namespace
+
+CallDeadline::CallDeadline(const boost::posix_time::time_duration& timeout)
+    : m_Previous(g_Current)
+    , m_Deadline(timeout.is_pos_infinity() ? Clock::time_point::max() : Clock::now() + boost::chrono::microseconds(timeout.total_microseconds()))
+{
+    if (m_Previous)
+        m_Deadline = std::min(m_Deadline, m_Previous->m_Deadline);
+    g_Current = this;
+}
+
+CallDeadline::~CallDeadline()
+{
+    g_Current = m_Previous;
+}
+
+CallDeadline::Clock::time_point CallDeadline::Current()
+{
+    return g_Current ? g_Current->m_Deadline : Clock::time_point::max();
+}
+
+boost::posix_time::time_duration CallDeadline::Remaining()
+{
+    return Remaining(Current());
+}
+
+boost::posix_time::time_duration CallDeadline::Remaining(const Clock::time_point& deadline)
+{
+    if (deadline == Clock::time_point::max())
+        return boost::posix_time::pos_infin;
+
+    const auto left = boost::chrono::duration_cast<boost::chrono::microseconds>(deadline - Clock::now());
+    return boost::posix_time::microseconds(left.count());
+}
+
+} // namespace rpc
@@ -0,0 +1,297 @@
+#include "rpc/FileStream.h"
+#include "rpc/Exceptions.h"
+
+#include <algorithm>
+#include <cstring>
+#include <streambuf>
+#include <vector>
+
+#include <google/protobuf/message.h>
+
+#include <boost/make_shared.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/exceptions.hpp>
+
+#if !defined(_WIN32)
+#include <cerrno>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
+namespace rpc
+{
+
+//! Get area is the whole mapped region, so reads and seeks don't copy anything.
+//! Small regions are not mapped, get area is a buffer filled with pread.
+class FileStream::Buffer : public std::streambuf
+{
+public:
+    enum { READ_BUFFER_SIZE = 64 * 1024 };
+
+    Buffer(const std::string& path, boost::uint64_t offset, boost::uint64_t size, bool isTemporary)
+        : m_Offset(offset)
+        , m_Size()
+        , m_ReadPosition()
+        , m_Temporary(isTemporary ? path : std::string())
+    {
+        namespace ip = boost::interprocess;
+        try
+        {
+            const boost::uint64_t fileSize = boost::filesystem::file_size(path);
+            if (offset > fileSize)
+                BOOST_THROW_EXCEPTION(Exception("Offset %s is beyond the end of the file: %s, size: %s", offset, path, fileSize));
+
+            m_Size = std::min(size, fileSize - offset);
+            m_File = ip::file_mapping(path.c_str(), ip::read_only);
+            if (IsMapped())
+                m_Region = ip::mapped_region(m_File, ip::read_only, static_cast<ip::offset_t>(offset), static_cast<std::size_t>(m_Size));
+        }
+        catch (const boost::interprocess::interprocess_exception& e)
+        {
+            Remove();
+            BOOST_THROW_EXCEPTION(Exception("Failed to map file: %s, error: %s", path, e.what()));
+        }
+        catch (const boost::filesystem::filesystem_error& e)
+        {
+            Remove();
+            BOOST_THROW_EXCEPTION(Exception("Failed to open file: %s, error: %s", path, e.what()));
+        }
+        catch (...)
+        {
+            Remove();
+            throw;
+        }
+
+        if (IsMapped())
+        {
+            const auto begin = static_cast<char*>(m_Region.get_address());
+            setg(begin, begin, begin + m_Size);
+        }
+        else
+        {
+            m_ReadBuffer.resize(static_cast<std::size_t>(std::min<boost::uint64_t>(m_Size, READ_BUFFER_SIZE)));
+            setg(m_ReadBuffer.data(), m_ReadBuffer.data(), m_ReadBuffer.data());
+        }
+    }
+
+    ~Buffer()
+    {
+        // file can't be removed while it's mapped on some platforms
+        boost::interprocess::mapped_region().swap(m_Region);
+        boost::interprocess::file_mapping().swap(m_File);
+        Remove();
+    }
+
+    boost::uint64_t GetSize() const
+    {
+        return m_Size;
+    }
+
+    boost::uint64_t GetPosition() const
+    {
+        return m_ReadPosition + (gptr() - eback());
+    }
+
+    const char* GetData() const
+    {
+        return IsMapped() ? eback() : nullptr;
+    }
+
+    //! Copy bytes of the region into data, throws if file ends before them
+    void Read(boost::uint64_t position, char* data, std::size_t size) const
+    {
+        if (position + size > m_Size)
+            BOOST_THROW_EXCEPTION(Exception("Range is out of the region, position: %s, size: %s, region: %s", position, size, m_Size));
+
+#if defined(_WIN32)
+        std::memcpy(data, static_cast<const char*>(m_Region.get_address()) + position, size);
+#else
+        for (std::size_t read = 0; read < size;)
+        {
+            const auto result = ::pread(m_File.get_mapping_handle().handle, data + read, size - read, static_cast<off_t>(m_Offset + position + read));
+            if (result < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                BOOST_THROW_EXCEPTION(Exception("Failed to read file, error: %s", std::strerror(errno)));
+            }
+            if (!result)
+                BOOST_THROW_EXCEPTION(Exception("File ends before the region, it's truncated, position: %s, region: %s", position + read, m_Size));
+
+            read += static_cast<std::size_t>(result);
+        }
+#endif
+    }
+
+#if defined(__linux__)
+    int GetHandle() const
+    {
+        return m_File.get_mapping_handle().handle;
+    }
+#endif
+
+protected:
+    virtual int_type underflow() override
+    {
+        if (IsMapped())
+            return traits_type::eof();
+
+        m_ReadPosition += egptr() - eback();
+        if (m_ReadPosition >= m_Size)
+        {
+            setg(m_ReadBuffer.data(), m_ReadBuffer.data(), m_ReadBuffer.data());
+            return traits_type::eof();
+        }
+
+        const auto size = static_cast<std::size_t>(std::min<boost::uint64_t>(m_Size - m_ReadPosition, m_ReadBuffer.size()));
+        Read(m_ReadPosition, m_ReadBuffer.data(), size);
+        setg(m_ReadBuffer.data(), m_ReadBuffer.data(), m_ReadBuffer.data() + size);
+        return traits_type::to_int_type(*gptr());
+    }
+
+    virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+    {
+        const off_type base = dir == std::ios_base::beg ? 0 : dir == std::ios_base::cur ? static_cast<off_type>(GetPosition()) : static_cast<off_type>(m_Size);
+        return seekpos(pos_type(base + off), which);
+    }
+
+    virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which) override
+    {
+        if (!(which & std::ios_base::in) || pos < 0 || static_cast<boost::uint64_t>(off_type(pos)) > m_Size)
+            return pos_type(off_type(-1));
+
+        // position inside of the get area is kept, otherwise the buffer is refilled from the new position
+        const auto position = static_cast<boost::uint64_t>(off_type(pos));
+        if (position >= m_ReadPosition && position <= m_ReadPosition + (egptr() - eback()))
+        {
+            setg(eback(), eback() + (position - m_ReadPosition), egptr());
+        }
+        else
+        {
+            m_ReadPosition = position;
+            setg(m_ReadBuffer.data(), m_ReadBuffer.data(), m_ReadBuffer.data());
+        }
+        return pos;
+    }
+
+    virtual std::streamsize showmanyc() override
+    {
+        return static_cast<std::streamsize>(m_Size - GetPosition());
+    }
+
+private:
+    bool IsMapped() const
+    {
+#if defined(_WIN32)
+        // there is no pread, every region is mapped
+        return m_Size != 0;
+#else
+        return m_Size >= MIN_MAPPED_SIZE;
+#endif
+    }
+
+    void Remove()
+    {
+        if (m_Temporary.empty())
+            return;
+
+        boost::system::error_code e;
+        boost::filesystem::remove(m_Temporary, e);
+    }
+
+private:
+    boost::interprocess::file_mapping m_File;
+    boost::interprocess::mapped_region m_Region;
+    const boost::uint64_t m_Offset;
+    boost::uint64_t m_Size;
+    boost::uint64_t m_ReadPosition;     //!< position of the get area in the region
+    std::vector<char> m_ReadBuffer;     //!< get area of the region which is not mapped
+    const std::string m_Temporary;
+};
+
+FileStream::FileStream(const std::string& path, boost::uint64_t offset, boost::uint64_t size, bool isTemporary)
+    : std::istream(nullptr)
+    , m_Offset(offset)
+    , m_Buffer(new Buffer(path, offset, size, isTemporary))
+{
+    rdbuf(m_Buffer.get());
+}
+
+FileStream::~FileStream()
+{
+}
+
+FileStream::Ptr FileStream::Instance(const std::string& path, boost::uint64_t offset, boost::uint64_t size)
+{
+    return boost::make_shared<FileStream>(path, offset, size);
+}
+
+FileStream::Ptr FileStream::Temporary(const std::string& path)
+{
+    return boost::make_shared<FileStream>(path, 0, std::numeric_limits<boost::uint64_t>::max(), true);
+}
+
+FileStream::Ptr FileStream::Cast(const IStream& stream)
+{
+    return boost::dynamic_pointer_cast<FileStream>(stream);
+}
+
+boost::uint64_t FileStream::GetOffset() const
+{
+    return m_Offset;
+}
+
+boost::uint64_t FileStream::GetSize() const
+{
+    return m_Buffer->GetSize();
+}
+
+boost::uint64_t FileStream::GetPosition() const
+{
+    return m_Buffer->GetPosition();
+}
+
+const char* FileStream::GetData() const
+{
+    return m_Buffer->GetData();
+}
+
+void FileStream::Read(boost::uint64_t position, char* data, std::size_t size) const
+{
+    m_Buffer->Read(position, data, size);
+}
+
+#if defined(__linux__)
+std::size_t FileStream::SendTo(int socket, boost::uint64_t position, std::size_t size) const
+{
+    if (position + size > GetSize())
+        BOOST_THROW_EXCEPTION(Exception("Range is out of the region, position: %s, size: %s, region: %s", position, size, GetSize()));
+
+    off_t offset = static_cast<off_t>(m_Offset + position);
+    std::size_t sent = 0;
+    while (sent < size)
+    {
+        const auto result = ::sendfile(socket, m_Buffer->GetHandle(), &offset, size - sent);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            BOOST_THROW_EXCEPTION(Exception("Failed to send file, error: %s", std::strerror(errno)));
+        }
+        if (!result)
+            break;
+
+        sent += static_cast<std::size_t>(result);
+    }
+    return sent;
+}
+#endif
+
+} // namespace rpc
@@ -0,0 +1,220 @@
+#include "rpc/FlowControl.h"
+#include "rpc/ChunkedStream.h"
+#include "Stream.h"
+
+namespace rpc
+{
+namespace details
+{
+
+FlowControl::FlowControl(const WriteFn& write)
+    : m_Write(write)
+{
+}
+
+void FlowControl::Configure(const Settings& settings)
+{
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    m_Settings = settings;
+}
+
+void FlowControl::Grant(boost::uint32_t calls, boost::uint64_t bytes)
+{
+    Ready ready;
+    {
+        boost::unique_lock<boost::mutex> lock(m_Mutex);
+        m_Stats.m_CallsLimit = calls;
+        m_Stats.m_BytesLimit = bytes;
+        Drain(ready);
+    }
+    Write(ready);
+}
+
+bool FlowControl::Send(const IFuture::Ptr& future, const proto::BasePacket& base, const MessagePtr& request, const IStream& stream)
+{
+    {
+        // calls without limits are not tracked, so flow control costs nothing until peer grants credit
+        boost::unique_lock<boost::mutex> lock(m_Mutex);
+        if (!m_Stats.m_CallsLimit && !m_Stats.m_BytesLimit)
+        {
+            lock.unlock();
+            m_Write(base, request, stream);
+            return true;
+        }
+    }
+
+    // size is computed outside of the lock, chunks of the stream aren't calls, they aren't limited
+    const boost::uint64_t size = (request ? request->ByteSize() : 0) + (stream && !ChunkedStream::Cast(stream) ? net::StreamSize(*stream) : 0);
+    {
+        boost::unique_lock<boost::mutex> lock(m_Mutex);
+
+        // queued calls go first, otherwise small calls could starve a large one
+        if (m_Queue.empty() && HasCredit(size))
+        {
+            Take(base.packetid(), size);
+        }
+        else
+        if (m_Settings.m_Mode == MODE_FAIL || IsQueueFull(size))
+        {
+            ++m_Stats.m_Rejected;
+            return false;
+        }
+        else
+        {
+            Queued queued;
+            queued.m_Future = future;
+            queued.m_Base = base;
+            if (request)
+            {
+                queued.m_Request.reset(request->New());
+                queued.m_Request->CopyFrom(*request);
+            }
+            queued.m_Stream = stream;
+            queued.m_Size = size;
+            m_Queue.emplace_back(std::move(queued));
+            m_Stats.m_Queued = m_Queue.size();
+            m_Stats.m_QueuedBytes += size;
+            return true;
+        }
+    }
+
+    m_Write(base, request, stream);
+    return true;
+}
+
+void FlowControl::Release(boost::uint32_t id)
+{
+    Ready ready;
+    {
+        boost::unique_lock<boost::mutex> lock(m_Mutex);
+        const auto it = m_InFlight.find(id);
+        if (it == m_InFlight.end())
+            return;
+
+        --m_Stats.m_Calls;
+        m_Stats.m_Bytes -= it->second;
+        m_InFlight.erase(it);
+        Drain(ready);
+    }
+    Write(ready);
+}
+
+bool FlowControl::Admit(boost::uint32_t id, boost::uint64_t size)
+{
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+
+    // nothing is tracked until this side grants limits, like calls of the sender
+    if (!m_Settings.m_MaxCalls && !m_Settings.m_MaxBytes)
+        return true;
+
+    // the same rules as the peer applies to its calls, so a well behaved peer is never refused
+    const bool isOverCalls = m_Settings.m_MaxCalls && m_Stats.m_IncomingCalls >= m_Settings.m_MaxCalls;
+    const bool isOverBytes = m_Settings.m_MaxBytes && m_Stats.m_IncomingBytes && m_Stats.m_IncomingBytes + size > m_Settings.m_MaxBytes;
+    if (isOverCalls || isOverBytes)
+    {
+        ++m_Stats.m_Refused;
+        return false;
+    }
+
+    if (!m_Incoming.emplace(id, size).second)
+        return true; // already counted
+
+    ++m_Stats.m_IncomingCalls;
+    m_Stats.m_IncomingBytes += size;
+    return true;
+}
+
+void FlowControl::ReleaseIncoming(boost::uint32_t id)
+{
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    const auto it = m_Incoming.find(id);
+    if (it == m_Incoming.end())
+        return;
+
+    --m_Stats.m_IncomingCalls;
+    m_Stats.m_IncomingBytes -= it->second;
+    m_Incoming.erase(it);
+}
+
+void FlowControl::Reset()
+{
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    m_InFlight.clear();
+    m_Incoming.clear();
+    m_Queue.clear();
+    m_Stats.m_Calls = 0;
+    m_Stats.m_Bytes = 0;
+    m_Stats.m_Queued = 0;
+    m_Stats.m_QueuedBytes = 0;
+    m_Stats.m_IncomingCalls = 0;
+    m_Stats.m_IncomingBytes = 0;
+}
+
+FlowControl::Stats FlowControl::GetStats() const
+{
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    return m_Stats;
+}
+
+bool FlowControl::HasCredit(boost::uint64_t size) const
+{
+    if (m_Stats.m_CallsLimit && m_Stats.m_Calls >= m_Stats.m_CallsLimit)
+        return false;
+
+    // single call larger than the whole window is written once nothing else is in flight
+    if (m_Stats.m_BytesLimit && m_Stats.m_Bytes && m_Stats.m_Bytes + size > m_Stats.m_BytesLimit)
+        return false;
+
+    return true;
+}
+
+bool FlowControl::IsQueueFull(boost::uint64_t size) const
+{
+    if (m_Settings.m_MaxQueued && m_Queue.size() >= m_Settings.m_MaxQueued)
+        return true;
+
+    // single call larger than the limit waits once the queue is empty
+    return m_Settings.m_MaxQueuedBytes && !m_Queue.empty() && m_Stats.m_QueuedBytes + size > m_Settings.m_MaxQueuedBytes;
+}
+
+void FlowControl::Take(boost::uint32_t id, boost::uint64_t size)
+{
+    m_InFlight[id] = size;
+    ++m_Stats.m_Calls;
+    m_Stats.m_Bytes += size;
+}
+
+void FlowControl::Drain(Ready& ready)
+{
+    while (!m_Queue.empty())
+    {
+        auto& front = m_Queue.front();
+
+        // call timed out or was cancelled while it was waiting
+        const auto future = front.m_Future.lock();
+        if (!future || future->IsReady())
+        {
+            m_Stats.m_QueuedBytes -= front.m_Size;
+            m_Queue.pop_front();
+            continue;
+        }
+
+        if (!HasCredit(front.m_Size))
+            break;
+
+        Take(front.m_Base.packetid(), front.m_Size);
+        m_Stats.m_QueuedBytes -= front.m_Size;
+        ready.emplace_back(std::move(front));
+        m_Queue.pop_front();
+    }
+    m_Stats.m_Queued = m_Queue.size();
+}
+
+void FlowControl::Write(const Ready& ready) const
+{
+    for (const auto& call : ready)
+        m_Write(call.m_Base, call.m_Request, call.m_Stream);
+}
+
+} // namespace details
+} // namespace rpc
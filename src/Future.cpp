@@ -4,6 +4,11 @@
 
 #include <google/protobuf/message.h>
 
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <vector>
+
 #include <boost/make_shared.hpp>
 #include <boost/thread.hpp>
 #include <boost/asio/io_service.hpp>
@@ -23,38 +28,96 @@ class FutureImpl : public IFuture, public boost::enable_shared_from_this<FutureI
 {
 public:
 
-    FutureImpl(boost::asio::io_service& svc) : m_Service(svc) {}
+    //! Upper bound of one blocking run of the io_service by a waiting service thread, wake up handler may be taken by another thread
+    enum { DRIVE_SLICE_MS = 100 };
+
+    FutureImpl(boost::asio::io_service& svc) : m_Service(svc), m_Waiters(), m_Drivers() {}
 
     virtual StreamPtr GetData() override
     {
-        boost::shared_ptr<boost::promise<StreamPtr>> promise;
-        {
-            boost::unique_lock<boost::recursive_mutex> lock(m_Mutex);
-            if (m_Exception)
-                boost::rethrow_exception(m_Exception);
+        Wait(boost::posix_time::pos_infin);
+
+        boost::unique_lock<boost::recursive_mutex> lock(m_Mutex);
+        if (m_Exception)
+            boost::rethrow_exception(m_Exception);
 
-            if (m_Stream)
-                return *m_Stream;
+        // response which wasn't serialized may have no stream, received packet always has one
+        if (!*m_Stream && m_Message)
+            m_Stream = StreamPtr(boost::make_shared<std::istringstream>());
 
-            promise = boost::make_shared<boost::promise<StreamPtr>>();
-            const auto callback = [promise](const IFuture::Ptr& f)
-            {
-                if (f->GetException())
-                    promise->set_exception(f->GetException());
-                else
-                    promise->set_value(f->GetData());
-            };
+        return *m_Stream;
+    }
 
-            GetData(callback);
+    virtual const google::protobuf::Message& GetResponse(const google::protobuf::Message& prototype) override
+    {
+        Wait(boost::posix_time::pos_infin);
+
+        // parsed under the lock, concurrent callers wait for the single parse
+        boost::unique_lock<boost::recursive_mutex> lock(m_Mutex);
+        if (m_Exception)
+            boost::rethrow_exception(m_Exception);
+
+        if (!m_Message)
+        {
+            std::unique_ptr<google::protobuf::Message> message(prototype.New());
+            try
+            {
+                if (const auto& stream = *m_Stream)
+                    details::ReadStream::Read(*stream, *message);
+            }
+            catch (const std::exception&)
+            {
+                // stream is consumed partially, every caller gets the same error
+                m_Exception = boost::current_exception();
+                throw;
+            }
+            m_Message.reset(message.release());
         }
+        return *m_Message;
+    }
+
+    virtual bool Wait(const boost::posix_time::time_duration& timeout) override
+    {
+        typedef boost::chrono::steady_clock Clock;
 
-        auto future = promise->get_future();
-        while (!future.is_ready())
+        const bool infinite = timeout.is_pos_infinity();
+        const auto deadline = Clock::now() + boost::chrono::microseconds(infinite ? 0 : timeout.total_microseconds());
+
+        if (IsReady())
+            return true;
+
+        // handlers queued so far are run by the waiter, nobody else may run the io_service and one of them may deliver the response
+        m_Service.poll();
+
+        // thread which runs the io_service must keep running it, its other handlers would never run otherwise
+        const bool isServiceThread = m_Service.get_executor().running_in_this_thread();
+
+        boost::unique_lock<boost::recursive_mutex> lock(m_Mutex);
+        while (!m_Stream && !m_Exception)
         {
-            if (!m_Service.poll())
-                boost::this_thread::sleep_for(boost::chrono::microseconds(1));
+            const auto now = Clock::now();
+            if (!infinite && now >= deadline)
+                return false;
+
+            if (!isServiceThread)
+            {
+                // parked until data is set, there is no periodic wake up
+                if (infinite)
+                    m_Condition.wait(lock);
+                else
+                    m_Condition.wait_until(lock, deadline);
+                continue;
+            }
+
+            // driver blocks in the io_service until a handler runs, setting the data posts a handler to wake it up
+            ++m_Drivers;
+            lock.unlock();
+            const auto slice = infinite ? DRIVE_SLICE_MS : std::min<boost::int64_t>(DRIVE_SLICE_MS, boost::chrono::duration_cast<boost::chrono::milliseconds>(deadline - now).count() + 1);
+            m_Service.run_one_for(std::chrono::milliseconds(slice));
+            lock.lock();
+            --m_Drivers;
         }
-        return future.get();
+        return true;
     }
 
     virtual void GetData(const Callback& c) override
@@ -67,16 +130,28 @@ public:
         }
         else
         {
-            m_Callback = c;
+            m_Callbacks.push_back(c);
         }
     }
 
+    virtual bool AddWaiter(Waiter& waiter) override
+    {
+        boost::unique_lock<boost::recursive_mutex> lock(m_Mutex);
+        if (m_Stream || m_Exception)
+            return false;
+
+        waiter.m_Next = m_Waiters;
+        m_Waiters = &waiter;
+        return true;
+    }
+
     virtual void SetData(const StreamPtr& stream) override
     {
         {
             boost::unique_lock<boost::recursive_mutex> lock(m_Mutex);
             m_Stream = stream;
         }
+        Notify();
         InvokeCallback();
     }
 
@@ -86,6 +161,18 @@ public:
             boost::unique_lock<boost::recursive_mutex> lock(m_Mutex);
             m_Exception = e;
         }
+        Notify();
+        InvokeCallback();
+    }
+
+    virtual void SetMessage(const MessagePtr& message, const StreamPtr& stream) override
+    {
+        {
+            boost::unique_lock<boost::recursive_mutex> lock(m_Mutex);
+            m_Message = message;
+            m_Stream = stream;
+        }
+        Notify();
         InvokeCallback();
     }
 
@@ -101,16 +188,79 @@ public:
         return m_Exception || m_Stream;
     }
 
+    virtual void SetCancel(const CancelFn& cancel) override
+    {
+        boost::unique_lock<boost::recursive_mutex> lock(m_Mutex);
+        m_Cancel = cancel;
+    }
+
+    virtual bool Cancel() override
+    {
+        CancelFn cancel;
+        {
+            boost::unique_lock<boost::recursive_mutex> lock(m_Mutex);
+            if (m_Stream || m_Exception)
+                return false;
+            cancel.swap(m_Cancel);
+        }
+
+        // cancel competes with response and timeout, the one which removes the call completes it
+        if (!cancel || !cancel(shared_from_this()))
+            return false;
+
+        try
+        {
+            BOOST_THROW_EXCEPTION(CancelledException("Call cancelled"));
+        }
+        catch (const std::exception&)
+        {
+            SetException(boost::current_exception());
+        }
+        return true;
+    }
+
+    //! Wakes up parked waiters and service threads which drive the io_service in Wait
+    void Notify()
+    {
+        bool isDriven;
+        {
+            boost::unique_lock<boost::recursive_mutex> lock(m_Mutex);
+            isDriven = m_Drivers != 0;
+        }
+
+        m_Condition.notify_all();
+        if (isDriven)
+            m_Service.post([](){});
+    }
+
     void InvokeCallback()
     {
-        Callback cb;
+        const auto self = shared_from_this();
+
+        Callbacks callbacks;
+        Waiter* waiters;
         {
             boost::unique_lock<boost::recursive_mutex> lock(m_Mutex);
-            m_Callback.swap(cb);
+            m_Callbacks.swap(callbacks);
+            waiters = m_Waiters;
+            m_Waiters = nullptr;
         }
 
-        if (cb)
-            cb(shared_from_this());
+        for (const auto& cb : callbacks)
+            cb(self);
+
+        // waiter may be destroyed by OnReady
+        while (waiters)
+        {
+            const auto next = waiters->m_Next;
+            waiters->OnReady();
+            waiters = next;
+        }
+    }
+
+    virtual boost::asio::io_service& GetService() const override
+    {
+        return m_Service;
     }
 
     virtual const google::protobuf::Message* GetBase() const override
@@ -125,13 +275,20 @@ public:
     }
 
 private:
+    typedef std::vector<Callback> Callbacks;
+
     boost::asio::io_service& m_Service;
     boost::optional<StreamPtr> m_Stream;
-    mutable Callback m_Callback;
+    MessagePtr m_Message;
+    Callbacks m_Callbacks;
+    Waiter* m_Waiters;
+    unsigned m_Drivers;
+    CancelFn m_Cancel;
     boost::exception_ptr m_Exception;
     std::unique_ptr<google::protobuf::Message> m_Base;
 
     mutable boost::recursive_mutex m_Mutex;
+    boost::condition_variable_any m_Condition;
 };
 
 } // anonymous namespace
@@ -0,0 +1,559 @@
+#include "rpc/InProcessChannel.h"
+#include "rpc/LocalHandler.h"
+#include "rpc/Deadline.h"
+#include "rpc/Exceptions.h"
+#include "rpc/Trace.h"
+#include "log/log.h"
+#include "conversion/cast.hpp"
+#include "ChannelSink.h"
+#include "PendingRequests.h"
+#include "PacketIdGenerator.h"
+#include "TimeoutWheel.h"
+
+#include "rpc_base.pb.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+
+#include <google/protobuf/descriptor.h>
+
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/range/algorithm.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/asio/io_service.hpp>
+
+namespace rpc
+{
+
+namespace
+{
+
+SET_LOGGING_MODULE("Rpc");
+
+#pragma warning(push)
+#pragma warning(disable:4250) // inherits via dominance
+
+class InProcessChannel
+    : public IInProcessChannel
+    , public details::IChannelSink
+    , boost::noncopyable
+    , public boost::enable_shared_from_this<InProcessChannel>
+{
+public:
+    typedef std::deque<details::IRequestHandler::Ptr> Handlers;
+    typedef std::deque<ILocalHandler::Ptr> LocalHandlers;
+
+    InProcessChannel(boost::asio::io_service& svc)
+        : m_Service(svc)
+        , m_IsClosed()
+        , m_CallTimeoutMs(0)
+        , m_Flow(boost::bind(&InProcessChannel::Dispatch, this, _1, _2, _3))
+    {
+    }
+
+    virtual IFuture::Ptr CallMethod(unsigned service,
+                                    unsigned method,
+                                    const MessagePtr& request,
+                                    const IStream& stream) override
+    {
+        proto::BasePacket base;
+
+        try
+        {
+            base.set_timeout(GetCallTimeout());
+        }
+        catch (const TimeoutException&)
+        {
+            // deadline of the caller is over, call is failed without being queued
+            const auto future = IFuture::Instance(m_Service);
+            future->SetException(boost::current_exception());
+            return future;
+        }
+
+        {
+            base.set_method(method);
+            base.set_serviceid(service);
+            base.set_packetid(GetNextPacketId());
+            base.set_direction(proto::BasePacket::Request);
+        }
+
+        RPC_TRACE_PACKET(DEBUG, base.packetid(), "->[%s]: Calling in process: %s", m_RemoteId, trace::Dump(base));
+        if (request && !request->IsInitialized())
+            BOOST_THROW_EXCEPTION(Exception("Can't call method because request is not initialized: base: %s, request: %s, errors: %s", base.ShortDebugString(), request->ShortDebugString(), request->InitializationErrorString()));
+
+        return Call(base, request, stream);
+    }
+
+    virtual IFuture::Ptr CallMethod(const gp::MethodDescriptor& method,
+                                    const MessagePtr& request,
+                                    const IStream& stream) override
+    {
+        const IService::Id id = method.service()->options().GetExtension(proto::ServiceId);
+        return CallMethod(id, method.index(), request, stream);
+    }
+
+    virtual void AddHandler(const details::IRequestHandler::Ptr& handler) override
+    {
+        boost::unique_lock<boost::mutex> lock(m_Mutex);
+        m_Handlers.emplace_back(handler);
+
+        // only local handlers are able to dispatch messages, the last added one is used like in other channels
+        if (const auto local = boost::dynamic_pointer_cast<ILocalHandler>(handler))
+            m_LocalHandlers.emplace_front(local);
+    }
+
+    virtual void OnIncomingData(const IStream& stream, const boost::exception_ptr& e) override
+    {
+        if (!stream)
+            Close(e);
+        else
+            BOOST_THROW_EXCEPTION(Exception("In-process channel doesn't receive serialized data"));
+    }
+
+    virtual void Close(const boost::exception_ptr& e) override
+    {
+        details::PendingRequests::Values responses;
+        {
+            boost::unique_lock<boost::mutex> lock(m_Mutex);
+            m_IsClosed = true;
+            if (!m_Exception)
+                m_Exception = e;
+            responses = m_OutgoingRequests.RemoveAll();
+            if (m_Timeouts)
+                m_Timeouts->Clear();
+        }
+
+        m_Flow.Reset();
+        for (const auto& request : m_IncomingRequests.RemoveAll())
+            request->MarkCancelled();
+
+        if (!responses.empty())
+        {
+            const auto exception = e ? e : rpc::MakeException("Channel closed by local side");
+            boost::for_each(responses, [&exception](const IFuture::Ptr& future){
+                try
+                {
+                    future->SetException(exception);
+                }
+                catch (const std::exception&)
+                {
+                }
+            });
+        }
+    }
+
+    virtual void SetRemoteId(const InstanceId& id) override
+    {
+        m_RemoteId = id;
+    }
+
+    virtual const InstanceId& GetRemoteId() const override
+    {
+        return m_RemoteId;
+    }
+
+    virtual details::IChannelSink::Ptr GetSink() const override
+    {
+        return boost::const_pointer_cast<InProcessChannel>(shared_from_this());
+    }
+
+    virtual void SetConnection(const net::IConnection::Ptr& connection) override
+    {
+        BOOST_THROW_EXCEPTION(Exception("In-process channel has no connection"));
+    }
+
+    //! Sink is used by responses, request may be pushed by generic code, it's copied because it may be reused by caller
+    virtual IFuture::Ptr Push(const proto::BasePacket& base, const gp::Message* message, const IStream& stream) override
+    {
+        MessagePtr copy;
+        if (message)
+        {
+            copy.reset(message->New());
+            copy->CopyFrom(*message);
+        }
+        return PushMessage(base, copy, stream);
+    }
+
+    //! Content of the message is swapped into a new one, nothing is copied or serialized
+    virtual IFuture::Ptr PushMovable(const proto::BasePacket& base, gp::Message* message, const IStream& stream) override
+    {
+        MessagePtr moved;
+        if (message)
+        {
+            moved.reset(message->New());
+            moved->GetReflection()->Swap(moved.get(), message);
+        }
+        return PushMessage(base, moved, stream);
+    }
+
+    virtual void Pop(const proto::BasePacket& base, const IStream& stream) override
+    {
+        const auto future = Remove(base);
+        if (!future)
+            return;
+
+        if (!base.error().empty() || base.errorid())
+            future->SetException(MakeException(base));
+        else
+            future->SetData(stream);
+    }
+
+    virtual bool IsPending(boost::uint32_t packetId) const override
+    {
+        return m_OutgoingRequests.Contains(packetId);
+    }
+
+    virtual void AddIncoming(boost::uint32_t packetId, const boost::shared_ptr<details::RequestAndInfoHolder>& request) override
+    {
+        if (!m_IncomingRequests.Insert(packetId, request))
+        {
+            m_IncomingRequests.Remove(packetId);
+            m_IncomingRequests.Insert(packetId, request);
+        }
+    }
+
+    virtual void CancelIncoming(boost::uint32_t packetId) override
+    {
+        if (const auto request = m_IncomingRequests.Remove(packetId))
+            request->MarkCancelled();
+    }
+
+    //! Channel is its own peer, its flow control never lets calls exceed the credit
+    virtual bool AdmitIncoming(boost::uint32_t, boost::uint64_t) override
+    {
+        return true;
+    }
+
+    //! Chunked streams are passed as is, chunks go from producer to consumer directly
+    virtual ChunkedStream::Ptr OpenChunks(const proto::BasePacket& base, const IStream& head) override
+    {
+        BOOST_THROW_EXCEPTION(Exception("In-process channel doesn't receive chunks: %s", base.ShortDebugString()));
+    }
+
+    virtual void PopChunk(const proto::BasePacket& base, const IStream& stream) override
+    {
+        BOOST_THROW_EXCEPTION(Exception("In-process channel doesn't receive chunks: %s", base.ShortDebugString()));
+    }
+
+    virtual void SetConnectionWrapper(const WrapConnectionFn& wrapper) override
+    {
+        BOOST_THROW_EXCEPTION(Exception("In-process channel has no connection"));
+    }
+
+    virtual void SetCoalescing(const details::WriteCoalescer::Settings& settings) override
+    {
+        if (settings.m_MaxBatchBytes)
+            BOOST_THROW_EXCEPTION(Exception("In-process channel doesn't write packets"));
+    }
+
+    virtual details::WriteCoalescer::Stats GetCoalescingStats() const override
+    {
+        return details::WriteCoalescer::Stats();
+    }
+
+    //! Channel is its own peer, limits are granted to its own calls
+    virtual void SetFlowControl(const details::FlowControl::Settings& settings) override
+    {
+        m_Flow.Configure(settings);
+        m_Flow.Grant(settings.m_MaxCalls, settings.m_MaxBytes);
+    }
+
+    virtual details::FlowControl::Stats GetFlowControlStats() const override
+    {
+        return m_Flow.GetStats();
+    }
+
+    virtual void GrantCredit(boost::uint32_t calls, boost::uint64_t bytes) override
+    {
+        m_Flow.Grant(calls, bytes);
+    }
+
+    virtual void SetCompression(const details::Compression::Settings& settings) override
+    {
+        if (settings.m_Codec != proto::NoCompression || !settings.m_Methods.empty())
+            BOOST_THROW_EXCEPTION(Exception("In-process channel doesn't write packets"));
+    }
+
+    virtual details::Compression::Stats GetCompressionStats() const override
+    {
+        return details::Compression::Stats();
+    }
+
+    virtual IStream Decompress(const proto::BasePacket& base, std::istream& stream) const override
+    {
+        BOOST_THROW_EXCEPTION(Exception("In-process channel doesn't read packets"));
+    }
+
+    //! Streams are passed as is, only collected chunked streams are spilled
+    virtual void SetSpill(const SpillStream::Settings& settings) override
+    {
+        boost::atomic_store(&m_Spill, boost::make_shared<const SpillStream::Settings>(settings));
+    }
+
+    virtual SpillStream::Settings GetSpill() const override
+    {
+        const auto settings = boost::atomic_load(&m_Spill);
+        return settings ? *settings : SpillStream::Settings();
+    }
+
+    virtual void Collect(const ChunkedStream::Ptr& stream, const SpillStream::Callback& callback) const override
+    {
+        const auto settings = boost::atomic_load(&m_Spill);
+        SpillStream::Collect(stream, settings ? *settings : SpillStream::Settings(), callback);
+    }
+
+    virtual void SetCallTimeout(const boost::posix_time::time_duration& timeout) override
+    {
+        m_CallTimeoutMs = timeout.is_pos_infinity() ? 0 : static_cast<boost::uint32_t>(std::max<boost::int64_t>(timeout.total_milliseconds(), 0));
+    }
+
+    virtual boost::uint32_t GetCallTimeout() const override
+    {
+        return details::TimeoutWheel::GetCallTimeout(m_CallTimeoutMs);
+    }
+
+private:
+
+    boost::uint32_t GetNextPacketId()
+    {
+        // skip ids of requests which are still waiting for response after counter wraparound
+        const auto& requests = m_OutgoingRequests;
+        return m_PacketIds.Next([&requests](boost::uint32_t id){ return requests.Contains(id); });
+    }
+
+    IFuture::Ptr Call(const proto::BasePacket& base, const MessagePtr& request, const IStream& stream)
+    {
+        IFuture::Ptr future;
+        if (base.packetid())
+        {
+            future = IFuture::Instance(m_Service);
+
+            boost::unique_lock<boost::mutex> lock(m_Mutex);
+            if (m_IsClosed)
+            {
+                const auto exception = m_Exception ? m_Exception : rpc::MakeException("Channel has been closed");
+                lock.unlock();
+                future->SetException(exception);
+                return future;
+            }
+
+            if (!m_OutgoingRequests.Insert(base.packetid(), future))
+                BOOST_THROW_EXCEPTION(Exception("Duplicated packet id: %s", base.ShortDebugString()));
+
+            if (base.timeout())
+                GetTimeouts(lock)->Add(base.packetid(), future, boost::posix_time::milliseconds(base.timeout()));
+
+            const boost::weak_ptr<InProcessChannel> weak = shared_from_this();
+            const auto id = base.packetid();
+            future->SetCancel([weak, id](const IFuture::Ptr& future){
+                const auto channel = weak.lock();
+                return channel && channel->Cancel(id, future);
+            });
+        }
+
+        if (!future)
+            Dispatch(base, request, stream);
+        else
+        if (!m_Flow.Send(future, base, request, stream))
+            Reject(base.packetid(), future);
+
+        return future;
+    }
+
+    void Dispatch(const proto::BasePacket& base, const MessagePtr& request, const IStream& stream)
+    {
+        // handlers are invoked on the io_service, inline if caller is already running it
+        const auto instance = shared_from_this();
+        const auto sent = CallDeadline::Clock::now();
+        m_Service.dispatch([instance, base = base, request, stream, sent]() mutable {
+            // queued call is not pending only if it was cancelled, timed out or channel was closed, nobody waits for it
+            if (base.packetid() && !instance->m_OutgoingRequests.Contains(base.packetid()))
+            {
+                RPC_TRACE_PACKET(DEBUG, base.packetid(), "<-[%s]: Dropping abandoned in process request: [%s]", instance->m_RemoteId, trace::Dump(base));
+                return;
+            }
+
+            // time spent in the queue counts against the budget of the call
+            const CallDeadline deadline(details::TimeoutWheel::GetBudget(base.timeout(), sent));
+            instance->HandleRequest(base, request, stream);
+        });
+    }
+
+    bool Cancel(boost::uint32_t id, const IFuture::Ptr& future)
+    {
+        if (!m_OutgoingRequests.Remove(id, future))
+            return false;
+
+        m_Flow.Release(id);
+        ForgetTimeout(id);
+
+        RPC_TRACE_PACKET(DEBUG, id, "->[%s]: Cancelling in process call", m_RemoteId);
+        CancelIncoming(id);
+        return true;
+    }
+
+    //! Fail the call which has no credit
+    void Reject(boost::uint32_t id, const IFuture::Ptr& future)
+    {
+        if (!m_OutgoingRequests.Remove(id, future))
+            return;
+
+        ForgetTimeout(id);
+        try
+        {
+            const auto stats = m_Flow.GetStats();
+            BOOST_THROW_EXCEPTION(OverloadException("No credit for in process call %s, calls in flight: %s, queued: %s", id, stats.m_Calls, stats.m_Queued));
+        }
+        catch (const std::exception&)
+        {
+            future->SetException(boost::current_exception());
+        }
+    }
+
+    //! Wheel is created by the first call with deadline
+    const details::TimeoutWheel::Ptr& GetTimeouts(boost::unique_lock<boost::mutex>&)
+    {
+        if (!m_Timeouts)
+        {
+            const boost::weak_ptr<InProcessChannel> weak = shared_from_this();
+            m_Timeouts = boost::make_shared<details::TimeoutWheel>(m_Service, [weak](boost::uint32_t id, const IFuture::Ptr& future){
+                const auto channel = weak.lock();
+                if (!channel || !channel->m_OutgoingRequests.Remove(id, future))
+                    return false;
+
+                channel->m_Flow.Release(id);
+                return true;
+            });
+        }
+        return m_Timeouts;
+    }
+
+    //! Completed call doesn't wait in the wheel until its deadline
+    void ForgetTimeout(boost::uint32_t id)
+    {
+        details::TimeoutWheel::Ptr timeouts;
+        {
+            boost::unique_lock<boost::mutex> lock(m_Mutex);
+            timeouts = m_Timeouts;
+        }
+        if (timeouts)
+            timeouts->Remove(id);
+    }
+
+    void HandleRequest(proto::BasePacket& base, const MessagePtr& request, const IStream& stream)
+    {
+        try
+        {
+            RPC_TRACE_PACKET(DEBUG, base.packetid(), "<-[%s]: Handling in process request: [%s]", m_RemoteId, trace::Dump(base));
+
+            if (base.callerid().empty() && !m_RemoteId.empty())
+                base.set_callerid(m_RemoteId);
+
+            ILocalHandler::Ptr handler;
+            {
+                boost::unique_lock<boost::mutex> lock(m_Mutex);
+                if (!m_LocalHandlers.empty())
+                    handler = m_LocalHandlers.front();
+            }
+
+            if (!handler)
+                BOOST_THROW_EXCEPTION(Exception("Unable to handle request, there is no local handler: %s", base.ShortDebugString()));
+
+            handler->HandleMessage(base, request, stream, shared_from_this());
+        }
+        catch (const std::exception& e)
+        {
+            LOG_ERROR("Failed to process request: %s", boost::diagnostic_information(e));
+
+            // complete call with error
+            base.set_direction(proto::BasePacket::Response);
+            base.set_error(conv::cast<std::string>(boost::diagnostic_information(e)));
+
+            Complete(base, MessagePtr(), IStream());
+        }
+    }
+
+    IFuture::Ptr PushMessage(const proto::BasePacket& base, const MessagePtr& message, const IStream& stream)
+    {
+        if (base.direction() != proto::BasePacket::Response)
+            return Call(base, message, stream);
+
+        Complete(base, message, stream);
+        return IFuture::Ptr();
+    }
+
+    IFuture::Ptr Remove(const proto::BasePacket& base)
+    {
+        if (!base.packetid())
+            return IFuture::Ptr();
+
+        for (const auto& handler : m_Handlers)
+            handler->HandleResponse(base, m_RemoteId);
+
+        const auto future = m_OutgoingRequests.Remove(base.packetid());
+        if (!future)
+        {
+            // late response of expired call is expected
+            LOG_WARNING("<-[%s] Unknown or timed out packet id: %s", m_RemoteId, base.ShortDebugString());
+            return future;
+        }
+
+        m_Flow.Release(base.packetid());
+        ForgetTimeout(base.packetid());
+        future->SetBase(base);
+        return future;
+    }
+
+    void Complete(const proto::BasePacket& base, const MessagePtr& message, const IStream& stream)
+    {
+        if (base.packetid())
+            m_IncomingRequests.Remove(base.packetid());
+
+        const auto future = Remove(base);
+        if (!future)
+            return;
+
+        RPC_TRACE_PACKET(DEBUG, base.packetid(), "<-[%s]: Handling in process response: [%s]", m_RemoteId, trace::Dump(base));
+
+        if (!base.error().empty() || base.errorid())
+        {
+            future->SetException(MakeException(base));
+            return;
+        }
+
+        // message is owned by the response already, it's never serialized
+        future->SetMessage(message, stream);
+    }
+
+private:
+    boost::asio::io_service& m_Service;
+    InstanceId m_RemoteId;
+    details::PacketIdGenerator m_PacketIds;
+    details::PendingRequests m_OutgoingRequests;
+    details::PacketTable<boost::shared_ptr<details::RequestAndInfoHolder>> m_IncomingRequests;
+
+    mutable boost::mutex m_Mutex;
+    Handlers m_Handlers;
+    LocalHandlers m_LocalHandlers;
+    bool m_IsClosed;
+    boost::exception_ptr m_Exception;
+    details::TimeoutWheel::Ptr m_Timeouts;
+    std::atomic<boost::uint32_t> m_CallTimeoutMs;
+    details::FlowControl m_Flow;
+    boost::shared_ptr<const SpillStream::Settings> m_Spill;
+};
+
+#pragma warning(pop)
+
+} // anonymous namespace
+
+IInProcessChannel::Ptr IInProcessChannel::Instance(boost::asio::io_service& svc)
+{
+    return boost::make_shared<InProcessChannel>(svc);
+}
+
+} // namespace rpc
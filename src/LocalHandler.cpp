@@ -1,6 +1,11 @@
 #include "rpc/LocalHandler.h"
+#include "rpc/Dispatch.h"
+#include "rpc/Deadline.h"
+#include "rpc/ChunkedStream.h"
+#include "rpc/Exceptions.h"
 #include "conversion/cast.hpp"
 #include "Stream.h"
+#include "rpc/Trace.h"
 #include "log/log.h"
 #include "ChannelSink.h"
 
@@ -11,6 +16,11 @@
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/asio/io_service.hpp>
 #include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/algorithm/cxx11/any_of.hpp>
+
+#include <algorithm>
+#include <typeinfo>
 
 namespace rpc
 {
@@ -55,7 +65,17 @@ ResponseHolder::ResponseHolder()
 
 }
 
-void ResponseHolder::Send(const gp::Message& message, const IStream& stream)
+void ResponseHolder::Reset()
+{
+    PacketHolder::Reset();
+    m_IsSent = false;
+    if (m_Base)
+        m_Base->Clear();
+    m_Method = nullptr;
+    m_Service = nullptr;
+}
+
+void ResponseHolder::Send(gp::Message& message, const IStream& stream, bool isLast)
 {
     if (!m_Base)
         return; // response is not initialized
@@ -69,7 +89,7 @@ void ResponseHolder::Send(const gp::Message& message, const IStream& stream)
 
     // this method will be invoked when response is out of user code scope
     // and there is no more references. so we are ready to send it.
-    const auto* m = &message;
+    auto* m = &message;
     if (base.error().empty())
     {
         try
@@ -90,6 +110,15 @@ void ResponseHolder::Send(const gp::Message& message, const IStream& stream)
         m = nullptr;
     }
 
+    // error response has no stream, producer of the chunked one learns that nobody reads it
+    auto out = stream;
+    if (!base.error().empty())
+    {
+        if (const auto chunked = ChunkedStream::Cast(stream))
+            chunked->Close(MakeException(base));
+        out.reset();
+    }
+
     auto& channel = static_cast<ISequencedChannel&>(*m_Channel);
 
     try
@@ -101,12 +130,15 @@ void ResponseHolder::Send(const gp::Message& message, const IStream& stream)
         }
         else
         {
-            LOG_TRACE("->[%s]: Sending response packet: %s", channel.GetRemoteId(), base.ShortDebugString());
+            RPC_TRACE_PACKET(TRACE, base.packetid(), "->[%s]: Sending response packet: %s", channel.GetRemoteId(), trace::Dump(base));
         }
 
-        // serialize response
+        // serialize response, in-process sink takes content of the response which is cleared anyway
         const auto sink = channel.GetSink();
-        sink->Push(base, m, stream);
+        if (isLast)
+            sink->PushMovable(base, m, out);
+        else
+            sink->Push(base, m, out);
     }
     catch (const std::exception& e)
     {
@@ -127,6 +159,7 @@ class LocalHandler
 public:
     LocalHandler(boost::asio::io_service& svc)
         : m_Service(svc)
+        , m_Services(boost::make_shared<ServiceIndex>())
     {    
     }
 
@@ -134,50 +167,261 @@ public:
     {
         const auto& currentBase = static_cast<const proto::BasePacket&>(baseMessage);
 
-        std::vector<IService::Ptr> services;
+        // caller may have given up already, drop request before its body is touched
+        const CallDeadline deadline(GetBudget(currentBase));
+        ThrowIfExpired(currentBase);
 
+        const Target target = Find(currentBase);
+
+        // prepare request and response
+        const MessagePtr request(target.m_Entry ? target.m_Entry->m_AcquireRequest() : target.m_Service->AcquireRequest(*target.m_Method));
+
+        // parse request from stream
+        details::ReadStream::Read(*stream, *request);
+
+        if (currentBase.chunked())
         {
-            boost::unique_lock<boost::mutex> lock(m_ServiceMutex);
-            for (const auto& service : m_Services)
+            // stream data follow in chunk packets
+            const auto sink = channel->GetSink();
+            const auto chunks = sink->OpenChunks(currentBase, IStream());
+            if (sink->GetSpill().m_Threshold)
             {
-                if (const auto s = service.lock())
-                {
-                    if (s->GetId() == currentBase.serviceid())
-                        services.emplace_back(s);
-                }
+                CollectAndDispatch(currentBase, target, request, chunks, channel);
+                return true;
+            }
+            SetRequestStream(target, *request, chunks);
+        }
+        else
+        {
+            // assign stream if more data exist
+            const auto pos = stream->tellg();
+            stream->seekg(0, std::ios::end);
+            if (pos != stream->tellg())
+            {
+                stream->clear();
+                stream->seekg(pos);
+                SetRequestStream(target, *request, stream);
             }
         }
 
-        if (services.empty())
-            BOOST_THROW_EXCEPTION(Exception("Unable to handle request, service is not supported: %s", currentBase.ShortDebugString()));
+        Dispatch(currentBase, target, request, channel);
+        return true;
+    }
 
-        // get method description from service
-        const auto* methodDesc = services.front()->GetDescriptor().method(currentBase.method());
-        assert(methodDesc);
+    virtual void HandleMessage(const gp::Message& baseMessage, const MessagePtr& message, const IStream& stream, const rpc::ISequencedChannel::Ptr& channel) override
+    {
+        const auto& currentBase = static_cast<const proto::BasePacket&>(baseMessage);
 
-        // prepare request and response
-        std::unique_ptr<gp::Message> rawRequest(services.front()->CreateRequest(*methodDesc));
-        std::unique_ptr<gp::Message> rawResponse(services.front()->CreateResponse(*methodDesc));
+        const CallDeadline deadline(GetBudget(currentBase));
+        ThrowIfExpired(currentBase);
 
-        // parse request from stream
-        details::ReadStream::Read(*stream, *rawRequest);
+        const Target target = Find(currentBase);
 
-        // assign stream if more data exist
-        const auto pos = stream->tellg();
-        stream->seekg(0, std::ios::end);
-        if (pos != stream->tellg())
+        // generated stub creates the same request wrapper as generated service expects, it's passed as is,
+        // wrapper is acquired and filled only for other messages
+        MessagePtr request = message;
+        if (!target.m_Entry || !target.m_Entry->m_IsRequest(*message))
         {
-            stream->clear();
-            stream->seekg(pos);
-            dynamic_cast<details::StreamHolder&>(*rawRequest).Stream(stream);
+            const MessagePtr acquired(target.m_Entry ? target.m_Entry->m_AcquireRequest() : target.m_Service->AcquireRequest(*target.m_Method));
+            if (typeid(*acquired) != typeid(*message))
+            {
+                acquired->CopyFrom(*message);
+                request = acquired;
+            }
+        }
+
+        // stream is passed as is, the same way as received one it's assigned only if it has data or is chunked
+        if (stream && (ChunkedStream::Cast(stream) || net::StreamSize(*stream)))
+            SetRequestStream(target, *request, stream);
+
+        Dispatch(currentBase, target, request, channel);
+    }
+
+    virtual void HandleResponse(const gp::Message&, const InstanceId&) override {}
+
+    virtual void ProvideService(const boost::weak_ptr<IService>& svc) override
+    {
+        const auto service = svc.lock();
+        if (!service)
+            return;
+
+        // publish new snapshot, readers keep using the previous one until they are done
+        boost::unique_lock<boost::mutex> lock(m_ServiceMutex);
+        const auto index = boost::make_shared<ServiceIndex>(*m_Services);
+        (*index)[service->GetId()].emplace_back(svc);
+        boost::atomic_store(&m_Services, ServiceIndexPtr(index));
+    }
+
+    virtual void RemoveService(const boost::weak_ptr<IService>& svc) override
+    {
+        // drop first registration of the service and all expired ones, compare by owner
+        bool removed = false;
+        const auto isRemoved = [&svc, &removed](const boost::weak_ptr<IService>& s)
+        {
+            if (s.expired())
+                return true;
+            if (removed || s.owner_before(svc) || svc.owner_before(s))
+                return false;
+            return removed = true;
+        };
+
+        boost::unique_lock<boost::mutex> lock(m_ServiceMutex);
+        const auto index = boost::make_shared<ServiceIndex>(*m_Services);
+        for (auto it = index->begin(); it != index->end();)
+        {
+            auto& services = it->second;
+            services.erase(std::remove_if(services.begin(), services.end(), isRemoved), services.end());
+            if (services.empty())
+                it = index->erase(it);
+            else
+                ++it;
+        }
+        boost::atomic_store(&m_Services, ServiceIndexPtr(index));
+    }
+
+    virtual bool HasService(const rpc::IService::Id& id) const override
+    {
+        const auto index = boost::atomic_load(&m_Services);
+        const auto services = index->find(id);
+        if (services == index->end())
+            return false;
+
+        return boost::algorithm::any_of(services->second, [](const boost::weak_ptr<IService>& s){ return !s.expired(); });
+    }
+
+private:
+    typedef std::vector<boost::weak_ptr<IService>> Services;
+    typedef boost::unordered_map<IService::Id, Services> ServiceIndex;
+    typedef boost::shared_ptr<const ServiceIndex> ServiceIndexPtr;
+
+    //! Method resolved for incoming request
+    struct Target
+    {
+        const Services* m_Services;
+        IService::Ptr m_Service;
+        const gp::MethodDescriptor* m_Method;
+        const details::MethodEntry* m_Entry;
+        ServiceIndexPtr m_Index;    //!< keeps services alive while request is dispatched
+    };
+
+    Target Find(const proto::BasePacket& currentBase) const
+    {
+        Target target = {};
+
+        // lookup services in current snapshot, the hot path doesn't take service mutex and doesn't allocate
+        target.m_Index = boost::atomic_load(&m_Services);
+        const auto services = target.m_Index->find(currentBase.serviceid());
+
+        if (services != target.m_Index->end())
+        {
+            target.m_Services = &services->second;
+            for (const auto& service : services->second)
+            {
+                if ((target.m_Service = service.lock()))
+                    break;
+            }
         }
 
+        if (!target.m_Service)
+            BOOST_THROW_EXCEPTION(Exception("Unable to handle request, service is not supported: %s", currentBase.ShortDebugString()));
+
+        // get method description from service
+        target.m_Method = target.m_Service->GetDescriptor().method(currentBase.method());
+        assert(target.m_Method);
+
+        // generated services provide typed method thunks, others are accessed through RTTI
+        const auto* table = target.m_Service->GetMethodTable();
+        target.m_Entry = table ? &table[target.m_Method->index()] : nullptr;
+        return target;
+    }
+
+    //! Budget is counted from the moment request is handled, channel which received or queued it sets a shorter deadline
+    static boost::posix_time::time_duration GetBudget(const proto::BasePacket& base)
+    {
+        if (!base.timeout())
+            return boost::posix_time::pos_infin;
+        return boost::posix_time::milliseconds(base.timeout());
+    }
+
+    static void ThrowIfExpired(const proto::BasePacket& base)
+    {
+        const auto remaining = CallDeadline::Remaining();
+        if (!remaining.is_pos_infinity() && remaining <= boost::posix_time::time_duration())
+            BOOST_THROW_EXCEPTION(TimeoutException("Request dropped, deadline of the caller expired: %s", base.ShortDebugString()));
+    }
+
+    static void SetRequestStream(const Target& target, gp::Message& request, const IStream& stream)
+    {
+        auto* streamHolder = target.m_Entry ? target.m_Entry->m_StreamHolder(request) : dynamic_cast<details::StreamHolder*>(&request);
+        if (!streamHolder)
+            BOOST_THROW_EXCEPTION(Exception("Unexpected stream data, method doesn't accept stream: %s", target.m_Method->full_name()));
+
+        streamHolder->Stream(stream);
+    }
+
+    //! Request is dispatched once its stream ends, with data collected in memory or in a mapped temporary file past threshold
+    void CollectAndDispatch(const proto::BasePacket& currentBase, const Target& target, const MessagePtr& request, const ChunkedStream::Ptr& chunks, const rpc::ISequencedChannel::Ptr& channel)
+    {
+        // method must accept the stream before it's collected
+        SetRequestStream(target, *request, IStream());
+
+        const auto base = boost::make_shared<proto::BasePacket>(currentBase);
+        const auto deadline = CallDeadline::Current();
+        const auto instance = shared_from_this();
+        const boost::weak_ptr<rpc::ISequencedChannel> weak = channel;
+
+        channel->GetSink()->Collect(chunks, [instance, base, target, request, weak, deadline](const IStream& stream, const boost::exception_ptr& e){
+            const auto channel = weak.lock();
+            if (!channel)
+                return;
+
+            try
+            {
+                if (e)
+                    boost::rethrow_exception(e);
+
+                const CallDeadline scope(CallDeadline::Remaining(deadline));
+                ThrowIfExpired(*base);
+
+                SetRequestStream(target, *request, stream);
+                instance->Dispatch(*base, target, request, channel);
+            }
+            catch (const std::exception& ex)
+            {
+                LOG_ERROR("Failed to collect request stream: %s, error: %s", base->ShortDebugString(), boost::diagnostic_information(ex));
+                SendError(*base, channel, ex);
+            }
+        });
+    }
+
+    static void SendError(proto::BasePacket base, const rpc::ISequencedChannel::Ptr& channel, const std::exception& e)
+    {
+        if (!base.packetid())
+            return;
+
+        base.set_direction(proto::BasePacket::Response);
+        base.set_error(conv::cast<std::string>(boost::diagnostic_information(e)));
+        channel->GetSink()->Push(base, nullptr, IStream());
+    }
+
+    void Dispatch(const proto::BasePacket& currentBase, const Target& target, const MessagePtr& request, const rpc::ISequencedChannel::Ptr& channel)
+    {
+        const auto* methodDesc = target.m_Method;
+        const auto* entry = target.m_Entry;
+        const auto& front = target.m_Service;
+        const MessagePtr response(entry ? entry->m_AcquireResponse() : front->AcquireResponse(*methodDesc));
+
         struct ResponseAccess : public details::ResponseHolder
         {
             void SetChannel(const rpc::ISequencedChannel::Ptr& c) { m_Channel = c; }
             void SetBase(const proto::BasePacket& in)
             {
-                m_Base = std::make_unique<proto::BasePacket>(in);
+                // recycled response keeps previously allocated base packet
+                if (m_Base)
+                    m_Base->CopyFrom(in);
+                else
+                    m_Base = std::make_unique<proto::BasePacket>(in);
+
                 auto& base = static_cast<proto::BasePacket&>(*m_Base);
                 base.set_direction(proto::BasePacket::Response);
             }
@@ -192,14 +436,15 @@ public:
             void SetInstance(const rpc::InstanceId& id) { m_InstanceId = id; }
             void SetIsResponseRequired(bool value) { m_IsResponseRequired = value; }
             void SetMethodDescriptor(const gp::MethodDescriptor* value) { m_MethodDescriptor = value; }
+            void SetDeadline(const CallDeadline::Clock::time_point& value) { m_Deadline = value; }
         };
 
         // set up request and response additional data
-        auto responseHolder = dynamic_cast<details::PacketHolder*>(rawResponse.get());
+        auto* responseHolder = entry ? &entry->m_ResponseHolder(*response) : dynamic_cast<details::ResponseHolder*>(response.get());
         assert(responseHolder && "Can't extract stream holder from response, generated service is invalid");
         auto* responseAccessor = static_cast<ResponseAccess*>(responseHolder);
 
-        auto requestHolder = dynamic_cast<details::RequestAndInfoHolder*>(rawRequest.get());
+        auto* requestHolder = entry ? &entry->m_RequestHolder(*request) : dynamic_cast<details::RequestAndInfoHolder*>(request.get());
         assert(requestHolder && "Can't extract info holder from request, generated service is invalid");
         auto* requestAccessor = static_cast<RequestAccess*>(requestHolder);
 
@@ -216,19 +461,28 @@ public:
         // set up method descriptor
         requestAccessor->SetMethodDescriptor(methodDesc);
 
+        // calls made by handlers while dispatching inherit the deadline, later ones may use the remaining budget
+        requestAccessor->SetDeadline(CallDeadline::Current());
+
+        // caller may cancel the call until response is sent
+        if (currentBase.packetid())
+            channel->GetSink()->AddIncoming(currentBase.packetid(), boost::shared_ptr<details::RequestAndInfoHolder>(request, requestHolder));
+
         // initialize response
         responseAccessor->SetBase(currentBase);
         responseAccessor->SetMethod(methodDesc);
-        responseAccessor->SetService(&services.front()->GetDescriptor());
+        responseAccessor->SetService(&front->GetDescriptor());
 
-        LOG_TRACE("Handling request [%s] by local handler", methodDesc->full_name());
+        RPC_TRACE_PACKET(TRACE, currentBase.packetid(), "Handling request [%s] by local handler", methodDesc->full_name());
 
         const auto instance(shared_from_this());
-        const MessagePtr request(rawRequest.release());
-        const MessagePtr response(rawResponse.release());
 
-        for (auto& service : services)
+        for (const auto& weak : *target.m_Services)
         {
+            const auto service = weak.lock();
+            if (!service)
+                continue;
+
             try
             {
                 service->CallMethod(*methodDesc, request, response);
@@ -243,44 +497,16 @@ public:
                                                   service->GetDescriptor().full_name());
             }
         }
-
-        return true;
-    }
-
-    virtual void HandleResponse(const gp::Message&, const InstanceId&) override {}
-
-    virtual void ProvideService(const boost::weak_ptr<IService>& svc) override
-    {
-        boost::unique_lock<boost::mutex> lock(m_ServiceMutex);
-        m_Services.emplace_back(svc);
-    }
-
-    virtual void RemoveService(const boost::weak_ptr<IService>& svc) override
-    {
-        boost::unique_lock<boost::mutex> lock(m_ServiceMutex);
-        const auto it = boost::find_if(m_Services, boost::bind(&boost::weak_ptr<IService>::lock, _1) == svc.lock());
-        if (it != m_Services.end())
-            m_Services.erase(it);
-    }
-
-    virtual bool HasService(const rpc::IService::Id& id) const override
-    {
-        boost::unique_lock<boost::mutex> lock(m_ServiceMutex);
-        for (const auto& svc : m_Services)
-        {
-            if (const auto s = svc.lock())
-            {
-                if (s->GetId() == id)
-                    return true;
-            }
-        }
-        return false;
     }
 
 private:
     boost::asio::io_service& m_Service;
-    std::vector<boost::weak_ptr<IService>> m_Services;
-    mutable boost::mutex m_ServiceMutex;
+
+    //! Immutable snapshot of provided services, replaced as a whole on each change
+    ServiceIndexPtr m_Services;
+
+    //! Serializes snapshot writers
+    boost::mutex m_ServiceMutex;
 };
 
 
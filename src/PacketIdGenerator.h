@@ -0,0 +1,36 @@
+#pragma once
+
+#include <atomic>
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace rpc
+{
+namespace details
+{
+
+//! Packet id allocator, ids are never zero and never collide with ids which are still pending after wraparound
+class PacketIdGenerator : boost::noncopyable
+{
+public:
+    explicit PacketIdGenerator(boost::uint32_t initial = 0) : m_Counter(initial) {}
+
+    //! Allocate next id, retries only for zero id and ids reported as pending by predicate
+    template<typename IsPending>
+    boost::uint32_t Next(const IsPending& isPending)
+    {
+        for (;;)
+        {
+            const boost::uint32_t id = m_Counter.fetch_add(1, std::memory_order_relaxed) + 1;
+            if (id && !isPending(id))
+                return id;
+        }
+    }
+
+private:
+    std::atomic<boost::uint32_t> m_Counter;
+};
+
+} // namespace details
+} // namespace rpc
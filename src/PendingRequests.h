@@ -0,0 +1,232 @@
+#pragma once
+
+#include "rpc/Future.h"
+
+#include <vector>
+#include <cassert>
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace rpc
+{
+namespace details
+{
+
+//! Shared pointers indexed by packet id.
+//! Ids are spread over independently locked shards, each shard is an open addressing
+//! table with linear probing, so insert and remove don't allocate once the table is warmed up.
+template<typename Ptr>
+class PacketTable : boost::noncopyable
+{
+public:
+    enum { SHARDS_COUNT = 16, INITIAL_SHARD_CAPACITY = 64 };
+
+    typedef std::vector<Ptr> Values;
+    typedef typename Ptr::element_type Value;
+
+    //! Register value, returns false if id is already registered
+    bool Insert(boost::uint32_t id, const Ptr& value)
+    {
+        assert(id && "zero packet id is reserved");
+        return GetShard(id).Insert(id, value);
+    }
+
+    //! Remove value by id, returns empty pointer if id is unknown
+    Ptr Remove(boost::uint32_t id)
+    {
+        return GetShard(id).Remove(id, nullptr);
+    }
+
+    //! Remove value by id only if it's registered with expected value
+    Ptr Remove(boost::uint32_t id, const Ptr& expected)
+    {
+        return GetShard(id).Remove(id, expected.get());
+    }
+
+    bool Contains(boost::uint32_t id) const
+    {
+        return GetShard(id).Contains(id);
+    }
+
+    //! Value by id, empty pointer if id is unknown
+    Ptr Get(boost::uint32_t id) const
+    {
+        return GetShard(id).Get(id);
+    }
+
+    //! Remove all values
+    Values RemoveAll()
+    {
+        Values result;
+        for (auto& shard : m_Shards)
+            shard.RemoveAll(result);
+        return result;
+    }
+
+private:
+
+    class Shard
+    {
+        struct Slot
+        {
+            Slot() : m_Id() {}
+            boost::uint32_t m_Id;
+            Ptr m_Value;
+        };
+
+        typedef std::vector<Slot> Slots;
+
+    public:
+        Shard() : m_Slots(INITIAL_SHARD_CAPACITY), m_Size() {}
+
+        bool Insert(boost::uint32_t id, const Ptr& value)
+        {
+            boost::unique_lock<boost::mutex> lock(m_Mutex);
+
+            // keep load factor below 0.5 to keep probe sequences short
+            if ((m_Size + 1) * 2 > m_Slots.size())
+                Grow();
+
+            if (!Place(m_Slots, id, value))
+                return false;
+
+            ++m_Size;
+            return true;
+        }
+
+        Ptr Remove(boost::uint32_t id, const Value* expected)
+        {
+            boost::unique_lock<boost::mutex> lock(m_Mutex);
+
+            std::size_t hole = 0;
+            if (!Find(id, hole) || (expected && m_Slots[hole].m_Value.get() != expected))
+                return Ptr();
+
+            Ptr result;
+            result.swap(m_Slots[hole].m_Value);
+            m_Slots[hole].m_Id = 0;
+            --m_Size;
+
+            // backward shift deletion, move following entries of the cluster to the hole
+            // if the hole lies between their home slot and current position
+            const auto mask = m_Slots.size() - 1;
+            for (auto i = (hole + 1) & mask; m_Slots[i].m_Id; i = (i + 1) & mask)
+            {
+                const auto home = Home(m_Slots, m_Slots[i].m_Id);
+                if (((i - home) & mask) >= ((i - hole) & mask))
+                {
+                    std::swap(m_Slots[hole], m_Slots[i]);
+                    hole = i;
+                }
+            }
+
+            return result;
+        }
+
+        bool Contains(boost::uint32_t id) const
+        {
+            boost::unique_lock<boost::mutex> lock(m_Mutex);
+            std::size_t index = 0;
+            return Find(id, index);
+        }
+
+        Ptr Get(boost::uint32_t id) const
+        {
+            boost::unique_lock<boost::mutex> lock(m_Mutex);
+            std::size_t index = 0;
+            return Find(id, index) ? m_Slots[index].m_Value : Ptr();
+        }
+
+        void RemoveAll(Values& out)
+        {
+            boost::unique_lock<boost::mutex> lock(m_Mutex);
+            for (auto& slot : m_Slots)
+            {
+                if (!slot.m_Id)
+                    continue;
+
+                out.emplace_back();
+                out.back().swap(slot.m_Value);
+                slot.m_Id = 0;
+            }
+            m_Size = 0;
+        }
+
+    private:
+
+        static std::size_t Home(const Slots& slots, boost::uint32_t id)
+        {
+            // low bits are used to select the shard
+            return (id / SHARDS_COUNT) & (slots.size() - 1);
+        }
+
+        static bool Place(Slots& slots, boost::uint32_t id, const Ptr& value)
+        {
+            const auto mask = slots.size() - 1;
+            for (auto i = Home(slots, id);; i = (i + 1) & mask)
+            {
+                auto& slot = slots[i];
+                if (slot.m_Id == id)
+                    return false;
+
+                if (!slot.m_Id)
+                {
+                    slot.m_Id = id;
+                    slot.m_Value = value;
+                    return true;
+                }
+            }
+        }
+
+        bool Find(boost::uint32_t id, std::size_t& index) const
+        {
+            const auto mask = m_Slots.size() - 1;
+            for (auto i = Home(m_Slots, id); m_Slots[i].m_Id; i = (i + 1) & mask)
+            {
+                if (m_Slots[i].m_Id == id)
+                {
+                    index = i;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void Grow()
+        {
+            Slots slots(m_Slots.size() * 2);
+            for (const auto& slot : m_Slots)
+            {
+                if (slot.m_Id)
+                    Place(slots, slot.m_Id, slot.m_Value);
+            }
+            m_Slots.swap(slots);
+        }
+
+    private:
+        Slots m_Slots;
+        std::size_t m_Size;
+        mutable boost::mutex m_Mutex;
+    };
+
+    Shard& GetShard(boost::uint32_t id)
+    {
+        return m_Shards[id % SHARDS_COUNT];
+    }
+
+    const Shard& GetShard(boost::uint32_t id) const
+    {
+        return m_Shards[id % SHARDS_COUNT];
+    }
+
+private:
+    Shard m_Shards[SHARDS_COUNT];
+};
+
+//! Outstanding requests of the caller
+typedef PacketTable<IFuture::Ptr> PendingRequests;
+
+} // namespace details
+} // namespace rpc
@@ -0,0 +1,797 @@
+#include "rpc/SharedMemoryConnection.h"
+#include "rpc/BatchConnection.h"
+#include "rpc/Exceptions.h"
+#include "log/log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/exception/diagnostic_information.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/exceptions.hpp>
+
+#if defined(__linux__)
+#include <climits>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#if !defined(_WIN32)
+#include <cerrno>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+namespace rpc
+{
+
+namespace
+{
+
+SET_LOGGING_MODULE("Rpc");
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2, "shared memory transport requires lock free atomics");
+
+enum
+{
+    CACHE_LINE = 64,
+    RECORD_ALIGNMENT = 8,
+    MIN_RING_SIZE = 256 * 1024,
+    WAIT_INTERVAL_MS = 100      //!< waiters wake up periodically to check if peer is closed or its process is gone
+};
+
+const boost::uint32_t SEGMENT_MAGIC = 0x53435052; // "RPCS"
+const boost::uint32_t SEGMENT_VERSION = 2;
+
+//! Control block of a single producer single consumer ring, positions grow monotonically
+struct RingControl
+{
+    alignas(CACHE_LINE) std::atomic<boost::uint64_t> m_Head;   //!< end of published records
+    std::atomic<boost::uint32_t> m_DataSeq;                     //!< futex word, changed when records are published
+    std::atomic<boost::uint32_t> m_ReaderWaiting;
+
+    alignas(CACHE_LINE) std::atomic<boost::uint64_t> m_Tail;   //!< end of released records
+    std::atomic<boost::uint32_t> m_SpaceSeq;                    //!< futex word, changed when records are released
+    std::atomic<boost::uint32_t> m_WriterWaiting;               //!< number of writers waiting for space
+};
+
+//! Segment starts with the header, ring data follows, ring of the creator first
+struct SegmentHeader
+{
+    std::atomic<boost::uint32_t> m_Magic;       //!< written last by creator
+    boost::uint32_t m_Version;
+    boost::uint64_t m_RingSize;
+    std::atomic<boost::uint32_t> m_Closed[2];
+    std::atomic<boost::uint32_t> m_Pids[2];     //!< process of each side, peer which dies doesn't close its side
+    RingControl m_Rings[2];
+};
+
+//! Every prepared block is stored as a record, record never wraps around the end of the ring
+struct RecordHeader
+{
+    enum { WRAP = 1 };  //!< rest of the ring is skipped
+
+    boost::uint32_t m_Size;
+    boost::uint32_t m_Flags;
+};
+
+std::size_t Align(std::size_t size, std::size_t alignment)
+{
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+boost::uint64_t RecordSize(std::size_t size)
+{
+    return sizeof(RecordHeader) + Align(size, RECORD_ALIGNMENT);
+}
+
+std::size_t DataOffset()
+{
+    return Align(sizeof(SegmentHeader), CACHE_LINE);
+}
+
+#if defined(__linux__)
+
+//! Returns true if waiter wasn't woken up within the interval
+bool FutexWait(std::atomic<boost::uint32_t>& word, boost::uint32_t expected)
+{
+    timespec timeout = {};
+    timeout.tv_nsec = WAIT_INTERVAL_MS * 1000000;
+    return syscall(SYS_futex, reinterpret_cast<boost::uint32_t*>(&word), FUTEX_WAIT, expected, &timeout, nullptr, 0) == -1 && errno == ETIMEDOUT;
+}
+
+void FutexWake(std::atomic<boost::uint32_t>& word)
+{
+    syscall(SYS_futex, reinterpret_cast<boost::uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+#else
+
+bool FutexWait(std::atomic<boost::uint32_t>& word, boost::uint32_t expected)
+{
+    if (word.load() != expected)
+        return false;
+
+    boost::this_thread::sleep_for(boost::chrono::microseconds(100));
+    return true;
+}
+
+void FutexWake(std::atomic<boost::uint32_t>&)
+{
+}
+
+#endif
+
+void Notify(std::atomic<boost::uint32_t>& seq, const std::atomic<boost::uint32_t>& waiting)
+{
+    seq.fetch_add(1);
+    if (waiting.load())
+        FutexWake(seq);
+}
+
+boost::uint32_t GetProcessId()
+{
+#if defined(_WIN32)
+    return 0; // peer liveness is not checked
+#else
+    return static_cast<boost::uint32_t>(::getpid());
+#endif
+}
+
+//! Process of the peer exited without closing its side, e.g. it crashed. Checked by waiters which time out.
+bool IsPeerGone(const SegmentHeader& header, unsigned side)
+{
+#if defined(_WIN32)
+    return false;
+#else
+    const auto pid = header.m_Pids[1 - side].load();
+    return pid && ::kill(static_cast<pid_t>(pid), 0) != 0 && errno == ESRCH;
+#endif
+}
+
+struct Ring
+{
+    RingControl* m_Control;
+    char* m_Data;
+    boost::uint64_t m_Size;
+
+    char* At(boost::uint64_t position) const
+    {
+        return m_Data + (position & (m_Size - 1));
+    }
+};
+
+//! Mapped segment, creator removes it on destruction
+class Segment : boost::noncopyable
+{
+public:
+    typedef boost::shared_ptr<Segment> Ptr;
+
+    Segment(const std::string& name, std::size_t ringSize)
+        : m_Name(name)
+        , m_IsOwner(true)
+    {
+        namespace ip = boost::interprocess;
+
+        std::size_t size = MIN_RING_SIZE;
+        while (size < ringSize)
+            size *= 2;
+
+        try
+        {
+            ip::shared_memory_object::remove(name.c_str());
+            ip::shared_memory_object shm(ip::create_only, name.c_str(), ip::read_write);
+            shm.truncate(static_cast<ip::offset_t>(DataOffset() + size * 2));
+            m_Region = ip::mapped_region(shm, ip::read_write);
+        }
+        catch (const ip::interprocess_exception& e)
+        {
+            BOOST_THROW_EXCEPTION(Exception("Failed to create shared memory segment: %s, error: %s", name, e.what()));
+        }
+
+        auto& header = *new (m_Region.get_address()) SegmentHeader();
+        header.m_Version = SEGMENT_VERSION;
+        header.m_RingSize = size;
+        header.m_Magic.store(SEGMENT_MAGIC);
+    }
+
+    explicit Segment(const std::string& name)
+        : m_Name(name)
+        , m_IsOwner(false)
+    {
+        namespace ip = boost::interprocess;
+
+        try
+        {
+            ip::shared_memory_object shm(ip::open_only, name.c_str(), ip::read_write);
+            m_Region = ip::mapped_region(shm, ip::read_write);
+        }
+        catch (const ip::interprocess_exception& e)
+        {
+            BOOST_THROW_EXCEPTION(Exception("Failed to open shared memory segment: %s, error: %s", name, e.what()));
+        }
+
+        if (m_Region.get_size() < DataOffset() || Header().m_Magic.load() != SEGMENT_MAGIC)
+            BOOST_THROW_EXCEPTION(Exception("Shared memory segment is not initialized: %s", name));
+        if (Header().m_Version != SEGMENT_VERSION)
+            BOOST_THROW_EXCEPTION(Exception("Unsupported shared memory segment version: %s, expected: %s", Header().m_Version, SEGMENT_VERSION));
+    }
+
+    ~Segment()
+    {
+        if (m_IsOwner)
+            boost::interprocess::shared_memory_object::remove(m_Name.c_str());
+    }
+
+    SegmentHeader& Header() const
+    {
+        return *static_cast<SegmentHeader*>(m_Region.get_address());
+    }
+
+    Ring GetRing(unsigned index) const
+    {
+        auto& header = Header();
+        const Ring ring = { &header.m_Rings[index], static_cast<char*>(m_Region.get_address()) + DataOffset() + index * header.m_RingSize, header.m_RingSize };
+        return ring;
+    }
+
+    const std::string& GetName() const
+    {
+        return m_Name;
+    }
+
+private:
+    const std::string m_Name;
+    const bool m_IsOwner;
+    boost::interprocess::mapped_region m_Region;
+};
+
+//! Consumer side of the ring. Records are released in order when streams pointing to them are destroyed.
+class Reader : public boost::enable_shared_from_this<Reader>, boost::noncopyable
+{
+    struct Region
+    {
+        boost::uint64_t m_End;
+        bool m_IsReleased;
+    };
+
+    //! Stream over record data in the ring
+    class InPlaceStream : public boost::iostreams::stream<boost::iostreams::array_source>
+    {
+    public:
+        InPlaceStream(const char* data, std::size_t size, const boost::shared_ptr<Reader>& reader, boost::uint64_t end)
+            : boost::iostreams::stream<boost::iostreams::array_source>(data, size)
+            , m_Reader(reader)
+            , m_End(end)
+        {
+        }
+
+        ~InPlaceStream()
+        {
+            m_Reader->Release(m_End);
+        }
+
+    private:
+        const boost::shared_ptr<Reader> m_Reader;
+        const boost::uint64_t m_End;
+    };
+
+    //! Stream over copy of the record data
+    class CopiedStream : private std::vector<char>, public boost::iostreams::stream<boost::iostreams::array_source>
+    {
+    public:
+        CopiedStream(const char* data, std::size_t size)
+            : std::vector<char>(data, data + size)
+            , boost::iostreams::stream<boost::iostreams::array_source>(std::vector<char>::data(), size)
+        {
+        }
+    };
+
+public:
+    typedef boost::shared_ptr<Reader> Ptr;
+
+    Reader(const Segment::Ptr& segment, unsigned side)
+        : m_Segment(segment)
+        , m_Side(side)
+        , m_Ring(segment->GetRing(1 - side))
+        , m_PeerClosed(segment->Header().m_Closed[1 - side])
+        , m_Position(m_Ring.m_Control->m_Tail.load())
+    {
+    }
+
+    //! Blocks until next record is published, returns empty stream when peer is closed or reader is stopped.
+    //! Throws if the record doesn't fit published data, ring is corrupted and can't be read any further,
+    //! or if process of the peer is gone.
+    net::IConnection::StreamPtr Next(const std::atomic<bool>& stop)
+    {
+        auto& control = *m_Ring.m_Control;
+        for (;;)
+        {
+            const auto head = control.m_Head.load(std::memory_order_acquire);
+            if (m_Position == head)
+            {
+                if (stop || m_PeerClosed.load())
+                    return net::IConnection::StreamPtr();
+
+                const auto seq = control.m_DataSeq.load();
+                control.m_ReaderWaiting.store(1);
+                bool isIdle = false;
+                if (m_Position == control.m_Head.load() && !stop && !m_PeerClosed.load())
+                    isIdle = FutexWait(control.m_DataSeq, seq);
+                control.m_ReaderWaiting.store(0);
+
+                if (isIdle && IsPeerGone(m_Segment->Header(), m_Side))
+                    BOOST_THROW_EXCEPTION(Exception("Peer process of shared memory segment is gone: %s", m_Segment->GetName()));
+                continue;
+            }
+
+            const auto offset = m_Position & (m_Ring.m_Size - 1);
+            if (head - m_Position < sizeof(RecordHeader) || head - m_Position > m_Ring.m_Size)
+                BOOST_THROW_EXCEPTION(Exception("Invalid shared memory ring head: %s, position: %s", head, m_Position));
+
+            const auto& record = *reinterpret_cast<const RecordHeader*>(m_Ring.At(m_Position));
+            if (record.m_Flags == RecordHeader::WRAP)
+            {
+                const auto next = m_Position + m_Ring.m_Size - offset;
+                if (next > head)
+                    BOOST_THROW_EXCEPTION(Exception("Wrap record at: %s is past published data: %s", m_Position, head));
+
+                m_Position = next;
+                Track(m_Position, true);
+                continue;
+            }
+
+            // only wrap records may reach the end of the ring, records are parsed in place
+            const std::size_t size = record.m_Size;
+            const auto recordSize = RecordSize(size);
+            if (record.m_Flags || recordSize > head - m_Position || recordSize > m_Ring.m_Size / 2 || offset + recordSize > m_Ring.m_Size)
+                BOOST_THROW_EXCEPTION(Exception("Invalid shared memory record at: %s, size: %s, flags: %s, published: %s", m_Position, size, record.m_Flags, head - m_Position));
+
+            const auto* data = m_Ring.At(m_Position) + sizeof(RecordHeader);
+            m_Position += recordSize;
+
+            // keep at most half of the ring pinned by streams, so writer doesn't stall on a slow consumer
+            if (m_Position - control.m_Tail.load() > m_Ring.m_Size / 2)
+            {
+                const auto stream = boost::make_shared<CopiedStream>(data, size);
+                Track(m_Position, true);
+                return stream;
+            }
+
+            Track(m_Position, false);
+            return boost::make_shared<InPlaceStream>(data, size, shared_from_this(), m_Position);
+        }
+    }
+
+    void Release(boost::uint64_t end)
+    {
+        boost::unique_lock<boost::mutex> lock(m_Mutex);
+        for (auto& region : m_Regions)
+        {
+            if (region.m_End == end)
+            {
+                region.m_IsReleased = true;
+                break;
+            }
+        }
+        Advance();
+    }
+
+private:
+    void Track(boost::uint64_t end, bool isReleased)
+    {
+        boost::unique_lock<boost::mutex> lock(m_Mutex);
+        m_Regions.push_back(Region{ end, isReleased });
+        if (isReleased)
+            Advance();
+    }
+
+    //! Move tail over leading released records and wake up writer
+    void Advance()
+    {
+        boost::uint64_t tail = 0;
+        while (!m_Regions.empty() && m_Regions.front().m_IsReleased)
+        {
+            tail = m_Regions.front().m_End;
+            m_Regions.pop_front();
+        }
+
+        if (!tail)
+            return;
+
+        auto& control = *m_Ring.m_Control;
+        control.m_Tail.store(tail);
+        Notify(control.m_SpaceSeq, control.m_WriterWaiting);
+    }
+
+private:
+    const Segment::Ptr m_Segment;
+    const unsigned m_Side;
+    const Ring m_Ring;
+    std::atomic<boost::uint32_t>& m_PeerClosed;
+    boost::uint64_t m_Position;
+
+    boost::mutex m_Mutex;
+    std::deque<Region> m_Regions;
+};
+
+class SharedMemoryConnection : public ISharedMemoryConnection, public IBatchConnection
+{
+public:
+    //! Records reserved in the ring one after another, committed when destroyed. Other writers may reserve records meanwhile,
+    //! records are published in order of reservation once all records before them are committed.
+    class RecordData : public net::details::IData
+    {
+    public:
+        RecordData(SharedMemoryConnection& parent, boost::uint64_t position, const std::size_t* sizes, std::size_t count)
+            : m_Parent(parent)
+            , m_End(position)
+            , m_Size()
+            , m_Written()
+            , m_Index()
+            , m_Offset()
+        {
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                auto& record = *reinterpret_cast<RecordHeader*>(parent.m_WriteRing.At(m_End));
+                record.m_Size = static_cast<boost::uint32_t>(sizes[i]);
+                record.m_Flags = 0;
+
+                if (sizes[i])
+                    m_Buffers.emplace_back(boost::asio::buffer(parent.m_WriteRing.At(m_End) + sizeof(RecordHeader), sizes[i]));
+
+                m_End += RecordSize(sizes[i]);
+                m_Size += sizes[i];
+            }
+        }
+
+        ~RecordData()
+        {
+            m_Parent.Commit(m_End);
+        }
+
+        //! Data is written to the records in order
+        virtual void Write(const void* data, std::size_t size) override
+        {
+            if (m_Written + size > m_Size)
+                BOOST_THROW_EXCEPTION(Exception("Record overflow, size: %s, written: %s", m_Size, m_Written + size));
+
+            m_Written += size;
+            const char* source = static_cast<const char*>(data);
+            while (size)
+            {
+                const auto& buffer = m_Buffers[m_Index];
+                const auto toCopy = std::min(size, boost::asio::buffer_size(buffer) - m_Offset);
+                std::memcpy(boost::asio::buffer_cast<char*>(buffer) + m_Offset, source, toCopy);
+
+                source += toCopy;
+                size -= toCopy;
+                m_Offset += toCopy;
+                if (m_Offset == boost::asio::buffer_size(buffer))
+                {
+                    ++m_Index;
+                    m_Offset = 0;
+                }
+            }
+        }
+
+        virtual const std::vector<boost::asio::mutable_buffer>& GetBuffers() override
+        {
+            return m_Buffers;
+        }
+
+        std::size_t GetRemaining() const
+        {
+            return m_Size - m_Written;
+        }
+
+    private:
+        SharedMemoryConnection& m_Parent;
+        boost::uint64_t m_End;
+        std::size_t m_Size;
+        std::size_t m_Written;
+        std::size_t m_Index;
+        std::size_t m_Offset;
+        std::vector<boost::asio::mutable_buffer> m_Buffers;
+    };
+
+    //! Batch which doesn't fit half of the ring, each run of its records is reserved separately
+    class BatchData : public net::details::IData
+    {
+    public:
+        explicit BatchData(std::vector<boost::shared_ptr<RecordData>>&& runs) : m_Runs(std::move(runs)), m_Index()
+        {
+            for (const auto& run : m_Runs)
+                m_Buffers.insert(m_Buffers.end(), run->GetBuffers().begin(), run->GetBuffers().end());
+        }
+
+        virtual void Write(const void* data, std::size_t size) override
+        {
+            const char* source = static_cast<const char*>(data);
+            while (size)
+            {
+                if (m_Index == m_Runs.size())
+                    BOOST_THROW_EXCEPTION(Exception("Batch overflow, remaining: %s", size));
+
+                const auto toWrite = std::min(size, m_Runs[m_Index]->GetRemaining());
+                m_Runs[m_Index]->Write(source, toWrite);
+                source += toWrite;
+                size -= toWrite;
+                if (!m_Runs[m_Index]->GetRemaining())
+                    ++m_Index;
+            }
+        }
+
+        virtual const std::vector<boost::asio::mutable_buffer>& GetBuffers() override
+        {
+            return m_Buffers;
+        }
+
+    private:
+        const std::vector<boost::shared_ptr<RecordData>> m_Runs;
+        std::size_t m_Index;
+        std::vector<boost::asio::mutable_buffer> m_Buffers;
+    };
+
+    //! Reserved region of the ring, wrap record before the record belongs to it
+    struct Reservation
+    {
+        boost::uint64_t m_End;
+        boost::thread::id m_Writer;
+        bool m_IsCommitted;
+    };
+
+    SharedMemoryConnection(boost::asio::io_service& svc, const Segment::Ptr& segment, unsigned side)
+        : m_Strand(svc)
+        , m_Segment(segment)
+        , m_Side(side)
+        , m_WriteRing(segment->GetRing(side))
+        , m_WritePosition(m_WriteRing.m_Control->m_Head.load())
+        , m_PublishedPosition(m_WritePosition)
+        , m_Reader(boost::make_shared<Reader>(segment, side))
+        , m_Stop(false)
+    {
+        segment->Header().m_Pids[side].store(GetProcessId());
+    }
+
+    ~SharedMemoryConnection()
+    {
+        Close();
+    }
+
+    virtual void Receive(const Callback& callback) override
+    {
+        boost::unique_lock<boost::mutex> lock(m_ThreadMutex);
+        if (m_Thread.joinable() || m_Stop)
+            return;
+
+        m_Thread = boost::thread(&SharedMemoryConnection::ReadLoop, this, callback);
+    }
+
+    virtual void Close() override
+    {
+        if (m_Stop.exchange(true))
+            return;
+
+        auto& header = m_Segment->Header();
+        header.m_Closed[m_Side].store(1);
+
+        // wake up peer reader and writer, then our own reader
+        auto& write = *m_WriteRing.m_Control;
+        Notify(write.m_DataSeq, write.m_ReaderWaiting);
+        auto& read = header.m_Rings[1 - m_Side];
+        Notify(read.m_SpaceSeq, read.m_WriterWaiting);
+        Notify(read.m_DataSeq, read.m_ReaderWaiting);
+
+        boost::unique_lock<boost::mutex> lock(m_ThreadMutex);
+        if (m_Thread.joinable() && m_Thread.get_id() != boost::this_thread::get_id())
+            m_Thread.join();
+    }
+
+    virtual net::details::IData::Ptr Prepare(std::size_t size) override
+    {
+        return Reserve(&size, 1);
+    }
+
+    virtual net::details::IData::Ptr PrepareBatch(const std::vector<std::size_t>& sizes) override
+    {
+        // records of the batch are reserved at once, unless they don't fit half of the ring together
+        std::vector<boost::shared_ptr<RecordData>> runs;
+        std::size_t first = 0;
+        boost::uint64_t runSize = 0;
+        for (std::size_t i = 0; i < sizes.size(); ++i)
+        {
+            const auto recordSize = RecordSize(sizes[i]);
+            if (i != first && runSize + recordSize > m_WriteRing.m_Size / 2)
+            {
+                runs.push_back(Reserve(&sizes[first], i - first));
+                first = i;
+                runSize = 0;
+            }
+            runSize += recordSize;
+        }
+
+        if (first != sizes.size())
+            runs.push_back(Reserve(&sizes[first], sizes.size() - first));
+
+        if (runs.size() == 1)
+            return runs.front();
+        return boost::make_shared<BatchData>(std::move(runs));
+    }
+
+    virtual void Flush() override
+    {
+    }
+
+    virtual std::string GetInfo() const override
+    {
+        return "shm:" + m_Segment->GetName();
+    }
+
+private:
+    //! Reserve contiguous records, record prepared while the writer holds another one may exceed the limit of unpublished data
+    boost::shared_ptr<RecordData> Reserve(const std::size_t* sizes, std::size_t count)
+    {
+        boost::uint64_t recordSize = 0;
+        for (std::size_t i = 0; i < count; ++i)
+            recordSize += RecordSize(sizes[i]);
+
+        if (recordSize > m_WriteRing.m_Size / 2)
+            BOOST_THROW_EXCEPTION(Exception("Block is too large for shared memory ring: %s, ring size: %s", recordSize, m_WriteRing.m_Size));
+
+        const auto writer = boost::this_thread::get_id();
+        boost::unique_lock<boost::mutex> lock(m_WriteMutex);
+
+        // record prepared while the writer holds another one is published after it, so writers which
+        // don't hold records keep unpublished records within half of the ring and leave the rest to nested ones
+        const bool isNested = std::any_of(m_Reservations.begin(), m_Reservations.end(), [&writer](const Reservation& r){
+            return r.m_Writer == writer && !r.m_IsCommitted;
+        });
+
+        boost::uint64_t start = 0;
+        boost::uint64_t position = 0;
+        for (;;)
+        {
+            // records are contiguous, so they may be parsed in place, skip the rest of the ring
+            start = m_WritePosition;
+            const auto contiguous = m_WriteRing.m_Size - (start & (m_WriteRing.m_Size - 1));
+            position = contiguous < recordSize ? start + contiguous : start;
+
+            if (isNested || m_Reservations.empty() || position + recordSize - m_PublishedPosition <= m_WriteRing.m_Size / 2)
+                break;
+
+            m_Published.wait(lock);
+        }
+
+        m_WritePosition = position + recordSize;
+        m_Reservations.push_back(Reservation{ m_WritePosition, writer, false });
+        lock.unlock();
+
+        // region is reserved, writers of records reserved before may commit them meanwhile
+        WaitForSpace(position + recordSize);
+
+        if (position != start)
+        {
+            auto& wrap = *reinterpret_cast<RecordHeader*>(m_WriteRing.At(start));
+            wrap.m_Size = 0;
+            wrap.m_Flags = RecordHeader::WRAP;
+        }
+
+        return boost::make_shared<RecordData>(*this, position, sizes, count);
+    }
+
+    //! Publish leading committed records, wrap record written before a record becomes visible with it
+    void Commit(boost::uint64_t end)
+    {
+        boost::unique_lock<boost::mutex> lock(m_WriteMutex);
+        for (auto& reservation : m_Reservations)
+        {
+            if (reservation.m_End == end)
+            {
+                reservation.m_IsCommitted = true;
+                break;
+            }
+        }
+
+        boost::uint64_t head = 0;
+        while (!m_Reservations.empty() && m_Reservations.front().m_IsCommitted)
+        {
+            head = m_Reservations.front().m_End;
+            m_Reservations.pop_front();
+        }
+
+        if (!head)
+            return;
+
+        m_PublishedPosition = head;
+        m_Published.notify_all();
+
+        auto& control = *m_WriteRing.m_Control;
+        control.m_Head.store(head);
+        Notify(control.m_DataSeq, control.m_ReaderWaiting);
+    }
+
+    void WaitForSpace(boost::uint64_t end)
+    {
+        auto& control = *m_WriteRing.m_Control;
+        const auto& peerClosed = m_Segment->Header().m_Closed[1 - m_Side];
+        while (end - control.m_Tail.load() > m_WriteRing.m_Size)
+        {
+            if (m_Stop || peerClosed.load())
+                BOOST_THROW_EXCEPTION(Exception("Shared memory connection is closed: %s", m_Segment->GetName()));
+
+            const auto seq = control.m_SpaceSeq.load();
+            control.m_WriterWaiting.fetch_add(1);
+            bool isIdle = false;
+            if (end - control.m_Tail.load() > m_WriteRing.m_Size)
+                isIdle = FutexWait(control.m_SpaceSeq, seq);
+            control.m_WriterWaiting.fetch_sub(1);
+
+            if (isIdle && IsPeerGone(m_Segment->Header(), m_Side))
+                BOOST_THROW_EXCEPTION(Exception("Peer process of shared memory segment is gone: %s", m_Segment->GetName()));
+        }
+    }
+
+    void ReadLoop(const Callback& callback)
+    {
+        try
+        {
+            while (const auto stream = m_Reader->Next(m_Stop))
+                m_Strand.post(boost::bind(callback, stream));
+        }
+        catch (const std::exception& e)
+        {
+            LOG_ERROR("Failed to read from shared memory segment: %s, error: %s", m_Segment->GetName(), boost::diagnostic_information(e));
+        }
+
+        // peer is gone or ring is corrupted, empty stream closes the channel
+        if (!m_Stop)
+            m_Strand.post(boost::bind(callback, StreamPtr()));
+    }
+
+private:
+    boost::asio::io_service::strand m_Strand;
+    const Segment::Ptr m_Segment;
+    const unsigned m_Side;
+
+    const Ring m_WriteRing;
+    boost::mutex m_WriteMutex;                  //!< never held while waiting for space
+    boost::uint64_t m_WritePosition;            //!< end of reserved records
+    boost::uint64_t m_PublishedPosition;        //!< end of published records
+    boost::condition_variable m_Published;
+    std::deque<Reservation> m_Reservations;     //!< reserved records which are not published yet
+
+    const Reader::Ptr m_Reader;
+    std::atomic<bool> m_Stop;
+    boost::mutex m_ThreadMutex;
+    boost::thread m_Thread;
+};
+
+} // anonymous namespace
+
+ISharedMemoryConnection::Ptr ISharedMemoryConnection::Create(boost::asio::io_service& svc, const std::string& name, std::size_t ringSize)
+{
+    return boost::make_shared<SharedMemoryConnection>(svc, boost::make_shared<Segment>(name, ringSize), 0);
+}
+
+ISharedMemoryConnection::Ptr ISharedMemoryConnection::Open(boost::asio::io_service& svc, const std::string& name)
+{
+    return boost::make_shared<SharedMemoryConnection>(svc, boost::make_shared<Segment>(name), 1);
+}
+
+} // namespace rpc
@@ -0,0 +1,194 @@
+#include "rpc/SpillStream.h"
+#include "rpc/FileStream.h"
+#include "rpc/Exceptions.h"
+#include "net/connection.hpp"
+
+#include <memory>
+#include <sstream>
+
+#include <google/protobuf/message.h>
+
+#include <boost/make_shared.hpp>
+#include <boost/filesystem/operations.hpp>
+
+namespace rpc
+{
+
+namespace
+{
+
+//! Chunks are written until the first failure, the rest is dropped and the failure is reported at the end.
+//! Spilled file is released once the stream ends, the stream keeps its callback.
+struct Collector
+{
+    Collector(const SpillStream::Settings& settings) : m_Spill(new SpillStream(settings)) {}
+
+    std::unique_ptr<SpillStream> m_Spill;
+    boost::exception_ptr m_Exception;
+};
+
+} // anonymous namespace
+
+SpillStream::SpillStream(const Settings& settings)
+    : m_Settings(settings)
+    , m_Size()
+{
+}
+
+SpillStream::~SpillStream()
+{
+    if (m_Path.empty())
+        return;
+
+    m_File.close();
+    boost::system::error_code e;
+    boost::filesystem::remove(m_Path, e);
+}
+
+void SpillStream::Write(const char* data, std::size_t size)
+{
+    if (!m_File.is_open())
+    {
+        if (!m_Settings.m_Threshold || m_Size + size <= m_Settings.m_Threshold)
+        {
+            m_Memory.append(data, size);
+            m_Size += size;
+            return;
+        }
+
+        Open();
+    }
+
+    if (!m_File.write(data, size))
+        BOOST_THROW_EXCEPTION(Exception("Failed to write temporary file: %s, size: %s", m_Path, m_Size));
+
+    m_Size += size;
+}
+
+void SpillStream::Write(std::istream& stream)
+{
+    char buffer[64 * 1024];
+    while (stream)
+    {
+        const auto read = static_cast<std::size_t>(stream.read(buffer, sizeof(buffer)).gcount());
+        if (!read)
+            break;
+
+        Write(buffer, read);
+    }
+}
+
+boost::uint64_t SpillStream::GetSize() const
+{
+    return m_Size;
+}
+
+bool SpillStream::IsSpilled() const
+{
+    return m_File.is_open();
+}
+
+IStream SpillStream::Finish()
+{
+    if (!m_File.is_open())
+        return boost::make_shared<std::istringstream>(m_Memory);
+
+    m_File.close();
+    if (m_File.fail())
+        BOOST_THROW_EXCEPTION(Exception("Failed to write temporary file: %s, size: %s", m_Path, m_Size));
+
+    // file is owned by the stream from now on
+    const auto path = m_Path;
+    m_Path.clear();
+    return FileStream::Temporary(path);
+}
+
+void SpillStream::Open()
+{
+    const auto directory = m_Settings.m_Directory.empty() ? boost::filesystem::temp_directory_path() : boost::filesystem::path(m_Settings.m_Directory);
+    m_Path = (directory / boost::filesystem::unique_path("rpc-%%%%-%%%%-%%%%-%%%%.spill")).string();
+
+    m_File.open(m_Path.c_str(), std::ios::binary | std::ios::trunc);
+    if (!m_File.is_open())
+    {
+        m_Path.clear();
+        BOOST_THROW_EXCEPTION(Exception("Failed to create temporary file in: %s", directory.string()));
+    }
+
+    if (!m_File.write(m_Memory.data(), m_Memory.size()))
+        BOOST_THROW_EXCEPTION(Exception("Failed to write temporary file: %s, size: %s", m_Path, m_Size));
+
+    std::string().swap(m_Memory);
+}
+
+IStream SpillStream::Spill(const IStream& stream, const Settings& settings)
+{
+    if (!stream || !settings.m_Threshold || ChunkedStream::Cast(stream) || FileStream::Cast(stream))
+        return stream;
+
+    if (net::StreamSize(*stream) <= settings.m_Threshold)
+        return stream;
+
+    SpillStream spill(settings);
+    spill.Write(*stream);
+    return spill.Finish();
+}
+
+void SpillStream::Collect(const ChunkedStream::Ptr& stream, const Settings& settings, const Callback& callback)
+{
+    const auto collector = boost::make_shared<Collector>(settings);
+
+    // rest of the packet which opened the stream, e.g. response message, precedes the chunks
+    if (stream->rdbuf())
+    {
+        try
+        {
+            collector->m_Spill->Write(*stream);
+        }
+        catch (const std::exception&)
+        {
+            collector->m_Exception = boost::current_exception();
+        }
+    }
+
+    // producer is not stalled even if data is dropped, otherwise it never ends the stream
+    stream->SetAutoGrant(1);
+    stream->Read([collector, callback](const IStream& chunk, const boost::exception_ptr& e){
+        if (chunk)
+        {
+            if (collector->m_Spill && !collector->m_Exception)
+            {
+                try
+                {
+                    collector->m_Spill->Write(*chunk);
+                }
+                catch (const std::exception&)
+                {
+                    collector->m_Exception = boost::current_exception();
+                }
+            }
+            return;
+        }
+
+        const std::unique_ptr<SpillStream> spill(std::move(collector->m_Spill));
+        if (e || collector->m_Exception)
+        {
+            callback(IStream(), e ? e : collector->m_Exception);
+            return;
+        }
+
+        IStream result;
+        boost::exception_ptr error;
+        try
+        {
+            result = spill->Finish();
+        }
+        catch (const std::exception&)
+        {
+            error = boost::current_exception();
+        }
+        callback(result, error);
+    });
+}
+
+} // namespace rpc
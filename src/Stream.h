@@ -4,13 +4,24 @@
 #include "net/details/memory.hpp"
 #include "net/details/stream.hpp"
 #include "rpc/Exceptions.h"
+#include "rpc/FileStream.h"
 
 #include "rpc/Base.h"
 
 #include <google/protobuf/message.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream.h>
 
 #include <boost/cstdint.hpp>
 #include <boost/iostreams/stream.hpp>
+#include <boost/asio/buffer.hpp>
+
+#include <vector>
+#include <utility>
+#include <limits>
+#include <cstring>
+#include <istream>
+#include <algorithm>
 
 
 namespace rpc
@@ -18,10 +29,74 @@ namespace rpc
 namespace details
 {
 
+//! Unread part of the stream buffer get area, allows to read received data without copying.
+//! Streams over contiguous memory (string streams, array devices, received packets) expose all their data.
+class StreamView
+{
+public:
+    //! Unread contiguous bytes, empty if stream buffer doesn't keep its data in memory
+    static std::pair<const char*, std::size_t> Get(std::istream& s)
+    {
+        if (s.rdstate() != std::ios::goodbit || !s.rdbuf())
+            return std::pair<const char*, std::size_t>(nullptr, 0);
+
+        auto& buffer = *s.rdbuf();
+        const char* begin = (buffer.*Access::GetPtr())();
+        const char* end = (buffer.*Access::GetEndPtr())();
+        return std::pair<const char*, std::size_t>(begin, begin ? end - begin : 0);
+    }
+
+    //! Mark bytes returned by Get as read
+    static void Consume(std::istream& s, std::size_t size)
+    {
+        auto& buffer = *s.rdbuf();
+        for (const auto step = static_cast<std::size_t>(std::numeric_limits<int>::max()); size;)
+        {
+            const auto bump = std::min(size, step);
+            (buffer.*Access::GetBump())(static_cast<int>(bump));
+            size -= bump;
+        }
+    }
+
+private:
+    //! Members of stream buffer are protected, pointers to them may be taken only in derived class
+    struct Access : std::streambuf
+    {
+        typedef char* (std::streambuf::*PtrFn)() const;
+        typedef void (std::streambuf::*BumpFn)(int);
+
+        static PtrFn GetPtr() { return &Access::gptr; }
+        static PtrFn GetEndPtr() { return &Access::egptr; }
+        static BumpFn GetBump() { return &Access::gbump; }
+    };
+};
+
 class ReadStream
 {
 public:
     static boost::uint32_t Read(std::istream& s, gp::Message& message)
+    {
+        // whole message is in stream memory, parse it in place
+        const auto view = StreamView::Get(s);
+        if (view.second >= sizeof(boost::uint32_t))
+        {
+            boost::uint32_t size = 0;
+            std::memcpy(&size, view.first, sizeof(size));
+            if (view.second - sizeof(size) >= size)
+            {
+                if (size && !message.ParseFromArray(view.first + sizeof(size), size))
+                    BOOST_THROW_EXCEPTION(Exception("Failed to parse incoming packet"));
+
+                StreamView::Consume(s, sizeof(size) + size);
+                return size;
+            }
+        }
+
+        return ReadCopy(s, message);
+    }
+
+private:
+    static boost::uint32_t ReadCopy(std::istream& s, gp::Message& message)
     {
         boost::uint32_t size = 0;
         s.read(reinterpret_cast<char*>(&size), sizeof(boost::uint32_t));
@@ -46,6 +121,64 @@ public:
     }
 };
 
+//! Output stream over buffers owned by connection, used to serialize messages in place
+class BufferSequenceOutputStream : public gp::io::ZeroCopyOutputStream
+{
+public:
+    typedef std::vector<boost::asio::mutable_buffer> Buffers;
+
+    BufferSequenceOutputStream(const Buffers& buffers)
+        : m_Buffers(buffers)
+        , m_Index()
+        , m_Offset()
+        , m_ByteCount()
+    {
+    }
+
+    virtual bool Next(void** data, int* size) override
+    {
+        for (; m_Index < m_Buffers.size(); ++m_Index, m_Offset = 0)
+        {
+            const auto& buffer = m_Buffers[m_Index];
+            const auto bufferSize = boost::asio::buffer_size(buffer);
+            if (m_Offset == bufferSize)
+                continue;
+
+            *data = boost::asio::buffer_cast<char*>(buffer) + m_Offset;
+            *size = static_cast<int>(bufferSize - m_Offset);
+            m_ByteCount += *size;
+            m_Offset = bufferSize;
+            return true;
+        }
+        return false;
+    }
+
+    virtual void BackUp(int count) override
+    {
+        m_Offset -= count;
+        m_ByteCount -= count;
+    }
+
+    virtual gp::int64 ByteCount() const override
+    {
+        return m_ByteCount;
+    }
+
+    static std::size_t Size(const Buffers& buffers)
+    {
+        std::size_t result = 0;
+        for (const auto& buffer : buffers)
+            result += boost::asio::buffer_size(buffer);
+        return result;
+    }
+
+private:
+    const Buffers& m_Buffers;
+    std::size_t m_Index;
+    std::size_t m_Offset;
+    gp::int64 m_ByteCount;
+};
+
 class WriteStream
 {
 public:
@@ -70,51 +203,216 @@ public:
 
         if (streamSize + totalSize < MAX_IN_MEMORY_STREAM_SIZE)
         {
-            totalSize += streamSize;
+            const auto data = m_NextLayer->Prepare(static_cast<std::size_t>(totalSize + streamSize));
 
-            char buffer[MAX_IN_MEMORY_STREAM_SIZE];
+            // connection exposes its own buffers, serialize directly into them
+            if (WriteInPlace(*data, totalSize + streamSize, base, request, stream, streamSize))
+                return;
 
-            *reinterpret_cast<boost::uint32_t*>(buffer) = baseSize;
-            if (!base.SerializeToArray(buffer + sizeof(baseSize), baseSize))
-                BOOST_THROW_EXCEPTION(Exception("Failed to serialize base packet"));
+            WriteCopy(*data, totalSize, base, request, stream, streamSize);
+        }
+        else
+        {
+            bool inPlace = false;
+            {
+                const auto data = m_NextLayer->Prepare(static_cast<std::size_t>(totalSize));
+                inPlace = WriteInPlace(*data, totalSize, base, request, rpc::IStream(), 0);
+                if (!inPlace)
+                {
+                    boost::iostreams::stream<net::details::StreamWrapper> out(data);
+
+                    out.write(reinterpret_cast<const char*>(&baseSize), sizeof(baseSize));
+                    if (!base.SerializeToOstream(&out))
+                        BOOST_THROW_EXCEPTION(Exception("Failed to serialize base packet"));
+
+                    if (request)
+                    {
+                        out.write(reinterpret_cast<const char*>(&requestSize), sizeof(requestSize));
+                        if (!request->SerializeToOstream(&out))
+                            BOOST_THROW_EXCEPTION(Exception("Failed to serialize base packet"));
+                    }
+                }
+            }
+
+            if (stream)
+            {
+                if (const auto file = FileStream::Cast(stream))
+                    SendFile(file, streamSize);
+                else if (inPlace)
+                    SendStreamInPlace(stream, streamSize);
+                else
+                    SendStream(stream, streamSize);
+            }
+        }
+
+    }
+
+private:
+
+    //! Serializes packet into buffers owned by connection, returns false if connection has no buffers
+    static bool WriteInPlace(net::details::IData& data,
+                             uint64_t size,
+                             const gp::Message& base,
+                             const gp::Message* request,
+                             const rpc::IStream& stream,
+                             uint64_t streamSize)
+    {
+        const auto& buffers = data.GetBuffers();
+        if (BufferSequenceOutputStream::Size(buffers) < size)
+            return false;
+
+        const uint64_t headerSize = size - streamSize;
+        {
+            BufferSequenceOutputStream out(buffers);
+            gp::io::CodedOutputStream coded(&out);
+
+            const uint32_t baseSize = base.GetCachedSize();
+            coded.WriteRaw(&baseSize, sizeof(baseSize));
+            base.SerializeWithCachedSizes(&coded);
 
             if (request)
             {
-                *reinterpret_cast<boost::uint32_t*>(buffer + baseSize + sizeof(baseSize)) = requestSize;
-                if (!request->SerializeToArray(buffer + baseSize + sizeof(baseSize) + sizeof(requestSize), requestSize))
-                    BOOST_THROW_EXCEPTION(Exception("Failed to serialize base packet"));
+                const uint32_t requestSize = request->GetCachedSize();
+                coded.WriteRaw(&requestSize, sizeof(requestSize));
+                request->SerializeWithCachedSizes(&coded);
             }
 
-            if (streamSize)
-                stream->read(buffer + totalSize - streamSize, streamSize);
+            if (coded.HadError() || static_cast<uint64_t>(coded.ByteCount()) != headerSize)
+                BOOST_THROW_EXCEPTION(Exception("Failed to serialize base packet"));
+        }
+
+        if (streamSize)
+            ReadToBuffers(*stream, buffers, headerSize, streamSize);
 
-            m_NextLayer->Prepare(static_cast<std::size_t>(totalSize))->Write(buffer, static_cast<std::size_t>(totalSize));
+        return true;
+    }
+
+    //! Serializes packet into temporary buffer and copies it to the connection
+    static void WriteCopy(net::details::IData& data,
+                          uint64_t totalSize,
+                          const gp::Message& base,
+                          const gp::Message* request,
+                          const rpc::IStream& stream,
+                          uint64_t streamSize)
+    {
+        const uint32_t baseSize = base.GetCachedSize();
+        const uint32_t requestSize = request ? request->GetCachedSize() : 0;
+
+        totalSize += streamSize;
+
+        char buffer[MAX_IN_MEMORY_STREAM_SIZE];
+
+        *reinterpret_cast<boost::uint32_t*>(buffer) = baseSize;
+        if (!base.SerializeToArray(buffer + sizeof(baseSize), baseSize))
+            BOOST_THROW_EXCEPTION(Exception("Failed to serialize base packet"));
+
+        if (request)
+        {
+            *reinterpret_cast<boost::uint32_t*>(buffer + baseSize + sizeof(baseSize)) = requestSize;
+            if (!request->SerializeToArray(buffer + baseSize + sizeof(baseSize) + sizeof(requestSize), requestSize))
+                BOOST_THROW_EXCEPTION(Exception("Failed to serialize base packet"));
         }
-        else
+
+        if (streamSize)
+            stream->read(buffer + totalSize - streamSize, streamSize);
+
+        data.Write(buffer, static_cast<std::size_t>(totalSize));
+    }
+
+    //! Reads stream data directly into connection buffers starting from offset
+    static void ReadToBuffers(std::istream& stream,
+                              const BufferSequenceOutputStream::Buffers& buffers,
+                              uint64_t offset,
+                              uint64_t size)
+    {
+        for (const auto& buffer : buffers)
         {
+            if (!size)
+                break;
+
+            const auto bufferSize = boost::asio::buffer_size(buffer);
+            if (offset >= bufferSize)
             {
-                const auto data = m_NextLayer->Prepare(static_cast<std::size_t>(totalSize));
-                boost::iostreams::stream<net::details::StreamWrapper> out(data);
+                offset -= bufferSize;
+                continue;
+            }
+
+            const auto toRead = std::min<uint64_t>(bufferSize - offset, size);
+            stream.read(boost::asio::buffer_cast<char*>(buffer) + offset, static_cast<std::streamsize>(toRead));
+            if (static_cast<uint64_t>(stream.gcount()) != toRead)
+                BOOST_THROW_EXCEPTION(Exception("Stream is shorter than expected, remaining: %s", size - stream.gcount()));
+
+            size -= toRead;
+            offset = 0;
+        }
+    }
+
+    void SendStreamInPlace(const rpc::IStream& stream, uint64_t size)
+    {
+        // read stream data directly to the connection buffers
+        static const uint64_t chunkSize = MAX_IN_MEMORY_STREAM_SIZE;
+
+        for (uint64_t sent = 0; sent < size;)
+        {
+            const auto toSend = std::min(size - sent, chunkSize);
+            const auto data = m_NextLayer->Prepare(static_cast<std::size_t>(toSend));
+            const auto& buffers = data->GetBuffers();
+            if (BufferSequenceOutputStream::Size(buffers) < toSend)
+                BOOST_THROW_EXCEPTION(Exception("Connection buffers are too small: %s, expected: %s", BufferSequenceOutputStream::Size(buffers), toSend));
 
-                out.write(reinterpret_cast<const char*>(&baseSize), sizeof(baseSize));
-                if (!base.SerializeToOstream(&out))
-                    BOOST_THROW_EXCEPTION(Exception("Failed to serialize base packet"));
+            ReadToBuffers(*stream, buffers, 0, toSend);
+            sent += toSend;
+        }
+    }
 
-                if (request)
+    //! File is handed to the connection if it sends files by itself, otherwise it's read straight into connection buffers.
+    //! Mapping isn't used here, so truncated file fails the write instead of raising SIGBUS.
+    void SendFile(const FileStream::Ptr& file, uint64_t size)
+    {
+        const auto position = file->GetPosition();
+        if (const auto sender = dynamic_cast<IFileSender*>(m_NextLayer.get()))
+        {
+            sender->SendFile(file, position, size);
+        }
+        else
+        {
+            static const uint64_t chunkSize = MAX_IN_MEMORY_STREAM_SIZE;
+            for (uint64_t sent = 0; sent < size;)
+            {
+                const auto toSend = static_cast<std::size_t>(std::min(size - sent, chunkSize));
+                const auto data = m_NextLayer->Prepare(toSend);
+                const auto& buffers = data->GetBuffers();
+                if (BufferSequenceOutputStream::Size(buffers) >= toSend)
                 {
-                    out.write(reinterpret_cast<const char*>(&requestSize), sizeof(requestSize));
-                    if (!request->SerializeToOstream(&out))
-                        BOOST_THROW_EXCEPTION(Exception("Failed to serialize base packet"));
+                    ReadFileToBuffers(*file, position + sent, buffers, toSend);
                 }
+                else
+                {
+                    char buffer[MAX_IN_MEMORY_STREAM_SIZE];
+                    file->Read(position + sent, buffer, toSend);
+                    data->Write(buffer, toSend);
+                }
+                sent += toSend;
             }
-
-            if (stream)
-                SendStream(stream, streamSize);
         }
 
+        // region is consumed the same way as read streams are
+        file->seekg(static_cast<std::streamoff>(size), std::ios::cur);
     }
 
-private:
+    static void ReadFileToBuffers(const FileStream& file, uint64_t position, const BufferSequenceOutputStream::Buffers& buffers, std::size_t size)
+    {
+        for (const auto& buffer : buffers)
+        {
+            if (!size)
+                break;
+
+            const auto toRead = std::min(boost::asio::buffer_size(buffer), size);
+            file.Read(position, boost::asio::buffer_cast<char*>(buffer), toRead);
+            position += toRead;
+            size -= toRead;
+        }
+    }
 
     void SendStream(const rpc::IStream& stream, uint64_t size)
     {
@@ -0,0 +1,178 @@
+#include "TimeoutWheel.h"
+#include "rpc/Deadline.h"
+#include "rpc/Exceptions.h"
+
+#include <algorithm>
+#include <limits>
+#include <cassert>
+
+#include <boost/bind.hpp>
+#include <boost/asio/placeholders.hpp>
+
+namespace rpc
+{
+namespace details
+{
+
+TimeoutWheel::TimeoutWheel(boost::asio::io_service& svc, const ExpireFn& expire)
+    : m_Expire(expire)
+    , m_Start(Clock::now())
+    , m_Timer(svc)
+    , m_Slots(SLOTS_COUNT)
+    , m_Current()
+    , m_IsTimerActive()
+{
+}
+
+void TimeoutWheel::Add(boost::uint32_t id, const IFuture::Ptr& future, const boost::posix_time::time_duration& timeout)
+{
+    const auto now = GetTick();
+    const auto ticks = (std::max<boost::int64_t>(timeout.total_milliseconds(), 0) + TICK_MS - 1) / TICK_MS;
+
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    if (m_Ticks.empty())
+        m_Current = now;
+
+    // deadline is never in the processed past, otherwise call would wait for the whole turn of the wheel
+    const auto tick = std::max(now + ticks, m_Current + 1);
+
+    const auto inserted = m_Ticks.emplace(id, tick);
+    if (!inserted.second)
+    {
+        Erase(id, inserted.first->second);
+        inserted.first->second = tick;
+    }
+    m_Slots[tick % SLOTS_COUNT].push_back(Entry{ tick, id, future });
+
+    ScheduleTick();
+}
+
+void TimeoutWheel::Remove(boost::uint32_t id)
+{
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    const auto it = m_Ticks.find(id);
+    if (it == m_Ticks.end())
+        return;
+
+    Erase(id, it->second);
+    m_Ticks.erase(it);
+
+    // timer is not cancelled, it stops after the next tick if nothing is added
+}
+
+void TimeoutWheel::Clear()
+{
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    for (auto& slot : m_Slots)
+        slot.clear();
+    m_Ticks.clear();
+
+    // timer is not cancelled, it stops after the next tick if nothing is added
+}
+
+std::size_t TimeoutWheel::GetSize() const
+{
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    return m_Ticks.size();
+}
+
+void TimeoutWheel::Erase(boost::uint32_t id, boost::uint64_t tick)
+{
+    // order of entries in the slot doesn't matter, the last one takes place of the removed one
+    auto& slot = m_Slots[tick % SLOTS_COUNT];
+    const auto it = std::find_if(slot.begin(), slot.end(), [id](const Entry& entry){ return entry.m_Id == id; });
+    assert(it != slot.end() && "call is registered in the slot of its tick");
+    std::swap(*it, slot.back());
+    slot.pop_back();
+}
+
+boost::uint64_t TimeoutWheel::GetTick() const
+{
+    return boost::chrono::duration_cast<boost::chrono::milliseconds>(Clock::now() - m_Start).count() / TICK_MS;
+}
+
+void TimeoutWheel::ScheduleTick()
+{
+    if (m_IsTimerActive)
+        return;
+
+    m_IsTimerActive = true;
+    m_Timer.expires_from_now(boost::posix_time::milliseconds(static_cast<long>(TICK_MS)));
+    m_Timer.async_wait(boost::bind(&TimeoutWheel::OnTimer, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void TimeoutWheel::OnTimer(const boost::system::error_code& e)
+{
+    Expired expired;
+    {
+        boost::unique_lock<boost::mutex> lock(m_Mutex);
+        m_IsTimerActive = false;
+
+        const auto now = GetTick();
+        if (now > m_Current)
+        {
+            // visit slots passed since the previous tick, each slot once even if timer was late for a whole turn
+            const auto passed = std::min<boost::uint64_t>(now - m_Current, SLOTS_COUNT);
+            for (auto tick = now - passed + 1; tick <= now; ++tick)
+            {
+                auto& slot = m_Slots[tick % SLOTS_COUNT];
+                const auto remaining = std::partition(slot.begin(), slot.end(), [now](const Entry& entry){ return entry.m_Tick > now; });
+                for (auto it = remaining; it != slot.end(); ++it)
+                {
+                    m_Ticks.erase(it->m_Id);
+                    if (const auto future = it->m_Future.lock())
+                    {
+                        if (!future->IsReady())
+                            expired.emplace_back(it->m_Id, future);
+                    }
+                }
+                slot.erase(remaining, slot.end());
+            }
+            m_Current = now;
+        }
+
+        if (!m_Ticks.empty() && e != boost::asio::error::operation_aborted)
+            ScheduleTick();
+    }
+
+    for (const auto& call : expired)
+    {
+        if (!m_Expire(call.first, call.second))
+            continue;
+
+        try
+        {
+            BOOST_THROW_EXCEPTION(TimeoutException("Call %s timed out", call.first));
+        }
+        catch (const std::exception&)
+        {
+            call.second->SetException(boost::current_exception());
+        }
+    }
+}
+
+boost::uint32_t TimeoutWheel::GetCallTimeout(boost::uint32_t defaultTimeoutMs)
+{
+    const auto remaining = CallDeadline::Remaining();
+    if (remaining.is_pos_infinity())
+        return defaultTimeoutMs;
+
+    if (remaining <= boost::posix_time::time_duration())
+        BOOST_THROW_EXCEPTION(TimeoutException("Call not sent, deadline expired %s us ago", -remaining.total_microseconds()));
+
+    // rounded up, zero means there is no deadline
+    const auto ms = (remaining.total_microseconds() + 999) / 1000;
+    return static_cast<boost::uint32_t>(std::min<boost::int64_t>(ms, std::numeric_limits<boost::uint32_t>::max()));
+}
+
+boost::posix_time::time_duration TimeoutWheel::GetBudget(boost::uint32_t timeoutMs, const boost::chrono::steady_clock::time_point& received)
+{
+    if (!timeoutMs)
+        return boost::posix_time::pos_infin;
+
+    const auto queued = boost::chrono::duration_cast<boost::chrono::microseconds>(boost::chrono::steady_clock::now() - received);
+    return boost::posix_time::milliseconds(timeoutMs) - boost::posix_time::microseconds(queued.count());
+}
+
+} // namespace details
+} // namespace rpc
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "rpc/Future.h"
+
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/function.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/chrono.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace rpc
+{
+namespace details
+{
+
+//! Expires pending calls by deadline.
+//! Deadlines are rounded up to a tick and hashed into slots of the wheel, a single timer ticks
+//! while there are calls in the wheel, so registering a call never touches the timer.
+//! Completed calls are removed by their owner, so the wheel holds only calls in flight.
+class TimeoutWheel : public boost::enable_shared_from_this<TimeoutWheel>, boost::noncopyable
+{
+public:
+    typedef boost::shared_ptr<TimeoutWheel> Ptr;
+
+    //! Removes expired call from pending ones, returns false if call is not pending anymore.
+    //! Removed call is failed with TimeoutException.
+    typedef boost::function<bool(boost::uint32_t id, const IFuture::Ptr& future)> ExpireFn;
+
+    enum { TICK_MS = 10, SLOTS_COUNT = 512 };
+
+    TimeoutWheel(boost::asio::io_service& svc, const ExpireFn& expire);
+
+    //! Register pending call, call registered with the same id before is replaced
+    void Add(boost::uint32_t id, const IFuture::Ptr& future, const boost::posix_time::time_duration& timeout);
+
+    //! Forget completed call, unknown ids are ignored
+    void Remove(boost::uint32_t id);
+
+    //! Forget all calls
+    void Clear();
+
+    //! Calls in the wheel
+    std::size_t GetSize() const;
+
+    //! Milliseconds left for a call made now by the current thread, zero if call has no deadline.
+    //! Deadline of the thread is used if there is one, default timeout otherwise.
+    //! Throws TimeoutException if deadline of the thread is over, such call is failed without being sent.
+    static boost::uint32_t GetCallTimeout(boost::uint32_t defaultTimeoutMs);
+
+    //! Budget of the received request, time passed since it was received counts against its timeout
+    static boost::posix_time::time_duration GetBudget(boost::uint32_t timeoutMs, const boost::chrono::steady_clock::time_point& received);
+
+private:
+    typedef boost::chrono::steady_clock Clock;
+
+    struct Entry
+    {
+        boost::uint64_t m_Tick;
+        boost::uint32_t m_Id;
+        boost::weak_ptr<IFuture> m_Future;
+    };
+
+    typedef std::vector<Entry> Slot;
+    typedef std::vector<std::pair<boost::uint32_t, IFuture::Ptr>> Expired;
+    typedef boost::unordered_map<boost::uint32_t, boost::uint64_t> Ticks;
+
+    boost::uint64_t GetTick() const;
+    void ScheduleTick();
+
+    //! Remove entry of the call from the slot of its tick
+    void Erase(boost::uint32_t id, boost::uint64_t tick);
+    void OnTimer(const boost::system::error_code& e);
+
+private:
+    const ExpireFn m_Expire;
+    const Clock::time_point m_Start;
+    boost::asio::deadline_timer m_Timer;
+
+    mutable boost::mutex m_Mutex;
+    std::vector<Slot> m_Slots;
+    Ticks m_Ticks;                  //!< tick of each call in the wheel, locates its entry
+    boost::uint64_t m_Current;      //!< last processed tick
+    bool m_IsTimerActive;
+};
+
+} // namespace details
+} // namespace rpc
@@ -0,0 +1,57 @@
+#include "rpc/Trace.h"
+#include "rpc/Exceptions.h"
+
+namespace rpc
+{
+namespace trace
+{
+namespace details
+{
+
+std::atomic<boost::uint32_t> g_SampleRate(1);
+std::atomic<int> g_Level(LEVEL_TRACE);
+
+} // namespace details
+
+void SetMode(Mode mode, boost::uint32_t sampleRate)
+{
+    switch (mode)
+    {
+    case TRACE_OFF:
+        details::g_SampleRate = 0;
+        break;
+    case TRACE_SAMPLED:
+        if (sampleRate < 2)
+            BOOST_THROW_EXCEPTION(Exception("Invalid packet trace sample rate: %s", sampleRate));
+        details::g_SampleRate = sampleRate;
+        break;
+    case TRACE_ALL:
+        details::g_SampleRate = 1;
+        break;
+    default:
+        BOOST_THROW_EXCEPTION(Exception("Invalid packet trace mode: %s", static_cast<int>(mode)));
+    }
+}
+
+Mode GetMode()
+{
+    const auto rate = details::g_SampleRate.load();
+    if (!rate)
+        return TRACE_OFF;
+    return rate == 1 ? TRACE_ALL : TRACE_SAMPLED;
+}
+
+void SetLevel(Level level)
+{
+    if (level < LEVEL_TRACE || level > LEVEL_INFO)
+        BOOST_THROW_EXCEPTION(Exception("Invalid packet trace level: %s", static_cast<int>(level)));
+    details::g_Level = level;
+}
+
+Level GetLevel()
+{
+    return static_cast<Level>(details::g_Level.load());
+}
+
+} // namespace trace
+} // namespace rpc
@@ -0,0 +1,332 @@
+#include "rpc/WriteCoalescer.h"
+#include "Stream.h"
+#include "rpc/BatchConnection.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/asio/placeholders.hpp>
+#include <boost/thread/reverse_lock.hpp>
+
+namespace rpc
+{
+namespace details
+{
+
+namespace
+{
+
+//! Connection which serializes packet into a single buffer, prepared blocks are appended one after another
+class FrameConnection : public net::IConnection
+{
+public:
+    class FrameData : public net::details::IData
+    {
+    public:
+        FrameData(std::vector<char>& data, std::size_t offset, std::size_t size)
+            : m_Data(data)
+            , m_Offset(offset)
+            , m_End(offset + size)
+        {
+            if (size)
+                m_Buffers.emplace_back(boost::asio::buffer(&m_Data[offset], size));
+        }
+
+        virtual void Write(const void* data, std::size_t size) override
+        {
+            if (m_Offset + size > m_End)
+                BOOST_THROW_EXCEPTION(Exception("Frame overflow, size: %s, written: %s", m_End - m_Offset, size));
+
+            std::memcpy(&m_Data[m_Offset], data, size);
+            m_Offset += size;
+        }
+
+        virtual const std::vector<boost::asio::mutable_buffer>& GetBuffers() override
+        {
+            return m_Buffers;
+        }
+
+    private:
+        std::vector<char>& m_Data;
+        std::size_t m_Offset;
+        const std::size_t m_End;
+        std::vector<boost::asio::mutable_buffer> m_Buffers;
+    };
+
+    FrameConnection(std::vector<char>& data, std::vector<std::size_t>& frames) : m_Data(data), m_Frames(frames) {}
+
+    virtual void Receive(const Callback&) override
+    {
+        assert(!"not supported");
+    }
+    virtual void Close() override
+    {
+    }
+    virtual net::details::IData::Ptr Prepare(std::size_t size) override
+    {
+        // previous block is written by now, so growing the buffer doesn't invalidate it
+        const auto offset = m_Data.size();
+        m_Data.resize(offset + size);
+        m_Frames.push_back(size);
+        return boost::make_shared<FrameData>(m_Data, offset, size);
+    }
+    virtual void Flush() override
+    {
+    }
+    virtual std::string GetInfo() const override
+    {
+        return "batch";
+    }
+
+private:
+    std::vector<char>& m_Data;
+    std::vector<std::size_t>& m_Frames;
+};
+
+//! Only one thread writes to the connection at a time, so batches don't interleave
+class WriterScope : boost::noncopyable
+{
+public:
+    WriterScope(boost::unique_lock<boost::mutex>& lock, bool& isWriting, boost::condition_variable& released)
+        : m_Lock(lock)
+        , m_IsWriting(isWriting)
+        , m_Released(released)
+    {
+        while (m_IsWriting)
+            m_Released.wait(m_Lock);
+        m_IsWriting = true;
+    }
+
+    ~WriterScope()
+    {
+        if (!m_Lock.owns_lock())
+            m_Lock.lock();
+        m_IsWriting = false;
+        m_Released.notify_all();
+    }
+
+private:
+    boost::unique_lock<boost::mutex>& m_Lock;
+    bool& m_IsWriting;
+    boost::condition_variable& m_Released;
+};
+
+} // anonymous namespace
+
+WriteCoalescer::WriteCoalescer(boost::asio::io_service& svc, const Settings& settings)
+    : m_Settings(settings)
+    , m_Timer(svc)
+    , m_BatchBytes()
+    , m_IsWriting()
+    , m_IsTimerActive()
+{
+}
+
+void WriteCoalescer::Write(const net::IConnection::Ptr& connection, const gp::Message& base, const gp::Message* request, const IStream& stream)
+{
+    const auto streamSize = stream ? net::StreamSize(*stream) : 0;
+    {
+        boost::unique_lock<boost::mutex> lock(m_Mutex);
+
+        // nothing is in flight, there is no batch to join, so packet is written directly;
+        // large streams are not copied to the batch either, they are written directly after pending packets
+        const bool isIdle = !m_IsWriting && m_Batch.empty();
+        if (isIdle || streamSize >= m_Settings.m_MaxBatchBytes)
+        {
+            WriterScope writer(lock, m_IsWriting, m_WriterReleased);
+
+            if (isIdle)
+            {
+                // direct write prepares one block, unless stream is sent in blocks of its own after the header
+                const auto size = PacketSize(base, request, streamSize);
+                const auto writes = size < WriteStream::MAX_IN_MEMORY_STREAM_SIZE ? 1 : 1 + (streamSize + WriteStream::MAX_IN_MEMORY_STREAM_SIZE - 1) / WriteStream::MAX_IN_MEMORY_STREAM_SIZE;
+                CountBatch(FLUSH_IDLE, 1, size, static_cast<std::size_t>(writes));
+            }
+            else
+                Drain(lock, FLUSH_BYPASS, true);
+
+            {
+                boost::reverse_lock<boost::unique_lock<boost::mutex>> unlock(lock);
+                WriteStream(connection).Write(base, request, stream);
+            }
+
+            Drain(lock, FLUSH_IN_FLIGHT, false);
+            return;
+        }
+    }
+
+    Packet packet;
+    packet.m_Connection = connection;
+    WriteStream(boost::make_shared<FrameConnection>(packet.m_Data, packet.m_Frames)).Write(base, request, stream);
+
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    m_BatchBytes += packet.m_Data.size();
+    m_Batch.emplace_back(std::move(packet));
+
+    // current writer will pick this packet up once it's done
+    if (m_IsWriting)
+        return;
+
+    FlushReason reason = FLUSH_IN_FLIGHT;
+    if (m_BatchBytes >= m_Settings.m_MaxBatchBytes)
+        reason = FLUSH_SIZE;
+    else
+    if (!m_Settings.m_MaxDelay.is_zero())
+    {
+        ScheduleFlush();
+        return;
+    }
+
+    WriterScope writer(lock, m_IsWriting, m_WriterReleased);
+    Drain(lock, reason, false);
+}
+
+void WriteCoalescer::Flush(FlushReason reason)
+{
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    if (reason == FLUSH_CLOSE)
+        m_Timer.cancel();
+
+    WriterScope writer(lock, m_IsWriting, m_WriterReleased);
+    Drain(lock, reason, true);
+}
+
+WriteCoalescer::Stats WriteCoalescer::GetStats() const
+{
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    return m_Stats;
+}
+
+void WriteCoalescer::Drain(boost::unique_lock<boost::mutex>& lock, FlushReason reason, bool force)
+{
+    while (!m_Batch.empty())
+    {
+        Batch batch;
+        batch.swap(m_Batch);
+
+        const auto packets = batch.size();
+        const auto bytes = m_BatchBytes;
+        m_BatchBytes = 0;
+
+        std::size_t writes = 0;
+        {
+            boost::reverse_lock<boost::unique_lock<boost::mutex>> unlock(lock);
+            writes = WriteBatch(batch);
+        }
+        CountBatch(reason, packets, bytes, writes);
+
+        // decide what to do with packets collected during the write
+        if (force || m_BatchBytes >= m_Settings.m_MaxBatchBytes)
+        {
+            reason = force ? reason : FLUSH_SIZE;
+        }
+        else
+        if (m_Settings.m_MaxDelay.is_zero())
+        {
+            reason = FLUSH_IN_FLIGHT;
+        }
+        else
+        {
+            if (!m_Batch.empty())
+                ScheduleFlush();
+            break;
+        }
+    }
+}
+
+void WriteCoalescer::ScheduleFlush()
+{
+    if (m_IsTimerActive)
+        return;
+
+    m_IsTimerActive = true;
+    m_Timer.expires_from_now(m_Settings.m_MaxDelay);
+    m_Timer.async_wait(boost::bind(&WriteCoalescer::OnTimer, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void WriteCoalescer::OnTimer(const boost::system::error_code& e)
+{
+    boost::unique_lock<boost::mutex> lock(m_Mutex);
+    m_IsTimerActive = false;
+
+    // active writer will flush or reschedule remaining packets
+    if (e || m_IsWriting)
+        return;
+
+    WriterScope writer(lock, m_IsWriting, m_WriterReleased);
+    Drain(lock, FLUSH_DELAY, true);
+}
+
+void WriteCoalescer::CountBatch(FlushReason reason, std::size_t packets, std::size_t bytes, std::size_t writes)
+{
+    ++m_Stats.m_Batches;
+    m_Stats.m_Writes += writes;
+    ++m_Stats.m_Flushes[reason];
+    m_Stats.m_Packets += packets;
+    m_Stats.m_Bytes += bytes;
+    m_Stats.m_MaxBatchPackets = std::max<boost::uint64_t>(m_Stats.m_MaxBatchPackets, packets);
+}
+
+std::size_t WriteCoalescer::PacketSize(const gp::Message& base, const gp::Message* request, boost::uint64_t streamSize)
+{
+    const std::size_t requestSize = request ? sizeof(boost::uint32_t) + request->ByteSize() : 0;
+    return static_cast<std::size_t>(sizeof(boost::uint32_t) + base.ByteSize() + requestSize + streamSize);
+}
+
+std::size_t WriteCoalescer::WriteBatch(Batch& batch)
+{
+    std::size_t writes = 0;
+    for (auto begin = batch.begin(); begin != batch.end();)
+    {
+        // consecutive packets of the same connection
+        const auto connection = begin->m_Connection;
+        const auto end = std::find_if(begin, batch.end(), [&connection](const Packet& packet){ return packet.m_Connection != connection; });
+
+        if (const auto batchConnection = dynamic_cast<IBatchConnection*>(connection.get()))
+        {
+            std::vector<std::size_t> sizes;
+            for (auto it = begin; it != end; ++it)
+                sizes.insert(sizes.end(), it->m_Frames.begin(), it->m_Frames.end());
+
+            // all blocks are prepared at once, each packet is copied to them once, directly from the packet buffer
+            const auto data = batchConnection->PrepareBatch(sizes);
+            for (auto it = begin; it != end; ++it)
+                data->Write(it->m_Data.data(), it->m_Data.size());
+            ++writes;
+        }
+        else
+        {
+            for (auto it = begin; it != end; ++it)
+            {
+                WritePacket(*it);
+                writes += it->m_Frames.size();
+            }
+        }
+
+        // packets are complete once wrapped connection is released, as with direct write
+        for (; begin != end; ++begin)
+            begin->m_Connection.reset();
+    }
+    return writes;
+}
+
+void WriteCoalescer::WritePacket(const Packet& packet)
+{
+    // each frame is copied to the connection once, directly from the packet buffer
+    const char* frame = packet.m_Data.data();
+    for (const auto size : packet.m_Frames)
+    {
+        const auto data = packet.m_Connection->Prepare(size);
+        const auto& buffers = data->GetBuffers();
+        if (BufferSequenceOutputStream::Size(buffers) >= size)
+            boost::asio::buffer_copy(buffers, boost::asio::buffer(frame, size));
+        else
+            data->Write(frame, size);
+        frame += size;
+    }
+}
+
+} // namespace details
+} // namespace rpc
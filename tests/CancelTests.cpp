@@ -0,0 +1,99 @@
+#include "rpc/Exceptions.h"
+#include "ServiceFixture.h"
+
+#include <gtest/gtest.h>
+
+namespace
+{
+
+typedef InProcessFixture Cancel;
+typedef SerializedFixture SerializedCancel;
+
+} // anonymous namespace
+
+TEST_F(Cancel, CallInProgress)
+{
+    const auto future = Call();
+    const auto other = Call();
+    m_Service.poll();
+    ASSERT_EQ(m_Svc->m_Requests.size(), 2u);
+
+    EXPECT_TRUE(future.Cancel());
+    ASSERT_TRUE(future.IsReady());
+    EXPECT_THROW(future.Response(), rpc::CancelledException);
+
+    // handler observes cancellation, other calls are not affected
+    EXPECT_TRUE(m_Svc->m_Requests[0]->IsCancelled());
+    EXPECT_FALSE(m_Svc->m_Requests[1]->IsCancelled());
+
+    // late response is dropped
+    m_Svc->Release();
+    m_Service.poll();
+    EXPECT_THROW(future.Response(), rpc::CancelledException);
+    EXPECT_EQ(other.Response().data(), 2u);
+
+    EXPECT_FALSE(future.Cancel());
+    EXPECT_FALSE(other.Cancel());
+}
+
+TEST_F(Cancel, QueuedCallIsNotDispatched)
+{
+    const auto future = Call();
+    EXPECT_TRUE(future.Cancel());
+    m_Service.poll();
+
+    EXPECT_TRUE(m_Svc->m_Requests.empty());
+    EXPECT_THROW(future.Response(), rpc::CancelledException);
+}
+
+TEST_F(Cancel, CompletedCall)
+{
+    const auto future = Call();
+    m_Service.poll();
+    m_Svc->Release();
+
+    EXPECT_FALSE(future.Cancel());
+    EXPECT_EQ(future.Response().data(), 2u);
+}
+
+TEST_F(Cancel, NotACall)
+{
+    const rpc::Future<proto::test::Response> future(rpc::IFuture::Instance(m_Service));
+    EXPECT_FALSE(future.Cancel());
+    EXPECT_FALSE(future.IsReady());
+}
+
+TEST_F(Cancel, CloseCancelsRequestsInProgress)
+{
+    const auto future = Call();
+    m_Service.poll();
+    ASSERT_EQ(m_Svc->m_Requests.size(), 1u);
+
+    m_Channel->Close(rpc::MakeException("closed"));
+    EXPECT_TRUE(m_Svc->m_Requests.front()->IsCancelled());
+    EXPECT_ANY_THROW(future.Response());
+}
+
+TEST_F(SerializedCancel, CallInProgress)
+{
+    const auto future = Call();
+    const auto other = Call();
+    ToServer();
+    ASSERT_EQ(m_Svc->m_Requests.size(), 2u);
+
+    // cancel packet reaches the server and marks the request being handled
+    EXPECT_TRUE(future.Cancel());
+    ASSERT_TRUE(future.IsReady());
+    EXPECT_THROW(future.Response(), rpc::CancelledException);
+    ASSERT_FALSE(m_ClientConnection->IsEmpty());
+
+    ToServer();
+    EXPECT_TRUE(m_Svc->m_Requests[0]->IsCancelled());
+    EXPECT_FALSE(m_Svc->m_Requests[1]->IsCancelled());
+
+    // late response is dropped by the client
+    m_Svc->Release();
+    ToClient();
+    EXPECT_THROW(future.Response(), rpc::CancelledException);
+    EXPECT_EQ(other.Response().data(), 2u);
+}
@@ -0,0 +1,391 @@
+#include "rpc/Channel.h"
+#include "rpc/InProcessChannel.h"
+#include "rpc/LocalHandler.h"
+#include "rpc/ChunkedStream.h"
+#include "rpc/Exceptions.h"
+#include "PacketConnection.h"
+
+#include "test_service.pb.h"
+
+#include <gtest/gtest.h>
+
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/make_shared.hpp>
+#include <boost/asio/io_service.hpp>
+
+namespace
+{
+
+std::string ReadChunk(const rpc::IStream& chunk)
+{
+    return std::string(std::istreambuf_iterator<char>(*chunk), std::istreambuf_iterator<char>());
+}
+
+//! Collects chunks of the stream as they arrive
+struct Reader
+{
+    Reader() : m_IsEnded(), m_IsFailed() {}
+
+    void Read(const rpc::ChunkedStream::Ptr& stream)
+    {
+        stream->Read([this](const rpc::IStream& chunk, const boost::exception_ptr& e){
+            if (chunk)
+                m_Chunks.push_back(ReadChunk(chunk));
+            else
+            {
+                m_IsEnded = true;
+                m_IsFailed = !!e;
+            }
+        });
+    }
+
+    std::vector<std::string> m_Chunks;
+    bool m_IsEnded;
+    bool m_IsFailed;
+};
+
+//! Echoes each chunk of the request stream as soon as it arrives
+class EchoService : public proto::test::TestService
+{
+public:
+    virtual void TestMethod(const rpc::StreamRequest<::proto::test::Request>::Ptr& request, const rpc::StreamResponse<::proto::test::Response>::Ptr& response) override
+    {
+        response->set_data(request->data() + 1);
+
+        const auto in = rpc::ChunkedStream::Cast(request->Stream());
+        ASSERT_TRUE(in);
+
+        const auto out = rpc::ChunkedStream::Instance();
+        in->Read([out](const rpc::IStream& chunk, const boost::exception_ptr& e){
+            if (chunk)
+                out->Write(ReadChunk(chunk));
+            else
+                out->Close(e);
+        });
+        response->Stream(out);
+    }
+};
+
+//! Keeps request stream unread until the test reads it
+class HoldService : public proto::test::TestService
+{
+public:
+    virtual void TestMethod(const rpc::StreamRequest<::proto::test::Request>::Ptr& request, const rpc::StreamResponse<::proto::test::Response>::Ptr& response) override
+    {
+        response->set_data(request->data() + 1);
+        m_Stream = rpc::ChunkedStream::Cast(request->Stream());
+    }
+
+    rpc::ChunkedStream::Ptr m_Stream;
+};
+
+} // anonymous namespace
+
+TEST(ChunkedStream, QueuedChunksAreDeliveredFirst)
+{
+    const auto stream = rpc::ChunkedStream::Instance();
+    stream->Write(std::string("first"));
+    stream->Write(std::string("second"));
+
+    Reader reader;
+    reader.Read(stream);
+    ASSERT_EQ(reader.m_Chunks.size(), 2u);
+    EXPECT_EQ(reader.m_Chunks[0], "first");
+    EXPECT_EQ(reader.m_Chunks[1], "second");
+
+    // consumer gets chunks as they are written
+    stream->Write(std::string("third"));
+    ASSERT_EQ(reader.m_Chunks.size(), 3u);
+    EXPECT_EQ(reader.m_Chunks[2], "third");
+    EXPECT_FALSE(reader.m_IsEnded);
+
+    stream->Close();
+    EXPECT_TRUE(reader.m_IsEnded);
+    EXPECT_FALSE(reader.m_IsFailed);
+    EXPECT_THROW(stream->Write(std::string("late")), rpc::Exception);
+}
+
+TEST(ChunkedStream, ProducerFailure)
+{
+    const auto stream = rpc::ChunkedStream::Instance();
+    Reader reader;
+    reader.Read(stream);
+
+    stream->Write(std::string("data"));
+    stream->Close(rpc::MakeException("failed"));
+    EXPECT_EQ(reader.m_Chunks.size(), 1u);
+    EXPECT_TRUE(reader.m_IsEnded);
+    EXPECT_TRUE(reader.m_IsFailed);
+}
+
+TEST(ChunkedStream, AbandonedStreamFails)
+{
+    Reader reader;
+    {
+        const auto stream = rpc::ChunkedStream::Instance();
+        reader.Read(stream);
+    }
+    EXPECT_TRUE(reader.m_IsEnded);
+    EXPECT_TRUE(reader.m_IsFailed);
+}
+
+TEST(ChunkedStream, WindowLimitsDelivery)
+{
+    const auto stream = rpc::ChunkedStream::Instance();
+    stream->SetWindow(2);
+
+    Reader reader;
+    reader.Read(stream);
+    for (int i = 0; i < 5; ++i)
+        stream->Write(std::to_string(i));
+    stream->Close();
+
+    // the rest waits for credit of the consumer
+    EXPECT_EQ(reader.m_Chunks.size(), 2u);
+    EXPECT_EQ(stream->GetQueued(), 3u);
+
+    stream->Grant(2);
+    EXPECT_EQ(reader.m_Chunks.size(), 4u);
+    EXPECT_FALSE(reader.m_IsEnded);
+
+    // end of the stream doesn't need credit
+    stream->Grant(1);
+    EXPECT_EQ(reader.m_Chunks.size(), 5u);
+    EXPECT_EQ(reader.m_Chunks.back(), "4");
+    EXPECT_TRUE(reader.m_IsEnded);
+}
+
+TEST(ChunkedStream, AutoGrantReturnsCreditOfHandledChunks)
+{
+    const auto stream = rpc::ChunkedStream::Instance();
+    stream->SetWindow(2);
+    stream->SetAutoGrant(1);
+
+    for (int i = 0; i < 5; ++i)
+        stream->Write(std::to_string(i));
+    EXPECT_EQ(stream->GetQueued(), 5u);
+
+    Reader reader;
+    reader.Read(stream);
+    EXPECT_EQ(reader.m_Chunks.size(), 5u);
+    EXPECT_EQ(stream->GetQueued(), 0u);
+}
+
+TEST(ChunkedStream, WriteReportsFullQueue)
+{
+    const auto stream = rpc::ChunkedStream::Instance();
+    stream->SetMaxQueued(2);
+
+    EXPECT_TRUE(stream->Write(std::string("0")));
+    EXPECT_FALSE(stream->Write(std::string("1")));
+
+    // producer ignoring the limit still gets its chunks delivered
+    EXPECT_FALSE(stream->Write(std::string("2")));
+
+    bool isWritable = false;
+    stream->WhenWritable([&isWritable](){ isWritable = true; });
+    EXPECT_FALSE(isWritable);
+
+    Reader reader;
+    reader.Read(stream);
+    EXPECT_TRUE(isWritable);
+    EXPECT_EQ(reader.m_Chunks.size(), 3u);
+
+    // there is room already
+    isWritable = false;
+    stream->WhenWritable([&isWritable](){ isWritable = true; });
+    EXPECT_TRUE(isWritable);
+}
+
+TEST(ChunkedStream, CloseWakesWaitingProducer)
+{
+    const auto stream = rpc::ChunkedStream::Instance();
+    stream->SetMaxQueued(1);
+    EXPECT_FALSE(stream->Write(std::string("0")));
+
+    bool isWritable = false;
+    stream->WhenWritable([&isWritable](){ isWritable = true; });
+    stream->Close(rpc::MakeException("closed"));
+    EXPECT_TRUE(isWritable);
+    EXPECT_THROW(stream->Write(std::string("1")), rpc::Exception);
+}
+
+TEST(ChunkedStream, InProcessEcho)
+{
+    boost::asio::io_service service;
+    const auto channel = rpc::IInProcessChannel::Instance(service);
+    const auto handler = rpc::ILocalHandler::Instance(service);
+    const auto svc = boost::make_shared<EchoService>();
+    handler->ProvideService(svc);
+    channel->AddHandler(handler);
+
+    proto::test::Request request;
+    request.set_data(1);
+    const auto in = rpc::ChunkedStream::Instance();
+    const auto future = proto::test::TestService::Stub(*channel).TestMethod(request, in);
+    service.poll();
+
+    EXPECT_EQ(future.Response().data(), 2u);
+    const auto out = rpc::ChunkedStream::Cast(future.Stream());
+    ASSERT_TRUE(out);
+
+    Reader reader;
+    reader.Read(out);
+
+    // each chunk makes the round trip before the next one is produced
+    for (int i = 0; i < 100; ++i)
+    {
+        in->Write(std::to_string(i));
+        ASSERT_EQ(reader.m_Chunks.size(), static_cast<std::size_t>(i + 1));
+        EXPECT_EQ(reader.m_Chunks.back(), std::to_string(i));
+    }
+
+    in->Close();
+    EXPECT_TRUE(reader.m_IsEnded);
+    EXPECT_FALSE(reader.m_IsFailed);
+}
+
+TEST(ChunkedStream, SerializedEcho)
+{
+    boost::asio::io_service service;
+
+    const auto clientConnection = boost::make_shared<PacketConnection>();
+    const auto client = rpc::ISequencedChannel::Instance(service);
+    client->SetConnection(clientConnection);
+
+    const auto serverConnection = boost::make_shared<PacketConnection>();
+    const auto server = rpc::ISequencedChannel::Instance(service);
+    server->SetConnection(serverConnection);
+
+    const auto handler = rpc::ILocalHandler::Instance(service);
+    const auto svc = boost::make_shared<EchoService>();
+    handler->ProvideService(svc);
+    server->AddHandler(handler);
+
+    proto::test::Request request;
+    request.set_data(1);
+    const auto in = rpc::ChunkedStream::Instance();
+    const auto future = proto::test::TestService::Stub(*client).TestMethod(request, in);
+
+    // response is sent before the request stream ends
+    clientConnection->WriteToChannel(*server);
+    service.poll();
+    serverConnection->WriteToChannel(*client);
+
+    EXPECT_EQ(future.Response().data(), 2u);
+    const auto out = rpc::ChunkedStream::Cast(future.Stream());
+    ASSERT_TRUE(out);
+
+    Reader reader;
+    reader.Read(out);
+
+    for (int i = 0; i < 10; ++i)
+    {
+        in->Write(std::string(1000, static_cast<char>('a' + i)));
+        clientConnection->WriteToChannel(*server);
+        serverConnection->WriteToChannel(*client);
+
+        ASSERT_EQ(reader.m_Chunks.size(), static_cast<std::size_t>(i + 1));
+        EXPECT_EQ(reader.m_Chunks.back(), std::string(1000, static_cast<char>('a' + i)));
+    }
+
+    in->Close(rpc::MakeException("producer failed"));
+    clientConnection->WriteToChannel(*server);
+    serverConnection->WriteToChannel(*client);
+
+    EXPECT_TRUE(reader.m_IsEnded);
+    EXPECT_TRUE(reader.m_IsFailed);
+}
+
+TEST(ChunkedStream, CloseEndsStreams)
+{
+    boost::asio::io_service service;
+
+    const auto clientConnection = boost::make_shared<PacketConnection>();
+    const auto client = rpc::ISequencedChannel::Instance(service);
+    client->SetConnection(clientConnection);
+
+    const auto serverConnection = boost::make_shared<PacketConnection>();
+    const auto server = rpc::ISequencedChannel::Instance(service);
+    server->SetConnection(serverConnection);
+
+    const auto handler = rpc::ILocalHandler::Instance(service);
+    const auto svc = boost::make_shared<EchoService>();
+    handler->ProvideService(svc);
+    server->AddHandler(handler);
+
+    proto::test::Request request;
+    request.set_data(1);
+    const auto in = rpc::ChunkedStream::Instance();
+    const auto future = proto::test::TestService::Stub(*client).TestMethod(request, in);
+    clientConnection->WriteToChannel(*server);
+    service.poll();
+    serverConnection->WriteToChannel(*client);
+
+    Reader reader;
+    reader.Read(rpc::ChunkedStream::Cast(future.Stream()));
+
+    client->Close(rpc::MakeException("closed"));
+    EXPECT_TRUE(reader.m_IsEnded);
+    EXPECT_TRUE(reader.m_IsFailed);
+
+    // producer learns that nobody receives the stream
+    EXPECT_NO_THROW(in->Write(std::string("data")));
+    EXPECT_TRUE(in->IsClosed());
+    EXPECT_THROW(in->Write(std::string("data")), rpc::Exception);
+}
+
+TEST(ChunkedStream, SerializedStreamHasDefaultWindow)
+{
+    boost::asio::io_service service;
+
+    const auto clientConnection = boost::make_shared<PacketConnection>();
+    const auto client = rpc::ISequencedChannel::Instance(service);
+    client->SetConnection(clientConnection);
+
+    const auto serverConnection = boost::make_shared<PacketConnection>();
+    const auto server = rpc::ISequencedChannel::Instance(service);
+    server->SetConnection(serverConnection);
+
+    const auto handler = rpc::ILocalHandler::Instance(service);
+    const auto svc = boost::make_shared<HoldService>();
+    handler->ProvideService(svc);
+    server->AddHandler(handler);
+
+    proto::test::Request request;
+    request.set_data(1);
+    const auto in = rpc::ChunkedStream::Instance();
+    const auto future = proto::test::TestService::Stub(*client).TestMethod(request, in);
+    EXPECT_EQ(in->GetWindow(), static_cast<std::size_t>(rpc::ChunkedStream::DEFAULT_WINDOW));
+
+    const std::size_t count = rpc::ChunkedStream::DEFAULT_WINDOW * 3;
+    for (std::size_t i = 0; i < count; ++i)
+        in->Write(std::to_string(i));
+
+    // consumer doesn't read, so only the window is sent
+    clientConnection->WriteToChannel(*server);
+    service.poll();
+    ASSERT_TRUE(svc->m_Stream);
+    EXPECT_EQ(svc->m_Stream->GetQueued(), static_cast<std::size_t>(rpc::ChunkedStream::DEFAULT_WINDOW));
+    EXPECT_EQ(in->GetQueued(), count - rpc::ChunkedStream::DEFAULT_WINDOW);
+
+    // credit is returned as the consumer handles chunks
+    Reader reader;
+    reader.Read(svc->m_Stream);
+    in->Close();
+    while (!clientConnection->IsEmpty() || !serverConnection->IsEmpty())
+    {
+        serverConnection->WriteToChannel(*client);
+        clientConnection->WriteToChannel(*server);
+    }
+
+    ASSERT_EQ(reader.m_Chunks.size(), count);
+    EXPECT_EQ(reader.m_Chunks.back(), std::to_string(count - 1));
+    EXPECT_TRUE(reader.m_IsEnded);
+    EXPECT_FALSE(reader.m_IsFailed);
+    EXPECT_EQ(in->GetQueued(), 0u);
+}
@@ -0,0 +1,292 @@
+#include "rpc/Channel.h"
+#include "rpc/LocalHandler.h"
+#include "rpc/ChunkedStream.h"
+#include "rpc/Compression.h"
+#include "../src/Stream.h"
+#include "../src/ChannelSink.h"
+#include "PacketConnection.h"
+
+#include "test_service.pb.h"
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+#include <iterator>
+
+#include <boost/make_shared.hpp>
+#include <boost/asio/io_service.hpp>
+
+namespace
+{
+
+typedef rpc::details::Compression Compression;
+
+const Compression::Codec CODECS[] = { proto::Zlib, proto::Zstd };
+
+std::string ReadAll(std::istream& stream)
+{
+    return std::string(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+}
+
+proto::test::Request MakeRequest(std::size_t payload)
+{
+    proto::test::Request request;
+    request.set_data(42);
+    request.set_payload(std::string(payload, 'p'));
+    return request;
+}
+
+Compression::Settings MakeSettings(Compression::Codec codec)
+{
+    Compression::Settings settings;
+    settings.m_Codec = codec;
+    return settings;
+}
+
+//! Echoes payload and stream of the request
+class EchoService : public proto::test::TestService
+{
+public:
+    virtual void TestMethod(const rpc::StreamRequest<::proto::test::Request>::Ptr& request, const rpc::StreamResponse<::proto::test::Response>::Ptr& response) override
+    {
+        response->set_data(request->data() + 1);
+        response->set_payload(request->payload());
+        response->Stream(request->Stream());
+    }
+};
+
+} // anonymous namespace
+
+TEST(Compression, RoundTrip)
+{
+    const auto data = MakeRequest(10000).SerializeAsString() + std::string(5000, 's');
+    for (const auto codec : CODECS)
+    {
+        const auto compressed = Compression::Compress(codec, data);
+        EXPECT_LT(compressed.size(), data.size());
+        EXPECT_EQ(Compression::Decompress(codec, compressed), data);
+    }
+}
+
+TEST(Compression, DecompressedSizeIsLimited)
+{
+    const std::string data(10000, 'd');
+    for (const auto codec : CODECS)
+    {
+        const auto compressed = Compression::Compress(codec, data);
+        EXPECT_THROW(Compression::Decompress(codec, compressed, data.size() - 1), rpc::Exception);
+        EXPECT_EQ(Compression::Decompress(codec, compressed, data.size()), data);
+        EXPECT_EQ(Compression::Decompress(codec, compressed, 0), data);
+
+        std::istringstream stream(compressed);
+        EXPECT_THROW(Compression::Decompress(codec, stream, data.size() / 2), rpc::Exception);
+    }
+}
+
+TEST(Compression, PayloadKeepsLayout)
+{
+    for (const auto codec : CODECS)
+    {
+        Compression compression(MakeSettings(codec));
+
+        const auto request = MakeRequest(10000);
+        const rpc::IStream stream = boost::make_shared<std::stringstream>(std::string(20000, 's'));
+        const auto payload = compression.Compress(codec, &request, stream);
+        ASSERT_TRUE(payload);
+
+        // receiver parses decompressed payload the same way as the raw one
+        const auto raw = Compression::Decompress(codec, *payload);
+        proto::test::Request parsed;
+        rpc::details::ReadStream::Read(*raw, parsed);
+        EXPECT_EQ(parsed.payload(), request.payload());
+        EXPECT_EQ(ReadAll(*raw), std::string(20000, 's'));
+
+        const auto stats = compression.GetStats();
+        EXPECT_EQ(stats.m_Packets, 1u);
+        EXPECT_EQ(stats.m_RawBytes, request.ByteSize() + sizeof(boost::uint32_t) + 20000);
+        EXPECT_LT(stats.m_CompressedBytes, stats.m_RawBytes);
+    }
+}
+
+TEST(Compression, Select)
+{
+    auto settings = MakeSettings(proto::Zlib);
+    settings.m_MaxBytes = Compression::DEFAULT_MIN_BYTES * 100;
+    settings.m_Methods[Compression::MethodKey(1000, 1)] = proto::Zstd;
+    settings.m_Methods[Compression::MethodKey(1000, 2)] = proto::NoCompression;
+    Compression compression(settings);
+
+    proto::BasePacket base;
+    base.set_serviceid(1000);
+
+    const auto large = MakeRequest(Compression::DEFAULT_MIN_BYTES);
+    const auto small = MakeRequest(10);
+    EXPECT_EQ(compression.Select(base, &large, rpc::IStream()), proto::Zlib);
+    EXPECT_EQ(compression.Select(base, &small, rpc::IStream()), proto::NoCompression);
+
+    // small request with large stream
+    const rpc::IStream stream = boost::make_shared<std::stringstream>(std::string(Compression::DEFAULT_MIN_BYTES, 's'));
+    EXPECT_EQ(compression.Select(base, &small, stream), proto::Zlib);
+    EXPECT_EQ(compression.Select(base, &large, rpc::ChunkedStream::Instance()), proto::NoCompression);
+
+    // payload above the limit isn't materialized for compression
+    const rpc::IStream huge = boost::make_shared<std::stringstream>(std::string(static_cast<std::size_t>(settings.m_MaxBytes), 's'));
+    EXPECT_EQ(compression.Select(base, &small, huge), proto::NoCompression);
+
+    base.set_method(1);
+    EXPECT_EQ(compression.Select(base, &large, rpc::IStream()), proto::Zstd);
+    base.set_method(2);
+    EXPECT_EQ(compression.Select(base, &large, rpc::IStream()), proto::NoCompression);
+}
+
+TEST(Compression, IncompressiblePayloadIsSentAsIs)
+{
+    std::string data(5000, '\0');
+    boost::uint32_t state = 1;
+    for (auto& c : data)
+    {
+        state = state * 1664525 + 1013904223;
+        c = static_cast<char>(state >> 24);
+    }
+
+    Compression compression(MakeSettings(proto::Zstd));
+    const rpc::IStream stream = boost::make_shared<std::stringstream>("head" + data);
+    stream->seekg(4);
+    EXPECT_FALSE(compression.Compress(proto::Zstd, nullptr, stream));
+
+    // stream is rewound, so it's written raw
+    EXPECT_EQ(ReadAll(*stream), data);
+    EXPECT_EQ(compression.GetStats().m_Skipped, 1u);
+    EXPECT_EQ(compression.GetStats().m_Packets, 0u);
+}
+
+TEST(Compression, Negotiate)
+{
+    auto settings = MakeSettings(proto::Zstd);
+    settings.m_Methods[Compression::MethodKey(1000, 1)] = proto::Zlib;
+
+    // peer which doesn't advertise codecs gets raw packets
+    proto::RpcInfo::Instance peer;
+    auto negotiated = Compression::Negotiate(settings, peer);
+    EXPECT_EQ(negotiated.m_Codec, proto::NoCompression);
+    EXPECT_EQ(negotiated.m_Methods[Compression::MethodKey(1000, 1)], proto::NoCompression);
+
+    Compression::Advertise(peer);
+    Compression::Advertise(peer);
+    ASSERT_EQ(peer.properties_size(), 1);
+    EXPECT_EQ(peer.properties(0).name(), Compression::PROPERTY);
+
+    negotiated = Compression::Negotiate(settings, peer);
+    EXPECT_EQ(negotiated.m_Codec, proto::Zstd);
+    EXPECT_EQ(negotiated.m_Methods[Compression::MethodKey(1000, 1)], proto::Zlib);
+
+    peer.mutable_properties(0)->set_value("Zlib,Unknown");
+    negotiated = Compression::Negotiate(settings, peer);
+    EXPECT_EQ(negotiated.m_Codec, proto::NoCompression);
+    EXPECT_EQ(negotiated.m_Methods[Compression::MethodKey(1000, 1)], proto::Zlib);
+}
+
+TEST(Compression, SerializedEcho)
+{
+    boost::asio::io_service service;
+
+    const auto clientConnection = boost::make_shared<PacketConnection>();
+    const auto client = rpc::ISequencedChannel::Instance(service);
+    client->GetSink()->SetConnection(clientConnection);
+    client->GetSink()->SetCompression(MakeSettings(proto::Zstd));
+
+    const auto serverConnection = boost::make_shared<PacketConnection>();
+    const auto server = rpc::ISequencedChannel::Instance(service);
+    server->GetSink()->SetConnection(serverConnection);
+    server->GetSink()->SetCompression(MakeSettings(proto::Zlib));
+
+    const auto handler = rpc::ILocalHandler::Instance(service);
+    const auto svc = boost::make_shared<EchoService>();
+    handler->ProvideService(svc);
+    server->AddHandler(handler);
+
+    const auto request = MakeRequest(10000);
+    const rpc::IStream stream = boost::make_shared<std::stringstream>(std::string(20000, 's'));
+    const auto future = proto::test::TestService::Stub(*client).TestMethod(request, stream);
+
+    clientConnection->WriteToChannel(*server);
+    service.poll();
+    serverConnection->WriteToChannel(*client);
+
+    EXPECT_EQ(future.Response().data(), 43u);
+    EXPECT_EQ(future.Response().payload(), request.payload());
+    EXPECT_EQ(ReadAll(*future.Stream()), std::string(20000, 's'));
+
+    EXPECT_EQ(client->GetSink()->GetCompressionStats().m_Packets, 1u);
+    EXPECT_EQ(server->GetSink()->GetCompressionStats().m_Packets, 1u);
+    EXPECT_LT(client->GetSink()->GetCompressionStats().m_CompressedBytes, 1000u);
+}
+
+TEST(Compression, OversizedRequestGetsErrorResponse)
+{
+    boost::asio::io_service service;
+
+    const auto clientConnection = boost::make_shared<PacketConnection>();
+    const auto client = rpc::ISequencedChannel::Instance(service);
+    client->GetSink()->SetConnection(clientConnection);
+    client->GetSink()->SetCompression(MakeSettings(proto::Zstd));
+
+    // server doesn't compress, but still limits what it decompresses
+    Compression::Settings limit;
+    limit.m_MaxDecompressedBytes = 1000;
+    const auto serverConnection = boost::make_shared<PacketConnection>();
+    const auto server = rpc::ISequencedChannel::Instance(service);
+    server->GetSink()->SetConnection(serverConnection);
+    server->GetSink()->SetCompression(limit);
+
+    const auto handler = rpc::ILocalHandler::Instance(service);
+    const auto svc = boost::make_shared<EchoService>();
+    handler->ProvideService(svc);
+    server->AddHandler(handler);
+
+    const auto future = proto::test::TestService::Stub(*client).TestMethod(MakeRequest(10000), rpc::IStream());
+
+    clientConnection->WriteToChannel(*server);
+    service.poll();
+    serverConnection->WriteToChannel(*client);
+
+    EXPECT_THROW(future.Response(), rpc::Exception);
+}
+
+TEST(Compression, RequestIsAdmittedOnRawSize)
+{
+    boost::asio::io_service service;
+
+    const auto clientConnection = boost::make_shared<PacketConnection>();
+    const auto client = rpc::ISequencedChannel::Instance(service);
+    client->GetSink()->SetConnection(clientConnection);
+    client->SetCompression(MakeSettings(proto::Zstd));
+
+    rpc::details::FlowControl::Settings flow;
+    flow.m_MaxCalls = 1;
+    const auto serverConnection = boost::make_shared<PacketConnection>();
+    const auto server = rpc::ISequencedChannel::Instance(service);
+    server->GetSink()->SetConnection(serverConnection);
+    server->SetFlowControl(flow);
+
+    const auto handler = rpc::ILocalHandler::Instance(service);
+    const auto svc = boost::make_shared<EchoService>();
+    handler->ProvideService(svc);
+    server->AddHandler(handler);
+
+    const auto request = MakeRequest(10000);
+    const auto first = proto::test::TestService::Stub(*client).TestMethod(request, rpc::IStream());
+    const auto second = proto::test::TestService::Stub(*client).TestMethod(request, rpc::IStream());
+
+    // both sides count the call on its size before compression, the second one is refused without decompressing
+    clientConnection->WriteToChannel(*server);
+    EXPECT_EQ(server->GetSink()->GetFlowControlStats().m_IncomingBytes, static_cast<boost::uint64_t>(request.ByteSize()));
+    EXPECT_EQ(server->GetSink()->GetFlowControlStats().m_Refused, 1u);
+
+    service.poll();
+    serverConnection->WriteToChannel(*client);
+
+    EXPECT_EQ(first.Response().payload(), request.payload());
+    EXPECT_THROW(second.Response(), rpc::Exception);
+}
@@ -0,0 +1,131 @@
+#include "rpc/Coroutine.h"
+
+#ifdef RPC_ENABLE_COROUTINES
+
+#include "rpc/InProcessChannel.h"
+#include "rpc/LocalHandler.h"
+#include "rpc/Exceptions.h"
+#include "test_service.pb.h"
+
+#include <gtest/gtest.h>
+
+#include <boost/make_shared.hpp>
+#include <boost/asio/io_service.hpp>
+
+namespace
+{
+
+//! TestCall is a coroutine which asks TestMethod of the same channel and adds one more
+class CoroutineService : public proto::test::TestService
+{
+public:
+    CoroutineService(rpc::details::IChannel& channel) : m_Channel(channel) {}
+
+    virtual void TestMethod(const rpc::StreamRequest<::proto::test::Request>::Ptr& request, const rpc::StreamResponse<::proto::test::Response>::Ptr& response) override
+    {
+        response->set_data(request->data() + 1);
+    }
+
+    virtual rpc::Task<::proto::test::Response> TestCall(const rpc::Request<::proto::test::Request>::Ptr& request) override
+    {
+        if (!request->data())
+            BOOST_THROW_EXCEPTION(rpc::Exception("Zero data"));
+
+        const auto inner = co_await proto::test::TestService::Stub(m_Channel).TestMethod(*request, rpc::IStream());
+
+        proto::test::Response response;
+        response.set_data(inner.Response().data() + 1);
+        co_return response;
+    }
+
+private:
+    rpc::details::IChannel& m_Channel;
+};
+
+class Coroutine : public testing::Test
+{
+public:
+    Coroutine()
+        : m_Channel(rpc::IInProcessChannel::Instance(m_Service))
+        , m_Handler(rpc::ILocalHandler::Instance(m_Service))
+        , m_Svc(boost::make_shared<CoroutineService>(*m_Channel))
+    {
+        m_Handler->ProvideService(m_Svc);
+        m_Channel->AddHandler(m_Handler);
+    }
+
+    rpc::Task<unsigned> Call(unsigned data)
+    {
+        proto::test::Request request;
+        request.set_data(data);
+        const auto future = co_await proto::test::TestService::Stub(*m_Channel).TestCall(request);
+        co_return future.Response().data();
+    }
+
+protected:
+    boost::asio::io_service m_Service;
+    rpc::IInProcessChannel::Ptr m_Channel;
+    rpc::ILocalHandler::Ptr m_Handler;
+    boost::shared_ptr<CoroutineService> m_Svc;
+};
+
+} // anonymous namespace
+
+TEST_F(Coroutine, AwaitFuture)
+{
+    proto::test::Request request;
+    request.set_data(1);
+    const auto future = proto::test::TestService::Stub(*m_Channel).TestMethod(request, rpc::IStream());
+
+    unsigned result = 0;
+    const auto task = [&]() -> rpc::Task<void> {
+        result = (co_await future).Response().data();
+    }();
+
+    // coroutine is suspended until response is delivered by the io_service
+    EXPECT_EQ(result, 0u);
+    m_Service.run();
+    EXPECT_EQ(result, 2u);
+}
+
+TEST_F(Coroutine, ServiceCoroutine)
+{
+    unsigned result = 0;
+    const auto task = [&]() -> rpc::Task<void> {
+        result = co_await Call(1);
+    }();
+
+    m_Service.run();
+    EXPECT_EQ(result, 3u);
+}
+
+TEST_F(Coroutine, ServiceCoroutineException)
+{
+    bool thrown = false;
+    const auto task = [&]() -> rpc::Task<void> {
+        try
+        {
+            co_await Call(0);
+        }
+        catch (const std::exception&)
+        {
+            thrown = true;
+        }
+    }();
+
+    m_Service.run();
+    EXPECT_TRUE(thrown);
+}
+
+TEST_F(Coroutine, DroppedTaskKeepsRunning)
+{
+    unsigned result = 0;
+    [&]() -> rpc::Task<void> {
+        result = co_await Call(1);
+    }();
+
+    m_Service.run();
+    EXPECT_EQ(result, 3u);
+}
+
+#endif // RPC_ENABLE_COROUTINES
@@ -0,0 +1,260 @@
+#include "rpc/Deadline.h"
+#include "rpc/Exceptions.h"
+#include "../src/ChannelSink.h"
+#include "../src/TimeoutWheel.h"
+#include "ServiceFixture.h"
+
+#include "test_service.pb.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+#include <algorithm>
+
+#include <boost/make_shared.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace
+{
+
+typedef InProcessFixture Deadline;
+typedef SerializedFixture SerializedDeadline;
+
+} // anonymous namespace
+
+TEST(CallDeadline, Scope)
+{
+    EXPECT_TRUE(rpc::CallDeadline::Remaining().is_pos_infinity());
+    {
+        const rpc::CallDeadline outer(boost::posix_time::seconds(10));
+        EXPECT_GT(rpc::CallDeadline::Remaining(), boost::posix_time::seconds(9));
+        {
+            // nested deadline can't extend the outer one
+            const rpc::CallDeadline inner(boost::posix_time::seconds(20));
+            EXPECT_LE(rpc::CallDeadline::Remaining(), boost::posix_time::seconds(10));
+
+            const rpc::CallDeadline shorter(boost::posix_time::seconds(1));
+            EXPECT_LE(rpc::CallDeadline::Remaining(), boost::posix_time::seconds(1));
+        }
+        EXPECT_GT(rpc::CallDeadline::Remaining(), boost::posix_time::seconds(9));
+    }
+    EXPECT_TRUE(rpc::CallDeadline::Remaining().is_pos_infinity());
+}
+
+TEST(CallDeadline, CallTimeout)
+{
+    EXPECT_EQ(rpc::details::TimeoutWheel::GetCallTimeout(0), 0u);
+    EXPECT_EQ(rpc::details::TimeoutWheel::GetCallTimeout(500), 500u);
+
+    {
+        const rpc::CallDeadline deadline(boost::posix_time::seconds(2));
+        EXPECT_GT(rpc::details::TimeoutWheel::GetCallTimeout(500), 1000u);
+    }
+    {
+        // remaining part of a millisecond still limits the call
+        const rpc::CallDeadline deadline(boost::posix_time::microseconds(500));
+        EXPECT_EQ(rpc::details::TimeoutWheel::GetCallTimeout(500), 1u);
+    }
+    {
+        const rpc::CallDeadline deadline(boost::posix_time::milliseconds(-5));
+        EXPECT_THROW(rpc::details::TimeoutWheel::GetCallTimeout(500), rpc::TimeoutException);
+    }
+}
+
+TEST(TimeoutWheel, ExpiresPendingCallsOnly)
+{
+    boost::asio::io_service service;
+    std::vector<boost::uint32_t> expired;
+    const auto wheel = boost::make_shared<rpc::details::TimeoutWheel>(service, [&expired](boost::uint32_t id, const rpc::IFuture::Ptr&){
+        expired.push_back(id);
+        return true;
+    });
+
+    const auto pending = rpc::IFuture::Instance(service);
+    const auto completed = rpc::IFuture::Instance(service);
+    const auto later = rpc::IFuture::Instance(service);
+    wheel->Add(1, pending, boost::posix_time::milliseconds(20));
+    wheel->Add(2, completed, boost::posix_time::milliseconds(20));
+    wheel->Add(3, later, boost::posix_time::seconds(60));
+    completed->SetData(rpc::IFuture::StreamPtr());
+
+    service.run_for(std::chrono::milliseconds(200));
+
+    ASSERT_EQ(expired.size(), 1u);
+    EXPECT_EQ(expired.front(), 1u);
+    EXPECT_THROW(rpc::Future<proto::test::Response>(pending).Response(), rpc::TimeoutException);
+    EXPECT_FALSE(later->IsReady());
+
+    // timer stops once wheel is empty
+    wheel->Clear();
+    service.restart();
+    EXPECT_LE(service.run_for(std::chrono::milliseconds(100)), 1u);
+}
+
+TEST(TimeoutWheel, CompletedCallsAreRemoved)
+{
+    boost::asio::io_service service;
+    std::vector<boost::uint32_t> expired;
+    const auto wheel = boost::make_shared<rpc::details::TimeoutWheel>(service, [&expired](boost::uint32_t id, const rpc::IFuture::Ptr&){
+        expired.push_back(id);
+        return true;
+    });
+
+    std::vector<rpc::IFuture::Ptr> futures;
+    for (boost::uint32_t id = 1; id <= 100; ++id)
+    {
+        futures.push_back(rpc::IFuture::Instance(service));
+        wheel->Add(id, futures.back(), boost::posix_time::milliseconds(20));
+    }
+    EXPECT_EQ(wheel->GetSize(), 100u);
+
+    // wheel holds only calls in flight, unknown ids are ignored
+    for (boost::uint32_t id = 1; id <= 100; id += 2)
+        wheel->Remove(id);
+    wheel->Remove(1);
+    wheel->Remove(1000);
+    EXPECT_EQ(wheel->GetSize(), 50u);
+
+    // call registered again with the same id replaces the previous one
+    wheel->Add(2, futures[1], boost::posix_time::seconds(60));
+    EXPECT_EQ(wheel->GetSize(), 50u);
+
+    service.run_for(std::chrono::milliseconds(200));
+
+    EXPECT_EQ(expired.size(), 49u);
+    EXPECT_EQ(std::count(expired.begin(), expired.end(), 2u), 0);
+    EXPECT_EQ(wheel->GetSize(), 1u);
+}
+
+TEST_F(Deadline, DefaultTimeout)
+{
+    m_Channel->GetSink()->SetCallTimeout(boost::posix_time::milliseconds(30));
+
+    const auto future = Call();
+    RunFor(boost::posix_time::milliseconds(300));
+
+    ASSERT_TRUE(future.IsReady());
+    EXPECT_THROW(future.Response(), rpc::TimeoutException);
+
+    // late response is dropped
+    m_Svc->Release();
+    RunFor(boost::posix_time::milliseconds(10));
+}
+
+TEST_F(Deadline, ScopedDeadline)
+{
+    rpc::Future<proto::test::Response> future(rpc::IFuture::Ptr{});
+    {
+        const rpc::CallDeadline deadline(boost::posix_time::milliseconds(30));
+        future = Call();
+    }
+    const auto withoutDeadline = Call();
+
+    RunFor(boost::posix_time::milliseconds(300));
+
+    EXPECT_THROW(future.Response(), rpc::TimeoutException);
+    EXPECT_FALSE(withoutDeadline.IsReady());
+}
+
+TEST_F(Deadline, ResponseBeforeDeadline)
+{
+    m_Channel->GetSink()->SetCallTimeout(boost::posix_time::milliseconds(100));
+
+    const auto future = Call();
+    m_Service.poll();
+    m_Svc->Release();
+
+    ASSERT_TRUE(future.IsReady());
+    EXPECT_EQ(future.Response().data(), 2u);
+
+    RunFor(boost::posix_time::milliseconds(300));
+    EXPECT_EQ(future.Response().data(), 2u);
+}
+
+TEST_F(Deadline, BudgetIsPassedToHandler)
+{
+    rpc::Future<proto::test::Response> future(rpc::IFuture::Ptr{});
+    {
+        const rpc::CallDeadline deadline(boost::posix_time::seconds(10));
+        future = Call();
+    }
+    const auto withoutDeadline = Call();
+    m_Service.poll();
+
+    ASSERT_EQ(m_Svc->m_Remaining.size(), 2u);
+    EXPECT_GT(m_Svc->m_Remaining[0], boost::posix_time::seconds(9));
+    EXPECT_LE(m_Svc->m_Remaining[0], boost::posix_time::seconds(10));
+    EXPECT_GT(m_Svc->m_Inherited[0], boost::posix_time::seconds(9));
+    EXPECT_LE(m_Svc->m_Inherited[0], m_Svc->m_Remaining[0]);
+    EXPECT_TRUE(m_Svc->m_Remaining[1].is_pos_infinity());
+    EXPECT_TRUE(m_Svc->m_Inherited[1].is_pos_infinity());
+
+    m_Svc->Release();
+    EXPECT_EQ(future.Response().data(), 2u);
+}
+
+TEST_F(Deadline, ExpiredRequestIsDropped)
+{
+    rpc::Future<proto::test::Response> future(rpc::IFuture::Ptr{});
+    {
+        const rpc::CallDeadline deadline(boost::posix_time::milliseconds(5));
+        future = Call();
+    }
+
+    // request expires while it's queued
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(20));
+    m_Service.poll();
+
+    EXPECT_TRUE(m_Svc->m_Responses.empty());
+    ASSERT_TRUE(future.IsReady());
+    EXPECT_ANY_THROW(future.Response());
+}
+
+TEST_F(Deadline, ExpiredDeadlineFailsCall)
+{
+    rpc::Future<proto::test::Response> future(rpc::IFuture::Ptr{});
+    {
+        const rpc::CallDeadline deadline(boost::posix_time::milliseconds(-1));
+        future = Call();
+    }
+
+    // call is failed right away and never reaches the handler
+    ASSERT_TRUE(future.IsReady());
+    EXPECT_THROW(future.Response(), rpc::TimeoutException);
+
+    m_Service.poll();
+    EXPECT_TRUE(m_Svc->m_Responses.empty());
+}
+
+TEST_F(SerializedDeadline, BudgetIsPassedToHandler)
+{
+    rpc::Future<proto::test::Response> future(rpc::IFuture::Ptr{});
+    {
+        const rpc::CallDeadline deadline(boost::posix_time::seconds(10));
+        future = Call();
+    }
+
+    ToServer();
+    ASSERT_EQ(m_Svc->m_Remaining.size(), 1u);
+    EXPECT_GT(m_Svc->m_Remaining[0], boost::posix_time::seconds(9));
+    EXPECT_LE(m_Svc->m_Remaining[0], boost::posix_time::seconds(10));
+    EXPECT_LE(m_Svc->m_Inherited[0], m_Svc->m_Remaining[0]);
+
+    m_Svc->Release();
+    ToClient();
+    EXPECT_EQ(future.Response().data(), 2u);
+}
+
+TEST_F(SerializedDeadline, ExpiredDeadlineFailsCall)
+{
+    rpc::Future<proto::test::Response> future(rpc::IFuture::Ptr{});
+    {
+        const rpc::CallDeadline deadline(boost::posix_time::milliseconds(-1));
+        future = Call();
+    }
+
+    // request is not written at all
+    ASSERT_TRUE(future.IsReady());
+    EXPECT_THROW(future.Response(), rpc::TimeoutException);
+    EXPECT_TRUE(m_ClientConnection->IsEmpty());
+}
@@ -0,0 +1,270 @@
+#include "../src/Stream.h"
+#include "rpc/FileStream.h"
+#include "test_service.pb.h"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/make_shared.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#if defined(__linux__)
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+//! Temporary file removed with the fixture
+class TempFile
+{
+public:
+    TempFile(const std::string& data)
+        : m_Path((boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()).string())
+    {
+        std::ofstream(m_Path.c_str(), std::ios::binary).write(data.data(), data.size());
+    }
+    ~TempFile()
+    {
+        boost::system::error_code e;
+        boost::filesystem::remove(m_Path, e);
+    }
+
+    const std::string& GetPath() const
+    {
+        return m_Path;
+    }
+
+private:
+    const std::string m_Path;
+};
+
+std::string MakeData(std::size_t size)
+{
+    std::string result(size, '\0');
+    for (std::size_t i = 0; i < size; ++i)
+        result[i] = static_cast<char>(i % 251);
+    return result;
+}
+
+//! Keeps all written data in one buffer, records files if it's able to send them
+class Connection : public net::IConnection
+{
+public:
+    class Data : public net::details::IData
+    {
+    public:
+        Data(std::string& buffer) : m_Buffer(buffer) {}
+
+        virtual void Write(const void* data, std::size_t size) override
+        {
+            m_Buffer.append(reinterpret_cast<const char*>(data), size);
+        }
+
+        virtual const std::vector<boost::asio::mutable_buffer>& GetBuffers() override
+        {
+            static const std::vector<boost::asio::mutable_buffer> res;
+            return res;
+        }
+
+    private:
+        std::string& m_Buffer;
+    };
+
+    virtual void Receive(const Callback& callback) override
+    {
+        throw std::runtime_error("The method or operation is not implemented.");
+    }
+    virtual void Close() override
+    {
+    }
+    virtual net::details::IData::Ptr Prepare(std::size_t size) override
+    {
+        return boost::make_shared<Data>(m_Data);
+    }
+    virtual void Flush() override
+    {
+    }
+    virtual std::string GetInfo() const override
+    {
+        return "";
+    }
+
+    std::string m_Data;
+};
+
+class FileSenderConnection : public Connection, public rpc::IFileSender
+{
+public:
+    virtual void SendFile(const rpc::FileStream::Ptr& file, boost::uint64_t position, boost::uint64_t size) override
+    {
+        m_File = file;
+        m_Position = position;
+        m_Size = size;
+        m_HeaderSize = m_Data.size();
+    }
+
+    rpc::FileStream::Ptr m_File;
+    boost::uint64_t m_Position = 0;
+    boost::uint64_t m_Size = 0;
+    std::size_t m_HeaderSize = 0;
+};
+
+proto::test::Request MakeRequest()
+{
+    proto::test::Request request;
+    request.set_data(42);
+    return request;
+}
+
+} // anonymous namespace
+
+TEST(FileStream, ReadsRegion)
+{
+    const auto data = MakeData(1000);
+    const TempFile file(data);
+
+    const auto stream = rpc::FileStream::Instance(file.GetPath(), 100, 500);
+    EXPECT_EQ(stream->GetOffset(), 100u);
+    EXPECT_EQ(stream->GetSize(), 500u);
+    EXPECT_EQ(net::StreamSize(*stream), 500u);
+
+    std::string read(200, '\0');
+    stream->read(&read[0], read.size());
+    EXPECT_EQ(read, data.substr(100, 200));
+    EXPECT_EQ(stream->GetPosition(), 200u);
+    EXPECT_EQ(net::StreamSize(*stream), 300u);
+
+    stream->seekg(450);
+    std::string tail;
+    *stream >> tail;
+    EXPECT_EQ(tail.size(), 50u);
+    EXPECT_TRUE(stream->eof());
+}
+
+TEST(FileStream, RegionIsLimitedByFile)
+{
+    const TempFile file(MakeData(10));
+    EXPECT_EQ(rpc::FileStream::Instance(file.GetPath(), 4)->GetSize(), 6u);
+    EXPECT_EQ(rpc::FileStream::Instance(file.GetPath(), 10)->GetSize(), 0u);
+    EXPECT_THROW(rpc::FileStream::Instance(file.GetPath(), 11), rpc::Exception);
+    EXPECT_THROW(rpc::FileStream::Instance(file.GetPath() + ".missing"), rpc::Exception);
+}
+
+TEST(FileStream, Cast)
+{
+    const TempFile file(MakeData(10));
+    const rpc::IStream stream = rpc::FileStream::Instance(file.GetPath());
+    EXPECT_TRUE(rpc::FileStream::Cast(stream));
+    EXPECT_FALSE(rpc::FileStream::Cast(boost::make_shared<std::stringstream>("data")));
+    EXPECT_FALSE(rpc::FileStream::Cast(rpc::IStream()));
+}
+
+TEST(FileStream, HandedToFileSender)
+{
+    const auto data = MakeData(rpc::details::WriteStream::MAX_IN_MEMORY_STREAM_SIZE * 3);
+    const TempFile file(data);
+    const auto stream = rpc::FileStream::Instance(file.GetPath());
+    stream->seekg(10);
+
+    const auto connection = boost::make_shared<FileSenderConnection>();
+    const auto request = MakeRequest();
+    rpc::details::WriteStream(connection).Write(request, nullptr, stream);
+
+    EXPECT_EQ(connection->m_File, stream);
+    EXPECT_EQ(connection->m_Position, 10u);
+    EXPECT_EQ(connection->m_Size, data.size() - 10);
+    EXPECT_EQ(connection->m_HeaderSize, request.ByteSize() + sizeof(boost::uint32_t));
+    EXPECT_EQ(connection->m_Data.size(), connection->m_HeaderSize);
+    EXPECT_EQ(stream->GetPosition(), data.size());
+}
+
+TEST(FileStream, WrittenWithoutMapping)
+{
+    const auto data = MakeData(rpc::details::WriteStream::MAX_IN_MEMORY_STREAM_SIZE * 3 + 17);
+    const TempFile file(data);
+
+    const auto connection = boost::make_shared<Connection>();
+    const auto request = MakeRequest();
+    rpc::details::WriteStream(connection).Write(request, nullptr, rpc::FileStream::Instance(file.GetPath()));
+
+    const auto headerSize = request.ByteSize() + sizeof(boost::uint32_t);
+    ASSERT_EQ(connection->m_Data.size(), headerSize + data.size());
+    EXPECT_TRUE(connection->m_Data.compare(headerSize, data.size(), data) == 0);
+}
+
+TEST(FileStream, TruncatedFileFailsWrite)
+{
+    const TempFile file(MakeData(rpc::FileStream::MIN_MAPPED_SIZE * 2));
+    const auto stream = rpc::FileStream::Instance(file.GetPath());
+    boost::filesystem::resize_file(file.GetPath(), 1000);
+
+    // write path reads the file instead of the mapping, so there is no SIGBUS
+    const auto connection = boost::make_shared<Connection>();
+    EXPECT_THROW(rpc::details::WriteStream(connection).Write(MakeRequest(), nullptr, stream), rpc::Exception);
+}
+
+TEST(FileStream, SmallRegionIsRead)
+{
+    const auto data = MakeData(rpc::details::WriteStream::MAX_IN_MEMORY_STREAM_SIZE * 3 + 17);
+    const TempFile file(data);
+
+    const auto stream = rpc::FileStream::Instance(file.GetPath(), 10);
+#if !defined(_WIN32)
+    EXPECT_FALSE(stream->GetData());
+#endif
+
+    // reads and seeks cross boundaries of the read buffer
+    std::string read(data.size() - 1000, '\0');
+    stream->read(&read[0], read.size());
+    EXPECT_EQ(read, data.substr(10, read.size()));
+    EXPECT_EQ(stream->GetPosition(), read.size());
+
+    stream->seekg(5);
+    read.assign(100, '\0');
+    stream->read(&read[0], read.size());
+    EXPECT_EQ(read, data.substr(15, 100));
+    EXPECT_EQ(net::StreamSize(*stream), data.size() - 115);
+
+    read.assign(100, '\0');
+    stream->Read(1000, &read[0], read.size());
+    EXPECT_EQ(read, data.substr(1010, 100));
+    EXPECT_EQ(stream->GetPosition(), 105u);
+    EXPECT_THROW(stream->Read(data.size() - 20, &read[0], read.size()), rpc::Exception);
+
+    const TempFile large(MakeData(rpc::FileStream::MIN_MAPPED_SIZE));
+    EXPECT_TRUE(rpc::FileStream::Instance(large.GetPath())->GetData());
+}
+
+#if defined(__linux__)
+TEST(FileStream, SendTo)
+{
+    const auto data = MakeData(10000);
+    const TempFile file(data);
+    const auto stream = rpc::FileStream::Instance(file.GetPath(), 1000);
+
+    int sockets[2] = {};
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+
+    EXPECT_EQ(stream->SendTo(sockets[0], 500, 4000), 4000u);
+    EXPECT_THROW(stream->SendTo(sockets[0], 8000, 2000), rpc::Exception);
+
+    std::string received(4000, '\0');
+    std::size_t read = 0;
+    while (read < received.size())
+    {
+        const auto result = ::read(sockets[1], &received[read], received.size() - read);
+        ASSERT_GT(result, 0);
+        read += result;
+    }
+    EXPECT_EQ(received, data.substr(1500, 4000));
+
+    ::close(sockets[0]);
+    ::close(sockets[1]);
+}
+#endif
@@ -0,0 +1,243 @@
+#include "rpc/Exceptions.h"
+#include "../src/ChannelSink.h"
+#include "rpc/FlowControl.h"
+#include "ServiceFixture.h"
+
+#include <gtest/gtest.h>
+
+namespace
+{
+
+typedef SerializedFixture SerializedFlowControl;
+
+class FlowControl : public InProcessFixture
+{
+public:
+    void SetLimits(boost::uint32_t calls, boost::uint64_t bytes, rpc::details::FlowControl::Mode mode)
+    {
+        rpc::details::FlowControl::Settings settings;
+        settings.m_MaxCalls = calls;
+        settings.m_MaxBytes = bytes;
+        settings.m_Mode = mode;
+        m_Channel->GetSink()->SetFlowControl(settings);
+    }
+
+    rpc::details::FlowControl::Stats GetStats() const
+    {
+        return m_Channel->GetSink()->GetFlowControlStats();
+    }
+};
+
+} // anonymous namespace
+
+TEST_F(FlowControl, CallsWaitForCredit)
+{
+    SetLimits(2, 0, rpc::details::FlowControl::MODE_WAIT);
+
+    std::vector<rpc::Future<proto::test::Response>> futures;
+    for (boost::uint32_t i = 1; i <= 5; ++i)
+        futures.push_back(Call(i));
+    m_Service.poll();
+
+    ASSERT_EQ(m_Svc->m_Responses.size(), 2u);
+    auto stats = GetStats();
+    EXPECT_EQ(stats.m_Calls, 2u);
+    EXPECT_EQ(stats.m_CallsLimit, 2u);
+    EXPECT_EQ(stats.m_Queued, 3u);
+
+    // completed call returns its credit to the first queued one
+    m_Svc->m_Responses.erase(m_Svc->m_Responses.begin());
+    m_Service.poll();
+    EXPECT_EQ(futures[0].Response().data(), 2u);
+    ASSERT_EQ(m_Svc->m_Responses.size(), 2u);
+    EXPECT_EQ(m_Svc->m_Responses.back()->data(), 4u);
+    EXPECT_EQ(GetStats().m_Queued, 2u);
+
+    // queued call completed by cancel is never dispatched
+    EXPECT_TRUE(futures[3].Cancel());
+
+    while (!m_Svc->m_Responses.empty())
+    {
+        m_Svc->Release();
+        m_Service.poll();
+    }
+
+    EXPECT_EQ(futures[4].Response().data(), 6u);
+    EXPECT_THROW(futures[3].Response(), rpc::CancelledException);
+
+    stats = GetStats();
+    EXPECT_EQ(stats.m_Calls, 0u);
+    EXPECT_EQ(stats.m_Bytes, 0u);
+    EXPECT_EQ(stats.m_Queued, 0u);
+}
+
+TEST_F(FlowControl, CallsFailWithoutCredit)
+{
+    SetLimits(1, 0, rpc::details::FlowControl::MODE_FAIL);
+
+    const auto first = Call();
+    const auto second = Call();
+
+    ASSERT_TRUE(second.IsReady());
+    EXPECT_THROW(second.Response(), rpc::OverloadException);
+    EXPECT_EQ(GetStats().m_Rejected, 1u);
+
+    m_Service.poll();
+    m_Svc->Release();
+    EXPECT_EQ(first.Response().data(), 2u);
+
+    // credit is returned with response
+    const auto third = Call();
+    m_Service.poll();
+    m_Svc->Release();
+    EXPECT_EQ(third.Response().data(), 2u);
+}
+
+TEST_F(FlowControl, BytesLimit)
+{
+    // the first call is written even if it's larger than the window
+    SetLimits(0, 1, rpc::details::FlowControl::MODE_WAIT);
+
+    const auto first = Call(1000);
+    const auto second = Call(1000);
+    m_Service.poll();
+
+    ASSERT_EQ(m_Svc->m_Responses.size(), 1u);
+    EXPECT_GT(GetStats().m_Bytes, 0u);
+    EXPECT_EQ(GetStats().m_Queued, 1u);
+
+    m_Svc->Release();
+    m_Service.poll();
+    m_Svc->Release();
+    EXPECT_EQ(second.Response().data(), 1001u);
+}
+
+TEST_F(FlowControl, CloseDropsQueuedCalls)
+{
+    SetLimits(1, 0, rpc::details::FlowControl::MODE_WAIT);
+
+    const auto first = Call();
+    const auto second = Call();
+    m_Channel->Close(rpc::MakeException("closed"));
+    m_Service.poll();
+
+    EXPECT_TRUE(m_Svc->m_Responses.empty());
+    EXPECT_ANY_THROW(first.Response());
+    EXPECT_ANY_THROW(second.Response());
+
+    const auto stats = GetStats();
+    EXPECT_EQ(stats.m_Calls, 0u);
+    EXPECT_EQ(stats.m_Queued, 0u);
+}
+
+TEST_F(FlowControl, QueueIsLimited)
+{
+    rpc::details::FlowControl::Settings settings;
+    settings.m_MaxCalls = 1;
+    settings.m_MaxQueued = 2;
+    m_Channel->GetSink()->SetFlowControl(settings);
+
+    const auto first = Call();
+    const auto queued = Call();
+    const auto last = Call();
+
+    // queue is full, the call fails right away like a call without credit in MODE_FAIL
+    const auto overflow = Call();
+    ASSERT_TRUE(overflow.IsReady());
+    EXPECT_THROW(overflow.Response(), rpc::OverloadException);
+
+    auto stats = GetStats();
+    EXPECT_EQ(stats.m_Queued, 2u);
+    EXPECT_GT(stats.m_QueuedBytes, 0u);
+    EXPECT_EQ(stats.m_Rejected, 1u);
+
+    while (!last.IsReady())
+    {
+        m_Service.poll();
+        m_Svc->Release();
+    }
+
+    EXPECT_EQ(first.Response().data(), 2u);
+    EXPECT_EQ(queued.Response().data(), 2u);
+    EXPECT_EQ(last.Response().data(), 2u);
+
+    stats = GetStats();
+    EXPECT_EQ(stats.m_Queued, 0u);
+    EXPECT_EQ(stats.m_QueuedBytes, 0u);
+}
+
+TEST_F(FlowControl, QueuedBytesAreLimited)
+{
+    rpc::details::FlowControl::Settings settings;
+    settings.m_MaxCalls = 1;
+    settings.m_MaxQueuedBytes = 1;
+    m_Channel->GetSink()->SetFlowControl(settings);
+
+    const auto first = Call();
+
+    // the first queued call may be larger than the limit, the next one doesn't fit
+    const auto queued = Call();
+    const auto overflow = Call();
+    ASSERT_TRUE(overflow.IsReady());
+    EXPECT_THROW(overflow.Response(), rpc::OverloadException);
+    EXPECT_FALSE(queued.IsReady());
+    EXPECT_EQ(GetStats().m_Queued, 1u);
+}
+
+TEST(FlowControlIncoming, CallsOverLimitsAreRefused)
+{
+    rpc::details::FlowControl flow([](const proto::BasePacket&, const rpc::MessagePtr&, const rpc::IStream&){});
+
+    // nothing is counted until limits are granted
+    EXPECT_TRUE(flow.Admit(1, 1000));
+    EXPECT_EQ(flow.GetStats().m_IncomingCalls, 0u);
+
+    rpc::details::FlowControl::Settings settings;
+    settings.m_MaxCalls = 2;
+    settings.m_MaxBytes = 100;
+    flow.Configure(settings);
+
+    // the first call may be larger than the window, like on the sender
+    EXPECT_TRUE(flow.Admit(2, 150));
+    EXPECT_FALSE(flow.Admit(3, 10));
+    flow.ReleaseIncoming(2);
+
+    EXPECT_TRUE(flow.Admit(3, 10));
+    EXPECT_TRUE(flow.Admit(4, 10));
+    EXPECT_FALSE(flow.Admit(5, 10));
+
+    auto stats = flow.GetStats();
+    EXPECT_EQ(stats.m_IncomingCalls, 2u);
+    EXPECT_EQ(stats.m_IncomingBytes, 20u);
+    EXPECT_EQ(stats.m_Refused, 2u);
+
+    // unknown ids are ignored
+    flow.ReleaseIncoming(5);
+    flow.ReleaseIncoming(3);
+    flow.ReleaseIncoming(4);
+    stats = flow.GetStats();
+    EXPECT_EQ(stats.m_IncomingCalls, 0u);
+    EXPECT_EQ(stats.m_IncomingBytes, 0u);
+}
+
+TEST_F(SerializedFlowControl, ServerRefusesCallsOverCredit)
+{
+    rpc::details::FlowControl::Settings settings;
+    settings.m_MaxCalls = 1;
+    m_Server->GetSink()->SetFlowControl(settings);
+
+    // client gets the credit only with responses, so it sends both calls
+    const auto first = Call();
+    const auto second = Call();
+    ToServer();
+
+    ASSERT_EQ(m_Svc->m_Responses.size(), 1u);
+    EXPECT_EQ(m_Server->GetSink()->GetFlowControlStats().m_Refused, 1u);
+    EXPECT_EQ(m_Server->GetSink()->GetFlowControlStats().m_IncomingCalls, 1u);
+
+    m_Svc->Release();
+    ToClient();
+    EXPECT_EQ(first.Response().data(), 2u);
+    EXPECT_ANY_THROW(second.Response());
+    EXPECT_EQ(m_Server->GetSink()->GetFlowControlStats().m_IncomingCalls, 0u);
+}
@@ -0,0 +1,398 @@
+#include "rpc/Future.h"
+#include "test_service.pb.h"
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/make_shared.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace
+{
+
+rpc::IFuture::StreamPtr MakePacket(const proto::test::Response& response, const std::string& tail)
+{
+    const auto data = response.SerializeAsString();
+    const auto size = static_cast<boost::uint32_t>(data.size());
+    return boost::make_shared<std::stringstream>(std::string(reinterpret_cast<const char*>(&size), sizeof(size)) + data + tail);
+}
+
+} // anonymous namespace
+
+TEST(Future, ResponseIsParsedOnceForAllCopies)
+{
+    boost::asio::io_service service;
+    const auto future = rpc::IFuture::Instance(service);
+
+    proto::test::Response response;
+    response.set_data(7);
+    response.set_payload("payload");
+    future->SetData(MakePacket(response, "tail"));
+
+    const rpc::Future<proto::test::Response> first(future);
+    const rpc::Future<proto::test::Response> second(first);
+    const rpc::Future<proto::test::Response> third(future);
+
+    EXPECT_EQ(first.Response().data(), 7u);
+    EXPECT_EQ(&first.Response(), &second.Response());
+    EXPECT_EQ(&first.Response(), &third.Response());
+
+    // stream is positioned after the message for every copy
+    std::string tail;
+    *third.Stream() >> tail;
+    EXPECT_EQ(tail, "tail");
+}
+
+TEST(Future, CallbackCopySharesResponse)
+{
+    boost::asio::io_service service;
+    const auto future = rpc::IFuture::Instance(service);
+    const rpc::Future<proto::test::Response> original(future);
+
+    const proto::test::Response* fromCallback = nullptr;
+    original.Async([&fromCallback](const rpc::Future<proto::test::Response>& copy){
+        fromCallback = &copy.Response();
+    });
+
+    proto::test::Response response;
+    response.set_data(1);
+    future->SetData(MakePacket(response, ""));
+
+    ASSERT_TRUE(fromCallback);
+    EXPECT_EQ(fromCallback, &original.Response());
+}
+
+TEST(Future, ConcurrentAccess)
+{
+    boost::asio::io_service service;
+    const auto future = rpc::IFuture::Instance(service);
+
+    std::vector<const proto::test::Response*> responses(8);
+    boost::thread_group threads;
+    for (auto& result : responses)
+    {
+        threads.create_thread([&future, &result](){
+            result = &rpc::Future<proto::test::Response>(future).Response();
+        });
+    }
+
+    proto::test::Response response;
+    response.set_data(3);
+    response.set_payload(std::string(100000, 'p'));
+    future->SetData(MakePacket(response, ""));
+    threads.join_all();
+
+    for (const auto* result : responses)
+    {
+        ASSERT_EQ(result, responses.front());
+        EXPECT_EQ(result->payload().size(), 100000u);
+    }
+}
+
+TEST(Future, WaitRunsQueuedHandlers)
+{
+    // nobody runs the io_service, response is delivered by a handler queued before the wait
+    boost::asio::io_service service;
+    const auto future = rpc::IFuture::Instance(service);
+
+    proto::test::Response response;
+    response.set_data(9);
+    service.post([&future, &response](){ future->SetData(MakePacket(response, "")); });
+
+    EXPECT_TRUE(future->Wait(boost::posix_time::seconds(5)));
+    EXPECT_EQ(rpc::Future<proto::test::Response>(future).Response().data(), 9u);
+}
+
+TEST(Future, WaitInHandlerDrivesService)
+{
+    // waiting handler runs on the only thread of the io_service, response is delivered by a handler posted later
+    boost::asio::io_service service;
+    const boost::asio::io_service::work work(service);
+    const auto future = rpc::IFuture::Instance(service);
+
+    proto::test::Response response;
+    response.set_data(9);
+
+    bool isReady = false;
+    service.post([&service, &future, &isReady](){
+        isReady = future->Wait(boost::posix_time::seconds(5));
+        service.stop();
+    });
+
+    boost::thread poster([&service, &future, &response](){
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(20));
+        service.post([&future, &response](){ future->SetData(MakePacket(response, "")); });
+    });
+
+    service.run();
+    poster.join();
+    EXPECT_TRUE(isReady);
+    EXPECT_EQ(rpc::Future<proto::test::Response>(future).Response().data(), 9u);
+}
+
+TEST(Future, WaitInHandlerWakesUpOnData)
+{
+    // data is set by a thread outside of the io_service while the waiting handler blocks in it
+    boost::asio::io_service service;
+    const boost::asio::io_service::work work(service);
+    const auto future = rpc::IFuture::Instance(service);
+
+    proto::test::Response response;
+    response.set_data(4);
+
+    bool isReady = false;
+    service.post([&service, &future, &isReady](){
+        isReady = future->Wait(boost::posix_time::seconds(5));
+        service.stop();
+    });
+
+    boost::thread setter([&future, &response](){
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(20));
+        future->SetData(MakePacket(response, ""));
+    });
+
+    const auto start = boost::chrono::steady_clock::now();
+    service.run();
+    setter.join();
+    EXPECT_TRUE(isReady);
+    EXPECT_LT(boost::chrono::steady_clock::now() - start, boost::chrono::seconds(1));
+}
+
+TEST(Future, WaitParksWhileServiceIsRunByOthers)
+{
+    // io_service has its own thread, waiter is only woken up by the data
+    boost::asio::io_service service;
+    const auto future = rpc::IFuture::Instance(service);
+
+    proto::test::Response response;
+    response.set_data(6);
+
+    const boost::asio::io_service::work work(service);
+    boost::thread runner([&service](){ service.run(); });
+    boost::thread poster([&service, &future, &response](){
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(20));
+        service.post([&future, &response](){ future->SetData(MakePacket(response, "")); });
+    });
+
+    EXPECT_FALSE(future->Wait(boost::posix_time::milliseconds(1)));
+    EXPECT_TRUE(future->Wait(boost::posix_time::seconds(5)));
+    poster.join();
+
+    service.stop();
+    runner.join();
+    EXPECT_EQ(rpc::Future<proto::test::Response>(future).Response().data(), 6u);
+}
+
+TEST(Future, ParseErrorIsShared)
+{
+    boost::asio::io_service service;
+    const auto future = rpc::IFuture::Instance(service);
+
+    const boost::uint32_t size = 10;
+    future->SetData(boost::make_shared<std::stringstream>(std::string(reinterpret_cast<const char*>(&size), sizeof(size)) + std::string(10, '\xff')));
+
+    const rpc::Future<proto::test::Response> first(future);
+    const rpc::Future<proto::test::Response> second(future);
+    EXPECT_THROW(first.Response(), std::exception);
+    EXPECT_THROW(second.Response(), std::exception);
+    EXPECT_TRUE(future->GetException());
+}
+
+TEST(Future, MultipleCallbacks)
+{
+    boost::asio::io_service service;
+    const auto future = rpc::IFuture::Instance(service);
+    const rpc::Future<proto::test::Response> original(future);
+
+    std::vector<unsigned> called;
+    original.Async([&called](const rpc::Future<proto::test::Response>& f){ called.push_back(f.Response().data()); });
+    original.Async([&called](const rpc::Future<proto::test::Response>& f){ called.push_back(f.Response().data() + 1); });
+
+    proto::test::Response response;
+    response.set_data(5);
+    future->SetData(MakePacket(response, ""));
+
+    ASSERT_EQ(called.size(), 2u);
+    EXPECT_EQ(called[0], 5u);
+    EXPECT_EQ(called[1], 6u);
+}
+
+TEST(Future, ThenReturnsMessage)
+{
+    boost::asio::io_service service;
+    const auto future = rpc::IFuture::Instance(service);
+
+    const auto next = rpc::Future<proto::test::Response>(future).Then([](const rpc::Future<proto::test::Response>& f){
+        proto::test::Request request;
+        request.set_data(f.Response().data() * 2);
+        return request;
+    });
+    EXPECT_FALSE(next.IsReady());
+
+    proto::test::Response response;
+    response.set_data(21);
+    future->SetData(MakePacket(response, ""));
+
+    ASSERT_TRUE(next.IsReady());
+    EXPECT_EQ(next.Response().data(), 42u);
+
+    // stream of continuation result is empty like a stream of received packet
+    const auto stream = next.Stream();
+    ASSERT_TRUE(stream);
+    EXPECT_EQ(stream->get(), std::char_traits<char>::eof());
+}
+
+TEST(Future, ThenUnwrapsFuture)
+{
+    boost::asio::io_service service;
+    const auto first = rpc::IFuture::Instance(service);
+    const auto second = rpc::IFuture::Instance(service);
+
+    const auto next = rpc::Future<proto::test::Response>(first).Then([second](const rpc::Future<proto::test::Response>&){
+        return rpc::Future<proto::test::Response>(second);
+    });
+
+    proto::test::Response response;
+    response.set_data(1);
+    first->SetData(MakePacket(response, ""));
+    EXPECT_FALSE(next.IsReady());
+
+    response.set_data(2);
+    second->SetData(MakePacket(response, "tail"));
+
+    ASSERT_TRUE(next.IsReady());
+    EXPECT_EQ(&next.Response(), &rpc::Future<proto::test::Response>(second).Response());
+
+    std::string tail;
+    *next.Stream() >> tail;
+    EXPECT_EQ(tail, "tail");
+}
+
+TEST(Future, ThenPropagatesException)
+{
+    boost::asio::io_service service;
+    const auto future = rpc::IFuture::Instance(service);
+
+    bool called = false;
+    const auto next = rpc::Future<proto::test::Response>(future).Then([&called](const rpc::Future<proto::test::Response>& f){
+        called = true;
+        return f.Response();
+    });
+
+    future->SetException(boost::copy_exception(std::runtime_error("failed")));
+
+    EXPECT_TRUE(called);
+    EXPECT_THROW(next.Response(), std::runtime_error);
+}
+
+TEST(Future, ThenOnExecutor)
+{
+    boost::asio::io_service service;
+    boost::asio::io_service executor;
+    const auto future = rpc::IFuture::Instance(service);
+
+    const auto next = rpc::Future<proto::test::Response>(future).Then(executor, [](const rpc::Future<proto::test::Response>& f){
+        return f.Response();
+    });
+
+    proto::test::Response response;
+    response.set_data(3);
+    future->SetData(MakePacket(response, ""));
+
+    // continuation is posted, nothing runs until executor is polled
+    EXPECT_FALSE(next.IsReady());
+    EXPECT_EQ(executor.poll(), 1u);
+
+    ASSERT_TRUE(next.IsReady());
+    EXPECT_EQ(next.Response().data(), 3u);
+}
+
+TEST(Future, WhenAll)
+{
+    boost::asio::io_service service;
+    std::vector<rpc::IFuture::Ptr> impls;
+    std::vector<rpc::Future<proto::test::Response>> futures;
+    for (unsigned i = 0; i < 3; ++i)
+    {
+        impls.push_back(rpc::IFuture::Instance(service));
+        futures.emplace_back(impls.back());
+    }
+
+    const auto all = rpc::WhenAll(service, futures, [](const std::vector<rpc::Future<proto::test::Response>>& ready){
+        proto::test::Response sum;
+        sum.set_data(0);
+        for (const auto& future : ready)
+            sum.set_data(sum.data() + future.Response().data());
+        return sum;
+    });
+
+    for (unsigned i = 0; i < impls.size(); ++i)
+    {
+        EXPECT_FALSE(all.IsReady());
+
+        proto::test::Response response;
+        response.set_data(i + 1);
+        impls[i]->SetData(MakePacket(response, ""));
+    }
+
+    service.poll();
+    ASSERT_TRUE(all.IsReady());
+    EXPECT_EQ(all.Response().data(), 6u);
+}
+
+TEST(Future, WhenAllEmpty)
+{
+    boost::asio::io_service service;
+    const auto all = rpc::WhenAll(service, std::vector<rpc::Future<proto::test::Response>>(), [](const std::vector<rpc::Future<proto::test::Response>>& ready){
+        proto::test::Response response;
+        response.set_data(static_cast<unsigned>(ready.size()));
+        return response;
+    });
+
+    service.poll();
+    ASSERT_TRUE(all.IsReady());
+    EXPECT_EQ(all.Response().data(), 0u);
+}
+
+TEST(Future, WhenAny)
+{
+    boost::asio::io_service service;
+    std::vector<rpc::IFuture::Ptr> impls;
+    std::vector<rpc::Future<proto::test::Response>> futures;
+    for (unsigned i = 0; i < 3; ++i)
+    {
+        impls.push_back(rpc::IFuture::Instance(service));
+        futures.emplace_back(impls.back());
+    }
+
+    unsigned calls = 0;
+    const auto any = rpc::WhenAny(service, futures, [&calls](std::size_t index, const std::vector<rpc::Future<proto::test::Response>>& ready){
+        ++calls;
+        return ready[index].Response();
+    });
+
+    proto::test::Response response;
+    response.set_data(2);
+    impls[1]->SetData(MakePacket(response, ""));
+    response.set_data(1);
+    impls[0]->SetData(MakePacket(response, ""));
+    service.poll();
+
+    ASSERT_TRUE(any.IsReady());
+    EXPECT_EQ(any.Response().data(), 2u);
+    EXPECT_EQ(calls, 1u);
+}
+
+TEST(Future, WhenAnyEmpty)
+{
+    boost::asio::io_service service;
+    const auto any = rpc::WhenAny(service, std::vector<rpc::Future<proto::test::Response>>(), [](std::size_t index, const std::vector<rpc::Future<proto::test::Response>>& ready){
+        return ready[index].Response();
+    });
+
+    EXPECT_THROW(any.Response(), std::invalid_argument);
+}
@@ -0,0 +1,189 @@
+#include "rpc/InProcessChannel.h"
+#include "rpc/LocalHandler.h"
+#include "rpc/Exceptions.h"
+#include "test_service.pb.h"
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+
+#include <boost/make_shared.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace
+{
+
+//! Remembers what was received, echoes stream back, fails on zero data
+class InProcessService : public proto::test::TestService
+{
+public:
+    InProcessService() : m_Request() {}
+
+    virtual void TestMethod(const rpc::StreamRequest<::proto::test::Request>::Ptr& request, const rpc::StreamResponse<::proto::test::Response>::Ptr& response) override
+    {
+        m_Request = request.get();
+        m_Caller = request->GetCaller();
+        m_Stream = request->Stream();
+
+        if (!request->data())
+            BOOST_THROW_EXCEPTION(rpc::Exception("Zero data"));
+
+        response->set_data(request->data() + 1);
+        response->set_payload(request->payload());
+        response->Stream(request->Stream());
+    }
+
+    const google::protobuf::Message* m_Request;
+    rpc::InstanceId m_Caller;
+    rpc::IStream m_Stream;
+};
+
+class InProcessChannel : public testing::Test
+{
+public:
+    InProcessChannel()
+        : m_Channel(rpc::IInProcessChannel::Instance(m_Service))
+        , m_Handler(rpc::ILocalHandler::Instance(m_Service))
+        , m_Svc(boost::make_shared<InProcessService>())
+    {
+        m_Handler->ProvideService(m_Svc);
+        m_Channel->AddHandler(m_Handler);
+    }
+
+protected:
+    boost::asio::io_service m_Service;
+    rpc::IInProcessChannel::Ptr m_Channel;
+    rpc::ILocalHandler::Ptr m_Handler;
+    boost::shared_ptr<InProcessService> m_Svc;
+};
+
+} // anonymous namespace
+
+TEST_F(InProcessChannel, SynchronousWithoutStream)
+{
+    proto::test::Request request;
+    request.set_data(99);
+    request.set_payload("payload");
+    const auto future = proto::test::TestService::Stub(*m_Channel).TestMethod(request, rpc::IStream());
+
+    // request is dispatched on the io_service
+    EXPECT_FALSE(future.IsReady());
+    m_Service.poll();
+
+    EXPECT_EQ(future.Response().data(), 100);
+    EXPECT_EQ(future.Response().payload(), "payload");
+    EXPECT_FALSE(m_Svc->m_Stream);
+
+    // stream of response without data is empty like a stream of received packet
+    const auto stream = future.Stream();
+    ASSERT_TRUE(stream);
+    EXPECT_EQ(stream->get(), std::char_traits<char>::eof());
+}
+
+TEST_F(InProcessChannel, StreamsArePassedAsIs)
+{
+    proto::test::Request request;
+    request.set_data(1);
+    const auto streamData = boost::make_shared<std::stringstream>("sometext");
+    const auto future = proto::test::TestService::Stub(*m_Channel).TestMethod(request, streamData);
+    m_Service.poll();
+
+    EXPECT_EQ(m_Svc->m_Stream, streamData);
+    EXPECT_EQ(future.Stream(), streamData);
+
+    std::string out;
+    *future.Stream() >> out;
+    EXPECT_EQ(out, "sometext");
+}
+
+TEST_F(InProcessChannel, RequestIsNotCopied)
+{
+    const auto request = boost::make_shared<rpc::StreamRequest<proto::test::Request>>();
+    request->set_data(1);
+
+    auto& channel = static_cast<rpc::details::IChannel&>(*m_Channel);
+    const auto& method = *proto::test::TestService::descriptor().method(0);
+    const rpc::Future<proto::test::Response> future(channel.CallMethod(method, request, rpc::IStream()));
+    m_Service.poll();
+
+    EXPECT_EQ(future.Response().data(), 2);
+    EXPECT_EQ(m_Svc->m_Request, request.get());
+}
+
+TEST_F(InProcessChannel, CallerIsRemoteId)
+{
+    m_Channel->SetRemoteId("client");
+
+    proto::test::Request request;
+    request.set_data(1);
+    const auto future = proto::test::TestService::Stub(*m_Channel).TestMethod(request, rpc::IStream());
+    m_Service.poll();
+
+    EXPECT_EQ(future.Response().data(), 2);
+    EXPECT_EQ(m_Svc->m_Caller, "client");
+}
+
+TEST_F(InProcessChannel, ServiceException)
+{
+    proto::test::Request request;
+    request.set_data(0);
+    const auto future = proto::test::TestService::Stub(*m_Channel).TestMethod(request, rpc::IStream());
+    m_Service.poll();
+
+    EXPECT_THROW(future.Response(), std::exception);
+}
+
+TEST_F(InProcessChannel, ServiceNotSupported)
+{
+    m_Handler->RemoveService(m_Svc);
+
+    proto::test::Request request;
+    request.set_data(1);
+    const auto future = proto::test::TestService::Stub(*m_Channel).TestMethod(request, rpc::IStream());
+    m_Service.poll();
+
+    EXPECT_THROW(future.Response(), std::exception);
+}
+
+TEST_F(InProcessChannel, Close)
+{
+    proto::test::Request request;
+    request.set_data(1);
+    const auto pending = proto::test::TestService::Stub(*m_Channel).TestMethod(request, rpc::IStream());
+
+    m_Channel->Close(boost::exception_ptr());
+    EXPECT_THROW(pending.Response(), std::exception);
+
+    // calls after close fail immediately
+    const auto future = proto::test::TestService::Stub(*m_Channel).TestMethod(request, rpc::IStream());
+    EXPECT_TRUE(future.IsReady());
+    EXPECT_THROW(future.Response(), std::exception);
+
+    m_Service.poll();
+}
+
+TEST_F(InProcessChannel, BlockingCallsFromOtherThreads)
+{
+    std::unique_ptr<boost::asio::io_service::work> work(new boost::asio::io_service::work(m_Service));
+    boost::thread thread([this](){ m_Service.run(); });
+
+    boost::thread_group callers;
+    for (unsigned i = 0; i < 4; ++i)
+    {
+        callers.create_thread([this, i](){
+            proto::test::TestService::Stub stub(*m_Channel);
+            for (unsigned call = 1; call <= 100; ++call)
+            {
+                proto::test::Request request;
+                request.set_data(call);
+                EXPECT_EQ(stub.TestMethod(request, rpc::IStream()).Response().data(), call + 1);
+            }
+        });
+    }
+    callers.join_all();
+
+    work.reset();
+    thread.join();
+}
@@ -0,0 +1,223 @@
+#include "rpc/Channel.h"
+#include "rpc/InProcessChannel.h"
+#include "rpc/LocalHandler.h"
+#include "rpc/MessageStream.h"
+#include "rpc/Exceptions.h"
+#include "PacketConnection.h"
+
+#include "test_service.pb.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <boost/make_shared.hpp>
+#include <boost/asio/io_service.hpp>
+
+namespace
+{
+
+const boost::uint32_t MESSAGES_COUNT = 200;
+
+//! Answers each request message with a response message as soon as it arrives
+class StreamingService : public proto::test::TestService
+{
+public:
+    virtual void TestMessages(const rpc::StreamRequest<::proto::test::Request>::Ptr& request, const rpc::StreamResponse<::proto::test::Response>::Ptr& response) override
+    {
+        response->set_data(request->data() + 1);
+
+        const TestMessagesResponseWriter writer;
+        TestMessagesRequestReader(request->Stream()).Read(
+            [writer](const ::proto::test::Request& message){
+                ::proto::test::Response out;
+                out.set_data(message.data() + 1);
+                writer.Write(out);
+            },
+            [writer](const boost::exception_ptr& e){
+                writer.Close(e);
+            });
+        response->Stream(writer.Stream());
+    }
+};
+
+//! Collects response messages
+struct Responses
+{
+    Responses() : m_IsEnded() {}
+
+    void Read(const rpc::IStream& stream)
+    {
+        proto::test::TestService::TestMessagesResponseReader(stream).Read(
+            [this](const proto::test::Response& message){ m_Data.push_back(message.data()); },
+            [this](const boost::exception_ptr& e){ m_IsEnded = true; m_Exception = e; });
+    }
+
+    std::vector<boost::uint32_t> m_Data;
+    bool m_IsEnded;
+    boost::exception_ptr m_Exception;
+};
+
+void WriteRequests(const proto::test::TestService::TestMessagesRequestWriter& writer)
+{
+    for (boost::uint32_t i = 0; i < MESSAGES_COUNT; ++i)
+    {
+        proto::test::Request message;
+        message.set_data(i);
+        writer.Write(message);
+    }
+    writer.Close();
+}
+
+void ExpectResponses(const Responses& responses)
+{
+    ASSERT_EQ(responses.m_Data.size(), MESSAGES_COUNT);
+    for (boost::uint32_t i = 0; i < MESSAGES_COUNT; ++i)
+        EXPECT_EQ(responses.m_Data[i], i + 1);
+
+    EXPECT_TRUE(responses.m_IsEnded);
+    EXPECT_FALSE(responses.m_Exception);
+}
+
+} // anonymous namespace
+
+TEST(MessageStream, InProcessBidirectional)
+{
+    boost::asio::io_service service;
+    const auto channel = rpc::IInProcessChannel::Instance(service);
+    const auto handler = rpc::ILocalHandler::Instance(service);
+    const auto svc = boost::make_shared<StreamingService>();
+    handler->ProvideService(svc);
+    channel->AddHandler(handler);
+
+    proto::test::Request request;
+    request.set_data(1);
+    const proto::test::TestService::TestMessagesRequestWriter writer;
+    const auto future = proto::test::TestService::Stub(*channel).TestMessages(request, writer);
+
+    // more messages than the window, the rest is sent once the reader returns credit
+    WriteRequests(writer);
+    service.poll();
+
+    EXPECT_EQ(future.Response().data(), 2u);
+
+    Responses responses;
+    responses.Read(future.Stream());
+    ExpectResponses(responses);
+    EXPECT_EQ(writer.GetQueued(), 0u);
+}
+
+TEST(MessageStream, SerializedBidirectional)
+{
+    boost::asio::io_service service;
+
+    const auto clientConnection = boost::make_shared<PacketConnection>();
+    const auto client = rpc::ISequencedChannel::Instance(service);
+    client->SetConnection(clientConnection);
+
+    const auto serverConnection = boost::make_shared<PacketConnection>();
+    const auto server = rpc::ISequencedChannel::Instance(service);
+    server->SetConnection(serverConnection);
+
+    const auto handler = rpc::ILocalHandler::Instance(service);
+    const auto svc = boost::make_shared<StreamingService>();
+    handler->ProvideService(svc);
+    server->AddHandler(handler);
+
+    proto::test::Request request;
+    request.set_data(1);
+    const proto::test::TestService::TestMessagesRequestWriter writer;
+    const auto future = proto::test::TestService::Stub(*client).TestMessages(request, writer);
+    WriteRequests(writer);
+
+    // writer doesn't send more than the window until the server grants credit
+    EXPECT_EQ(writer.GetQueued(), MESSAGES_COUNT - proto::test::TestService::TestMessagesRequestWriter::DEFAULT_WINDOW);
+
+    clientConnection->WriteToChannel(*server);
+    service.poll();
+    serverConnection->WriteToChannel(*client);
+
+    EXPECT_EQ(future.Response().data(), 2u);
+
+    Responses responses;
+    responses.Read(future.Stream());
+
+    while (!clientConnection->IsEmpty() || !serverConnection->IsEmpty())
+    {
+        clientConnection->WriteToChannel(*server);
+        serverConnection->WriteToChannel(*client);
+    }
+
+    ExpectResponses(responses);
+    EXPECT_EQ(writer.GetQueued(), 0u);
+}
+
+TEST(MessageStream, ReaderRequiresChunkedStream)
+{
+    EXPECT_THROW(rpc::MessageReader<proto::test::Request>(rpc::IStream()), rpc::Exception);
+}
+
+TEST(MessageStream, MalformedMessageEndsStream)
+{
+    const auto stream = rpc::ChunkedStream::Instance();
+
+    Responses responses;
+    responses.Read(stream);
+
+    proto::test::Response message;
+    message.set_data(1);
+    stream->Write(message.SerializeAsString());
+    stream->Write(std::string(10, '\xff'));
+
+    // reader ends the stream with the parse error and stops reading
+    ASSERT_EQ(responses.m_Data.size(), 1u);
+    EXPECT_TRUE(responses.m_IsEnded);
+    EXPECT_TRUE(responses.m_Exception);
+    EXPECT_TRUE(stream->IsClosed());
+    EXPECT_THROW(stream->Write(message.SerializeAsString()), rpc::Exception);
+}
+
+TEST(MessageStream, MalformedMessageCancelsSerializedWriter)
+{
+    boost::asio::io_service service;
+
+    const auto clientConnection = boost::make_shared<PacketConnection>();
+    const auto client = rpc::ISequencedChannel::Instance(service);
+    client->SetConnection(clientConnection);
+
+    const auto serverConnection = boost::make_shared<PacketConnection>();
+    const auto server = rpc::ISequencedChannel::Instance(service);
+    server->SetConnection(serverConnection);
+
+    const auto handler = rpc::ILocalHandler::Instance(service);
+    const auto svc = boost::make_shared<StreamingService>();
+    handler->ProvideService(svc);
+    server->AddHandler(handler);
+
+    proto::test::Request request;
+    request.set_data(1);
+    const proto::test::TestService::TestMessagesRequestWriter writer;
+    const auto future = proto::test::TestService::Stub(*client).TestMessages(request, writer);
+    writer.Stream()->Write(std::string(10, '\xff'));
+
+    clientConnection->WriteToChannel(*server);
+    service.poll();
+    serverConnection->WriteToChannel(*client);
+
+    // reader of the server failed to parse the message and cancelled the stream of the client
+    EXPECT_TRUE(writer.Stream()->IsClosed());
+    EXPECT_THROW(writer.Write(request), rpc::Exception);
+
+    Responses responses;
+    responses.Read(future.Stream());
+
+    while (!clientConnection->IsEmpty() || !serverConnection->IsEmpty())
+    {
+        clientConnection->WriteToChannel(*server);
+        serverConnection->WriteToChannel(*client);
+    }
+
+    EXPECT_TRUE(responses.m_Data.empty());
+    EXPECT_TRUE(responses.m_IsEnded);
+    EXPECT_TRUE(responses.m_Exception);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "net/connection.hpp"
+#include "net/details/memory.hpp"
+
+#include <string>
+#include <vector>
+
+#include <boost/make_shared.hpp>
+
+//! Connection which drops everything written to it
+class NullConnection : public net::IConnection
+{
+public:
+    class NullData : public net::details::IData
+    {
+    public:
+        virtual void Write(const void* data, std::size_t size) override
+        {
+        }
+
+        virtual const std::vector<boost::asio::mutable_buffer>& GetBuffers() override
+        {
+            static const std::vector<boost::asio::mutable_buffer> res;
+            return res;
+        }
+    };
+
+    virtual void Receive(const Callback& callback) override
+    {
+    }
+    virtual void Close() override
+    {
+    }
+    virtual net::details::IData::Ptr Prepare(std::size_t size) override
+    {
+        return boost::make_shared<NullData>();
+    }
+    virtual void Flush() override
+    {
+    }
+    virtual std::string GetInfo() const override
+    {
+        return "";
+    }
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "rpc/Channel.h"
+#include "net/details/memory.hpp"
+
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include <boost/make_shared.hpp>
+
+//! Keeps each written packet as a separate stream
+class PacketConnection : public net::IConnection
+{
+public:
+    class Data : public net::details::IData
+    {
+    public:
+        Data(PacketConnection& connection) : m_Parent(connection) {}
+        ~Data()
+        {
+            m_Parent.m_Packets.push_back(boost::make_shared<std::stringstream>(m_Buffer));
+        }
+
+        virtual void Write(const void* data, std::size_t size) override
+        {
+            m_Buffer.append(reinterpret_cast<const char*>(data), size);
+        }
+
+        virtual const std::vector<boost::asio::mutable_buffer>& GetBuffers() override
+        {
+            static const std::vector<boost::asio::mutable_buffer> res;
+            return res;
+        }
+
+    private:
+        PacketConnection& m_Parent;
+        std::string m_Buffer;
+    };
+
+    virtual void Receive(const Callback& callback) override
+    {
+        throw std::runtime_error("The method or operation is not implemented.");
+    }
+    virtual void Close() override
+    {
+    }
+    virtual net::details::IData::Ptr Prepare(std::size_t size) override
+    {
+        return boost::make_shared<Data>(*this);
+    }
+    virtual void Flush() override
+    {
+        throw std::logic_error("The method or operation is not implemented.");
+    }
+    virtual std::string GetInfo() const override
+    {
+        return "";
+    }
+
+    bool IsEmpty() const
+    {
+        return m_Packets.empty();
+    }
+
+    //! Pass packets written so far to the channel
+    void WriteToChannel(rpc::ISequencedChannel& channel)
+    {
+        std::vector<rpc::IStream> packets;
+        packets.swap(m_Packets);
+        for (const auto& packet : packets)
+            channel.OnIncomingData(packet, boost::exception_ptr());
+    }
+
+private:
+    std::vector<rpc::IStream> m_Packets;
+};
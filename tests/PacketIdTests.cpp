@@ -0,0 +1,104 @@
+#include "rpc/Channel.h"
+#include "../src/ChannelSink.h"
+#include "../src/PendingRequests.h"
+#include "../src/PacketIdGenerator.h"
+#include "NullConnection.h"
+
+#include "rpc_base.pb.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <deque>
+#include <limits>
+
+#include <boost/make_shared.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/thread/thread.hpp>
+
+TEST(PacketId, WrapAroundSkipsZeroAndPending)
+{
+    static const unsigned threadsCount = 16;
+    static const unsigned idsPerThread = 100000;
+    static const unsigned idsInFlight = 64;
+    static const unsigned longLivedCount = 1000;
+
+    // start close to the end of the range, so all threads wrap around
+    rpc::details::PacketIdGenerator generator(std::numeric_limits<boost::uint32_t>::max() - threadsCount * idsPerThread / 2);
+    rpc::details::PendingRequests pending;
+
+    // requests issued before wraparound which are still waiting for response
+    const auto future = rpc::IFuture::Ptr();
+    for (boost::uint32_t id = 1; id <= longLivedCount; ++id)
+        ASSERT_TRUE(pending.Insert(id, future));
+
+    std::atomic<unsigned> failures(0);
+    const auto isPending = [&pending](boost::uint32_t id){ return pending.Contains(id); };
+
+    boost::thread_group threads;
+    for (unsigned i = 0; i < threadsCount; ++i)
+    {
+        threads.create_thread([&](){
+            std::deque<boost::uint32_t> inFlight;
+            for (unsigned call = 0; call < idsPerThread; ++call)
+            {
+                const auto id = generator.Next(isPending);
+                if (!id || id <= longLivedCount || !pending.Insert(id, future))
+                    ++failures;
+                else
+                    inFlight.push_back(id);
+
+                if (inFlight.size() == idsInFlight)
+                {
+                    pending.Remove(inFlight.front());
+                    inFlight.pop_front();
+                }
+            }
+            for (const auto id : inFlight)
+                pending.Remove(id);
+        });
+    }
+    threads.join_all();
+
+    EXPECT_EQ(failures, 0u);
+    for (boost::uint32_t id = 1; id <= longLivedCount; ++id)
+        EXPECT_TRUE(pending.Contains(id));
+}
+
+TEST(PacketId, ConcurrentCallsHaveUniqueIds)
+{
+    static const unsigned threadsCount = 16;
+    static const unsigned callsPerThread = 10000;
+
+    boost::asio::io_service service;
+    const auto channel = rpc::ISequencedChannel::Instance(service);
+    channel->SetConnection(boost::make_shared<NullConnection>());
+
+    std::atomic<unsigned> failures(0);
+
+    boost::thread_group threads;
+    for (unsigned i = 0; i < threadsCount; ++i)
+    {
+        threads.create_thread([&](){
+            const auto request = boost::make_shared<proto::Empty>();
+            for (unsigned call = 0; call < callsPerThread; ++call)
+            {
+                try
+                {
+                    // duplicated id throws, zero id makes a call without future
+                    if (!channel->CallMethod(0, 0, request, rpc::IStream()))
+                        ++failures;
+                }
+                catch (const std::exception&)
+                {
+                    ++failures;
+                }
+            }
+        });
+    }
+    threads.join_all();
+
+    EXPECT_EQ(failures, 0u);
+
+    channel->Close(boost::exception_ptr());
+}
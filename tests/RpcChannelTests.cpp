@@ -19,6 +19,7 @@
 #include <boost/make_shared.hpp>
 #include <boost/assign/list_of.hpp>
 #include <boost/thread/future.hpp>
+#include <boost/thread/thread.hpp>
 #include <boost/range/algorithm.hpp>
 
 using testing::Range;
@@ -149,6 +150,8 @@ public:
         SequencedLocalConnection& m_Parent;
     };
 
+    SequencedLocalConnection() : m_Prepared() {}
+
     virtual void Receive(const Callback& callback)
     {
         throw std::runtime_error("The method or operation is not implemented.");
@@ -160,6 +163,7 @@ public:
 
     virtual net::details::IData::Ptr Prepare(std::size_t size) override
     {
+        ++m_Prepared;
         return boost::make_shared<LocalData>(*this);
     }
 
@@ -179,10 +183,81 @@ public:
         return "";
     }
 
+    unsigned m_Prepared;
+
 private:
     std::vector<rpc::IStream> m_Streams;
 };
 
+//! Connection which exposes own buffers, so packets are serialized in place
+class BufferedLocalConnection : public net::IConnection
+{
+public:
+    class LocalData : public net::details::IData
+    {
+    public:
+        LocalData(BufferedLocalConnection& connection, std::size_t size)
+            : m_Parent(connection)
+            , m_Buffer(size)
+        {
+            if (size)
+                m_Buffers.emplace_back(boost::asio::buffer(m_Buffer));
+        }
+        ~LocalData()
+        {
+            m_Parent.m_Stream->write(m_Buffer.data(), m_Buffer.size());
+        }
+
+        virtual void Write(const void* data, std::size_t size) override
+        {
+            throw std::logic_error("Data must be serialized in place");
+        }
+
+        virtual const std::vector<boost::asio::mutable_buffer>& GetBuffers() override
+        {
+            return m_Buffers;
+        }
+
+    private:
+        BufferedLocalConnection& m_Parent;
+        std::vector<char> m_Buffer;
+        std::vector<boost::asio::mutable_buffer> m_Buffers;
+    };
+
+    BufferedLocalConnection() : m_Stream(boost::make_shared<std::stringstream>()) {}
+
+    virtual void Receive(const Callback& callback)
+    {
+        throw std::runtime_error("The method or operation is not implemented.");
+    }
+    virtual void Close()
+    {
+        throw std::runtime_error("The method or operation is not implemented.");
+    }
+    virtual net::details::IData::Ptr Prepare(std::size_t size) override
+    {
+        return boost::make_shared<LocalData>(*this, size);
+    }
+
+    template<typename T>
+    void WriteToChannel(T& channel)
+    {
+        channel.OnIncomingData(m_Stream, boost::exception_ptr());
+    }
+
+    virtual void Flush() override
+    {
+        throw std::logic_error("The method or operation is not implemented.");
+    }
+    virtual std::string GetInfo() const
+    {
+        return "";
+    }
+
+private:
+    boost::shared_ptr<std::stringstream> m_Stream;
+};
+
 template<typename T>
 struct ConnectionGetter;
 
@@ -198,13 +273,13 @@ struct ConnectionGetter<rpc::IChannel>
     typedef SequencedLocalConnection Type;
 };
 
-template<typename T>
+template<typename T, typename C = typename ConnectionGetter<T>::Type>
 void SynchronousWithoutStreamTest()
 {
     boost::asio::io_service service;
 
     // initialize client
-    const auto clientConnection = boost::make_shared<typename ConnectionGetter<T>::Type>();
+    const auto clientConnection = boost::make_shared<C>();
     const auto client = T::Instance(service);
     client->GetSink()->SetConnection(clientConnection);
 
@@ -214,7 +289,7 @@ void SynchronousWithoutStreamTest()
     const auto future = proto::test::TestService::Stub(*client).TestMethod(request, rpc::IStream());
 
     // initialize server
-    const auto serverConnection = boost::make_shared<typename ConnectionGetter<T>::Type>();
+    const auto serverConnection = boost::make_shared<C>();
     const auto server = T::Instance(service);
     server->GetSink()->SetConnection(serverConnection);
 
@@ -237,13 +312,13 @@ void SynchronousWithoutStreamTest()
     EXPECT_EQ(future.Response().data(), 100);
 }
 
-template<typename T>
+template<typename T, typename C = typename ConnectionGetter<T>::Type>
 void SynchronousWithStreamTest()
 {
     boost::asio::io_service service;
 
     // initialize client
-    const auto clientConnection = boost::make_shared<typename ConnectionGetter<T>::Type>();
+    const auto clientConnection = boost::make_shared<C>();
     const auto client = T::Instance(service);
     client->GetSink()->SetConnection(clientConnection);
 
@@ -254,7 +329,7 @@ void SynchronousWithStreamTest()
     const auto future = proto::test::TestService::Stub(*client).TestMethod(request, streamData);
 
     // initialize server
-    const auto serverConnection = boost::make_shared<typename ConnectionGetter<T>::Type>();
+    const auto serverConnection = boost::make_shared<C>();
     const auto server = T::Instance(service);
     server->GetSink()->SetConnection(serverConnection);
 
@@ -283,13 +358,13 @@ void SynchronousWithStreamTest()
 }
 
 
-template<typename T>
+template<typename T, typename C = typename ConnectionGetter<T>::Type>
 void AsynchronousWithoutStream()
 {
     boost::asio::io_service service;
 
     // initialize client
-    const auto clientConnection = boost::make_shared<typename ConnectionGetter<T>::Type>();
+    const auto clientConnection = boost::make_shared<C>();
     const auto client = T::Instance(service);
     client->GetSink()->SetConnection(clientConnection);
 
@@ -306,7 +381,7 @@ void AsynchronousWithoutStream()
     proto::test::TestService::Stub(*client).TestMethod(request, rpc::IStream()).Async(callback);
 
     // initialize server
-    const auto serverConnection = boost::make_shared<typename ConnectionGetter<T>::Type>();
+    const auto serverConnection = boost::make_shared<C>();
     const auto server = T::Instance(service);
     server->GetSink()->SetConnection(serverConnection);
 
@@ -327,13 +402,13 @@ void AsynchronousWithoutStream()
 }
 
 
-template<typename T>
+template<typename T, typename C = typename ConnectionGetter<T>::Type>
 void AsynchronousWithStreamTest()
 {
     boost::asio::io_service service;
 
     // initialize client
-    const auto clientConnection = boost::make_shared<typename ConnectionGetter<T>::Type>();
+    const auto clientConnection = boost::make_shared<C>();
     const auto client = T::Instance(service);
     client->GetSink()->SetConnection(clientConnection);
 
@@ -356,7 +431,51 @@ void AsynchronousWithStreamTest()
     proto::test::TestService::Stub(*client).TestMethod(request, streamData).Async(callback);
 
     // initialize server
-    const auto serverConnection = boost::make_shared<typename ConnectionGetter<T>::Type>();
+    const auto serverConnection = boost::make_shared<C>();
+    const auto server = T::Instance(service);
+    server->GetSink()->SetConnection(serverConnection);
+
+    // initialize local handler
+    const auto handler = rpc::ILocalHandler::Instance(service);
+    const auto svc = boost::make_shared<Service>();
+    handler->ProvideService(svc);
+    server->AddHandler(handler);
+
+    // parse client output stream by server channel
+    clientConnection->WriteToChannel(*server);
+
+    // process request by service
+    service.poll();
+
+    // parse server output stream by client channel
+    serverConnection->WriteToChannel(*client);
+}
+
+template<typename T, typename C = typename ConnectionGetter<T>::Type>
+void BlockingWaitTest()
+{
+    boost::asio::io_service service;
+
+    // initialize client
+    const auto clientConnection = boost::make_shared<C>();
+    const auto client = T::Instance(service);
+    client->GetSink()->SetConnection(clientConnection);
+
+    // send request
+    proto::test::Request request;
+    request.set_data(99);
+    const auto future = proto::test::TestService::Stub(*client).TestMethod(request, rpc::IStream());
+
+    // response is not delivered yet
+    EXPECT_FALSE(future.Wait(boost::posix_time::milliseconds(10)));
+
+    // block in another thread until response arrives
+    boost::thread waiter([&future](){
+        EXPECT_EQ(future.Response().data(), 100);
+    });
+
+    // initialize server
+    const auto serverConnection = boost::make_shared<C>();
     const auto server = T::Instance(service);
     server->GetSink()->SetConnection(serverConnection);
 
@@ -374,6 +493,71 @@ void AsynchronousWithStreamTest()
 
     // parse server output stream by client channel
     serverConnection->WriteToChannel(*client);
+
+    waiter.join();
+    EXPECT_TRUE(future.Wait(boost::posix_time::milliseconds(10)));
+}
+
+template<typename T, typename C = typename ConnectionGetter<T>::Type>
+void CoalescingTest()
+{
+    static const unsigned callsCount = 10;
+
+    boost::asio::io_service service;
+
+    // initialize client, nothing is in flight, so packets don't wait for the batch despite the delay
+    const auto clientConnection = boost::make_shared<C>();
+    const auto client = T::Instance(service);
+    client->GetSink()->SetConnection(clientConnection);
+
+    rpc::details::WriteCoalescer::Settings settings;
+    settings.m_MaxBatchBytes = 1024 * 1024;
+    settings.m_MaxDelay = boost::posix_time::hours(1);
+    client->GetSink()->SetCoalescing(settings);
+
+    unsigned responses = 0;
+    const auto callback = [&responses](const rpc::Future<proto::test::Response>& future){
+        EXPECT_EQ(future.Response().data(), 2);
+
+        std::string out;
+        *future.Stream() >> out;
+        EXPECT_EQ(out, "sometext");
+        ++responses;
+    };
+
+    proto::test::Request request;
+    request.set_data(1);
+    for (unsigned i = 0; i < callsCount; ++i)
+        proto::test::TestService::Stub(*client).TestMethod(request, boost::make_shared<std::stringstream>("sometext")).Async(callback);
+
+    // each packet is a single block written to the connection as soon as it's sent
+    const auto stats = client->GetSink()->GetCoalescingStats();
+    EXPECT_EQ(clientConnection->m_Prepared, callsCount);
+    EXPECT_EQ(stats.m_Writes, callsCount);
+    EXPECT_EQ(stats.m_Packets, callsCount);
+    EXPECT_EQ(stats.m_MaxBatchPackets, 1u);
+    EXPECT_EQ(stats.m_Flushes[rpc::details::WriteCoalescer::FLUSH_IDLE], callsCount);
+
+    // disabling coalescing has nothing to flush
+    client->GetSink()->SetCoalescing(rpc::details::WriteCoalescer::Settings());
+    EXPECT_EQ(client->GetSink()->GetCoalescingStats().m_Flushes[rpc::details::WriteCoalescer::FLUSH_CLOSE], 0u);
+
+    // initialize server
+    const auto serverConnection = boost::make_shared<C>();
+    const auto server = T::Instance(service);
+    server->GetSink()->SetConnection(serverConnection);
+
+    const auto handler = rpc::ILocalHandler::Instance(service);
+    const auto svc = boost::make_shared<Service>();
+    handler->ProvideService(svc);
+    server->AddHandler(handler);
+
+    clientConnection->WriteToChannel(*server);
+    service.poll();
+    serverConnection->WriteToChannel(*client);
+    service.poll();
+
+    EXPECT_EQ(responses, callsCount);
 }
 
 TEST(SequencedRpcChannel, SynchronousWithoutStream)
@@ -396,6 +580,11 @@ TEST(SequencedRpcChannel, AsynchronousWithStream)
     AsynchronousWithStreamTest<rpc::ISequencedChannel>();
 }
 
+TEST(SequencedRpcChannel, BlockingWait)
+{
+    BlockingWaitTest<rpc::ISequencedChannel>();
+}
+
 TEST(RpcChannel, SynchronousWithoutStream)
 {
     SynchronousWithoutStreamTest<rpc::IChannel>();
@@ -415,3 +604,70 @@ TEST(RpcChannel, AsynchronousWithStream)
 {
     AsynchronousWithStreamTest<rpc::IChannel>();
 }
+
+TEST(RpcChannel, BlockingWait)
+{
+    BlockingWaitTest<rpc::IChannel>();
+}
+
+TEST(RpcChannel, Coalescing)
+{
+    CoalescingTest<rpc::IChannel>();
+}
+
+TEST(SequencedRpcChannel, SynchronousWithoutStreamInPlace)
+{
+    SynchronousWithoutStreamTest<rpc::ISequencedChannel, BufferedLocalConnection>();
+}
+
+TEST(SequencedRpcChannel, SynchronousWithStreamInPlace)
+{
+    SynchronousWithStreamTest<rpc::ISequencedChannel, BufferedLocalConnection>();
+}
+
+TEST(LocalHandler, ProvideAndRemoveService)
+{
+    boost::asio::io_service service;
+    const auto handler = rpc::ILocalHandler::Instance(service);
+    const auto first = boost::make_shared<Service>();
+    const auto second = boost::make_shared<Service>();
+    const auto id = first->GetId();
+
+    EXPECT_FALSE(handler->HasService(id));
+
+    handler->ProvideService(first);
+    handler->ProvideService(second);
+    EXPECT_TRUE(handler->HasService(id));
+
+    handler->RemoveService(first);
+    EXPECT_TRUE(handler->HasService(id));
+
+    handler->RemoveService(second);
+    EXPECT_FALSE(handler->HasService(id));
+
+    // expired services are not reported
+    {
+        const auto temporary = boost::make_shared<Service>();
+        handler->ProvideService(temporary);
+    }
+    EXPECT_FALSE(handler->HasService(id));
+}
+
+TEST(LocalHandler, RecyclesRequestAndResponse)
+{
+    Service svc;
+    const auto& method = *proto::test::TestService::descriptor().method(0);
+
+    const google::protobuf::Message* recycled = nullptr;
+    {
+        const auto request = svc.AcquireRequest(method);
+        static_cast<proto::test::Request&>(*request).set_data(1);
+        recycled = request.get();
+    }
+
+    // same object is returned cleared
+    const auto request = svc.AcquireRequest(method);
+    EXPECT_EQ(request.get(), recycled);
+    EXPECT_FALSE(static_cast<proto::test::Request&>(*request).has_data());
+    EXPECT_FALSE(boost::dynamic_pointer_cast<rpc::StreamRequest<proto::test::Request>>(request)->Stream());
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "rpc/Channel.h"
+#include "rpc/InProcessChannel.h"
+#include "rpc/LocalHandler.h"
+#include "rpc/Deadline.h"
+#include "PacketConnection.h"
+
+#include "test_service.pb.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <vector>
+
+#include <boost/make_shared.hpp>
+#include <boost/asio/io_service.hpp>
+
+//! Keeps request and response of TestMethod until released, remembers budget of each call
+class SlowService : public proto::test::TestService
+{
+public:
+    virtual void TestMethod(const rpc::StreamRequest<::proto::test::Request>::Ptr& request, const rpc::StreamResponse<::proto::test::Response>::Ptr& response) override
+    {
+        response->set_data(request->data() + 1);
+        m_Requests.push_back(request);
+        m_Responses.push_back(response);
+        m_Remaining.push_back(request->GetRemaining());
+        m_Inherited.push_back(rpc::CallDeadline::Remaining());
+    }
+
+    //! Send responses kept so far
+    void Release()
+    {
+        m_Requests.clear();
+        m_Responses.clear();
+    }
+
+    std::vector<rpc::StreamRequest<::proto::test::Request>::Ptr> m_Requests;
+    std::vector<rpc::StreamResponse<::proto::test::Response>::Ptr> m_Responses;
+    std::vector<boost::posix_time::time_duration> m_Remaining;      //!< budget of the request
+    std::vector<boost::posix_time::time_duration> m_Inherited;      //!< deadline of nested calls
+};
+
+inline proto::test::Request MakeRequest(boost::uint32_t data)
+{
+    proto::test::Request request;
+    request.set_data(data);
+    return request;
+}
+
+//! Slow service behind an in-process channel
+class InProcessFixture : public testing::Test
+{
+public:
+    InProcessFixture()
+        : m_Channel(rpc::IInProcessChannel::Instance(m_Service))
+        , m_Handler(rpc::ILocalHandler::Instance(m_Service))
+        , m_Svc(boost::make_shared<SlowService>())
+    {
+        m_Handler->ProvideService(m_Svc);
+        m_Channel->AddHandler(m_Handler);
+    }
+
+    rpc::Future<proto::test::Response> Call(boost::uint32_t data = 1)
+    {
+        return proto::test::TestService::Stub(*m_Channel).TestMethod(MakeRequest(data), rpc::IStream());
+    }
+
+    void RunFor(const boost::posix_time::time_duration& duration)
+    {
+        m_Service.restart();
+        m_Service.run_for(std::chrono::milliseconds(duration.total_milliseconds()));
+    }
+
+protected:
+    boost::asio::io_service m_Service;
+    rpc::IInProcessChannel::Ptr m_Channel;
+    rpc::ILocalHandler::Ptr m_Handler;
+    boost::shared_ptr<SlowService> m_Svc;
+};
+
+//! Slow service behind a serialized channel, packets are passed between client and server by the test
+class SerializedFixture : public testing::Test
+{
+public:
+    SerializedFixture()
+        : m_ClientConnection(boost::make_shared<PacketConnection>())
+        , m_Client(rpc::ISequencedChannel::Instance(m_Service))
+        , m_ServerConnection(boost::make_shared<PacketConnection>())
+        , m_Server(rpc::ISequencedChannel::Instance(m_Service))
+        , m_Handler(rpc::ILocalHandler::Instance(m_Service))
+        , m_Svc(boost::make_shared<SlowService>())
+    {
+        m_Client->GetSink()->SetConnection(m_ClientConnection);
+        m_Server->GetSink()->SetConnection(m_ServerConnection);
+
+        m_Handler->ProvideService(m_Svc);
+        m_Server->AddHandler(m_Handler);
+    }
+
+    rpc::Future<proto::test::Response> Call(boost::uint32_t data = 1)
+    {
+        return proto::test::TestService::Stub(*m_Client).TestMethod(MakeRequest(data), rpc::IStream());
+    }
+
+    //! Pass packets written by the client to the server
+    void ToServer()
+    {
+        m_ClientConnection->WriteToChannel(*m_Server);
+    }
+
+    //! Pass packets written by the server to the client
+    void ToClient()
+    {
+        m_ServerConnection->WriteToChannel(*m_Client);
+    }
+
+protected:
+    boost::asio::io_service m_Service;
+    boost::shared_ptr<PacketConnection> m_ClientConnection;
+    rpc::ISequencedChannel::Ptr m_Client;
+    boost::shared_ptr<PacketConnection> m_ServerConnection;
+    rpc::ISequencedChannel::Ptr m_Server;
+    rpc::ILocalHandler::Ptr m_Handler;
+    boost::shared_ptr<SlowService> m_Svc;
+};
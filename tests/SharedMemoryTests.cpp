@@ -0,0 +1,340 @@
+#include "rpc/Channel.h"
+#include "rpc/LocalHandler.h"
+#include "rpc/SharedMemoryConnection.h"
+#include "rpc/BatchConnection.h"
+#include "rpc/Exceptions.h"
+#include "test_service.pb.h"
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+#include <iterator>
+
+#include <boost/make_shared.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/chrono.hpp>
+
+#if defined(__linux__)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+//! Replies with request payload and size of request stream
+class SizeService : public proto::test::TestService
+{
+public:
+    virtual void TestMethod(const rpc::StreamRequest<::proto::test::Request>::Ptr& request, const rpc::StreamResponse<::proto::test::Response>::Ptr& response) override
+    {
+        std::size_t size = 0;
+        if (const auto stream = request->Stream())
+        {
+            char buffer[4096];
+            while (const auto read = stream->read(buffer, sizeof(buffer)).gcount())
+                size += static_cast<std::size_t>(read);
+        }
+
+        response->set_data(static_cast<boost::uint32_t>(size));
+        response->set_payload(request->payload());
+    }
+};
+
+//! Channel with io_service thread, connection data is delivered to the channel
+class Endpoint
+{
+public:
+    Endpoint(boost::asio::io_service& svc, const rpc::ISharedMemoryConnection::Ptr& connection)
+        : m_Service(svc)
+        , m_Work(new boost::asio::io_service::work(svc))
+        , m_Thread([this](){ m_Service.run(); })
+        , m_Channel(rpc::IChannel::Instance(m_Service))
+        , m_Connection(connection)
+    {
+        m_Channel->SetConnection(connection);
+
+        const boost::weak_ptr<rpc::IChannel> weak = m_Channel;
+        // empty stream means that peer has closed the connection
+        connection->Receive([weak](const rpc::IStream& stream){
+            if (const auto channel = weak.lock())
+                channel->OnIncomingData(stream, stream ? boost::exception_ptr() : rpc::MakeException("Connection closed by peer"));
+        });
+    }
+
+    ~Endpoint()
+    {
+        m_Channel->Close(boost::exception_ptr());
+        m_Work.reset();
+        m_Thread.join();
+    }
+
+    void Serve(const boost::shared_ptr<rpc::IService>& service)
+    {
+        m_Handler = rpc::ILocalHandler::Instance(m_Service);
+        m_Handler->ProvideService(service);
+        m_Channel->AddHandler(m_Handler);
+    }
+
+    rpc::IChannel& Channel()
+    {
+        return *m_Channel;
+    }
+
+private:
+    boost::asio::io_service& m_Service;
+    std::unique_ptr<boost::asio::io_service::work> m_Work;
+    boost::thread m_Thread;
+    rpc::IChannel::Ptr m_Channel;
+    rpc::ISharedMemoryConnection::Ptr m_Connection;
+    rpc::ILocalHandler::Ptr m_Handler;
+};
+
+std::string SegmentName(const char* test)
+{
+    std::ostringstream oss;
+    oss << "rpc_tests_" << test << "_" << boost::chrono::steady_clock::now().time_since_epoch().count();
+    return oss.str();
+}
+
+//! Sends calls with growing streams, ring is small so records wrap around and writer waits for space
+void CallWithStreams(rpc::IChannel& channel)
+{
+    proto::test::TestService::Stub stub(channel);
+    for (std::size_t size = 0; size <= 1024 * 1024; size = size * 2 + 1)
+    {
+        proto::test::Request request;
+        request.set_data(0);
+        request.set_payload(std::string(size % 1000, 'p'));
+
+        const auto stream = size ? boost::make_shared<std::stringstream>(std::string(size, 's')) : rpc::IStream();
+        const auto future = stub.TestMethod(request, stream);
+
+        EXPECT_EQ(future.Response().data(), size);
+        EXPECT_EQ(future.Response().payload(), request.payload());
+    }
+}
+
+//! Collects streams received by the connection
+class Receiver
+{
+public:
+    Receiver(boost::asio::io_service& svc, const rpc::ISharedMemoryConnection::Ptr& connection)
+        : m_Service(svc)
+    {
+        connection->Receive([this](const rpc::IStream& stream){
+            m_Streams.push_back(stream);
+        });
+    }
+
+    //! Run handlers until expected number of streams is received
+    const std::vector<rpc::IStream>& Wait(std::size_t count, boost::chrono::milliseconds timeout = boost::chrono::seconds(5))
+    {
+        const auto deadline = boost::chrono::steady_clock::now() + timeout;
+        while (m_Streams.size() < count && boost::chrono::steady_clock::now() < deadline)
+        {
+            m_Service.poll();
+            m_Service.reset();
+            boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+        }
+        return m_Streams;
+    }
+
+private:
+    boost::asio::io_service& m_Service;
+    std::vector<rpc::IStream> m_Streams;
+};
+
+std::string ReadAll(std::istream& stream)
+{
+    return std::string(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+}
+
+} // anonymous namespace
+
+TEST(SharedMemory, NestedRecordsArePublishedInOrder)
+{
+    boost::asio::io_service service;
+    const auto name = SegmentName("nested");
+
+    const auto writer = rpc::ISharedMemoryConnection::Create(service, name, 0);
+    const auto reader = rpc::ISharedMemoryConnection::Open(service, name);
+    Receiver receiver(service, reader);
+
+    // record may be prepared while another one is being written
+    auto outer = writer->Prepare(5);
+    outer->Write("outer", 5);
+    auto inner = writer->Prepare(5);
+    inner->Write("inner", 5);
+
+    // inner record waits for the one reserved before it
+    inner.reset();
+    EXPECT_TRUE(receiver.Wait(1, boost::chrono::milliseconds(100)).empty());
+
+    outer.reset();
+    const auto& streams = receiver.Wait(2);
+    ASSERT_EQ(streams.size(), 2u);
+    EXPECT_EQ(ReadAll(*streams[0]), "outer");
+    EXPECT_EQ(ReadAll(*streams[1]), "inner");
+
+    reader->Close();
+    writer->Close();
+}
+
+TEST(SharedMemory, BatchIsReservedAtOnce)
+{
+    boost::asio::io_service service;
+    const auto name = SegmentName("batch");
+
+    const auto writer = rpc::ISharedMemoryConnection::Create(service, name, 0);
+    const auto reader = rpc::ISharedMemoryConnection::Open(service, name);
+    Receiver receiver(service, reader);
+
+    const auto batch = boost::dynamic_pointer_cast<rpc::IBatchConnection>(writer);
+    ASSERT_TRUE(batch);
+
+    // blocks don't fit half of the ring together, the last one is reserved on its own
+    const std::string large(100 * 1024, 'l');
+    const std::vector<std::string> blocks = { "first", "", "abc", large, large };
+
+    std::vector<std::size_t> sizes;
+    for (const auto& block : blocks)
+        sizes.push_back(block.size());
+
+    {
+        const auto data = batch->PrepareBatch(sizes);
+        for (const auto& block : blocks)
+            data->Write(block.data(), block.size());
+    }
+
+    // every block is received as a record of its own
+    const auto& streams = receiver.Wait(blocks.size());
+    ASSERT_EQ(streams.size(), blocks.size());
+    for (std::size_t i = 0; i < blocks.size(); ++i)
+        EXPECT_EQ(ReadAll(*streams[i]), blocks[i]);
+
+    reader->Close();
+    writer->Close();
+}
+
+TEST(SharedMemory, CorruptedRecordClosesConnection)
+{
+    boost::asio::io_service service;
+    const auto name = SegmentName("corrupted");
+
+    const auto writer = rpc::ISharedMemoryConnection::Create(service, name, 0);
+    const auto reader = rpc::ISharedMemoryConnection::Open(service, name);
+    Receiver receiver(service, reader);
+
+    {
+        // record header precedes record data, size points past published data
+        const auto data = writer->Prepare(16);
+        auto* const header = boost::asio::buffer_cast<boost::uint32_t*>(data->GetBuffers().front()) - 2;
+        header[0] = 1024 * 1024;
+    }
+
+    // record is rejected, empty stream closes the channel
+    const auto& streams = receiver.Wait(1);
+    ASSERT_EQ(streams.size(), 1u);
+    EXPECT_FALSE(streams.front());
+
+    reader->Close();
+    writer->Close();
+}
+
+TEST(SharedMemory, CallsWithinProcess)
+{
+    boost::asio::io_service serverService;
+    boost::asio::io_service clientService;
+    const auto name = SegmentName("in_process");
+
+    const auto serverConnection = rpc::ISharedMemoryConnection::Create(serverService, name, 0);
+    const auto clientConnection = rpc::ISharedMemoryConnection::Open(clientService, name);
+
+    const auto svc = boost::make_shared<SizeService>();
+    Endpoint server(serverService, serverConnection);
+    server.Serve(svc);
+
+    Endpoint client(clientService, clientConnection);
+    CallWithStreams(client.Channel());
+}
+
+TEST(SharedMemory, OpenMissingSegmentThrows)
+{
+    boost::asio::io_service service;
+    EXPECT_THROW(rpc::ISharedMemoryConnection::Open(service, SegmentName("missing")), rpc::Exception);
+}
+
+#if defined(__linux__)
+
+TEST(SharedMemory, CallsBetweenProcesses)
+{
+    boost::asio::io_service service;
+    const auto name = SegmentName("processes");
+
+    // segment is created before fork, child process calls the service in parent process
+    const auto serverConnection = rpc::ISharedMemoryConnection::Create(service, name, 0);
+
+    const auto pid = fork();
+    ASSERT_NE(pid, -1);
+    if (!pid)
+    {
+        {
+            const auto clientConnection = rpc::ISharedMemoryConnection::Open(service, name);
+            Endpoint client(service, clientConnection);
+            CallWithStreams(client.Channel());
+        }
+        _exit(testing::Test::HasFailure() ? 1 : 0);
+    }
+
+    {
+        const auto svc = boost::make_shared<SizeService>();
+        Endpoint server(service, serverConnection);
+        server.Serve(svc);
+
+        int status = 0;
+        ASSERT_EQ(waitpid(pid, &status, 0), pid);
+        EXPECT_TRUE(WIFEXITED(status));
+        EXPECT_EQ(WEXITSTATUS(status), 0);
+    }
+}
+
+TEST(SharedMemory, DeadPeerClosesConnection)
+{
+    boost::asio::io_service service;
+    const auto name = SegmentName("dead_peer");
+
+    const auto connection = rpc::ISharedMemoryConnection::Create(service, name, 0);
+    Receiver receiver(service, connection);
+
+    // child process exits without closing its side, as if it crashed
+    const auto pid = fork();
+    ASSERT_NE(pid, -1);
+    if (!pid)
+    {
+        const auto peer = rpc::ISharedMemoryConnection::Open(service, name);
+        _exit(0);
+    }
+
+    int status = 0;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+
+    // reader finds out on its next wake up, empty stream closes the channel
+    const auto& streams = receiver.Wait(1);
+    ASSERT_EQ(streams.size(), 1u);
+    EXPECT_FALSE(streams.front());
+
+    // writer waiting for space which is never released fails as well
+    const std::vector<char> block(256 * 1024);
+    EXPECT_THROW(
+        for (;;)
+            connection->Prepare(block.size())->Write(block.data(), block.size());
+    , rpc::Exception);
+
+    connection->Close();
+}
+
+#endif
@@ -0,0 +1,296 @@
+#include "rpc/SpillStream.h"
+#include "rpc/FileStream.h"
+#include "rpc/Exceptions.h"
+#include "rpc/Channel.h"
+#include "rpc/LocalHandler.h"
+#include "../src/ChannelSink.h"
+#include "PacketConnection.h"
+
+#include "test_service.pb.h"
+
+#include <gtest/gtest.h>
+#include <google/protobuf/message.h>
+
+#include <sstream>
+#include <string>
+#include <iterator>
+
+#include <boost/make_shared.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/filesystem/operations.hpp>
+
+namespace
+{
+
+//! Temporary directory for spilled files, removed with the fixture
+class SpillStreamTest : public testing::Test
+{
+public:
+    SpillStreamTest()
+        : m_Directory(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path())
+    {
+        boost::filesystem::create_directories(m_Directory);
+        m_Settings.m_Threshold = 1000;
+        m_Settings.m_Directory = m_Directory.string();
+    }
+
+    ~SpillStreamTest()
+    {
+        boost::system::error_code e;
+        boost::filesystem::remove_all(m_Directory, e);
+    }
+
+    std::size_t GetFiles() const
+    {
+        return std::distance(boost::filesystem::directory_iterator(m_Directory), boost::filesystem::directory_iterator());
+    }
+
+    static std::string MakeData(std::size_t size)
+    {
+        std::string result(size, '\0');
+        for (std::size_t i = 0; i < size; ++i)
+            result[i] = static_cast<char>(i % 251);
+        return result;
+    }
+
+    static std::string ReadAll(std::istream& stream)
+    {
+        return std::string(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+    }
+
+protected:
+    const boost::filesystem::path m_Directory;
+    rpc::SpillStream::Settings m_Settings;
+};
+
+//! Remembers request stream, replies with its data as chunked stream
+class CollectingService : public proto::test::TestService
+{
+public:
+    CollectingService() : m_IsFile() {}
+
+    virtual void TestMethod(const rpc::StreamRequest<::proto::test::Request>::Ptr& request, const rpc::StreamResponse<::proto::test::Response>::Ptr& response) override
+    {
+        response->set_data(request->data() + 1);
+
+        const auto stream = request->Stream();
+        ASSERT_TRUE(stream);
+        m_IsFile = !!rpc::FileStream::Cast(stream);
+        m_Data = SpillStreamTest::ReadAll(*stream);
+
+        const auto out = rpc::ChunkedStream::Instance();
+        out->Write(m_Data);
+        out->Close();
+        response->Stream(out);
+    }
+
+    bool m_IsFile;
+    std::string m_Data;
+};
+
+} // anonymous namespace
+
+TEST_F(SpillStreamTest, KeepsSmallDataInMemory)
+{
+    rpc::SpillStream spill(m_Settings);
+    const auto data = MakeData(m_Settings.m_Threshold);
+    spill.Write(data.data(), data.size());
+    EXPECT_FALSE(spill.IsSpilled());
+    EXPECT_EQ(GetFiles(), 0u);
+
+    const auto stream = spill.Finish();
+    EXPECT_FALSE(rpc::FileStream::Cast(stream));
+    EXPECT_EQ(ReadAll(*stream), data);
+}
+
+TEST_F(SpillStreamTest, SpillsPastThreshold)
+{
+    const auto data = MakeData(m_Settings.m_Threshold * 5 + 7);
+    rpc::IStream stream;
+    {
+        rpc::SpillStream spill(m_Settings);
+        for (std::size_t offset = 0; offset < data.size(); offset += 300)
+        {
+            spill.Write(data.data() + offset, std::min<std::size_t>(300, data.size() - offset));
+            EXPECT_EQ(spill.IsSpilled(), spill.GetSize() > m_Settings.m_Threshold);
+        }
+        EXPECT_EQ(spill.GetSize(), data.size());
+        stream = spill.Finish();
+    }
+
+    // file outlives the spill stream and is mapped for random access
+    ASSERT_TRUE(rpc::FileStream::Cast(stream));
+    EXPECT_EQ(rpc::FileStream::Cast(stream)->GetSize(), data.size());
+    EXPECT_EQ(GetFiles(), 1u);
+
+    stream->seekg(4000);
+    EXPECT_EQ(ReadAll(*stream), data.substr(4000));
+
+    stream.reset();
+    EXPECT_EQ(GetFiles(), 0u);
+}
+
+TEST_F(SpillStreamTest, AbandonedFileIsRemoved)
+{
+    {
+        rpc::SpillStream spill(m_Settings);
+        const auto data = MakeData(m_Settings.m_Threshold + 1);
+        spill.Write(data.data(), data.size());
+        EXPECT_EQ(GetFiles(), 1u);
+    }
+    EXPECT_EQ(GetFiles(), 0u);
+}
+
+TEST_F(SpillStreamTest, SpillsRestOfReceivedStream)
+{
+    const auto data = MakeData(m_Settings.m_Threshold * 3);
+    const auto stream = boost::make_shared<std::stringstream>("header" + data);
+    stream->seekg(6);
+
+    const auto spilled = rpc::SpillStream::Spill(stream, m_Settings);
+    ASSERT_TRUE(rpc::FileStream::Cast(spilled));
+    EXPECT_EQ(ReadAll(*spilled), data);
+
+    // small, disabled and chunked streams are passed as is
+    const auto small = boost::make_shared<std::stringstream>(MakeData(m_Settings.m_Threshold));
+    EXPECT_EQ(rpc::SpillStream::Spill(small, m_Settings), small);
+    EXPECT_EQ(rpc::SpillStream::Spill(stream, rpc::SpillStream::Settings()), stream);
+
+    const rpc::IStream chunked = rpc::ChunkedStream::Instance();
+    EXPECT_EQ(rpc::SpillStream::Spill(chunked, m_Settings), chunked);
+    EXPECT_FALSE(rpc::SpillStream::Spill(rpc::IStream(), m_Settings));
+}
+
+TEST_F(SpillStreamTest, CollectsChunks)
+{
+    const auto stream = rpc::ChunkedStream::Instance();
+    stream->SetWindow(2);
+
+    rpc::IStream result;
+    bool isEnded = false;
+    rpc::SpillStream::Collect(stream, m_Settings, [&](const rpc::IStream& s, const boost::exception_ptr& e){
+        EXPECT_FALSE(e);
+        result = s;
+        isEnded = true;
+    });
+
+    // more chunks than the window, collector returns credit as it writes them
+    std::string data;
+    for (int i = 0; i < 10; ++i)
+    {
+        const auto chunk = MakeData(500 + i);
+        stream->Write(chunk);
+        data += chunk;
+    }
+    EXPECT_EQ(stream->GetQueued(), 0u);
+    EXPECT_FALSE(isEnded);
+
+    stream->Close();
+    ASSERT_TRUE(isEnded);
+    ASSERT_TRUE(rpc::FileStream::Cast(result));
+    EXPECT_EQ(ReadAll(*result), data);
+}
+
+TEST_F(SpillStreamTest, CollectsHeadBeforeChunks)
+{
+    // rest of the packet which opened the stream, e.g. response message, is kept with the data
+    const auto stream = rpc::ChunkedStream::Instance(boost::make_shared<std::stringstream>("head"));
+    rpc::IStream result;
+    rpc::SpillStream::Collect(stream, m_Settings, [&](const rpc::IStream& s, const boost::exception_ptr& e){
+        EXPECT_FALSE(e);
+        result = s;
+    });
+
+    const auto data = MakeData(m_Settings.m_Threshold * 2);
+    stream->Write(data);
+    stream->Close();
+
+    ASSERT_TRUE(rpc::FileStream::Cast(result));
+    EXPECT_EQ(ReadAll(*result), "head" + data);
+}
+
+TEST_F(SpillStreamTest, CollectReportsFailure)
+{
+    const auto stream = rpc::ChunkedStream::Instance();
+
+    bool isEnded = false;
+    rpc::SpillStream::Collect(stream, m_Settings, [&](const rpc::IStream& s, const boost::exception_ptr& e){
+        EXPECT_FALSE(s);
+        EXPECT_TRUE(e);
+        isEnded = true;
+    });
+
+    stream->Write(MakeData(m_Settings.m_Threshold * 2));
+    stream->Close(boost::copy_exception(rpc::Exception("producer failed")));
+    EXPECT_TRUE(isEnded);
+    EXPECT_EQ(GetFiles(), 0u);
+}
+
+TEST_F(SpillStreamTest, ChannelCollectsWithItsSettings)
+{
+    boost::asio::io_service service;
+    const auto channel = rpc::ISequencedChannel::Instance(service);
+    channel->GetSink()->SetSpill(m_Settings);
+
+    const auto stream = rpc::ChunkedStream::Instance();
+    rpc::IStream result;
+    channel->GetSink()->Collect(stream, [&](const rpc::IStream& s, const boost::exception_ptr& e){
+        EXPECT_FALSE(e);
+        result = s;
+    });
+
+    const auto data = MakeData(m_Settings.m_Threshold * 3);
+    stream->Write(data);
+    stream->Close();
+
+    ASSERT_TRUE(rpc::FileStream::Cast(result));
+    EXPECT_EQ(ReadAll(*result), data);
+}
+
+TEST_F(SpillStreamTest, ReceivedChunkedStreamsAreSpilled)
+{
+    boost::asio::io_service service;
+
+    const auto clientConnection = boost::make_shared<PacketConnection>();
+    const auto client = rpc::ISequencedChannel::Instance(service);
+    client->GetSink()->SetConnection(clientConnection);
+    client->GetSink()->SetSpill(m_Settings);
+
+    const auto serverConnection = boost::make_shared<PacketConnection>();
+    const auto server = rpc::ISequencedChannel::Instance(service);
+    server->GetSink()->SetConnection(serverConnection);
+    server->GetSink()->SetSpill(m_Settings);
+
+    const auto handler = rpc::ILocalHandler::Instance(service);
+    const auto svc = boost::make_shared<CollectingService>();
+    handler->ProvideService(svc);
+    server->AddHandler(handler);
+
+    proto::test::Request request;
+    request.set_data(1);
+    const auto in = rpc::ChunkedStream::Instance();
+    const auto future = proto::test::TestService::Stub(*client).TestMethod(request, in);
+
+    // stream is larger than threshold, it's sent in chunks smaller than threshold
+    const auto data = MakeData(m_Settings.m_Threshold * 3);
+    for (std::size_t offset = 0; offset < data.size(); offset += m_Settings.m_Threshold / 2)
+        in->Write(data.substr(offset, m_Settings.m_Threshold / 2));
+    in->Close();
+
+    while (!clientConnection->IsEmpty() || !serverConnection->IsEmpty())
+    {
+        clientConnection->WriteToChannel(*server);
+        service.poll();
+        serverConnection->WriteToChannel(*client);
+    }
+
+    // handler is called once the whole request stream is received
+    EXPECT_TRUE(svc->m_IsFile);
+    EXPECT_EQ(svc->m_Data, data);
+
+    // caller gets collected response stream as well
+    EXPECT_EQ(future.Response().data(), 2u);
+    const auto stream = future.Stream();
+    ASSERT_TRUE(rpc::FileStream::Cast(stream));
+    EXPECT_EQ(ReadAll(*stream), data);
+}
@@ -0,0 +1,124 @@
+#include "../src/Stream.h"
+#include "test_service.pb.h"
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+#include <streambuf>
+
+namespace
+{
+
+std::string Serialize(const google::protobuf::Message& message, const std::string& tail)
+{
+    const auto data = message.SerializeAsString();
+    const auto size = static_cast<boost::uint32_t>(data.size());
+    return std::string(reinterpret_cast<const char*>(&size), sizeof(size)) + data + tail;
+}
+
+//! Keeps data in memory but fails if it is copied out through the stream interface
+class MemoryBuffer : public std::streambuf
+{
+public:
+    MemoryBuffer(std::string& data)
+    {
+        setg(&data[0], &data[0], &data[0] + data.size());
+    }
+
+protected:
+    virtual std::streamsize xsgetn(char*, std::streamsize) override
+    {
+        ADD_FAILURE() << "Data is copied";
+        return 0;
+    }
+};
+
+//! Exposes only one byte at a time, like a buffer which is refilled from device
+class ByteBuffer : public std::streambuf
+{
+public:
+    ByteBuffer(const std::string& data) : m_Data(data), m_Offset(), m_Current() {}
+
+protected:
+    virtual int_type underflow() override
+    {
+        if (m_Offset == m_Data.size())
+            return traits_type::eof();
+
+        m_Current = m_Data[m_Offset++];
+        setg(&m_Current, &m_Current, &m_Current + 1);
+        return traits_type::to_int_type(m_Current);
+    }
+
+private:
+    const std::string m_Data;
+    std::size_t m_Offset;
+    char m_Current;
+};
+
+proto::test::Request MakeRequest(std::size_t payload)
+{
+    proto::test::Request request;
+    request.set_data(42);
+    request.set_payload(std::string(payload, 'p'));
+    return request;
+}
+
+} // anonymous namespace
+
+TEST(ReadStream, ParsesInPlace)
+{
+    const auto request = MakeRequest(64 * 1024);
+    auto data = Serialize(request, "tail");
+
+    MemoryBuffer buffer(data);
+    std::istream stream(&buffer);
+
+    proto::test::Request parsed;
+    EXPECT_EQ(rpc::details::ReadStream::Read(stream, parsed), request.ByteSize());
+    EXPECT_EQ(parsed.payload(), request.payload());
+
+    // trailing data is a view of the same memory
+    const auto view = rpc::details::StreamView::Get(stream);
+    ASSERT_EQ(view.second, 4u);
+    EXPECT_EQ(std::string(view.first, view.second), "tail");
+    EXPECT_EQ(view.first, data.data() + data.size() - 4);
+}
+
+TEST(ReadStream, CopiesFromNonContiguousBuffer)
+{
+    for (const auto payload : { 0, 10, 10000 })
+    {
+        const auto request = MakeRequest(payload);
+        ByteBuffer buffer(Serialize(request, "tail"));
+        std::istream stream(&buffer);
+
+        proto::test::Request parsed;
+        rpc::details::ReadStream::Read(stream, parsed);
+        EXPECT_EQ(parsed.payload(), request.payload());
+
+        std::string tail;
+        stream >> tail;
+        EXPECT_EQ(tail, "tail");
+    }
+}
+
+TEST(ReadStream, StringStreamTail)
+{
+    const auto request = MakeRequest(100);
+    std::istringstream stream(Serialize(request, "tail") + Serialize(request, ""));
+
+    proto::test::Request first;
+    proto::test::Request second;
+    rpc::details::ReadStream::Read(stream, first);
+
+    std::string tail(4, '\0');
+    stream.read(&tail[0], 4);
+    EXPECT_EQ(tail, "tail");
+
+    rpc::details::ReadStream::Read(stream, second);
+    EXPECT_EQ(second.data(), 42u);
+    EXPECT_EQ(second.payload(), request.payload());
+    EXPECT_EQ(stream.peek(), std::char_traits<char>::eof());
+}
@@ -0,0 +1,115 @@
+#include "rpc/Trace.h"
+#include "rpc/Exceptions.h"
+
+#include "rpc_base.pb.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <sstream>
+
+namespace
+{
+
+//! Counts argument evaluations of trace macro
+std::string Evaluate(unsigned& counter)
+{
+    ++counter;
+    return std::string();
+}
+
+} // anonymous namespace
+
+TEST(PacketTrace, EveryPacketReachesLoggerByDefault)
+{
+    // logger level decides, as with plain log macros
+    EXPECT_EQ(rpc::trace::GetMode(), rpc::trace::TRACE_ALL);
+    EXPECT_EQ(rpc::trace::GetLevel(), rpc::trace::LEVEL_TRACE);
+}
+
+TEST(PacketTrace, DumpIsFormattedWhenWritten)
+{
+    proto::BasePacket base;
+    base.set_packetid(7);
+    base.set_callerid("client");
+
+    const rpc::trace::Dump dump(base);
+    base.set_method(3);
+
+    std::ostringstream stream;
+    stream << dump;
+    EXPECT_EQ(stream.str(), base.ShortDebugString());
+}
+
+TEST(PacketTrace, ArgumentsAreNotEvaluatedWhenDisabled)
+{
+    rpc::trace::SetMode(rpc::trace::TRACE_OFF);
+
+    unsigned evaluations = 0;
+    for (boost::uint32_t id = 0; id < 1000; ++id)
+        RPC_TRACE_PACKET(TRACE, id, "packet: %s", Evaluate(evaluations));
+
+    EXPECT_EQ(evaluations, 0u);
+    rpc::trace::SetMode(rpc::trace::TRACE_ALL);
+}
+
+TEST(PacketTrace, SampledModeTracesSamePacketIds)
+{
+    rpc::trace::SetMode(rpc::trace::TRACE_SAMPLED, 100);
+    EXPECT_EQ(rpc::trace::GetMode(), rpc::trace::TRACE_SAMPLED);
+
+    unsigned evaluations = 0;
+    for (boost::uint32_t id = 1; id <= 1000; ++id)
+        RPC_TRACE_PACKET(TRACE, id, "packet: %s", Evaluate(evaluations));
+
+#ifdef RPC_DISABLE_PACKET_TRACE
+    EXPECT_EQ(evaluations, 0u);
+#else
+    EXPECT_EQ(evaluations, 10u);
+#endif
+
+    EXPECT_TRUE(rpc::trace::details::IsTraced(200));
+    EXPECT_FALSE(rpc::trace::details::IsTraced(201));
+
+    EXPECT_THROW(rpc::trace::SetMode(rpc::trace::TRACE_SAMPLED, 1), rpc::Exception);
+
+    rpc::trace::SetMode(rpc::trace::TRACE_ALL);
+    EXPECT_TRUE(rpc::trace::details::IsTraced(201));
+
+    rpc::trace::SetMode(rpc::trace::TRACE_OFF);
+    EXPECT_EQ(rpc::trace::GetMode(), rpc::trace::TRACE_OFF);
+
+    rpc::trace::SetMode(rpc::trace::TRACE_ALL);
+}
+
+TEST(PacketTrace, LevelDropsPacketsBeforeLogger)
+{
+    unsigned traced = 0;
+    unsigned debugged = 0;
+
+    // logger writes debug records only
+    rpc::trace::SetLevel(rpc::trace::LEVEL_DEBUG);
+    for (boost::uint32_t id = 1; id <= 1000; ++id)
+    {
+        RPC_TRACE_PACKET(TRACE, id, "packet: %s", Evaluate(traced));
+        RPC_TRACE_PACKET(DEBUG, id, "packet: %s", Evaluate(debugged));
+    }
+
+    EXPECT_EQ(traced, 0u);
+#ifdef RPC_DISABLE_PACKET_TRACE
+    EXPECT_EQ(debugged, 0u);
+#else
+    EXPECT_EQ(debugged, 1000u);
+#endif
+
+    // neither level is written, every packet is dropped although every packet is traced by mode
+    rpc::trace::SetLevel(rpc::trace::LEVEL_INFO);
+    debugged = 0;
+    for (boost::uint32_t id = 1; id <= 1000; ++id)
+        RPC_TRACE_PACKET(DEBUG, id, "packet: %s", Evaluate(debugged));
+
+    EXPECT_EQ(debugged, 0u);
+    EXPECT_EQ(rpc::trace::GetLevel(), rpc::trace::LEVEL_INFO);
+
+    rpc::trace::SetLevel(rpc::trace::LEVEL_TRACE);
+}
@@ -0,0 +1,311 @@
+#include "rpc/WriteCoalescer.h"
+#include "../src/Stream.h"
+#include "rpc/BatchConnection.h"
+
+#include "test_service.pb.h"
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/make_shared.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/asio/io_service.hpp>
+
+namespace
+{
+
+typedef rpc::details::WriteCoalescer WriteCoalescer;
+
+//! Keeps each prepared block as a frame, first Prepare may be held until released
+class FrameConnection : public net::IConnection
+{
+public:
+    class Data : public net::details::IData
+    {
+    public:
+        Data(FrameConnection& connection, std::size_t size)
+            : m_Parent(connection)
+            , m_Buffer(size, '\0')
+        {
+            if (size)
+                m_Buffers.emplace_back(boost::asio::buffer(&m_Buffer[0], size));
+        }
+
+        ~Data()
+        {
+            m_Parent.AddFrame(m_Buffer);
+        }
+
+        virtual void Write(const void*, std::size_t) override
+        {
+            ADD_FAILURE() << "data is expected in connection buffers";
+        }
+
+        virtual const std::vector<boost::asio::mutable_buffer>& GetBuffers() override
+        {
+            return m_Buffers;
+        }
+
+    private:
+        FrameConnection& m_Parent;
+        std::string m_Buffer;
+        std::vector<boost::asio::mutable_buffer> m_Buffers;
+    };
+
+    FrameConnection(bool holdFirst = false) : m_IsHeld(holdFirst), m_IsWaiting(), m_Prepared() {}
+
+    virtual void Receive(const Callback&) override
+    {
+    }
+    virtual void Close() override
+    {
+    }
+    virtual net::details::IData::Ptr Prepare(std::size_t size) override
+    {
+        boost::unique_lock<boost::mutex> lock(m_Mutex);
+        m_IsWaiting = m_IsHeld;
+        m_Changed.notify_all();
+        while (m_IsHeld)
+            m_Changed.wait(lock);
+        m_IsWaiting = false;
+        ++m_Prepared;
+
+        return boost::make_shared<Data>(*this, size);
+    }
+    virtual void Flush() override
+    {
+    }
+    virtual std::string GetInfo() const override
+    {
+        return "frames";
+    }
+
+    void WaitHeld()
+    {
+        boost::unique_lock<boost::mutex> lock(m_Mutex);
+        while (!m_IsWaiting)
+            m_Changed.wait(lock);
+    }
+
+    void Release()
+    {
+        boost::unique_lock<boost::mutex> lock(m_Mutex);
+        m_IsHeld = false;
+        m_Changed.notify_all();
+    }
+
+    std::vector<std::string> GetFrames() const
+    {
+        boost::unique_lock<boost::mutex> lock(m_Mutex);
+        return m_Frames;
+    }
+
+    void AddFrame(const std::string& frame)
+    {
+        boost::unique_lock<boost::mutex> lock(m_Mutex);
+        m_Frames.push_back(frame);
+    }
+
+    //! Number of Prepare calls
+    unsigned GetPrepared() const
+    {
+        boost::unique_lock<boost::mutex> lock(m_Mutex);
+        return m_Prepared;
+    }
+
+private:
+    mutable boost::mutex m_Mutex;
+    boost::condition_variable m_Changed;
+    bool m_IsHeld;
+    bool m_IsWaiting;
+    unsigned m_Prepared;
+    std::vector<std::string> m_Frames;
+};
+
+//! Prepares blocks of a batch at once, each block is kept as a frame
+class BatchFrameConnection : public FrameConnection, public rpc::IBatchConnection
+{
+public:
+    class BatchData : public net::details::IData
+    {
+    public:
+        BatchData(BatchFrameConnection& connection, const std::vector<std::size_t>& sizes) : m_Parent(connection), m_Sizes(sizes) {}
+
+        ~BatchData()
+        {
+            std::size_t offset = 0;
+            for (const auto size : m_Sizes)
+            {
+                m_Parent.AddFrame(m_Buffer.substr(offset, size));
+                offset += size;
+            }
+        }
+
+        virtual void Write(const void* data, std::size_t size) override
+        {
+            m_Buffer.append(static_cast<const char*>(data), size);
+        }
+
+        virtual const std::vector<boost::asio::mutable_buffer>& GetBuffers() override
+        {
+            static const std::vector<boost::asio::mutable_buffer> empty;
+            return empty;
+        }
+
+    private:
+        BatchFrameConnection& m_Parent;
+        const std::vector<std::size_t> m_Sizes;
+        std::string m_Buffer;
+    };
+
+    BatchFrameConnection(bool holdFirst = false) : FrameConnection(holdFirst), m_Batches() {}
+
+    virtual net::details::IData::Ptr PrepareBatch(const std::vector<std::size_t>& sizes) override
+    {
+        ++m_Batches;
+        return boost::make_shared<BatchData>(*this, sizes);
+    }
+
+    unsigned m_Batches;
+};
+
+proto::test::Request MakeRequest(boost::uint32_t data)
+{
+    proto::test::Request request;
+    request.set_data(data);
+    return request;
+}
+
+proto::BasePacket MakeBase(boost::uint32_t id)
+{
+    proto::BasePacket base;
+    base.set_packetid(id);
+    base.set_direction(proto::BasePacket::Request);
+    return base;
+}
+
+WriteCoalescer::Settings MakeSettings()
+{
+    WriteCoalescer::Settings settings;
+    settings.m_MaxBatchBytes = 1024 * 1024;
+    settings.m_MaxDelay = boost::posix_time::hours(1);
+    return settings;
+}
+
+//! Frames of the packet written directly to the connection
+std::vector<std::string> DirectFrames(const proto::BasePacket& base, const google::protobuf::Message* request, const std::string& stream)
+{
+    const auto connection = boost::make_shared<FrameConnection>();
+    rpc::details::WriteStream(connection).Write(base, request, stream.empty() ? rpc::IStream() : boost::make_shared<std::stringstream>(stream));
+    return connection->GetFrames();
+}
+
+} // anonymous namespace
+
+TEST(WriteCoalescer, IdlePacketIsWrittenImmediately)
+{
+    boost::asio::io_service service;
+    const auto coalescer = boost::make_shared<WriteCoalescer>(service, MakeSettings());
+    const auto connection = boost::make_shared<FrameConnection>();
+
+    const auto base = MakeBase(1);
+    const auto request = MakeRequest(1);
+    coalescer->Write(connection, base, &request, rpc::IStream());
+
+    // doesn't wait for the delay
+    EXPECT_EQ(connection->GetFrames(), DirectFrames(base, &request, ""));
+
+    const auto stats = coalescer->GetStats();
+    EXPECT_EQ(stats.m_Batches, 1u);
+    EXPECT_EQ(stats.m_Writes, 1u);
+    EXPECT_EQ(connection->GetPrepared(), 1u);
+    EXPECT_EQ(stats.m_Packets, 1u);
+    EXPECT_EQ(stats.m_Bytes, connection->GetFrames().front().size());
+    EXPECT_EQ(stats.m_Flushes[WriteCoalescer::FLUSH_IDLE], 1u);
+}
+
+TEST(WriteCoalescer, PacketsWrittenInFlightAreBatched)
+{
+    boost::asio::io_service service;
+    const auto coalescer = boost::make_shared<WriteCoalescer>(service, MakeSettings());
+    const auto connection = boost::make_shared<FrameConnection>(true);
+
+    const auto first = MakeBase(0);
+    boost::thread writer([&](){ coalescer->Write(connection, first, nullptr, rpc::IStream()); });
+    connection->WaitHeld();
+
+    // packet with a stream larger than a single prepared block keeps its framing
+    const std::string large(rpc::details::WriteStream::MAX_IN_MEMORY_STREAM_SIZE + 100, 's');
+
+    std::vector<std::string> expected = DirectFrames(first, nullptr, "");
+    for (boost::uint32_t i = 1; i < 4; ++i)
+    {
+        const auto base = MakeBase(i);
+        const auto request = MakeRequest(i);
+        const auto stream = i == 3 ? large : std::string("sometext");
+        coalescer->Write(connection, base, &request, boost::make_shared<std::stringstream>(stream));
+
+        const auto frames = DirectFrames(base, &request, stream);
+        expected.insert(expected.end(), frames.begin(), frames.end());
+    }
+
+    connection->Release();
+    writer.join();
+
+    // packets collected during the write follow it as a single batch
+    EXPECT_EQ(connection->GetFrames(), expected);
+
+    const auto stats = coalescer->GetStats();
+    EXPECT_EQ(stats.m_Batches, 2u);
+    EXPECT_EQ(stats.m_Packets, 4u);
+    EXPECT_EQ(stats.m_MaxBatchPackets, 3u);
+    EXPECT_EQ(stats.m_Flushes[WriteCoalescer::FLUSH_IDLE], 1u);
+    EXPECT_EQ(stats.m_Flushes[WriteCoalescer::FLUSH_IN_FLIGHT], 1u);
+
+    // connection without batch support gets every block of the batch prepared on its own
+    EXPECT_EQ(connection->GetPrepared(), expected.size());
+    EXPECT_EQ(stats.m_Writes, expected.size());
+}
+
+TEST(WriteCoalescer, BatchIsPreparedAtOnce)
+{
+    boost::asio::io_service service;
+    const auto coalescer = boost::make_shared<WriteCoalescer>(service, MakeSettings());
+    const auto connection = boost::make_shared<BatchFrameConnection>(true);
+
+    const auto first = MakeBase(0);
+    boost::thread writer([&](){ coalescer->Write(connection, first, nullptr, rpc::IStream()); });
+    connection->WaitHeld();
+
+    const std::string large(rpc::details::WriteStream::MAX_IN_MEMORY_STREAM_SIZE + 100, 's');
+
+    std::vector<std::string> expected = DirectFrames(first, nullptr, "");
+    for (boost::uint32_t i = 1; i < 4; ++i)
+    {
+        const auto base = MakeBase(i);
+        const auto request = MakeRequest(i);
+        const auto stream = i == 3 ? large : std::string("sometext");
+        coalescer->Write(connection, base, &request, boost::make_shared<std::stringstream>(stream));
+
+        const auto frames = DirectFrames(base, &request, stream);
+        expected.insert(expected.end(), frames.begin(), frames.end());
+    }
+
+    connection->Release();
+    writer.join();
+
+    // framing is the same, but only the direct write prepares a block on its own
+    EXPECT_EQ(connection->GetFrames(), expected);
+    EXPECT_EQ(connection->GetPrepared(), 1u);
+    EXPECT_EQ(connection->m_Batches, 1u);
+
+    const auto stats = coalescer->GetStats();
+    EXPECT_EQ(stats.m_Batches, 2u);
+    EXPECT_EQ(stats.m_Writes, 2u);
+    EXPECT_EQ(stats.m_Packets, 4u);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+//! Latencies of calls in nanoseconds
+typedef std::vector<boost::uint64_t> Latencies;
+
+//! Latencies of all threads in one sorted list
+inline Latencies Merge(const std::vector<Latencies>& threads)
+{
+    Latencies all;
+    for (const auto& thread : threads)
+        all.insert(all.end(), thread.begin(), thread.end());
+    std::sort(all.begin(), all.end());
+    return all;
+}
+
+inline boost::uint64_t Percentile(const Latencies& sorted, double percentile)
+{
+    if (sorted.empty())
+        return 0;
+    const auto index = static_cast<std::size_t>(percentile * (sorted.size() - 1));
+    return sorted[index];
+}
+
+//! Result of the bench run, each value is recorded as property of the test and printed
+//! as one json object per line, so results may be collected without gtest output
+class BenchReport
+{
+public:
+    explicit BenchReport(const std::string& bench)
+    {
+        m_Json << "{\"bench\": \"" << bench << "\"";
+    }
+
+    BenchReport& Add(const std::string& name, const std::string& value)
+    {
+        testing::Test::RecordProperty(name, value);
+        m_Json << ", \"" << name << "\": \"" << value << "\"";
+        return *this;
+    }
+
+    BenchReport& Add(const std::string& name, boost::uint64_t value)
+    {
+        testing::Test::RecordProperty(name, std::to_string(value));
+        m_Json << ", \"" << name << "\": " << value;
+        return *this;
+    }
+
+    //! p50, p99 and p999 of sorted latencies
+    BenchReport& AddPercentiles(const Latencies& sorted)
+    {
+        return Add("p50_ns", Percentile(sorted, 0.5))
+              .Add("p99_ns", Percentile(sorted, 0.99))
+              .Add("p999_ns", Percentile(sorted, 0.999));
+    }
+
+    void Print() const
+    {
+        std::cout << m_Json.str() << "}" << std::endl;
+    }
+
+private:
+    std::ostringstream m_Json;
+};
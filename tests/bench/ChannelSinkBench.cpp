@@ -0,0 +1,93 @@
+#include "rpc/Channel.h"
+#include "../../src/ChannelSink.h"
+#include "../NullConnection.h"
+
+#include "rpc_base.pb.h"
+
+#include <gtest/gtest.h>
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include <boost/make_shared.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/chrono.hpp>
+
+namespace
+{
+
+class ChannelSinkBench : public testing::TestWithParam<unsigned>
+{
+public:
+    enum
+    {
+        CALLS_PER_THREAD = 100000,
+        CALLS_IN_FLIGHT = 100
+    };
+
+    //! Push a window of requests, then pop responses for all of them
+    static void PushPop(rpc::details::IChannelSink& sink, unsigned thread)
+    {
+        proto::BasePacket request;
+        request.set_direction(proto::BasePacket::Request);
+
+        proto::BasePacket response;
+        response.set_direction(proto::BasePacket::Response);
+
+        const auto stream = boost::make_shared<std::stringstream>();
+        const boost::uint32_t first = thread * CALLS_PER_THREAD + 1;
+
+        for (boost::uint32_t window = 0; window < CALLS_PER_THREAD; window += CALLS_IN_FLIGHT)
+        {
+            for (boost::uint32_t i = 0; i < CALLS_IN_FLIGHT; ++i)
+            {
+                request.set_packetid(first + window + i);
+                sink.Push(request, nullptr, rpc::IStream());
+            }
+
+            for (boost::uint32_t i = 0; i < CALLS_IN_FLIGHT; ++i)
+            {
+                response.set_packetid(first + window + i);
+                sink.Pop(response, stream);
+            }
+        }
+    }
+};
+
+} // anonymous namespace
+
+TEST_P(ChannelSinkBench, PushPop)
+{
+    const auto threadsCount = GetParam();
+
+    boost::asio::io_service service;
+    const auto sink = rpc::details::IChannelSink::Instance(service, boost::weak_ptr<rpc::details::IChannel>());
+    sink->SetConnection(boost::make_shared<NullConnection>());
+
+    const auto start = boost::chrono::steady_clock::now();
+
+    boost::thread_group threads;
+    for (unsigned i = 0; i < threadsCount; ++i)
+        threads.create_thread([&sink, i](){ PushPop(*sink, i); });
+    threads.join_all();
+
+    const auto elapsed = boost::chrono::duration_cast<boost::chrono::nanoseconds>(boost::chrono::steady_clock::now() - start).count();
+    const auto calls = static_cast<boost::uint64_t>(threadsCount) * CALLS_PER_THREAD;
+
+    const auto callsPerSecond = static_cast<boost::uint64_t>(calls * 1000000000.0 / elapsed);
+    const auto nsPerCall = static_cast<boost::uint64_t>(static_cast<double>(elapsed) / calls);
+
+    RecordProperty("threads", threadsCount);
+    RecordProperty("calls", std::to_string(calls));
+    RecordProperty("calls_per_second", std::to_string(callsPerSecond));
+    RecordProperty("ns_per_call", std::to_string(nsPerCall));
+
+    std::cout << "ChannelSink Push/Pop: threads: " << threadsCount
+              << ", calls: " << calls
+              << ", calls/s: " << callsPerSecond
+              << ", ns/call: " << nsPerCall << std::endl;
+}
+
+INSTANTIATE_TEST_CASE_P(Threads, ChannelSinkBench, testing::Values(1u, 8u, 64u));
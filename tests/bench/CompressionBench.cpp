@@ -0,0 +1,127 @@
+#include "rpc/Compression.h"
+
+#include "test_service.pb.h"
+
+#include <gtest/gtest.h>
+
+#include <iostream>
+#include <string>
+#include <tuple>
+
+#include <boost/chrono.hpp>
+
+namespace
+{
+
+typedef rpc::details::Compression Compression;
+
+enum Payload
+{
+    PAYLOAD_TEXT,       //!< repeated text, compresses well
+    PAYLOAD_MESSAGES,   //!< serialized test requests with small numbers
+    PAYLOAD_RANDOM,     //!< incompressible bytes
+};
+
+class CompressionBench : public testing::TestWithParam<std::tuple<Compression::Codec, Payload, std::size_t>>
+{
+public:
+    enum { ITERATIONS = 50 };
+
+    static std::string MakePayload(Payload payload, std::size_t size)
+    {
+        std::string result;
+        result.reserve(size);
+
+        if (payload == PAYLOAD_TEXT)
+        {
+            static const std::string text = "The quick brown fox jumps over the lazy dog. ";
+            while (result.size() < size)
+                result += text;
+        }
+        else
+        if (payload == PAYLOAD_MESSAGES)
+        {
+            proto::test::Request request;
+            for (boost::uint32_t i = 0; result.size() < size; ++i)
+            {
+                request.set_data(i);
+                request.set_payload(std::to_string(i * 7));
+                result += request.SerializeAsString();
+            }
+        }
+        else
+        {
+            boost::uint32_t state = 1;
+            while (result.size() < size)
+            {
+                state = state * 1664525 + 1013904223;
+                result.push_back(static_cast<char>(state >> 24));
+            }
+        }
+
+        result.resize(size);
+        return result;
+    }
+
+    //! Nanoseconds per iteration
+    template<typename Fn>
+    static double Measure(const Fn& fn)
+    {
+        const auto start = boost::chrono::steady_clock::now();
+        for (int i = 0; i < ITERATIONS; ++i)
+            fn();
+        return static_cast<double>(boost::chrono::duration_cast<boost::chrono::nanoseconds>(boost::chrono::steady_clock::now() - start).count()) / ITERATIONS;
+    }
+};
+
+const char* ToString(Payload payload)
+{
+    switch (payload)
+    {
+    case PAYLOAD_TEXT: return "text";
+    case PAYLOAD_MESSAGES: return "messages";
+    default: return "random";
+    }
+}
+
+} // anonymous namespace
+
+TEST_P(CompressionBench, RatioAndCost)
+{
+    const auto codec = std::get<0>(GetParam());
+    const auto kind = std::get<1>(GetParam());
+    const auto size = std::get<2>(GetParam());
+
+    const auto data = MakePayload(kind, size);
+
+    std::string compressed;
+    const auto compressNs = Measure([&](){ compressed = Compression::Compress(codec, data); });
+
+    std::string restored;
+    const auto decompressNs = Measure([&](){ restored = Compression::Decompress(codec, compressed); });
+
+    ASSERT_EQ(restored, data);
+
+    const auto ratio = static_cast<double>(data.size()) / compressed.size();
+    const auto compressMbs = data.size() * 1000.0 / compressNs;
+    const auto decompressMbs = data.size() * 1000.0 / decompressNs;
+
+    RecordProperty("codec", proto::CompressionType_Name(codec));
+    RecordProperty("payload", ToString(kind));
+    RecordProperty("bytes", std::to_string(size));
+    RecordProperty("ratio", std::to_string(ratio));
+    RecordProperty("compress_mb_per_s", std::to_string(compressMbs));
+    RecordProperty("decompress_mb_per_s", std::to_string(decompressMbs));
+
+    std::cout << "Compression: codec: " << proto::CompressionType_Name(codec)
+              << ", payload: " << ToString(kind)
+              << ", bytes: " << size
+              << ", ratio: " << ratio
+              << ", compress MB/s: " << compressMbs
+              << ", decompress MB/s: " << decompressMbs << std::endl;
+}
+
+INSTANTIATE_TEST_CASE_P(Codecs, CompressionBench, testing::Combine(
+    testing::Values(proto::Zlib, proto::Zstd),
+    testing::Values(PAYLOAD_TEXT, PAYLOAD_MESSAGES, PAYLOAD_RANDOM),
+    testing::Values(std::size_t(4 * 1024), std::size_t(1024 * 1024))));
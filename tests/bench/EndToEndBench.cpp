@@ -0,0 +1,446 @@
+#include "rpc/Channel.h"
+#include "rpc/InProcessChannel.h"
+#include "rpc/LocalHandler.h"
+#include "rpc/SharedMemoryConnection.h"
+#include "rpc/Exceptions.h"
+#include "../../src/ChannelSink.h"
+#include "../../src/Stream.h"
+#include "BenchReport.h"
+
+#include "test_service.pb.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <boost/make_shared.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/chrono.hpp>
+
+namespace
+{
+
+typedef boost::chrono::steady_clock Clock;
+
+//! Received packet, owns its data
+class PacketStream
+    : private std::vector<char>
+    , public boost::iostreams::stream<boost::iostreams::array_source>
+{
+public:
+    PacketStream(std::vector<char>&& data)
+        : std::vector<char>(std::move(data))
+        , boost::iostreams::stream<boost::iostreams::array_source>(std::vector<char>::data(), std::vector<char>::size())
+    {
+    }
+};
+
+//! In memory connection, every prepared block is delivered to the peer channel as a separate stream.
+//! Blocks are delivered in order on a strand of the io_service, like a socket connection would do.
+class LoopbackConnection : public net::IConnection
+{
+public:
+    class LoopbackData : public net::details::IData
+    {
+    public:
+        LoopbackData(LoopbackConnection& parent, std::size_t size)
+            : m_Parent(parent)
+            , m_Data(size)
+            , m_Offset()
+        {
+            if (size)
+                m_Buffers.emplace_back(boost::asio::buffer(m_Data));
+        }
+
+        ~LoopbackData()
+        {
+            m_Parent.Deliver(std::move(m_Data));
+        }
+
+        virtual void Write(const void* data, std::size_t size) override
+        {
+            std::copy(static_cast<const char*>(data), static_cast<const char*>(data) + size, m_Data.begin() + m_Offset);
+            m_Offset += size;
+        }
+
+        virtual const std::vector<boost::asio::mutable_buffer>& GetBuffers() override
+        {
+            return m_Buffers;
+        }
+
+    private:
+        LoopbackConnection& m_Parent;
+        std::vector<char> m_Data;
+        std::size_t m_Offset;
+        std::vector<boost::asio::mutable_buffer> m_Buffers;
+    };
+
+    LoopbackConnection(boost::asio::io_service& svc) : m_Strand(svc) {}
+
+    void SetPeer(const rpc::ISequencedChannel::Ptr& peer)
+    {
+        m_Peer = peer;
+    }
+
+    virtual void Receive(const Callback& callback) override
+    {
+    }
+    virtual void Close() override
+    {
+    }
+    virtual net::details::IData::Ptr Prepare(std::size_t size) override
+    {
+        return boost::make_shared<LoopbackData>(*this, size);
+    }
+    virtual void Flush() override
+    {
+    }
+    virtual std::string GetInfo() const override
+    {
+        return "loopback";
+    }
+
+private:
+    void Deliver(std::vector<char>&& data)
+    {
+        const rpc::IStream stream = boost::make_shared<PacketStream>(std::move(data));
+        const boost::weak_ptr<rpc::ISequencedChannel> peer = m_Peer;
+        m_Strand.post([peer, stream](){
+            if (const auto channel = peer.lock())
+                channel->OnIncomingData(stream, boost::exception_ptr());
+        });
+    }
+
+private:
+    boost::asio::io_service::strand m_Strand;
+    boost::weak_ptr<rpc::ISequencedChannel> m_Peer;
+};
+
+//! Replies with the request payload, request stream is consumed but not sent back
+class EchoService : public proto::test::TestService
+{
+public:
+    virtual void TestMethod(const rpc::StreamRequest<::proto::test::Request>::Ptr& request, const rpc::StreamResponse<::proto::test::Response>::Ptr& response) override
+    {
+        response->set_data(request->data() + 1);
+        response->set_payload(request->payload());
+
+        if (const auto stream = request->Stream())
+        {
+            char buffer[64 * 1024];
+            while (stream->read(buffer, sizeof(buffer)).gcount())
+                ;
+        }
+    }
+};
+
+enum ChannelType
+{
+    SEQUENCED_CHANNEL,
+    CHANNEL,
+    IN_PROCESS
+};
+
+enum Transport
+{
+    LOOPBACK,
+    SHARED_MEMORY
+};
+
+enum CallMode
+{
+    SYNC,
+    ASYNC
+};
+
+struct Payload
+{
+    const char* m_Name;
+    std::size_t m_MessageBytes;     //!< size of the payload field of request and response
+    std::size_t m_StreamBytes;      //!< size of the request stream
+};
+
+const Payload PAYLOADS[] =
+{
+    { "empty",          0,          0 },
+    { "message_1k",     1024,       0 },
+    { "stream_1k",      0,          1024 },
+    { "stream_64k",     0,          64 * 1024 },
+    { "stream_1m",      0,          1024 * 1024 },
+    { "stream_10m",     0,          10 * 1024 * 1024 }
+};
+
+typedef std::tuple<ChannelType, Transport, unsigned, CallMode, unsigned> Params;
+
+//! Supported combinations only, so every instantiated case reports its result
+std::vector<Params> MakeParams()
+{
+    std::vector<Params> result;
+    for (const auto type : { SEQUENCED_CHANNEL, CHANNEL, IN_PROCESS })
+    {
+        for (const auto transport : { LOOPBACK, SHARED_MEMORY })
+        {
+            // in-process channel doesn't use transport, it runs once
+            if (type == IN_PROCESS && transport != LOOPBACK)
+                continue;
+
+            for (unsigned payload = 0; payload < sizeof(PAYLOADS) / sizeof(PAYLOADS[0]); ++payload)
+            {
+                // sequenced channel relies on transport framing, stream sent in several blocks can't be reassembled
+                const auto packetSize = PAYLOADS[payload].m_MessageBytes + PAYLOADS[payload].m_StreamBytes;
+                if (type == SEQUENCED_CHANNEL && packetSize >= rpc::details::WriteStream::MAX_IN_MEMORY_STREAM_SIZE)
+                    continue;
+
+                for (const auto mode : { SYNC, ASYNC })
+                {
+                    for (const auto threads : { 1u, 4u, 16u })
+                        result.emplace_back(type, transport, payload, mode, threads);
+                }
+            }
+        }
+    }
+    return result;
+}
+
+class EndToEndBench : public testing::TestWithParam<Params>
+{
+public:
+    enum
+    {
+        MAX_CALLS = 20000,
+        MIN_CALLS = 20,
+        BYTES_PER_RUN = 256 * 1024 * 1024,
+        ASYNC_CALLS_IN_FLIGHT = 32,
+        SERVICE_THREADS = 2
+    };
+
+    EndToEndBench() : m_Work(new boost::asio::io_service::work(m_Service))
+    {
+        for (unsigned i = 0; i < SERVICE_THREADS; ++i)
+            m_Threads.create_thread([this](){ m_Service.run(); });
+    }
+
+    ~EndToEndBench()
+    {
+        m_Work.reset();
+        m_Service.stop();
+        m_Threads.join_all();
+    }
+
+    void Connect(ChannelType type, Transport transport)
+    {
+        m_Client = Create(type);
+        m_Server = type == IN_PROCESS ? m_Client : Create(type);
+
+        if (type == IN_PROCESS)
+        {
+            // nothing is serialized, there is no transport
+        }
+        else
+        if (transport == SHARED_MEMORY)
+        {
+            std::ostringstream name;
+            name << "rpc_bench_" << Clock::now().time_since_epoch().count();
+
+            const auto serverConnection = rpc::ISharedMemoryConnection::Create(m_Service, name.str());
+            const auto clientConnection = rpc::ISharedMemoryConnection::Open(m_Service, name.str());
+            Receive(serverConnection, m_Server);
+            Receive(clientConnection, m_Client);
+
+            m_Client->SetConnection(clientConnection);
+            m_Server->SetConnection(serverConnection);
+        }
+        else
+        {
+            const auto clientConnection = boost::make_shared<LoopbackConnection>(m_Service);
+            const auto serverConnection = boost::make_shared<LoopbackConnection>(m_Service);
+            clientConnection->SetPeer(m_Server);
+            serverConnection->SetPeer(m_Client);
+
+            m_Client->SetConnection(clientConnection);
+            m_Server->SetConnection(serverConnection);
+        }
+
+        m_Echo = boost::make_shared<EchoService>();
+        const auto handler = rpc::ILocalHandler::Instance(m_Service);
+        handler->ProvideService(m_Echo);
+        m_Server->AddHandler(handler);
+    }
+
+    static void Receive(const net::IConnection::Ptr& connection, const rpc::ISequencedChannel::Ptr& channel)
+    {
+        const boost::weak_ptr<rpc::ISequencedChannel> weak = channel;
+        connection->Receive([weak](const rpc::IStream& stream){
+            if (const auto channel = weak.lock())
+                channel->OnIncomingData(stream, stream ? boost::exception_ptr() : rpc::MakeException("Connection closed by peer"));
+        });
+    }
+
+    void Disconnect()
+    {
+        m_Client->Close(boost::exception_ptr());
+        m_Server->Close(boost::exception_ptr());
+    }
+
+    rpc::ISequencedChannel::Ptr Create(ChannelType type)
+    {
+        if (type == CHANNEL)
+            return rpc::IChannel::Instance(m_Service);
+        if (type == IN_PROCESS)
+            return rpc::IInProcessChannel::Instance(m_Service);
+        return rpc::ISequencedChannel::Instance(m_Service);
+    }
+
+    static rpc::IStream MakeStream(const std::string& data)
+    {
+        if (data.empty())
+            return rpc::IStream();
+        return boost::make_shared<std::stringstream>(data);
+    }
+
+    //! Blocking calls, one at a time
+    void RunSync(const proto::test::Request& request, const std::string& streamData, unsigned calls, Latencies& latencies)
+    {
+        proto::test::TestService::Stub stub(*m_Client);
+        for (unsigned i = 0; i < calls; ++i)
+        {
+            const auto stream = MakeStream(streamData);
+            const auto start = Clock::now();
+            const auto future = stub.TestMethod(request, stream);
+            const auto& response = future.Response();
+            latencies.push_back(boost::chrono::duration_cast<boost::chrono::nanoseconds>(Clock::now() - start).count());
+
+            if (response.data() != request.data() + 1)
+                ADD_FAILURE() << "Unexpected response: " << response.ShortDebugString();
+        }
+    }
+
+    //! Callback based calls, keeps a window of calls in flight
+    void RunAsync(const proto::test::Request& request, const std::string& streamData, unsigned calls, Latencies& latencies)
+    {
+        boost::mutex mutex;
+        boost::condition_variable completed;
+        unsigned inFlight = 0;
+
+        latencies.resize(calls);
+
+        proto::test::TestService::Stub stub(*m_Client);
+        for (unsigned i = 0; i < calls; ++i)
+        {
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (inFlight == ASYNC_CALLS_IN_FLIGHT)
+                    completed.wait(lock);
+                ++inFlight;
+            }
+
+            const auto stream = MakeStream(streamData);
+            const auto start = Clock::now();
+            auto& latency = latencies[i];
+            stub.TestMethod(request, stream).Async([&, start](const rpc::Future<proto::test::Response>& future){
+                latency = boost::chrono::duration_cast<boost::chrono::nanoseconds>(Clock::now() - start).count();
+                try
+                {
+                    if (future.Response().data() != request.data() + 1)
+                        ADD_FAILURE() << "Unexpected response: " << future.Response().ShortDebugString();
+                }
+                catch (const std::exception& e)
+                {
+                    ADD_FAILURE() << "Call failed: " << e.what();
+                }
+
+                boost::unique_lock<boost::mutex> lock(mutex);
+                --inFlight;
+                completed.notify_all();
+            });
+        }
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (inFlight)
+            completed.wait(lock);
+    }
+
+protected:
+    boost::asio::io_service m_Service;
+    std::unique_ptr<boost::asio::io_service::work> m_Work;
+    boost::thread_group m_Threads;
+
+    rpc::ISequencedChannel::Ptr m_Client;
+    rpc::ISequencedChannel::Ptr m_Server;
+    boost::shared_ptr<EchoService> m_Echo;
+};
+
+} // anonymous namespace
+
+TEST_P(EndToEndBench, TestMethod)
+{
+    const auto type = std::get<0>(GetParam());
+    const auto transport = std::get<1>(GetParam());
+    const auto& payload = PAYLOADS[std::get<2>(GetParam())];
+    const auto mode = std::get<3>(GetParam());
+    const auto threadsCount = std::get<4>(GetParam());
+
+    const auto packetSize = payload.m_MessageBytes + payload.m_StreamBytes;
+    const auto bytesPerCall = std::max<std::size_t>(packetSize, 1);
+    const auto totalCalls = std::max<std::size_t>(MIN_CALLS, std::min<std::size_t>(MAX_CALLS, BYTES_PER_RUN / bytesPerCall));
+    const auto callsPerThread = static_cast<unsigned>(std::max<std::size_t>(1, totalCalls / threadsCount));
+
+    Connect(type, transport);
+
+    proto::test::Request request;
+    request.set_data(1);
+    request.set_payload(std::string(payload.m_MessageBytes, 'x'));
+    const std::string streamData(payload.m_StreamBytes, 's');
+
+    std::vector<Latencies> latencies(threadsCount);
+
+    const auto start = Clock::now();
+
+    boost::thread_group threads;
+    for (unsigned i = 0; i < threadsCount; ++i)
+    {
+        auto& result = latencies[i];
+        threads.create_thread([&, mode](){
+            if (mode == SYNC)
+                RunSync(request, streamData, callsPerThread, result);
+            else
+                RunAsync(request, streamData, callsPerThread, result);
+        });
+    }
+    threads.join_all();
+
+    const auto elapsed = boost::chrono::duration_cast<boost::chrono::nanoseconds>(Clock::now() - start).count();
+
+    Disconnect();
+
+    const auto all = Merge(latencies);
+    const auto calls = static_cast<boost::uint64_t>(all.size());
+
+    const char* channelName = type == CHANNEL ? "channel" : type == IN_PROCESS ? "in_process" : "sequenced_channel";
+    const char* transportName = type == IN_PROCESS ? "none" : transport == SHARED_MEMORY ? "shared_memory" : "loopback";
+    const char* modeName = mode == SYNC ? "sync" : "async";
+
+    BenchReport("rpc_end_to_end")
+        .Add("channel", channelName)
+        .Add("transport", transportName)
+        .Add("payload", payload.m_Name)
+        .Add("mode", modeName)
+        .Add("threads", threadsCount)
+        .Add("calls", calls)
+        .Add("calls_per_second", static_cast<boost::uint64_t>(calls * 1000000000.0 / elapsed))
+        .Add("bytes_per_second", static_cast<boost::uint64_t>(calls * 1000000000.0 * packetSize / elapsed))
+        .AddPercentiles(all)
+        .Print();
+}
+
+INSTANTIATE_TEST_CASE_P(Calls, EndToEndBench, testing::ValuesIn(MakeParams()));
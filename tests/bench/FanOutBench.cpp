@@ -0,0 +1,142 @@
+#include "rpc/InProcessChannel.h"
+#include "rpc/LocalHandler.h"
+#include "BenchReport.h"
+
+#include "test_service.pb.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <boost/make_shared.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/chrono.hpp>
+
+namespace
+{
+
+typedef boost::chrono::steady_clock Clock;
+
+class IncrementService : public proto::test::TestService
+{
+public:
+    virtual void TestMethod(const rpc::StreamRequest<::proto::test::Request>::Ptr& request, const rpc::StreamResponse<::proto::test::Response>::Ptr& response) override
+    {
+        response->set_data(request->data() + 1);
+    }
+};
+
+//! Every query is sent to all channels, response is combined by WhenAll
+class FanOutBench : public testing::TestWithParam<unsigned>
+{
+public:
+    enum
+    {
+        CHANNELS = 100,
+        QUERIES = 2000,
+        SERVICE_THREADS = 2
+    };
+
+    typedef rpc::Future<proto::test::Response> ResponseFuture;
+
+    FanOutBench() : m_Work(new boost::asio::io_service::work(m_Service))
+    {
+        const auto service = boost::make_shared<IncrementService>();
+        for (unsigned i = 0; i < CHANNELS; ++i)
+        {
+            const auto channel = rpc::IInProcessChannel::Instance(m_Service);
+            const auto handler = rpc::ILocalHandler::Instance(m_Service);
+            handler->ProvideService(service);
+            channel->AddHandler(handler);
+            m_Channels.push_back(channel);
+        }
+
+        for (unsigned i = 0; i < SERVICE_THREADS; ++i)
+            m_Threads.create_thread([this](){ m_Service.run(); });
+    }
+
+    ~FanOutBench()
+    {
+        for (const auto& channel : m_Channels)
+            channel->Close(boost::exception_ptr());
+
+        m_Work.reset();
+        m_Service.stop();
+        m_Threads.join_all();
+    }
+
+    void Query(unsigned queries, Latencies& latencies)
+    {
+        proto::test::Request request;
+        request.set_data(1);
+
+        std::vector<ResponseFuture> futures;
+        futures.reserve(m_Channels.size());
+        for (unsigned i = 0; i < queries; ++i)
+        {
+            const auto start = Clock::now();
+
+            futures.clear();
+            for (const auto& channel : m_Channels)
+                futures.push_back(proto::test::TestService::Stub(*channel).TestMethod(request, rpc::IStream()));
+
+            const auto sum = rpc::WhenAll(m_Service, futures, [](const std::vector<ResponseFuture>& ready){
+                proto::test::Response result;
+                result.set_data(0);
+                for (const auto& future : ready)
+                    result.set_data(result.data() + future.Response().data());
+                return result;
+            });
+
+            const auto data = sum.Response().data();
+            latencies.push_back(boost::chrono::duration_cast<boost::chrono::nanoseconds>(Clock::now() - start).count());
+
+            if (data != 2 * CHANNELS)
+                ADD_FAILURE() << "Unexpected sum: " << data;
+        }
+    }
+
+protected:
+    boost::asio::io_service m_Service;
+    std::unique_ptr<boost::asio::io_service::work> m_Work;
+    boost::thread_group m_Threads;
+    std::vector<rpc::IInProcessChannel::Ptr> m_Channels;
+};
+
+} // anonymous namespace
+
+TEST_P(FanOutBench, WhenAll)
+{
+    const auto threadsCount = GetParam();
+    const auto queriesPerThread = std::max<unsigned>(1, QUERIES / threadsCount);
+
+    std::vector<Latencies> latencies(threadsCount);
+
+    const auto start = Clock::now();
+
+    boost::thread_group threads;
+    for (unsigned i = 0; i < threadsCount; ++i)
+    {
+        auto& result = latencies[i];
+        threads.create_thread([&, queriesPerThread](){ Query(queriesPerThread, result); });
+    }
+    threads.join_all();
+
+    const auto elapsed = boost::chrono::duration_cast<boost::chrono::nanoseconds>(Clock::now() - start).count();
+
+    const auto all = Merge(latencies);
+    const auto queries = static_cast<boost::uint64_t>(all.size());
+
+    BenchReport("rpc_fan_out")
+        .Add("channels", CHANNELS)
+        .Add("threads", threadsCount)
+        .Add("queries", queries)
+        .Add("queries_per_second", static_cast<boost::uint64_t>(queries * 1000000000.0 / elapsed))
+        .AddPercentiles(all)
+        .Print();
+}
+
+INSTANTIATE_TEST_CASE_P(Queries, FanOutBench, testing::Values(1u, 4u));
@@ -0,0 +1,149 @@
+#include "rpc/FileStream.h"
+#include "../../src/Stream.h"
+
+#include "test_service.pb.h"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <boost/make_shared.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/chrono.hpp>
+
+namespace
+{
+
+//! Exposes one reused buffer for every prepared block, like the shared memory ring does, data is dropped
+class BufferConnection : public net::IConnection
+{
+public:
+    class Data : public net::details::IData
+    {
+    public:
+        Data(std::vector<char>& buffer, std::size_t size)
+        {
+            if (buffer.size() < size)
+                buffer.resize(size);
+            if (size)
+                m_Buffers.emplace_back(boost::asio::buffer(buffer.data(), size));
+        }
+
+        virtual void Write(const void*, std::size_t) override
+        {
+        }
+
+        virtual const std::vector<boost::asio::mutable_buffer>& GetBuffers() override
+        {
+            return m_Buffers;
+        }
+
+    private:
+        std::vector<boost::asio::mutable_buffer> m_Buffers;
+    };
+
+    BufferConnection() : m_Bytes() {}
+
+    virtual void Receive(const Callback&) override
+    {
+    }
+    virtual void Close() override
+    {
+    }
+    virtual net::details::IData::Ptr Prepare(std::size_t size) override
+    {
+        m_Bytes += size;
+        return boost::make_shared<Data>(m_Buffer, size);
+    }
+    virtual void Flush() override
+    {
+    }
+    virtual std::string GetInfo() const override
+    {
+        return "buffer";
+    }
+
+    boost::uint64_t m_Bytes;
+
+private:
+    std::vector<char> m_Buffer;
+};
+
+enum Source
+{
+    SOURCE_FILE,    //!< FileStream, read with pread straight into buffers of the connection
+    SOURCE_FSTREAM, //!< std::ifstream, read through the file buffer into the connection
+};
+
+class FileStreamBench : public testing::TestWithParam<std::tuple<Source, std::size_t>>
+{
+public:
+    enum { ITERATIONS = 20 };
+
+    FileStreamBench()
+        : m_Path((boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()).string())
+    {
+        const std::string data(std::get<1>(GetParam()), 'f');
+        std::ofstream(m_Path.c_str(), std::ios::binary).write(data.data(), data.size());
+    }
+
+    ~FileStreamBench()
+    {
+        boost::system::error_code e;
+        boost::filesystem::remove(m_Path, e);
+    }
+
+    rpc::IStream Open() const
+    {
+        if (std::get<0>(GetParam()) == SOURCE_FILE)
+            return rpc::FileStream::Instance(m_Path);
+        return boost::make_shared<std::ifstream>(m_Path.c_str(), std::ios::binary);
+    }
+
+protected:
+    const std::string m_Path;
+};
+
+const char* ToString(Source source)
+{
+    return source == SOURCE_FILE ? "file" : "fstream";
+}
+
+} // anonymous namespace
+
+TEST_P(FileStreamBench, Write)
+{
+    const auto source = std::get<0>(GetParam());
+    const auto size = std::get<1>(GetParam());
+
+    proto::test::Request request;
+    request.set_data(42);
+
+    const auto connection = boost::make_shared<BufferConnection>();
+
+    // stream is opened by each iteration, the way handler opens the file it sends
+    const auto start = boost::chrono::steady_clock::now();
+    for (int i = 0; i < ITERATIONS; ++i)
+        rpc::details::WriteStream(connection).Write(request, nullptr, Open());
+    const auto ns = boost::chrono::duration_cast<boost::chrono::nanoseconds>(boost::chrono::steady_clock::now() - start).count();
+
+    ASSERT_GE(connection->m_Bytes, static_cast<boost::uint64_t>(size) * ITERATIONS);
+
+    const auto mbs = static_cast<double>(size) * ITERATIONS * 1000.0 / ns;
+
+    RecordProperty("source", ToString(source));
+    RecordProperty("bytes", std::to_string(size));
+    RecordProperty("mb_per_s", std::to_string(mbs));
+
+    std::cout << "FileStream: source: " << ToString(source)
+              << ", bytes: " << size
+              << ", MB/s: " << mbs << std::endl;
+}
+
+INSTANTIATE_TEST_CASE_P(Sources, FileStreamBench, testing::Combine(
+    testing::Values(SOURCE_FILE, SOURCE_FSTREAM),
+    testing::Values(std::size_t(1024 * 1024), std::size_t(64 * 1024 * 1024))));
@@ -0,0 +1,126 @@
+#include "rpc/Trace.h"
+
+#include "rpc_base.pb.h"
+
+#include <gtest/gtest.h>
+
+#include <iostream>
+#include <string>
+#include <tuple>
+
+#include <boost/chrono.hpp>
+
+namespace
+{
+
+class TraceBench : public testing::TestWithParam<std::tuple<rpc::trace::Mode, rpc::trace::Level>>
+{
+public:
+    enum
+    {
+        PACKETS_COUNT = 1000000,
+        SAMPLE_RATE = 1000
+    };
+
+    //! Run packet loop, trace point passes packet dump as production code does
+    template<typename Fn>
+    static boost::uint64_t Run(const Fn& trace)
+    {
+        proto::BasePacket base;
+        base.set_direction(proto::BasePacket::Request);
+        base.set_serviceid(1000);
+        base.set_method(1);
+        base.set_callerid("client");
+
+        const auto start = boost::chrono::steady_clock::now();
+        for (boost::uint32_t id = 1; id <= PACKETS_COUNT; ++id)
+        {
+            base.set_packetid(id);
+            trace(base);
+            s_LastPacketId = base.packetid();
+        }
+        return boost::chrono::duration_cast<boost::chrono::nanoseconds>(boost::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    //! Keeps the loop from being optimized out
+    static volatile boost::uint32_t s_LastPacketId;
+};
+
+volatile boost::uint32_t TraceBench::s_LastPacketId = 0;
+
+const char* ToString(rpc::trace::Mode mode)
+{
+    switch (mode)
+    {
+    case rpc::trace::TRACE_OFF: return "off";
+    case rpc::trace::TRACE_SAMPLED: return "sampled";
+    default: return "all";
+    }
+}
+
+const char* ToString(rpc::trace::Level level)
+{
+    switch (level)
+    {
+    case rpc::trace::LEVEL_TRACE: return "trace";
+    case rpc::trace::LEVEL_DEBUG: return "debug";
+    default: return "info";
+    }
+}
+
+} // anonymous namespace
+
+TEST_P(TraceBench, PacketTrace)
+{
+    const auto mode = std::get<0>(GetParam());
+    const auto level = std::get<1>(GetParam());
+    rpc::trace::SetMode(mode, SAMPLE_RATE);
+    rpc::trace::SetLevel(level);
+
+    unsigned formatted = 0;
+
+    // same loop without trace point
+    const auto baseline = Run([](const proto::BasePacket&){});
+    const auto elapsed = Run([&formatted](const proto::BasePacket& base){
+        RPC_TRACE_PACKET(TRACE, base.packetid(), "->[%s]: Pushing packet: %s", (++formatted, base.callerid()), rpc::trace::Dump(base));
+    });
+
+    rpc::trace::SetMode(rpc::trace::TRACE_ALL);
+    rpc::trace::SetLevel(rpc::trace::LEVEL_TRACE);
+
+#ifdef RPC_DISABLE_PACKET_TRACE
+    EXPECT_EQ(formatted, 0u);
+#else
+    if (mode == rpc::trace::TRACE_OFF || level != rpc::trace::LEVEL_TRACE)
+        EXPECT_EQ(formatted, 0u);
+    else
+    if (mode == rpc::trace::TRACE_SAMPLED)
+        EXPECT_EQ(formatted, PACKETS_COUNT / SAMPLE_RATE);
+    else
+        EXPECT_EQ(formatted, PACKETS_COUNT);
+#endif
+
+    const auto baselineNs = static_cast<double>(baseline) / PACKETS_COUNT;
+    const auto traceNs = static_cast<double>(elapsed) / PACKETS_COUNT;
+
+    RecordProperty("mode", ToString(mode));
+    RecordProperty("level", ToString(level));
+    RecordProperty("packets", std::to_string(PACKETS_COUNT));
+    RecordProperty("baseline_ns_per_packet", std::to_string(baselineNs));
+    RecordProperty("ns_per_packet", std::to_string(traceNs));
+
+    std::cout << "Packet trace: mode: " << ToString(mode)
+              << ", level: " << ToString(level)
+              << ", packets: " << PACKETS_COUNT
+              << ", baseline ns/packet: " << baselineNs
+              << ", ns/packet: " << traceNs
+              << ", formatted: " << formatted << std::endl;
+}
+
+// last case is the default mode with logger level which drops packet trace, as in production
+INSTANTIATE_TEST_CASE_P(Modes, TraceBench, testing::Values(
+    std::make_tuple(rpc::trace::TRACE_OFF, rpc::trace::LEVEL_TRACE),
+    std::make_tuple(rpc::trace::TRACE_SAMPLED, rpc::trace::LEVEL_TRACE),
+    std::make_tuple(rpc::trace::TRACE_ALL, rpc::trace::LEVEL_TRACE),
+    std::make_tuple(rpc::trace::TRACE_ALL, rpc::trace::LEVEL_INFO)));